@@ -21,6 +21,7 @@ Z* -------------------------------------------------------------------
 #include"MemoryDebug.h"
 #include"Feedback.h"
 #include"Ortho.h"
+#include"ThreadPool.h"
 
 int FeedbackInit(PyMOLGlobals * G, int quiet)
 {
@@ -149,6 +150,8 @@ void FeedbackAutoAdd(PyMOLGlobals * G, unsigned int sysmod, unsigned char mask,
 
 void FeedbackAdd(PyMOLGlobals * G, const char *str)
 {
+  if(ThreadPoolIsWorker())      /* Ortho is not thread-safe */
+    return;
   OrthoAddOutput(G, str);
 }
 
@@ -12,6 +12,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #include "File.h"
 #include "MemoryDebug.h"
 
@@ -84,3 +91,72 @@ char * FileGetContents(const char *filename, long *size) {
   fclose(fp);
   return contents;
 }
+
+/*
+ * Open a read-only view of the given file. Returns false if the file
+ * cannot be read.
+ */
+int FileViewOpen(CFileView * view, const char *filename) {
+  view->data = NULL;
+  view->size = 0;
+  view->mapped = false;
+
+#ifndef _WIN32
+  int fd = open(filename, O_RDONLY);
+  if (fd != -1) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+      void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (addr != MAP_FAILED) {
+        view->data = (const char *) addr;
+        view->size = (long) st.st_size;
+        view->mapped = true;
+      }
+    }
+    close(fd);
+    if (view->mapped)
+      return true;
+  }
+#endif
+
+  /* not mappable (e.g. empty file, pipe, Windows): read it */
+  view->data = FileGetContents(filename, &view->size);
+  return view->data != NULL;
+}
+
+int FileViewOpenText(CFileView * view, const char *filename) {
+  if (!FileViewOpen(view, filename))
+    return false;
+
+#ifndef _WIN32
+  if (view->mapped && view->size % sysconf(_SC_PAGESIZE) == 0) {
+    /* no slack after the last byte for the terminator */
+    FileViewClose(view);
+    view->data = FileGetContents(filename, &view->size);
+    return view->data != NULL;
+  }
+#endif
+
+  return true;
+}
+
+void FileViewClose(CFileView * view) {
+  if (view->data) {
+#ifndef _WIN32
+    if (view->mapped)
+      munmap((void *) view->data, view->size);
+    else
+#endif
+      mfree((void *) view->data);
+  }
+  view->data = NULL;
+  view->size = 0;
+  view->mapped = false;
+}
+
+void FileViewAdviseSequential(CFileView * view) {
+#if !defined(_WIN32) && defined(POSIX_MADV_SEQUENTIAL)
+  if (view->mapped)
+    posix_madvise((void *) view->data, view->size, POSIX_MADV_SEQUENTIAL);
+#endif
+}
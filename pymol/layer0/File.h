@@ -15,4 +15,30 @@ FILE * pymol_fopen(const char * filename, const char * mode);
 
 char * FileGetContents(const char *filename, long *size);
 
+/*
+ * Read-only view of a whole file. Where possible the file is memory
+ * mapped, so pages are only read from disk when they are touched and
+ * stay reclaimable page cache; otherwise it is read into the heap.
+ * The contents are not NUL terminated.
+ */
+typedef struct {
+  const char *data;
+  long size;
+  int mapped;
+} CFileView;
+
+int FileViewOpen(CFileView * view, const char *filename);
+
+/*
+ * Like FileViewOpen, but data[size] is guaranteed to be NUL, so text
+ * parsers can consume the view in place. Mapped files get this for free
+ * from the zero filled tail of their last page; files which end exactly
+ * on a page boundary are read into the heap instead.
+ */
+int FileViewOpenText(CFileView * view, const char *filename);
+void FileViewClose(CFileView * view);
+
+/* hint that the view will be read front to back */
+void FileViewAdviseSequential(CFileView * view);
+
 #endif
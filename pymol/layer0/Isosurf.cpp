@@ -31,6 +31,9 @@ Z* -------------------------------------------------------------------
 #include"PConv.h"
 #include"P.h"
 #include"Util.h"
+#include"Setting.h"
+#include"Base.h"
+#include"ThreadPool.h"
 
 #define Trace_OFF
 
@@ -79,6 +82,7 @@ struct _CIsosurf {
   int Max[3];
   CField *Coord, *Data;
   float Level;
+  IsofieldPyramid *Pyramid;     /* resolved before the block tasks start */
   int Code[256];
 
   int *Num;
@@ -102,9 +106,13 @@ static int IsosurfPoints(CIsosurf * II);
 static int IsosurfGradients(PyMOLGlobals * G, CSetting * set1, CSetting * set2,
                             CIsosurf * II, Isofield * field,
                             int *range, float min_level, float max_level);
+static CIsosurf *IsosurfNew(PyMOLGlobals * G);
 
 #define IsosurfSubSize		64
 
+/* every thread needs ~45 MB of block scratch (mostly I->Point) */
+#define cIsosurfMaxThread	8
+
 static void _IsosurfFree(CIsosurf * I)
 {
   FreeP(I);
@@ -173,6 +181,8 @@ Isofield *IsosurfNewFromPyList(PyMOLGlobals * G, PyObject * list)
     result->data = NULL;
     result->points = NULL;
     result->gradients = NULL;
+    result->pyramid = NULL;
+    result->shared = false;
   }
   if(ok)
     ok = PConvPyListToIntArrayInPlace(PyList_GetItem(list, 0), result->dimensions, 3);
@@ -216,6 +226,8 @@ Isofield *IsosurfNewCopy(PyMOLGlobals * G, const Isofield * src)
   ok = ((result->points = FieldNewCopy(G, src->points)) != NULL);
 
   result->gradients = NULL;
+  result->pyramid = NULL;
+  result->shared = false;
   if(!ok) {
     if(result->data)
       FieldFree(result->data);
@@ -411,6 +423,8 @@ Isofield *IsosurfFieldAlloc(PyMOLGlobals * G, int *dims)
   result->dimensions[2] = dims[2];
   result->save_points = true;
   result->gradients = NULL;
+  result->pyramid = NULL;
+  result->shared = false;
   return (result);
 }
 
@@ -418,6 +432,7 @@ Isofield *IsosurfFieldAlloc(PyMOLGlobals * G, int *dims)
 /*===========================================================================*/
 void IsosurfFieldFree(PyMOLGlobals * G, Isofield * field)
 {
+  IsofieldInvalidate(field);
   if(field->gradients)
     FieldFree(field->gradients);
   FieldFree(field->points);
@@ -865,6 +880,224 @@ int IsosurfGetRange(PyMOLGlobals * G, Isofield * field,
 }
 
 
+/*===========================================================================*/
+static void IsosurfSetBlock(CIsosurf * I, const int *range, int i, int j, int k)
+{
+  int c;
+  I->CurOff[0] = IsosurfSubSize * i;
+  I->CurOff[1] = IsosurfSubSize * j;
+  I->CurOff[2] = IsosurfSubSize * k;
+  for(c = 0; c < 3; c++)
+    I->CurOff[c] += range[c];
+  for(c = 0; c < 3; c++) {
+    I->Max[c] = range[3 + c] - I->CurOff[c];
+    if(I->Max[c] > (IsosurfSubSize + 1))
+      I->Max[c] = (IsosurfSubSize + 1);
+  }
+}
+
+
+/*===========================================================================*/
+/* false if the field's min/max pyramid shows the current block is entirely
+ * above or below the level, in which case IsosurfBlock emits nothing */
+static int IsosurfBlockMayContain(CIsosurf * I)
+{
+  int hi[3];
+  int c;
+  for(c = 0; c < 3; c++)
+    hi[c] = I->CurOff[c] + I->Max[c];
+  return IsofieldPyramidMayContain(I->Pyramid, I->CurOff, hi, I->Level);
+}
+
+
+/*===========================================================================*/
+static int IsosurfBlock(CIsosurf * I, int mode)
+{
+  int ok = true;
+  switch (mode) {
+  case 0:                      /* standard mode - want lines */
+    ok = IsosurfCurrent(I);
+    break;
+  case 1:                      /* point mode - just want points on the isosurface */
+    ok = IsosurfPoints(I);
+    break;
+  case 2:
+    /* reserved */
+    break;
+  }
+  return ok;
+}
+
+
+/*===========================================================================*/
+static int IsosurfGetNThread(PyMOLGlobals * G, int n_block, int n_max)
+{
+  int n_thread;
+  if((n_block < 2) || !G->Setting || !ThreadPoolIsNative())
+    return 1;
+  n_thread = SettingGetGlobal_i(G, cSetting_max_threads);
+  if(n_thread > n_max)
+    n_thread = n_max;
+  if(n_thread > n_block)
+    n_thread = n_block;
+  if(n_thread < 1)
+    n_thread = 1;
+  return n_thread;
+}
+
+
+/*
+ * Parallel contouring: sub-blocks are dealt out round-robin to n_task
+ * private CIsosurf instances, each appending to its own Num/Line VLAs.
+ * Every block leaves the link state of its scratch clean and closes its
+ * segments, so the merge below just concatenates the per-block output in
+ * the serial (i, j, k) order, which makes the result identical to the
+ * serial loop.
+ */
+typedef struct {
+  int task;
+  int line_start, n_line;
+  int seg_start, n_seg;
+} IsosurfBlockRec;
+
+typedef struct {
+  CIsosurf *Main;
+  CIsosurf **Task;
+  Isofield *Field;
+  IsosurfBlockRec *Block;
+  const int *range, *Steps;
+  int n_block, n_task, mode;
+  int *ok;
+} IsosurfBlockJob;
+
+static void IsosurfBlockTask(void *data, int t)
+{
+  IsosurfBlockJob *job = (IsosurfBlockJob *) data;
+  CIsosurf *M = job->Main;
+  CIsosurf *I = job->Task[t];
+  int ok = true;
+  int b, c;
+
+  I->Skip = M->Skip;
+  I->Coord = M->Coord;
+  I->Data = M->Data;
+  I->Level = M->Level;
+  I->Pyramid = M->Pyramid;
+  for(c = 0; c < 3; c++) {
+    I->AbsDim[c] = M->AbsDim[c];
+    I->CurDim[c] = M->CurDim[c];
+  }
+  I->NLine = 0;
+  I->NSeg = 0;
+  I->Num = VLAlloc(int, 100);
+  I->Line = VLAlloc(float, 3000);
+  CHECKOK(ok, I->Num);
+  CHECKOK(ok, I->Line);
+  if(ok)
+    ok = IsosurfAlloc(I->G, I);
+  if(ok) {
+    int x, y, z;
+    I->Num[0] = 0;
+    for(x = 0; x < I->CurDim[0]; x++)
+      for(y = 0; y < I->CurDim[1]; y++)
+        for(z = 0; z < I->CurDim[2]; z++)
+          for(c = 0; c < 3; c++)
+            EdgePt(I->Point, x, y, z, c).NLink = 0;
+  }
+  for(b = t; ok && b < job->n_block; b += job->n_task) {
+    IsosurfBlockRec *rec = job->Block + b;
+    int i = b / (job->Steps[1] * job->Steps[2]);
+    int j = (b / job->Steps[2]) % job->Steps[1];
+    int k = b % job->Steps[2];
+    IsosurfSetBlock(I, job->range, i, j, k);
+    rec->task = t;
+    rec->line_start = I->NLine;
+    rec->seg_start = I->NSeg;
+    if(IsosurfBlockMayContain(I))
+      ok = IsosurfBlock(I, job->mode);
+    rec->n_line = I->NLine - rec->line_start;
+    rec->n_seg = I->NSeg - rec->seg_start;
+    if(I->G->Interrupt)
+      ok = false;
+  }
+  IsosurfPurge(I);
+  job->ok[t] = ok;
+}
+
+static int IsosurfBlocksParallel(CIsosurf * I, Isofield * field, const int *range,
+                                 const int *Steps, int mode, int n_thread)
+{
+  PyMOLGlobals *G = I->G;
+  IsosurfBlockJob job;
+  int ok = true;
+  int b, t;
+
+  job.Main = I;
+  job.Field = field;
+  job.range = range;
+  job.Steps = Steps;
+  job.mode = mode;
+  job.n_block = Steps[0] * Steps[1] * Steps[2];
+  job.n_task = n_thread;
+  job.Task = Calloc(CIsosurf *, n_thread);
+  job.Block = Calloc(IsosurfBlockRec, job.n_block);
+  job.ok = Calloc(int, n_thread);
+  CHECKOK(ok, job.Task);
+  CHECKOK(ok, job.Block);
+  CHECKOK(ok, job.ok);
+  for(t = 0; ok && t < n_thread; t++) {
+    job.Task[t] = IsosurfNew(G);
+    CHECKOK(ok, job.Task[t]);
+  }
+
+  if(ok) {
+    ThreadPoolRun(G, n_thread, n_thread, IsosurfBlockTask, &job);
+    for(t = 0; t < n_thread; t++)
+      ok = ok && job.ok[t];
+  }
+
+  /* concatenate in serial block order */
+  for(b = 0; ok && b < job.n_block; b++) {
+    IsosurfBlockRec *rec = job.Block + b;
+    CIsosurf *T = job.Task[rec->task];
+    if(rec->n_line) {
+      VLACheck(I->Line, float, (I->NLine + rec->n_line) * 3);
+      CHECKOK(ok, I->Line);
+      if(ok)
+        memcpy(I->Line + I->NLine * 3, T->Line + rec->line_start * 3,
+               sizeof(float) * 3 * rec->n_line);
+      I->NLine += rec->n_line;
+    }
+    if(ok && rec->n_seg) {
+      VLACheck(I->Num, int, I->NSeg + rec->n_seg + 1);
+      CHECKOK(ok, I->Num);
+      if(ok)
+        memcpy(I->Num + I->NSeg, T->Num + rec->seg_start, sizeof(int) * rec->n_seg);
+      I->NSeg += rec->n_seg;
+    }
+  }
+  if(ok)
+    I->Num[I->NSeg] = I->NLine;
+
+  PRINTFB(G, FB_Isomesh, FB_Blather)
+    " IsosurfVolume: contoured %d blocks on %d threads.\n", job.n_block, n_thread
+    ENDFB(G);
+
+  if(job.Task) {
+    for(t = 0; t < n_thread; t++) {
+      if(job.Task[t]) {
+        VLAFreeP(job.Task[t]->Num);
+        VLAFreeP(job.Task[t]->Line);
+        _IsosurfFree(job.Task[t]);
+      }
+    }
+  }
+  FreeP(job.Task);
+  FreeP(job.Block);
+  FreeP(job.ok);
+  return ok;
+}
+
 /*===========================================================================*/
 int IsosurfVolume(PyMOLGlobals * G, CSetting * set1, CSetting * set2,
                   Isofield * field, float level, int **num,
@@ -882,6 +1115,7 @@ int IsosurfVolume(PyMOLGlobals * G, CSetting * set1, CSetting * set2,
     int Steps[3];
     int c, i, j, k;
     int x, y, z;
+    int n_thread;
     int range_store[6];
     I->Num = *num;
     I->Line = *vert;
@@ -921,20 +1155,19 @@ int IsosurfVolume(PyMOLGlobals * G, CSetting * set1, CSetting * set2,
         IsosurfPurge(I);
         break;
       default:
+        /* resolve the min/max pyramid here, tasks must not build it */
+        I->Pyramid = IsofieldGetPyramid(G, field);
+        n_thread = IsosurfGetNThread(G, Steps[0] * Steps[1] * Steps[2], cIsosurfMaxThread);
+        if(n_thread > 1) {
+          ok = IsosurfBlocksParallel(I, field, range, Steps, mode, n_thread);
+          IsosurfPurge(I);
+          break;
+        }
         for(i = 0; i < Steps[0]; i++) {
           for(j = 0; j < Steps[1]; j++) {
             for(k = 0; k < Steps[2]; k++) {
               if(ok) {
-                I->CurOff[0] = IsosurfSubSize * i;
-                I->CurOff[1] = IsosurfSubSize * j;
-                I->CurOff[2] = IsosurfSubSize * k;
-                for(c = 0; c < 3; c++)
-                  I->CurOff[c] += range[c];
-                for(c = 0; c < 3; c++) {
-                  I->Max[c] = range[3 + c] - I->CurOff[c];
-                  if(I->Max[c] > (IsosurfSubSize + 1))
-                    I->Max[c] = (IsosurfSubSize + 1);
-                }
+                IsosurfSetBlock(I, range, i, j, k);
                 if(!(i || j || k)) {
                   for(x = 0; x < I->Max[0]; x++)
                     for(y = 0; y < I->Max[1]; y++)
@@ -948,18 +1181,8 @@ int IsosurfVolume(PyMOLGlobals * G, CSetting * set1, CSetting * set2,
                          I->CurOff[c], I->Max[c]);
 #endif
 
-                if(ok)
-                  switch (mode) {
-                  case 0:      /* standard mode - want lines */
-                    ok = IsosurfCurrent(I);
-                    break;
-                  case 1:      /* point mode - just want points on the isosurface */
-                    ok = IsosurfPoints(I);
-                    break;
-                  case 2:
-                    /* reserved */
-                    break;
-                  }
+                if(ok && IsosurfBlockMayContain(I))
+                  ok = IsosurfBlock(I, mode);
                 if(G->Interrupt) {
                   ok = false;
                 }
@@ -2200,3 +2423,364 @@ void IsofieldGetCorners(PyMOLGlobals * G, Isofield * field, float * corner) {
     memcpy(corner + a * 3, F3Ptr(points, i, j, k), 3 * sizeof(float));
   }
 }
+
+
+/*===========================================================================*/
+
+/*
+ * Level 0 blocks cover cIsofieldBlock^3 voxels (fewer at the upper
+ * edges), every further level merges 2x2x2 blocks of the level below,
+ * up to a single block for the whole field. Sums are only kept on level 0.
+ */
+#define cIsofieldBlock		8
+#define cIsofieldMaxLevel	24
+
+struct _IsofieldPyramid {
+  int n_level;
+  int dim[cIsofieldMaxLevel][3];
+  float *min[cIsofieldMaxLevel], *max[cIsofieldMaxLevel];
+  double *sum, *sumsq;
+  int cnt;
+};
+
+#ifndef _PYMOL_NO_CXX11
+#include <mutex>
+/* pyramids may be requested concurrently by asynchronous object builds */
+static std::mutex s_pyramid_mutex;
+#define PYRAMID_LOCK std::lock_guard<std::mutex> pyramid_lock_(s_pyramid_mutex)
+#else
+#define PYRAMID_LOCK
+#endif
+
+static void IsofieldPyramidFree(IsofieldPyramid * P)
+{
+  int a;
+  for(a = 0; a < P->n_level; a++) {
+    FreeP(P->min[a]);
+    FreeP(P->max[a]);
+  }
+  FreeP(P->sum);
+  FreeP(P->sumsq);
+  FreeP(P);
+}
+
+typedef struct {
+  IsofieldPyramid *P;
+  CField *data;
+} IsofieldPyramidJob;
+
+/* level 0 blocks of one slab (first block index a) */
+static void IsofieldPyramidSlabTask(void *data, int a)
+{
+  IsofieldPyramidJob *job = (IsofieldPyramidJob *) data;
+  IsofieldPyramid *P = job->P;
+  CField *field = job->data;
+  int b, c, i, j, k;
+  int lo[3], hi[3];
+  int idx = a * P->dim[0][1] * P->dim[0][2];
+
+  lo[0] = a * cIsofieldBlock;
+  hi[0] = lo[0] + cIsofieldBlock;
+  if(hi[0] > (int) field->dim[0])
+    hi[0] = field->dim[0];
+  for(b = 0; b < P->dim[0][1]; b++) {
+    lo[1] = b * cIsofieldBlock;
+    hi[1] = lo[1] + cIsofieldBlock;
+    if(hi[1] > (int) field->dim[1])
+      hi[1] = field->dim[1];
+    for(c = 0; c < P->dim[0][2]; c++, idx++) {
+      float mn = FLT_MAX, mx = -FLT_MAX;
+      double sum = 0.0, sumsq = 0.0;
+      lo[2] = c * cIsofieldBlock;
+      hi[2] = lo[2] + cIsofieldBlock;
+      if(hi[2] > (int) field->dim[2])
+        hi[2] = field->dim[2];
+      for(i = lo[0]; i < hi[0]; i++)
+        for(j = lo[1]; j < hi[1]; j++)
+          for(k = lo[2]; k < hi[2]; k++) {
+            double f_val = Ffloat3(field, i, j, k);
+            if(mn > f_val)
+              mn = f_val;
+            if(mx < f_val)
+              mx = f_val;
+            sum += f_val;
+            sumsq += f_val * f_val;
+          }
+      P->min[0][idx] = mn;
+      P->max[0][idx] = mx;
+      P->sum[idx] = sum;
+      P->sumsq[idx] = sumsq;
+    }
+  }
+}
+
+static IsofieldPyramid *IsofieldPyramidNew(PyMOLGlobals * G, CField * data)
+{
+  IsofieldPyramidJob job;
+  IsofieldPyramid *P = Calloc(IsofieldPyramid, 1);
+  int ok = true;
+  int a, b, c, L, n;
+
+  CHECKOK(ok, P);
+  if(ok) {
+    P->cnt = data->dim[0] * data->dim[1] * data->dim[2];
+    for(c = 0; c < 3; c++)
+      P->dim[0][c] = (data->dim[c] + cIsofieldBlock - 1) / cIsofieldBlock;
+    for(L = 0; ok && L < cIsofieldMaxLevel; L++) {
+      if(L) {
+        for(c = 0; c < 3; c++)
+          P->dim[L][c] = (P->dim[L - 1][c] + 1) / 2;
+      }
+      n = P->dim[L][0] * P->dim[L][1] * P->dim[L][2];
+      P->min[L] = Alloc(float, n);
+      P->max[L] = Alloc(float, n);
+      CHECKOK(ok, P->min[L]);
+      CHECKOK(ok, P->max[L]);
+      P->n_level = L + 1;
+      if(n <= 1)
+        break;
+    }
+  }
+  if(ok) {
+    n = P->dim[0][0] * P->dim[0][1] * P->dim[0][2];
+    P->sum = Alloc(double, n);
+    P->sumsq = Alloc(double, n);
+    CHECKOK(ok, P->sum);
+    CHECKOK(ok, P->sumsq);
+  }
+  if(ok && P->cnt) {
+    int n_thread = (P->cnt < (1 << 20)) ? 1 :
+      IsosurfGetNThread(G, P->dim[0][0], PYMOL_MAX_THREADS);
+    job.P = P;
+    job.data = data;
+    ThreadPoolRun(G, n_thread, P->dim[0][0], IsofieldPyramidSlabTask, &job);
+
+    for(L = 1; L < P->n_level; L++) {
+      const int *d0 = P->dim[L - 1], *d1 = P->dim[L];
+      int idx = 0;
+      for(a = 0; a < d1[0]; a++)
+        for(b = 0; b < d1[1]; b++)
+          for(c = 0; c < d1[2]; c++, idx++) {
+            float mn = FLT_MAX, mx = -FLT_MAX;
+            int i, j, k;
+            for(i = 2 * a; i < 2 * a + 2 && i < d0[0]; i++)
+              for(j = 2 * b; j < 2 * b + 2 && j < d0[1]; j++)
+                for(k = 2 * c; k < 2 * c + 2 && k < d0[2]; k++) {
+                  int src = (i * d0[1] + j) * d0[2] + k;
+                  if(mn > P->min[L - 1][src])
+                    mn = P->min[L - 1][src];
+                  if(mx < P->max[L - 1][src])
+                    mx = P->max[L - 1][src];
+                }
+            P->min[L][idx] = mn;
+            P->max[L][idx] = mx;
+          }
+    }
+  }
+  if(!ok && P) {
+    IsofieldPyramidFree(P);
+    P = NULL;
+  }
+  return P;
+}
+
+IsofieldPyramid *IsofieldGetPyramid(PyMOLGlobals * G, Isofield * field)
+{
+  IsofieldPyramid *P;
+  {
+    PYRAMID_LOCK;
+    if(field->pyramid || field->shared || !field->data ||
+       (field->data->n_dim != 3) || (field->data->type != cFieldFloat))
+      return field->pyramid;
+  }
+  /* build without the lock: IsofieldPyramidNew runs pool tasks, and the
+   * pool's own lock may be held by a thread waiting for this one */
+  P = IsofieldPyramidNew(G, field->data);
+  {
+    PYRAMID_LOCK;
+    if(!field->pyramid && !field->shared) {
+      field->pyramid = P;
+      P = NULL;
+    }
+  }
+  if(P)                         /* lost the race */
+    IsofieldPyramidFree(P);
+  return field->pyramid;
+}
+
+void IsofieldInvalidate(Isofield * field)
+{
+  PYRAMID_LOCK;
+  if(field && field->pyramid) {
+    IsofieldPyramidFree(field->pyramid);
+    field->pyramid = NULL;
+  }
+}
+
+void IsofieldSetShared(Isofield * field)
+{
+  IsofieldInvalidate(field);
+  field->shared = true;
+}
+
+int IsofieldGetStats(PyMOLGlobals * G, Isofield * field, float *min, float *max,
+                     double *sum, double *sumsq)
+{
+  IsofieldPyramid *P = IsofieldGetPyramid(G, field);
+  float mn = 0.0F, mx = 0.0F;
+  double s = 0.0, s2 = 0.0;
+  int cnt = 0;
+  if(P && P->cnt) {
+    int a, n = P->dim[0][0] * P->dim[0][1] * P->dim[0][2];
+    cnt = P->cnt;
+    mn = P->min[P->n_level - 1][0];
+    mx = P->max[P->n_level - 1][0];
+    for(a = 0; a < n; a++) {
+      s += P->sum[a];
+      s2 += P->sumsq[a];
+    }
+  } else if(!P && field->data && (field->data->n_dim == 3)) {
+    /* no pyramid (shared or unusual data): scan the values */
+    CField *data = field->data;
+    int i, j, k;
+    for(i = 0; i < (int) data->dim[0]; i++)
+      for(j = 0; j < (int) data->dim[1]; j++)
+        for(k = 0; k < (int) data->dim[2]; k++) {
+          float f_val = Ffloat3(data, i, j, k);
+          if(!cnt++) {
+            mn = mx = f_val;
+          } else if(mn > f_val) {
+            mn = f_val;
+          } else if(mx < f_val) {
+            mx = f_val;
+          }
+          s += f_val;
+          s2 += (double) f_val * f_val;
+        }
+  }
+  if(min)
+    *min = mn;
+  if(max)
+    *max = mx;
+  if(sum)
+    *sum = s;
+  if(sumsq)
+    *sumsq = s2;
+  return cnt;
+}
+
+/* widens [*mn, *mx] by all blocks of level L below block (a, b, c) which
+ * overlap [lo, hi); stops as soon as the range straddles level */
+static void IsofieldPyramidRange(const IsofieldPyramid * P, int L, int a, int b, int c,
+                                 const int *lo, const int *hi, float level,
+                                 float *mn, float *mx)
+{
+  int size = cIsofieldBlock << L;
+  int blk[3], inside = true;
+  int d, idx;
+
+  blk[0] = a;
+  blk[1] = b;
+  blk[2] = c;
+  for(d = 0; d < 3; d++) {
+    int b_lo = blk[d] * size, b_hi = b_lo + size;
+    if((b_hi <= lo[d]) || (b_lo >= hi[d]))
+      return;
+    if((b_lo < lo[d]) || (b_hi > hi[d]))
+      inside = false;
+  }
+  if((*mn <= level) && (*mx > level))
+    return;
+  idx = (a * P->dim[L][1] + b) * P->dim[L][2] + c;
+  if(!L || inside) {
+    if(*mn > P->min[L][idx])
+      *mn = P->min[L][idx];
+    if(*mx < P->max[L][idx])
+      *mx = P->max[L][idx];
+  } else if(P->min[L][idx] > level) {
+    /* uniform block: the overlapping voxels are all above the level */
+    if(*mx < P->min[L][idx])
+      *mx = P->min[L][idx];
+  } else if(P->max[L][idx] <= level) {
+    /* ...or all at or below it */
+    if(*mn > P->max[L][idx])
+      *mn = P->max[L][idx];
+  } else {
+    const int *d0 = P->dim[L - 1];
+    int i, j, k;
+    for(i = 2 * a; i < 2 * a + 2 && i < d0[0]; i++)
+      for(j = 2 * b; j < 2 * b + 2 && j < d0[1]; j++)
+        for(k = 2 * c; k < 2 * c + 2 && k < d0[2]; k++)
+          IsofieldPyramidRange(P, L - 1, i, j, k, lo, hi, level, mn, mx);
+  }
+}
+
+int IsofieldMayContain(PyMOLGlobals * G, Isofield * field, const int *lo,
+                       const int *hi, float level)
+{
+  return IsofieldPyramidMayContain(IsofieldGetPyramid(G, field), lo, hi, level);
+}
+
+int IsofieldPyramidMayContain(const IsofieldPyramid * P, const int *lo,
+                              const int *hi, float level)
+{
+  float mn = FLT_MAX, mx = -FLT_MAX;
+  if(!P)
+    return true;
+  IsofieldPyramidRange(P, P->n_level - 1, 0, 0, 0, lo, hi, level, &mn, &mx);
+  return (mn <= level) && (mx > level);
+}
+
+void IsofieldHistogram(PyMOLGlobals * G, Isofield * field, int n_points,
+                       float min_his, float max_his, float *counts)
+{
+  IsofieldPyramid *P = IsofieldGetPyramid(G, field);
+  CField *data = field->data;
+  float irange = (float) (n_points - 1) / (max_his - min_his);
+  int a, b, c, i, j, k, pos;
+
+  if(!P) {
+    for(i = 0; i < (int) data->dim[0]; i++)
+      for(j = 0; j < (int) data->dim[1]; j++)
+        for(k = 0; k < (int) data->dim[2]; k++) {
+          double f_val = Ffloat3(data, i, j, k);
+          pos = (int) (irange * (f_val - min_his));
+          if(pos >= 0 && pos < n_points)
+            counts[pos] += 1.0;
+        }
+    return;
+  }
+
+  /* binning is monotonic: a block whose min and max share a bin (or are
+   * both out of range) does not need to be scanned */
+  for(a = 0; a < P->dim[0][0]; a++)
+    for(b = 0; b < P->dim[0][1]; b++)
+      for(c = 0; c < P->dim[0][2]; c++) {
+        int idx = (a * P->dim[0][1] + b) * P->dim[0][2] + c;
+        int lo[3], hi[3], d;
+        int pos_min = (int) (irange * ((double) P->min[0][idx] - min_his));
+        int pos_max = (int) (irange * ((double) P->max[0][idx] - min_his));
+        if((pos_max < 0) || (pos_min >= n_points))
+          continue;
+        lo[0] = a * cIsofieldBlock;
+        lo[1] = b * cIsofieldBlock;
+        lo[2] = c * cIsofieldBlock;
+        for(d = 0; d < 3; d++) {
+          hi[d] = lo[d] + cIsofieldBlock;
+          if(hi[d] > (int) data->dim[d])
+            hi[d] = data->dim[d];
+        }
+        if((pos_min == pos_max) && (pos_min >= 0)) {
+          counts[pos_min] += (float) ((hi[0] - lo[0]) * (hi[1] - lo[1]) * (hi[2] - lo[2]));
+          continue;
+        }
+        for(i = lo[0]; i < hi[0]; i++)
+          for(j = lo[1]; j < hi[1]; j++)
+            for(k = lo[2]; k < hi[2]; k++) {
+              double f_val = Ffloat3(data, i, j, k);
+              pos = (int) (irange * (f_val - min_his));
+              if(pos >= 0 && pos < n_points)
+                counts[pos] += 1.0;
+            }
+      }
+}
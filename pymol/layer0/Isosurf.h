@@ -26,12 +26,16 @@ Z* -------------------------------------------------------------------
 #include"PyMOLGlobals.h"
 #include"Setting.h"
 
+typedef struct _IsofieldPyramid IsofieldPyramid;
+
 typedef struct {
   int dimensions[3];
   int save_points;
   CField *points;
   CField *data;
   CField *gradients;
+  IsofieldPyramid *pyramid;     /* block min/max of data, built on demand */
+  int shared;                   /* data handed out writable, never build a pyramid */
 } Isofield;
 
 #define F3(field,P1,P2,P3) Ffloat3(field,P1,P2,P3)
@@ -65,4 +69,36 @@ Isofield *IsosurfNewCopy(PyMOLGlobals * G, const Isofield * src);
 
 void IsofieldGetCorners(PyMOLGlobals *, Isofield *, float *);
 
+/*
+ * Min/max block pyramid over field->data. It is built on first use and
+ * must be dropped with IsofieldInvalidate whenever data is changed in
+ * place.
+ */
+void IsofieldInvalidate(Isofield * field);
+
+/* drops the pyramid for good, for data which may be written behind our
+ * back (e.g. a NumPy view handed out by get_volume_field) */
+void IsofieldSetShared(Isofield * field);
+
+/* the pyramid (NULL if not available), built here if needed. Block tasks
+ * get it resolved by the caller: building it runs pool tasks itself */
+IsofieldPyramid *IsofieldGetPyramid(PyMOLGlobals * G, Isofield * field);
+
+/* min, max, sum and sum of squares of all data values (each may be NULL);
+ * returns the number of values */
+int IsofieldGetStats(PyMOLGlobals * G, Isofield * field, float *min, float *max,
+                     double *sum, double *sumsq);
+
+/* false if all data values in the index box [lo, hi) are on the same side
+ * of level (all > level or all <= level), i.e. no contour can pass */
+int IsofieldMayContain(PyMOLGlobals * G, Isofield * field, const int *lo,
+                       const int *hi, float level);
+int IsofieldPyramidMayContain(const IsofieldPyramid * P, const int *lo,
+                              const int *hi, float level);
+
+/* adds the number of values falling in each of n_points bins spanning
+ * [min_his, max_his] to counts */
+void IsofieldHistogram(PyMOLGlobals * G, Isofield * field, int n_points,
+                       float min_his, float max_his, float *counts);
+
 #endif
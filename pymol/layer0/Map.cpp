@@ -26,6 +26,7 @@ Z* ------------------------------------------------------------------- */
 #include"Feedback.h"
 #include"MemoryCache.h"
 #include"Base.h"
+#include"ThreadPool.h"
 
 #ifndef true
 #define true 1
@@ -54,6 +55,9 @@ void MapFree(MapType * I)
                false);
     VLACacheFreeP(I->G, I->EList, I->group_id, I->block_base + cCache_map_elist_offset,
                   false);
+    FreeP(I->CellStart);
+    FreeP(I->CellList);
+    FreeP(I->CellVert);
   }
   OOFreeP(I);
 }
@@ -233,36 +237,175 @@ int MapInsideXY(MapType * I, const float *v, int *a, int *b, int *c)
 
 #define ELIST_GROW_FACTOR 3
 
-int MapSetupExpressXY(MapType * I, int n_vert, int negative_start)
-{                               /* setup a list of XY neighbors for each square */
+/* maps with fewer vertices (or voxels) than this are always built serially */
+#define cMapParallelMin 50000
+
+/*
+ * Number of threads to use for building a map over n items
+ */
+static int MapGetNThread(PyMOLGlobals * G, int n)
+{
+  int n_thread;
+  if((n < cMapParallelMin) || !G->Setting || !ThreadPoolIsNative())
+    return 1;
+  n_thread = SettingGetGlobal_i(G, cSetting_max_threads);
+  if(n_thread < 1)
+    n_thread = 1;
+  if(n_thread > PYMOL_MAX_THREADS)
+    n_thread = PYMOL_MAX_THREADS;
+  return n_thread;
+}
+
+/*
+ * Express tables are built in slabs of the first map dimension. A slab
+ * function appends the lists for voxels a_start..a_stop to *list, starting
+ * at index *n, and stores the start indices in EHead.
+ */
+typedef int MapExpressSlabFn(MapType * I, const void *param, int a_start, int a_stop,
+                             int group_id, int **list, int *n);
+
+typedef struct {
+  const int *spanner;
+  int negative_start;
+} MapExpressParam;
+
+typedef struct {
+  MapType *map;
+  MapExpressSlabFn *fn;
+  const void *param;
+  int a_min, a_max, n_task;
+  int **list;                   /* per task */
+  int *n;                       /* per task */
+  int *base;                    /* per task, offset into the merged EList */
+  int *ok;                      /* per task */
+} MapExpressJob;
+
+static void MapExpressJobRange(const MapExpressJob * job, int t, int *a_start, int *a_stop)
+{
+  int n_slab = job->a_max - job->a_min + 1;
+  *a_start = job->a_min + (int) (((size_t) n_slab * t) / job->n_task);
+  *a_stop = job->a_min + (int) (((size_t) n_slab * (t + 1)) / job->n_task) - 1;
+}
+
+static void MapExpressSlabTask(void *data, int t)
+{
+  MapExpressJob *job = (MapExpressJob *) data;
+  int a_start, a_stop;
+  MapExpressJobRange(job, t, &a_start, &a_stop);
+  job->n[t] = 1;
+  job->list[t] = (int *) VLAMalloc(1000, sizeof(int), ELIST_GROW_FACTOR, 0);
+  job->ok[t] = job->list[t] &&
+    job->fn(job->map, job->param, a_start, a_stop, -1, job->list + t, job->n + t);
+}
+
+/* copies a task's list into place and rebases its EHead entries */
+static void MapExpressMergeTask(void *data, int t)
+{
+  MapExpressJob *job = (MapExpressJob *) data;
+  MapType *I = job->map;
+  int a_start, a_stop;
+  int offset = job->base[t] - 1;
+  int *eh, *eh_stop;
+
+  MapExpressJobRange(job, t, &a_start, &a_stop);
+  if(job->n[t] > 1)
+    memcpy(I->EList + job->base[t], job->list[t] + 1, sizeof(int) * (job->n[t] - 1));
+  if(offset && (a_stop >= a_start)) {
+    eh_stop = I->EHead + (a_stop + 1) * I->D1D2;
+    for(eh = I->EHead + a_start * I->D1D2; eh < eh_stop; eh++) {
+      if(*eh > 0)
+        *eh += offset;
+      else if(*eh < 0)
+        *eh -= offset;
+    }
+  }
+}
+
+/*
+ * Builds I->EList from slabs a_min..a_max, concurrently if the map is big
+ * enough. The result is identical to a serial build.
+ */
+static int MapExpressBuild(MapType * I, MapExpressSlabFn * fn, const void *param,
+                           int a_min, int a_max, int n_alloc, int grow_factor)
+{
   PyMOLGlobals *G = I->G;
-  int n, a, b, c, flag;
-  int d, e, i;
-  unsigned int mapSize;
-  int st, dim2;
-  int n_alloc = n_vert * 15;    /* emprical est. */
+  int group_id = I->group_id;
+  int block_offset = I->block_base + cCache_map_elist_offset;
+  int n_voxel = (a_max - a_min + 1) * I->D1D2;
+  int n_task = MapGetNThread(G, n_voxel);
   int ok = true;
+  int n = 1, t;
 
-  PRINTFD(G, FB_Map)
-    " MapSetupExpressXY-Debug: entered.\n" ENDFD;
+  if(n_task > (a_max - a_min + 1))
+    n_task = a_max - a_min + 1;
 
-  mapSize = I->Dim[0] * I->Dim[1] * I->Dim[2];
-  I->EHead =
-    CacheCalloc(G, int, mapSize, I->group_id, I->block_base + cCache_map_ehead_offset);
-  CHECKOK(ok, I->EHead);
-  if (ok)
-    I->EList = (int*) VLACacheMalloc(G, n_alloc, sizeof(int), ELIST_GROW_FACTOR, 0,
-			      I->group_id, I->block_base + cCache_map_elist_offset);
-  CHECKOK(ok, I->EList);
-  if (ok)
-    I->EMask = CacheCalloc(G, int, I->Dim[0] * I->Dim[1],
-			   I->group_id, I->block_base + cCache_map_emask_offset);
-  CHECKOK(ok, I->EMask);
+  if(n_task < 2) {
+    I->EList = (int *) VLACacheMalloc(G, n_alloc, sizeof(int), grow_factor, 0,
+                                      group_id, block_offset);
+    CHECKOK(ok, I->EList);
+    if(ok)
+      ok = fn(I, param, a_min, a_max, group_id, &I->EList, &n);
+  } else {
+    MapExpressJob job;
+    job.map = I;
+    job.fn = fn;
+    job.param = param;
+    job.a_min = a_min;
+    job.a_max = a_max;
+    job.n_task = n_task;
+    job.list = Calloc(int *, n_task);
+    job.n = Calloc(int, n_task * 3);
+    job.base = job.n + n_task;
+    job.ok = job.base + n_task;
+    CHECKOK(ok, job.list);
+    CHECKOK(ok, job.n);
+    if(ok) {
+      ThreadPoolRun(G, n_task, n_task, MapExpressSlabTask, &job);
+      for(t = 0; t < n_task; t++) {
+        ok = ok && job.ok[t];
+        job.base[t] = n;
+        n += job.n[t] - 1;
+      }
+    }
+    if(ok) {
+      I->EList = (int *) VLACacheMalloc(G, n, sizeof(int), grow_factor, 0,
+                                        group_id, block_offset);
+      CHECKOK(ok, I->EList);
+    }
+    if(ok)
+      ThreadPoolRun(G, n_task, n_task, MapExpressMergeTask, &job);
+    if(job.list) {
+      for(t = 0; t < n_task; t++)
+        VLAFreeP(job.list[t]);
+    }
+    FreeP(job.list);
+    FreeP(job.n);
+  }
+
+  if(ok) {
+    I->NEElem = n;
+    VLACacheSize(G, I->EList, int, I->NEElem, group_id, block_offset);
+    CHECKOK(ok, I->EList);
+  }
+  return ok;
+}
+
+static int MapExpressXYSlab(MapType * I, const void *param, int a_start, int a_stop,
+                            int group_id, int **list, int *n_ptr)
+{
+  PyMOLGlobals *G = I->G;
+  int negative_start = ((const MapExpressParam *) param)->negative_start;
+  int *e_list = *list;
+  int n = *n_ptr;
+  int a, b, c, flag;
+  int d, e, i;
+  int st, dim2;
+  int block_offset = I->block_base + cCache_map_elist_offset;
+  int ok = true;
 
-  n = 1;
   dim2 = I->Dim[2];
 
-  for(a = I->iMin[0]; ok && a <= I->iMax[0]; a++) {
+  for(a = a_start; ok && a <= a_stop; a++) {
     for(b = I->iMin[1]; ok && b <= I->iMax[1]; b++) {
       for(c = I->iMin[2]; ok && c <= I->iMax[2]; c++) {       /* a better alternative exists... */
         int *iPtr1 = (I->Head + ((a - 1) * I->D1D2) + ((b - 1) * dim2) + c);
@@ -281,10 +424,9 @@ int MapSetupExpressXY(MapType * I, int n_vert, int negative_start)
               flag = true;
               while(i >= 0) {
 
-                VLACacheCheck(G, I->EList, int, n, I->group_id,
-                              I->block_base + cCache_map_elist_offset);
-		CHECKOK(ok, I->EList);
-                I->EList[n] = i;
+                VLACacheCheck(G, e_list, int, n, group_id, block_offset);
+		CHECKOK(ok, e_list);
+                e_list[n] = i;
                 n++;
                 i = MapNext(I, i);
               }
@@ -299,25 +441,47 @@ int MapSetupExpressXY(MapType * I, int n_vert, int negative_start)
         if(ok && flag) {
           *(I->EMask + I->Dim[1] * a + b) = true;
           *(MapEStart(I, a, b, c)) = negative_start ? -st : st;
-          VLACacheCheck(G, I->EList, int, n, I->group_id,
-                        I->block_base + cCache_map_elist_offset);
-	  CHECKOK(ok, I->EList);
-          I->EList[n] = -1;
+          VLACacheCheck(G, e_list, int, n, group_id, block_offset);
+	  CHECKOK(ok, e_list);
+          e_list[n] = -1;
           n++;
         }
       }
     }
   }
 
-  PRINTFB(G, FB_Map, FB_Blather)
-    " MapSetupExpressXY: %d rows in express table\n", n ENDFB(G);
+  *list = e_list;
+  *n_ptr = n;
+  return ok;
+}
 
-  if (ok){
-    I->NEElem = n;
-    VLACacheSize(G, I->EList, int, I->NEElem, I->group_id,
-		 I->block_base + cCache_map_elist_offset);
-    CHECKOK(ok, I->EList);
+int MapSetupExpressXY(MapType * I, int n_vert, int negative_start)
+{                               /* setup a list of XY neighbors for each square */
+  PyMOLGlobals *G = I->G;
+  unsigned int mapSize;
+  int n_alloc = n_vert * 15;    /* emprical est. */
+  int ok = true;
+
+  PRINTFD(G, FB_Map)
+    " MapSetupExpressXY-Debug: entered.\n" ENDFD;
+
+  mapSize = I->Dim[0] * I->Dim[1] * I->Dim[2];
+  I->EHead =
+    CacheCalloc(G, int, mapSize, I->group_id, I->block_base + cCache_map_ehead_offset);
+  CHECKOK(ok, I->EHead);
+  if (ok)
+    I->EMask = CacheCalloc(G, int, I->Dim[0] * I->Dim[1],
+			   I->group_id, I->block_base + cCache_map_emask_offset);
+  CHECKOK(ok, I->EMask);
+  if (ok) {
+    MapExpressParam param = { NULL, negative_start };
+    ok = MapExpressBuild(I, MapExpressXYSlab, &param,
+                         I->iMin[0], I->iMax[0], n_alloc, ELIST_GROW_FACTOR);
   }
+
+  PRINTFB(G, FB_Map, FB_Blather)
+    " MapSetupExpressXY: %d rows in express table\n", I->NEElem ENDFB(G);
+
   PRINTFD(G, FB_Map)
     " MapSetupExpressXY-Debug: leaving...\n" ENDFD;
   return ok;
@@ -431,15 +595,74 @@ int MapSetupExpressXYVert(MapType * I, float *vert, int n_vert, int negative_sta
   return ok;
 }
 
+static int MapExpressPerpSlab(MapType * I, const void *param, int a_start, int a_stop,
+                              int group_id, int **list, int *n_ptr)
+{
+  PyMOLGlobals *G = I->G;
+  const int *spanner = ((const MapExpressParam *) param)->spanner;
+  int negative_start = ((const MapExpressParam *) param)->negative_start;
+  int *e_list = *list;
+  int n = *n_ptr;
+  int a, b, c, i, st;
+  int block_offset = I->block_base + cCache_map_elist_offset;
+  int *link = I->Link;
+  int ok = true;
+
+  for(a = a_start; ok && a <= a_stop; a++)
+    for(b = (I->iMin[1] - 1); ok && b <= (I->iMax[1] + 1); b++)
+      for(c = (I->iMin[2] - 1); ok && c <= (I->iMax[2] + 1); c++) {
+        int d, e, f;
+        const int am1 = a - 1, ap1 = a + 1, bm1 = b - 1, bp1 = b + 1, cm1 = c - 1, cp1 =
+          c + 1;
+        const int dim2 = I->Dim[2];
+        int flag = false;
+        int *hPtr1 = I->Head + ((am1) * I->D1D2) + ((bm1) * dim2) + cm1;
+        st = n;
+        for(d = am1; ok && d <= ap1; d++) {
+          int *hPtr2 = hPtr1;
+          for(e = bm1; ok && e <= bp1; e++) {
+            int *hPtr3 = hPtr2;
+            for(f = cm1; ok && f <= cp1; f++) {
+              i = *(hPtr3++);
+              /*                i=*MapFirst(I,d,e,f); */
+              if(i >= 0) {
+                flag = true;
+                while(ok && i >= 0) {
+                  if((!spanner) || (f == c) || spanner[i]) {
+                    /* for non-voxel-spanners, only spread in the XY plane (memory use ~ 9X instead of 27X -- a big difference!) */
+                    VLACacheCheck(G, e_list, int, n, group_id, block_offset);
+                    CHECKOK(ok, e_list);
+                    e_list[n] = i;
+                    n++;
+                  }
+                  i = link[i];
+                }
+              }
+            }
+            hPtr2 += dim2;
+          }
+          hPtr1 += I->D1D2;
+        }
+        if(ok && flag) {
+          *(MapEStart(I, a, b, c)) = negative_start ? -st : st;
+          VLACacheCheck(G, e_list, int, n, group_id, block_offset);
+          CHECKOK(ok, e_list);
+          e_list[n] = -1;
+          n++;
+        }
+      }
+
+  *list = e_list;
+  *n_ptr = n;
+  return ok;
+}
+
 int MapSetupExpressPerp(MapType * I, float *vert, float front, int nVertHint,
 			int negative_start, int *spanner)
 {
   PyMOLGlobals *G = I->G;
-  int n = 0;
   int a, b, c, i;
-
   unsigned int mapSize;
-  int st;
   int n_alloc = nVertHint * 15; /* emprical est. */
   int ok = true;
 
@@ -461,10 +684,6 @@ int MapSetupExpressPerp(MapType * I, float *vert, float front, int nVertHint,
   I->EHead = CacheCalloc(G, int, mapSize,
                          I->group_id, I->block_base + cCache_map_ehead_offset);
   CHECKOK(ok, I->EHead);
-  if (ok)
-    I->EList = (int*) VLACacheMalloc(G, n_alloc, sizeof(int), ELIST_GROW_FACTOR, 0,
-			      I->group_id, I->block_base + cCache_map_elist_offset);
-  CHECKOK(ok, I->EList);
   if (ok)
     I->EMask = CacheCalloc(G, int, I->Dim[0] * I->Dim[1],
 			   I->group_id, I->block_base + cCache_map_emask_offset);
@@ -475,14 +694,12 @@ int MapSetupExpressPerp(MapType * I, float *vert, float front, int nVertHint,
   link = I->Link;
   premult = -front * iDiv;
 
-  n = 1;
+  /* compute a "shadow" mask for all vertices */
   for(a = (iMin0 - 1); ok && a <= (iMax0 + 1); a++)
     for(b = (iMin1 - 1); ok && b <= (iMax1 + 1); b++)
       for(c = (I->iMin[2] - 1); ok && c <= (I->iMax[2] + 1); c++) {
 
-        int d, e, f;
-
-        /* compute a "shadow" mask for all vertices */
+        int d, e;
 
         i = *MapFirst(I, a, b, c);
         while(i >= 0) {
@@ -522,94 +739,37 @@ int MapSetupExpressPerp(MapType * I, float *vert, float front, int nVertHint,
           *(ptr2++) = true;
           *(ptr2++) = true;
         }
-
-        {
-          const int am1 = a - 1, ap1 = a + 1, bm1 = b - 1, bp1 = b + 1, cm1 = c - 1, cp1 =
-            c + 1;
-          const int dim2 = I->Dim[2];
-          int flag = false;
-          int *hPtr1 = I->Head + ((am1) * I->D1D2) + ((bm1) * dim2) + cm1;
-          st = n;
-          for(d = am1; ok && d <= ap1; d++) {
-            int *hPtr2 = hPtr1;
-            for(e = bm1; ok && e <= bp1; e++) {
-              int *hPtr3 = hPtr2;
-              for(f = cm1; ok && f <= cp1; f++) {
-                i = *(hPtr3++);
-                /*                i=*MapFirst(I,d,e,f); */
-                if(i >= 0) {
-                  flag = true;
-                  while(ok && i >= 0) {
-                    if((!spanner) || (f == c) || spanner[i]) {
-                      /* for non-voxel-spanners, only spread in the XY plane (memory use ~ 9X instead of 27X -- a big difference!) */
-                      VLACacheCheck(G, I->EList, int, n, I->group_id,
-                                    I->block_base + cCache_map_elist_offset);
-		      CHECKOK(ok, I->EList);
-                      I->EList[n] = i;
-                      n++;
-                    }
-                    i = link[i];
-                  }
-                }
-              }
-              hPtr2 += dim2;
-            }
-            hPtr1 += I->D1D2;
-          }
-          if(ok && flag) {
-            *(MapEStart(I, a, b, c)) = negative_start ? -st : st;
-            VLACacheCheck(G, I->EList, int, n, I->group_id,
-                          I->block_base + cCache_map_elist_offset);
-	    CHECKOK(ok, I->EList);
-            I->EList[n] = -1;
-            n++;
-          }
-        }
       }
-  PRINTFB(G, FB_Map, FB_Blather)
-    " MapSetupExpressPerp: %d rows in express table \n", n ENDFB(G);
-  if (ok){
-    I->NEElem = n;
-    VLACacheSize(G, I->EList, int, I->NEElem, I->group_id,
-		 I->block_base + cCache_map_elist_offset);
-    CHECKOK(ok, I->EList);
+
+  if(ok) {
+    MapExpressParam param = { spanner, negative_start };
+    ok = MapExpressBuild(I, MapExpressPerpSlab, &param,
+                         iMin0 - 1, iMax0 + 1, n_alloc, ELIST_GROW_FACTOR);
   }
+
+  PRINTFB(G, FB_Map, FB_Blather)
+    " MapSetupExpressPerp: %d rows in express table \n", I->NEElem ENDFB(G);
   PRINTFD(G, FB_Map)
-    " MapSetupExpress-Debug: leaving...n=%d\n", n ENDFD;
+    " MapSetupExpress-Debug: leaving...n=%d\n", I->NEElem ENDFD;
   return ok;
 }
 
-int MapSetupExpress(MapType * I)
-{                               /* setup a list of neighbors for each square */
+static int MapExpressSlab(MapType * I, const void *param, int a_start, int a_stop,
+                          int group_id, int **list, int *n_ptr)
+{
   PyMOLGlobals *G = I->G;
-  int n = 0;
+  int n = *n_ptr;
   int c, d, e, f, i, cm1, cp2, D1D2 = I->D1D2, D2 = I->Dim[2];
   int mx2 = I->iMax[2];
   int *link = I->Link;
   int st, flag;
   int *i_ptr3, *i_ptr4, *i_ptr5;
-  int *e_list = NULL;
-#ifdef _MemoryCache_ON
+  int *e_list = *list;
   int block_offset = I->block_base + cCache_map_elist_offset;
-  int group_id = I->group_id;
-#endif
-  int mx0 = I->iMax[0], mx1 = I->iMax[1], a, am1, ap2, *i_ptr1, b, bm1, bp2, *i_ptr2;
-  unsigned int mapSize;
+  int mx1 = I->iMax[1], a, am1, ap2, *i_ptr1, b, bm1, bp2, *i_ptr2;
   int ok = true;
 
-  PRINTFD(G, FB_Map)
-    " MapSetupExpress-Debug: entered.\n" ENDFD;
-
-  mapSize = I->Dim[0] * I->Dim[1] * I->Dim[2];
-  I->EHead =
-    CacheCalloc(G, int, mapSize, group_id, I->block_base + cCache_map_ehead_offset);
-  CHECKOK(ok, I->EHead);
-  if (ok)
-    e_list = (int*) VLACacheMalloc(G, 1000, sizeof(int), 5, 0, group_id, block_offset);
-  CHECKOK(ok, e_list);
-
-  n = 1;
-  for(a = (I->iMin[0] - 1); ok && a <= mx0; a++) {
+  for(a = a_start; ok && a <= a_stop; a++) {
     am1 = a - 1;
     ap2 = a + 2;
     i_ptr1 = I->Head + am1 * D1D2;
@@ -660,14 +820,30 @@ int MapSetupExpress(MapType * I)
       }
     }
   }
-  if (ok){
-    I->EList = e_list;
-    I->NEElem = n;
-    VLACacheSize(G, I->EList, int, I->NEElem, group_id, block_offset);
-    CHECKOK(ok, I->EList);
-  }
+
+  *list = e_list;
+  *n_ptr = n;
+  return ok;
+}
+
+int MapSetupExpress(MapType * I)
+{                               /* setup a list of neighbors for each square */
+  PyMOLGlobals *G = I->G;
+  unsigned int mapSize;
+  int ok = true;
+
   PRINTFD(G, FB_Map)
-    " MapSetupExpress-Debug: leaving...n=%d\n", n ENDFD;
+    " MapSetupExpress-Debug: entered.\n" ENDFD;
+
+  mapSize = I->Dim[0] * I->Dim[1] * I->Dim[2];
+  I->EHead =
+    CacheCalloc(G, int, mapSize, I->group_id, I->block_base + cCache_map_ehead_offset);
+  CHECKOK(ok, I->EHead);
+  if (ok)
+    ok = MapExpressBuild(I, MapExpressSlab, NULL, I->iMin[0] - 1, I->iMax[0], 1000, 5);
+
+  PRINTFD(G, FB_Map)
+    " MapSetupExpress-Debug: leaving...n=%d\n", I->NEElem ENDFD;
   return ok;
 }
 
@@ -814,6 +990,259 @@ float MapGetSeparation(PyMOLGlobals * G, float range, const float *mx, const flo
   return (divSize);
 }
 
+/*
+ * Parallel construction of Head/Link: vertices are counting sorted by voxel
+ * into a cell-sorted (CSR) list, with one histogram per chunk of vertices so
+ * that each voxel keeps ascending vertex order. Head and Link are then
+ * derived voxel by voxel, giving exactly the lists of the serial build
+ * (highest vertex index first).
+ */
+typedef struct {
+  MapType *map;
+  const float *vert;
+  const int *flag;
+  int n_vert, n_cell, n_chunk;
+  int *cell;                    /* voxel of each vertex, -1 if not hashed */
+  int *count;                   /* n_chunk histograms, then scatter offsets */
+  int *start;                   /* n_cell + 1 offsets into list */
+  int *range_start;             /* n_chunk + 1 */
+  int *list;                    /* hashed vertices sorted by voxel */
+} MapHashJob;
+
+static void MapHashRange(int n, int n_chunk, int t, int *start, int *stop)
+{
+  *start = (int) (((size_t) n * t) / n_chunk);
+  *stop = (int) (((size_t) n * (t + 1)) / n_chunk);
+}
+
+static void MapHashLocateTask(void *data, int t)
+{
+  MapHashJob *job = (MapHashJob *) data;
+  MapType *I = job->map;
+  int *hist = job->count + (size_t) t * job->n_cell;
+  int a, a_start, a_stop, h, k, l;
+
+  MapHashRange(job->n_vert, job->n_chunk, t, &a_start, &a_stop);
+  for(a = a_start; a < a_stop; a++) {
+    int c = -1;
+    if((!job->flag || job->flag[a]) && MapExclLocus(I, job->vert + 3 * a, &h, &k, &l)) {
+      c = (h * I->D1D2) + (k * I->Dim[2]) + l;
+      hist[c]++;
+    }
+    job->cell[a] = c;
+  }
+}
+
+static void MapHashSumTask(void *data, int t)
+{
+  MapHashJob *job = (MapHashJob *) data;
+  int c, c_start, c_stop, u, sum = 0;
+
+  MapHashRange(job->n_cell, job->n_chunk, t, &c_start, &c_stop);
+  for(u = 0; u < job->n_chunk; u++) {
+    const int *hist = job->count + (size_t) u * job->n_cell;
+    for(c = c_start; c < c_stop; c++)
+      sum += hist[c];
+  }
+  job->range_start[t + 1] = sum;
+}
+
+static void MapHashOffsetTask(void *data, int t)
+{
+  MapHashJob *job = (MapHashJob *) data;
+  int c, c_start, c_stop, u;
+  int offset = job->range_start[t];
+
+  MapHashRange(job->n_cell, job->n_chunk, t, &c_start, &c_stop);
+  for(c = c_start; c < c_stop; c++) {
+    job->start[c] = offset;
+    for(u = 0; u < job->n_chunk; u++) {
+      int *cnt = job->count + (size_t) u * job->n_cell + c;
+      int tmp = *cnt;
+      *cnt = offset;
+      offset += tmp;
+    }
+  }
+}
+
+static void MapHashScatterTask(void *data, int t)
+{
+  MapHashJob *job = (MapHashJob *) data;
+  int *offset = job->count + (size_t) t * job->n_cell;
+  int a, a_start, a_stop;
+
+  MapHashRange(job->n_vert, job->n_chunk, t, &a_start, &a_stop);
+  for(a = a_start; a < a_stop; a++) {
+    int c = job->cell[a];
+    if(c >= 0)
+      job->list[offset[c]++] = a;
+  }
+}
+
+static void MapHashLinkTask(void *data, int t)
+{
+  MapHashJob *job = (MapHashJob *) data;
+  MapType *I = job->map;
+  int c, c_start, c_stop, j;
+
+  MapHashRange(job->n_cell, job->n_chunk, t, &c_start, &c_stop);
+  for(c = c_start; c < c_stop; c++) {
+    int st = job->start[c], stop = job->start[c + 1];
+    if(stop > st) {
+      I->Head[c] = job->list[stop - 1];
+      for(j = st + 1; j < stop; j++)
+        I->Link[job->list[j]] = job->list[j - 1];
+    }
+  }
+}
+
+/*
+ * Fills I->Head and I->Link (already cleared to -1) on the thread pool.
+ * Returns false without doing anything if a serial build is preferable.
+ */
+static int MapHashParallel(MapType * I, const float *vert, int n_vert, const int *flag,
+                           int n_cell)
+{
+  PyMOLGlobals *G = I->G;
+  int n_thread = MapGetNThread(G, n_vert);
+  int t, ok = true;
+  MapHashJob job;
+
+  if(n_thread < 2)
+    return false;
+
+  /* bound the histogram memory by the size of the vertex arrays */
+  job.n_chunk = 1 + (int) ((4 * (size_t) n_vert) / n_cell);
+  if(job.n_chunk > n_thread)
+    job.n_chunk = n_thread;
+  if(job.n_chunk < 2)
+    return false;
+
+  job.map = I;
+  job.vert = vert;
+  job.flag = flag;
+  job.n_vert = n_vert;
+  job.n_cell = n_cell;
+  job.cell = Alloc(int, n_vert);
+  job.list = Alloc(int, n_vert);
+  job.start = Alloc(int, n_cell + 1);
+  job.range_start = Alloc(int, job.n_chunk + 1);
+  job.count = Calloc(int, (size_t) job.n_chunk * n_cell);
+  CHECKOK(ok, job.cell);
+  CHECKOK(ok, job.list);
+  CHECKOK(ok, job.start);
+  CHECKOK(ok, job.range_start);
+  CHECKOK(ok, job.count);
+
+  if(ok) {
+    ThreadPoolRun(G, n_thread, job.n_chunk, MapHashLocateTask, &job);
+    ThreadPoolRun(G, n_thread, job.n_chunk, MapHashSumTask, &job);
+    job.range_start[0] = 0;
+    for(t = 0; t < job.n_chunk; t++)
+      job.range_start[t + 1] += job.range_start[t];
+    job.start[n_cell] = job.range_start[job.n_chunk];
+    ThreadPoolRun(G, n_thread, job.n_chunk, MapHashOffsetTask, &job);
+    ThreadPoolRun(G, n_thread, job.n_chunk, MapHashScatterTask, &job);
+    ThreadPoolRun(G, n_thread, job.n_chunk, MapHashLinkTask, &job);
+
+    PRINTFB(G, FB_Map, FB_Blather)
+      " MapNew: hashed %d of %d vertices into %d voxels with %d threads\n",
+      job.start[n_cell], n_vert, n_cell, job.n_chunk ENDFB(G);
+  }
+
+  FreeP(job.cell);
+  FreeP(job.list);
+  FreeP(job.start);
+  FreeP(job.range_start);
+  FreeP(job.count);
+  return ok;
+}
+
+/*
+ * MapSetupCells: voxels are processed in ranges, each range first counting
+ * and later copying its chains, so large maps can be done on the thread pool
+ */
+typedef struct {
+  MapType *map;
+  const float *vert;
+  int n_cell, n_range;
+  int *range_start;             /* n_range + 1 */
+} MapCellsJob;
+
+static void MapCellsCountTask(void *data, int t)
+{
+  MapCellsJob *job = (MapCellsJob *) data;
+  MapType *I = job->map;
+  int c, c_start, c_stop, i, n = 0;
+
+  MapHashRange(job->n_cell, job->n_range, t, &c_start, &c_stop);
+  for(c = c_start; c < c_stop; c++)
+    for(i = I->Head[c]; i >= 0; i = I->Link[i])
+      n++;
+  job->range_start[t + 1] = n;
+}
+
+static void MapCellsFillTask(void *data, int t)
+{
+  MapCellsJob *job = (MapCellsJob *) data;
+  MapType *I = job->map;
+  int c, c_start, c_stop, i;
+  int n = job->range_start[t];
+
+  MapHashRange(job->n_cell, job->n_range, t, &c_start, &c_stop);
+  for(c = c_start; c < c_stop; c++) {
+    I->CellStart[c] = n;
+    for(i = I->Head[c]; i >= 0; i = I->Link[i]) {
+      I->CellList[n] = i;
+      if(job->vert)
+        copy3f(job->vert + 3 * i, I->CellVert + 3 * n);
+      n++;
+    }
+  }
+}
+
+int MapSetupCells(MapType * I, const float *vert)
+{
+  PyMOLGlobals *G = I->G;
+  MapCellsJob job;
+  int t, ok = true;
+
+  job.map = I;
+  job.vert = vert;
+  job.n_cell = I->Dim[0] * I->Dim[1] * I->Dim[2];
+  job.n_range = MapGetNThread(G, I->NVert);
+  job.range_start = Alloc(int, job.n_range + 1);
+  CHECKOK(ok, job.range_start);
+
+  FreeP(I->CellStart);
+  FreeP(I->CellList);
+  FreeP(I->CellVert);
+
+  if(ok) {
+    ThreadPoolRun(G, job.n_range, job.n_range, MapCellsCountTask, &job);
+    job.range_start[0] = 0;
+    for(t = 0; t < job.n_range; t++)
+      job.range_start[t + 1] += job.range_start[t];
+
+    I->CellStart = Alloc(int, job.n_cell + 1);
+    CHECKOK(ok, I->CellStart);
+    if(ok) {
+      I->CellList = Alloc(int, job.range_start[job.n_range] + 1);
+      CHECKOK(ok, I->CellList);
+    }
+    if(ok && vert) {
+      I->CellVert = Alloc(float, 3 * (job.range_start[job.n_range] + 1));
+      CHECKOK(ok, I->CellVert);
+    }
+  }
+  if(ok) {
+    ThreadPoolRun(G, job.n_range, job.n_range, MapCellsFillTask, &job);
+    I->CellStart[job.n_cell] = job.range_start[job.n_range];
+  }
+  FreeP(job.range_start);
+  return ok;
+}
+
 MapType *MapNew(PyMOLGlobals * G, float range, float *vert, int nVert, float *extent)
 {
   return (_MapNew(G, range, vert, nVert, extent, NULL, -1, 0));
@@ -862,6 +1291,9 @@ static MapType *_MapNew(PyMOLGlobals * G, float range, float *vert, int nVert,
   I->EList = NULL;
   I->EMask = NULL;
   I->NEElem = 0;
+  I->CellStart = NULL;
+  I->CellList = NULL;
+  I->CellVert = NULL;
 
   /* initialize an empty cache for the map */
   I->Link = CacheAlloc(G, int, nVert, group_id, block_base + cCache_map_link_offset);
@@ -1031,7 +1463,9 @@ static MapType *_MapNew(PyMOLGlobals * G, float range, float *vert, int nVert,
     " MapNew-Debug: creating 3D hash...\n" ENDFD;
 
   /* create 3-D hash of the vertices */
-  if(flag) {
+  if(MapHashParallel(I, vert, nVert, flag, mapSize)) {
+    /* done */
+  } else if(flag) {
     v = vert;
     for(a = 0; a < nVert; a++) {
       if(flag[a])
@@ -38,6 +38,9 @@ typedef struct {
   Vector3f Max, Min;
   int group_id;
   int block_base;
+  int *CellStart;               /* cell-sorted layout, see MapSetupCells */
+  int *CellList;
+  float *CellVert;
 } MapType;
 
 typedef struct {
@@ -61,11 +64,26 @@ int MapSetupExpressPerp(MapType * I, float *vert, float front, int nVertHint,
 
 void MapFree(MapType * I);
 
+/*
+ * Cell-sorted (CSR) copy of Head/Link: the vertices of voxel `cell` are
+ * CellList[CellStart[cell]] up to (excluding) CellList[CellStart[cell + 1]],
+ * in MapFirst/MapNext order. Consecutive voxels along the third dimension
+ * are adjacent, so a 3x3x3 neighborhood is nine contiguous runs (see
+ * MapCellRun). If `vert` is given, CellVert holds the coordinates in
+ * CellList order.
+ */
+int MapSetupCells(MapType * I, const float *vert);
+
 #define MapFirst(m,a,b,c) (m->Head + ((a) * m->D1D2) + ((b)*m->Dim[2]) + (c))
 
 #define MapEStart(m,a,b,c) (m->EHead + ((a) * m->D1D2) + ((b)*m->Dim[2]) + (c))
 
 #define MapNext(m,a) (*(m->Link+(a)))
+
+#define MapCell(m,a,b,c) (((a) * m->D1D2) + ((b)*m->Dim[2]) + (c))
+
+/* CellList range [start, stop) of voxels (a,b,c-1) through (a,b,c+1) */
+#define MapCellRun(m,a,b,c,start,stop) {const int *cs_ = m->CellStart + MapCell(m,a,b,(c)-1); start = cs_[0]; stop = cs_[3];}
 void MapLocus(MapType * map, const float *v, int *a, int *b, int *c);
 int *MapLocusEStart(MapType * map, const float *v);
 
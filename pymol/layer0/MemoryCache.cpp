@@ -16,6 +16,9 @@ I* Additional authors of this source file include:
 Z* -------------------------------------------------------------------
 */
 
+#include"os_predef.h"
+#include"os_std.h"
+
 #include"MemoryCache.h"
 
 #ifdef _MemoryCache_ON
@@ -23,172 +26,302 @@ Z* -------------------------------------------------------------------
 #include"MemoryDebug.h"
 #include"Setting.h"
 
-typedef struct {
-  int *ptr;
-  unsigned int size;
-} MemoryCacheRec;
+#ifndef _PYMOL_NO_CXX11
+#include <atomic>
+#include <mutex>
+#endif
 
-typedef MemoryCacheRec MemoryCacheThread[cMemoryCache_max_block];
+/* size classes: 64 bytes, then four steps per power of two up to 1 TB */
+#define cMemoryCache_n_class 140
+
+/* precedes every pooled block, keeps the payload 16 byte aligned */
+typedef union {
+  struct {
+    size_t size;                /* block bytes, including this header */
+    int cls;                    /* size class, -1 if too large to pool */
+  } info;
+  double align[2];
+} MemoryCacheHeader;
+
+/* free blocks and statistics of one thread (group) */
+typedef struct {
+  MemoryCacheHeader *Free[cMemoryCache_n_class];      /* linked through the payload */
+  unsigned int Hit[cMemoryCache_max_block];
+  unsigned int Miss[cMemoryCache_max_block];
+#ifndef _PYMOL_NO_CXX11
+  std::mutex Mutex;
+#endif
+} MemoryCacheShelf;
 
 struct _CMemoryCache {
-  MemoryCacheThread Cache[cMemoryCache_max_group];
+  MemoryCacheShelf Shelf[cMemoryCache_max_group];
+#ifndef _PYMOL_NO_CXX11
+  std::atomic<size_t> Pooled;
+#else
+  size_t Pooled;
+#endif
 };
 
-void MemoryCacheInit(PyMOLGlobals * G)
+#ifndef _PYMOL_NO_CXX11
+#define MEMORY_CACHE_LOCK(shelf) std::lock_guard<std::mutex> lock((shelf)->Mutex)
+#else
+/* without native threads, every group is only used by one thread at a time */
+#define MEMORY_CACHE_LOCK(shelf)
+#endif
+
+static int MemoryCacheClass(size_t size)
 {
-  G->MemoryCache = Calloc(CMemoryCache, 1);
+  int k = 6, cls;
+  if(size <= 64)
+    return 0;
+  size--;
+  while((size >> (k + 1)))
+    k++;
+  cls = 1 + (k - 6) * 4 + (int) (size >> (k - 2)) - 4;
+  return (cls < cMemoryCache_n_class) ? cls : -1;
 }
 
-void *_MemoryCacheMalloc(PyMOLGlobals * G, unsigned int size, int group_id,
-                         int block_id MD_FILE_LINE_Decl)
+static size_t MemoryCacheClassSize(int cls)
 {
-  if((group_id < 0) || (!SettingGetGlobal_b(G, cSetting_cache_memory)))
-    return (mmalloc(size));
+  if(!cls)
+    return 64;
+  cls--;
+  return ((size_t) (5 + (cls & 3))) << (4 + (cls >> 2));
+}
+
+static MemoryCacheShelf *MemoryCacheGetShelf(CMemoryCache * I, int group_id)
+{
+  return I->Shelf + (group_id % cMemoryCache_max_group);
+}
+
+static size_t MemoryCacheLimit(PyMOLGlobals * G)
+{
+  if(!G->Setting || !SettingGetGlobal_i(G, cSetting_cache_memory))
+    return 0;
+  return ((size_t) SettingGetGlobal_i(G, cSetting_cache_memory_max)) << 20;
+}
 
-  {
-    CMemoryCache *I = G->MemoryCache;
-    MemoryCacheRec *rec = &I->Cache[group_id][block_id];
-
-    if(!rec->ptr) {
-      rec->size = size;
-      rec->ptr = mmalloc(size);
-    } else if(rec->size < size) {
-      rec->size = size;
-      mfree(rec->ptr);
-      rec->ptr = mmalloc(size);
+static void MemoryCacheShelfPurge(CMemoryCache * I, MemoryCacheShelf * shelf)
+{
+  int a;
+  for(a = 0; a < cMemoryCache_n_class; a++) {
+    MemoryCacheHeader *hdr;
+    while((hdr = shelf->Free[a])) {
+      shelf->Free[a] = *(MemoryCacheHeader **) (hdr + 1);
+      I->Pooled -= hdr->info.size;
+      mfree(hdr);
     }
-    return (rec->ptr);
   }
 }
 
-void *_MemoryCacheCalloc(PyMOLGlobals * G, unsigned int number, unsigned int size,
-                         int group_id, int block_id MD_FILE_LINE_Decl)
+/* returns the free blocks of every thread to the system */
+static void MemoryCachePurgeAll(CMemoryCache * I)
 {
-  if((group_id < 0) || (!SettingGetGlobal_b(G, cSetting_cache_memory)))
-    return (mcalloc(number, size));
+  int a;
+  for(a = 0; a < cMemoryCache_max_group; a++) {
+    MemoryCacheShelf *shelf = I->Shelf + a;
+    MEMORY_CACHE_LOCK(shelf);
+    MemoryCacheShelfPurge(I, shelf);
+  }
+}
 
-  {
-    CMemoryCache *I = G->MemoryCache;
-    MemoryCacheRec *rec = &I->Cache[group_id][block_id];
-    unsigned int true_size = number * size;
+/* takes a block of at least `size` bytes from the pool or the system */
+static void *MemoryCacheGet(PyMOLGlobals * G, size_t size, int group_id, int block_id)
+{
+  CMemoryCache *I = G->MemoryCache;
+  MemoryCacheShelf *shelf = MemoryCacheGetShelf(I, group_id);
+  size_t need = size + sizeof(MemoryCacheHeader);
+  int cls = MemoryCacheClass(need);
+  MemoryCacheHeader *hdr = NULL;
 
-    /* interesting result: calloc is faster than cacheing */
+  if(((unsigned) block_id) >= cMemoryCache_max_block)
+    block_id = cCache_no_cache;
 
-    if(!rec->ptr) {
-      rec->size = true_size;
-      rec->ptr = mcalloc(number, size);
-    } else if(rec->size < true_size) {
-      mfree(rec->ptr);
-      rec->size = true_size;
-      rec->ptr = mcalloc(number, size);
+  if(!MemoryCacheLimit(G)) {
+    if(I->Pooled)
+      MemoryCachePurgeAll(I);
+  } else if(cls >= 0) {
+    MEMORY_CACHE_LOCK(shelf);
+    if((hdr = shelf->Free[cls])) {
+      shelf->Free[cls] = *(MemoryCacheHeader **) (hdr + 1);
+      I->Pooled -= hdr->info.size;
+      shelf->Hit[block_id]++;
     } else {
-      mfree(rec->ptr);
-      rec->size = true_size;
-      rec->ptr = mcalloc(number, size);
+      shelf->Miss[block_id]++;
     }
-    return (rec->ptr);
   }
+
+  if(!hdr) {
+    if(cls >= 0)
+      need = MemoryCacheClassSize(cls);
+    hdr = (MemoryCacheHeader *) mmalloc(need);
+    if(!hdr)
+      return NULL;
+    hdr->info.size = need;
+    hdr->info.cls = cls;
+  }
+  return (void *) (hdr + 1);
 }
 
-void MemoryCacheReplaceBlock(PyMOLGlobals * G, void *ptr, int group_id, int old_block_id,
-                             int new_block_id)
+/* returns a block to the pool, or to the system if the pool is full */
+static void MemoryCachePut(PyMOLGlobals * G, void *ptr, int group_id, int force)
 {
-  if((group_id < 0) || (!SettingGetGlobal_b(G, cSetting_cache_memory)))
-    return;
-  {
-    CMemoryCache *I = G->MemoryCache;
-    MemoryCacheRec *old_rec = &I->Cache[group_id][old_block_id];
-    MemoryCacheRec *new_rec = &I->Cache[group_id][new_block_id];
-    if(new_rec->ptr)
-      mfree(new_new->ptr);
-    *(new_rec) = *(old_rec);
-    old_rec->ptr = NULL;
+  CMemoryCache *I = G->MemoryCache;
+  MemoryCacheHeader *hdr = ((MemoryCacheHeader *) ptr) - 1;
+  size_t size = hdr->info.size;
+
+  if(!force && (hdr->info.cls >= 0)) {
+    size_t limit = MemoryCacheLimit(G);
+    if(limit && ((I->Pooled += size) <= limit)) {
+      MemoryCacheShelf *shelf = MemoryCacheGetShelf(I, group_id);
+      MEMORY_CACHE_LOCK(shelf);
+      *(MemoryCacheHeader **) ptr = shelf->Free[hdr->info.cls];
+      shelf->Free[hdr->info.cls] = hdr;
+      return;
+    }
+    if(limit)
+      I->Pooled -= size;
+  }
+  mfree(hdr);
+}
+
+/* moves the first `keep` bytes of `ptr` into a new block of `size` bytes */
+static void *MemoryCacheMove(PyMOLGlobals * G, void *ptr, size_t keep, size_t size,
+                             int group_id, int block_id)
+{
+  void *result = MemoryCacheGet(G, size, group_id, block_id);
+  if(result) {
+    memcpy(result, ptr, keep);
+    MemoryCachePut(G, ptr, group_id, false);
   }
+  return result;
+}
+
+void MemoryCacheInit(PyMOLGlobals * G)
+{
+#ifndef _PYMOL_NO_CXX11
+  G->MemoryCache = new CMemoryCache();
+#else
+  G->MemoryCache = Calloc(CMemoryCache, 1);
+#endif
+}
+
+void *_MemoryCacheMalloc(PyMOLGlobals * G, unsigned int size, int group_id,
+                         int block_id MD_FILE_LINE_Decl)
+{
+  if(group_id < 0)
+    return (mmalloc(size));
+  return MemoryCacheGet(G, size, group_id, block_id);
+}
+
+void *_MemoryCacheCalloc(PyMOLGlobals * G, unsigned int number, unsigned int size,
+                         int group_id, int block_id MD_FILE_LINE_Decl)
+{
+  void *result;
+  if(group_id < 0)
+    return (mcalloc(number, size));
+  result = MemoryCacheGet(G, ((size_t) number) * size, group_id, block_id);
+  if(result)
+    memset(result, 0, ((size_t) number) * size);
+  return result;
+}
+
+void MemoryCacheReplaceBlock(PyMOLGlobals * G, int group_id, int old_block_id,
+                             int new_block_id)
+{
+  /* blocks aren't tied to their slot, so there is nothing to hand over */
 }
 
 void *_MemoryCacheRealloc(PyMOLGlobals * G, void *ptr, unsigned int size, int group_id,
                           int block_id MD_FILE_LINE_Decl)
 {
-  /* no checking done */
+  MemoryCacheHeader *hdr;
+  size_t avail;
 
-  if((group_id < 0) || (!SettingGetGlobal_b(G, cSetting_cache_memory)))
+  if(group_id < 0)
     return (mrealloc(ptr, size));
-  {
-    CMemoryCache *I = G->MemoryCache;
-    MemoryCacheRec *rec = &I->Cache[group_id][block_id];
-
-    if(ptr != rec->ptr)
-      printf("Error: Memory Cache Mismatch 2 %d %d\n", group_id, block_id);
-    if(!rec->ptr) {
-      rec->size = size;
-      rec->ptr = mrealloc(ptr, size);
-    } else if(rec->size < size) {
-      rec->size = size;
-      rec->ptr = mrealloc(ptr, size);
-    }
-    return (rec->ptr);
-  }
+  if(!ptr)
+    return MemoryCacheGet(G, size, group_id, block_id);
+
+  hdr = ((MemoryCacheHeader *) ptr) - 1;
+  avail = hdr->info.size - sizeof(MemoryCacheHeader);
+  if(size <= avail)
+    return ptr;
+  return MemoryCacheMove(G, ptr, avail, size, group_id, block_id);
 }
 
-void *_MemoryShrinkForSure(PyMOLGlobals * G, void *ptr, unsigned int size, int group_id,
-                           int block_id MD_FILE_LINE_Decl)
-{
-  /* no checking done */
-
-  if((group_id < 0) || (!SettingGetGlobal_b(G, cSetting_cache_memory)))
-    return (ReallocForSure(ptr, size)); /* NOTE: fatal if new ptr is larger than old... */
-  {
-    CMemoryCache *I = G->MemoryCache;
-    MemoryCacheRec *rec = &I->Cache[group_id][block_id];
-
-    if(ptr != rec->ptr)
-      printf("Error: Memory Cache Mismatch 2 %d %d\n", group_id, block_id);
-    if(!rec->ptr) {             /* not currently cache-allocated... this should never happen */
-      rec->size = size;
-      rec->ptr = mrealloc(ptr, size);
-    } else if(rec->size < size) {
-      rec->ptr = MemoryReallocForSureSafe(ptr, size, rec->size);
-      rec->size = size;
-    } else {                    /* expanding size...should never happen... this should never happen */
-      rec->size = size;
-      rec->ptr = mrealloc(ptr, size);
-    }
-    return (rec->ptr);
-  }
+void *_MemoryCacheShrinkForSure(PyMOLGlobals * G, void *ptr, unsigned int size,
+                                int group_id, int block_id MD_FILE_LINE_Decl)
+{
+  MemoryCacheHeader *hdr;
+
+  if(group_id < 0)
+    return (MemoryReallocForSure(ptr, size));
+
+  hdr = ((MemoryCacheHeader *) ptr) - 1;
+  if(size >= hdr->info.size - sizeof(MemoryCacheHeader))
+    return _MemoryCacheRealloc(G, ptr, size, group_id, block_id MD_FILE_LINE_Nest);
+
+  /* release the slack if the block would fit into a smaller class */
+  if((hdr->info.cls < 0) ||
+     (MemoryCacheClass(size + sizeof(MemoryCacheHeader)) < hdr->info.cls))
+    return MemoryCacheMove(G, ptr, size, size, group_id, block_id);
+  return ptr;
 }
 
 void _MemoryCacheFree(PyMOLGlobals * G, void *ptr, int group_id, int block_id,
                       int force MD_FILE_LINE_Decl)
 {
-  if((group_id < 0) || (!SettingGetGlobal_b(G, cSetting_cache_memory))) {
+  if(group_id < 0) {
     mfree(ptr);
     return;
   }
-  {
-    CMemoryCache *I = G->MemoryCache;
-    MemoryCacheRec *rec = &I->Cache[group_id][block_id];
-    if(rec->ptr && (ptr != rec->ptr))
-      printf("Error: Memory Cache Mismatch 2 %d %d\n", group_id, block_id);
-    if(force) {
-      if(rec->ptr)
-        mfree(rec->ptr);
-      rec->ptr = NULL;
-    }
-  }
+  MemoryCachePut(G, ptr, group_id, force);
 }
 
-void MemoryCacheDone(PyMOLGlobals * G)
+void MemoryCacheTrim(PyMOLGlobals * G)
+{
+  CMemoryCache *I = G->MemoryCache;
+  if(I && I->Pooled > MemoryCacheLimit(G))
+    MemoryCachePurgeAll(I);
+}
+
+void MemoryCacheGetStats(PyMOLGlobals * G, MemoryCacheStats * stats, int reset)
 {
-  int a, b;
   CMemoryCache *I = G->MemoryCache;
+  int a, b;
+
+  memset(stats, 0, sizeof(MemoryCacheStats));
   for(a = 0; a < cMemoryCache_max_group; a++) {
+    MemoryCacheShelf *shelf = I->Shelf + a;
+    MEMORY_CACHE_LOCK(shelf);
     for(b = 0; b < cMemoryCache_max_block; b++) {
-      MemoryCacheRec *rec = &I->Cache[a][b];
-      if(rec->ptr)
-        mfree(rec->ptr);
+      stats->Hit[b] += shelf->Hit[b];
+      stats->Miss[b] += shelf->Miss[b];
+    }
+    if(reset) {
+      memset(shelf->Hit, 0, sizeof(shelf->Hit));
+      memset(shelf->Miss, 0, sizeof(shelf->Miss));
     }
   }
-  FreeP(G->MemoryCache);
+  stats->Pooled = I->Pooled;
+  stats->Limit = MemoryCacheLimit(G);
+}
+
+void MemoryCacheDone(PyMOLGlobals * G)
+{
+  int a;
+  CMemoryCache *I = G->MemoryCache;
+  if(!I)
+    return;
+  for(a = 0; a < cMemoryCache_max_group; a++)
+    MemoryCacheShelfPurge(I, I->Shelf + a);
+#ifndef _PYMOL_NO_CXX11
+  delete I;
+#else
+  FreeP(I);
+#endif
+  G->MemoryCache = NULL;
 }
 #else
 typedef int file_not_empty_as_per_iso_c;
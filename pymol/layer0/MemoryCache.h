@@ -18,12 +18,21 @@ Z* -------------------------------------------------------------------
 #ifndef _H_MemoryCache
 #define _H_MemoryCache
 
-#define _MemoryCache_OFF
+#include <stddef.h>
 
+#define _MemoryCache_ON
 
-/* NOTE: at the present time, MemoryCaching is not compatible with a
-   running PyMOL free of global state -- it's basically just a
-   performace hack for systems with slow memory management.
+
+/* Thread-aware buffer pool for the large, short lived work arrays of the
+   ray tracer and of the spatial hash maps.
+
+   group_id: the calling thread (ray tracing phase), < 0 bypasses the pool
+   block_id: the slot (cCache_* below), only used for statistics
+
+   Freed blocks are kept per thread in power-of-two size classes (four
+   steps per power) and handed out again for any slot of similar size,
+   until "cache_memory_max" MB are held. "cache_memory" off returns all
+   memory to the system.
 */
 
 
@@ -75,6 +84,13 @@ Z* -------------------------------------------------------------------
 #define cMemoryCache_max_block 100
 #define cMemoryCache_max_group 16
 
+typedef struct {
+  unsigned int Hit[cMemoryCache_max_block];
+  unsigned int Miss[cMemoryCache_max_block];
+  size_t Pooled;                /* bytes currently held for reuse */
+  size_t Limit;                 /* cache_memory_max in bytes */
+} MemoryCacheStats;
+
 #ifdef _MemoryCache_ON
 
 #include "PyMOLGlobals.h"
@@ -85,6 +101,13 @@ void MemoryCacheDone(PyMOLGlobals * G);
 void MemoryCacheReplaceBlock(PyMOLGlobals * G, int group_id, int old_block_id,
                              int new_block_id);
 
+/* returns all pooled memory to the system if more than the current limit
+   is held (after "cache_memory" or "cache_memory_max" changed) */
+void MemoryCacheTrim(PyMOLGlobals * G);
+
+/* hit/miss counters summed over all threads, optionally resetting them */
+void MemoryCacheGetStats(PyMOLGlobals * G, MemoryCacheStats * stats, int reset);
+
 void *_MemoryCacheMalloc(PyMOLGlobals * G, unsigned int size, int group_id,
                          int block_id MD_FILE_LINE_Decl);
 void *_MemoryCacheCalloc(PyMOLGlobals * G, unsigned int number, unsigned int size,
@@ -101,7 +124,7 @@ void _MemoryCacheFree(PyMOLGlobals * G, void *ptr, int group_id, int block_id,
 #define CacheRealloc(G,ptr,type,size,thread,id) (type*)_MemoryCacheRealloc(G,ptr,sizeof(type)*(size),thread,id MD_FILE_LINE_Call)
 #define CacheFreeP(G,ptr,thread,id,force) {if(ptr) {_MemoryCacheFree(G,ptr,thread,id,force MD_FILE_LINE_Call);ptr=NULL;}}
 
-#define VLACacheCheck(G,ptr,type,rec,t,i) (ptr=(type*)(((((unsigned)rec)>=((VLARec*)(ptr))[-1].nAlloc) ? VLACacheExpand(G,ptr,(rec),t,i) : (ptr))))
+#define VLACacheCheck(G,ptr,type,rec,t,i) (ptr=(type*)(((((ov_size)rec)>=((VLARec*)(ptr))[-1].size) ? VLACacheExpand(G,ptr,(rec),t,i) : (ptr))))
 #define VLACacheAlloc(G,type,initSize,t,i) (type*)VLACacheMalloc(G,initSize,sizeof(type),3,0,t,i)
 #define VLACacheFreeP(G,ptr,t,i,f) {if(ptr) {VLACacheFree(G,ptr,t,i,f);ptr=NULL;}}
 #define VLACacheSize(G,ptr,type,size,t,i) {ptr=(type*)VLACacheSetSize(G,ptr,size,t,i);}
@@ -137,13 +160,15 @@ void *VLACacheExpand(PyMOLGlobals * G, void *ptr, unsigned int rec, int thread_i
 #define MemoryCacheInit(x)
 #define MemoryCacheDone(x)
 #define MemoryCacheReplaceBlock(G,g,o,n)
+#define MemoryCacheTrim(G)
+#define MemoryCacheGetStats(G,s,r) memset(s,0,sizeof(MemoryCacheStats))
 
 #define VLACacheMalloc(G,a,b,c,d,t,i) VLAMalloc(a,b,c,d)
 #define VLACacheFree(G,p,t,i,f) VLAFree(p)
 
 #define CacheAlloc(G,type,size,thread,id) (type*)mmalloc(sizeof(type)*(size))
 #define CacheCalloc(G,type,size,thread,id) (type*)mcalloc(sizeof(type),size)
-#define CacheRealloc(G,ptr,type,size,thread,id) (type*)mrealloc(sizeof(type)*(size))
+#define CacheRealloc(G,ptr,type,size,thread,id) (type*)mrealloc(ptr,sizeof(type)*(size))
 #define CacheFreeP(G,ptr,thread,id,force) {if(ptr) {mfree(ptr);ptr=NULL;}}
 
 #endif
@@ -126,7 +126,7 @@ void *VLACacheExpand(PyMOLGlobals * G, void *ptr, unsigned int rec, int thread_i
     vla->size = ((unsigned int) (rec * vla->grow_factor)) + 1;
     if(vla->size <= rec)
       vla->size = rec + 1;
-    vla = (void *) _MemoryCacheRealloc(G, vla,
+    vla = (VLARec *) _MemoryCacheRealloc(G, vla,
                                        (vla->unit_size * vla->size) + sizeof(VLARec),
                                        thread_index, block_id MD_FILE_LINE_Call);
     if(!vla) {
@@ -189,7 +189,7 @@ void *_VLACacheMalloc(PyMOLGlobals * G, const char *file, int line,
   VLARec *vla;
   char *start, *stop;
 
-  vla = (void *) _MemoryCacheMalloc(G, (init_size * unit_size) + sizeof(VLARec),
+  vla = (VLARec *) _MemoryCacheMalloc(G, (init_size * unit_size) + sizeof(VLARec),
                                     thread, id MD_FILE_LINE_Nest);
 
   if(!vla) {
@@ -276,7 +276,7 @@ void *VLACacheSetSize(PyMOLGlobals * G, void *ptr, unsigned int new_size, int gr
   }
   vla->size = new_size;
   vla =
-    (void *) _MemoryCacheRealloc(G, vla, (vla->unit_size * vla->size) + sizeof(VLARec),
+    (VLARec *) _MemoryCacheRealloc(G, vla, (vla->unit_size * vla->size) + sizeof(VLARec),
                                  group_id, block_id MD_FILE_LINE_Call);
   if(!vla) {
     printf("VLASetSize-ERR: realloc failed.\n");
@@ -305,13 +305,13 @@ void *VLACacheSetSizeForSure(PyMOLGlobals * G, void *ptr, unsigned int new_size,
   if(new_size < vla->size) {
     vla->size = new_size;
     vla =
-      (void *) _MemoryCacheShrinkForSure(G, vla,
+      (VLARec *) _MemoryCacheShrinkForSure(G, vla,
                                          (vla->unit_size * vla->size) + sizeof(VLARec),
                                          group_id, block_id MD_FILE_LINE_Call);
   } else {
     vla->size = new_size;
     vla =
-      (void *) _MemoryCacheRealloc(G, vla, (vla->unit_size * vla->size) + sizeof(VLARec),
+      (VLARec *) _MemoryCacheRealloc(G, vla, (vla->unit_size * vla->size) + sizeof(VLARec),
                                    group_id, block_id MD_FILE_LINE_Call);
   }
   if(!vla) {
@@ -32,6 +32,8 @@ inline float DIP2PIXEL(float v) { return v * _gScaleFactor; }
 typedef int lexidx_t;
 
 typedef struct _CMemoryCache CMemoryCache;
+typedef struct _CThreadPool CThreadPool;
+typedef struct _CRayCache CRayCache;
 typedef struct _CIsosurf CIsosurf;
 typedef struct _CTetsurf CTetsurf;
 typedef struct _CSphere CSphere;
@@ -116,6 +118,8 @@ struct _PyMOLGlobals {
   /* singleton objects */
 
   CMemoryCache *MemoryCache;    /* could probably eliminate this... */
+  CThreadPool *ThreadPool;      /* persistent workers for parallel loops */
+  CRayCache *RayCache;          /* ray tracing data kept between frames */
   CIsosurf *Isosurf;
   CTetsurf *Tetsurf;
   CSphere *Sphere;
@@ -28,6 +28,8 @@ Z* -------------------------------------------------------------------
 #include"Vector.h"
 #include"Feedback.h"
 #include"P.h"
+#include"Setting.h"
+#include"ThreadPool.h"
 
 #define Trace_OFF
 
@@ -90,6 +92,7 @@ struct _CTetsurf {
   int Max[3];
   CField *Coord, *Data, *Grad;
   float Level;
+  IsofieldPyramid *Pyramid;     /* resolved before the block tasks start */
   int Edge[6020];               /* 6017 */
   int EdgeStart[256];
   int TotPrim;
@@ -106,6 +109,9 @@ static int TetsurfFindActiveBoxes(CTetsurf * II, int mode, int *n_strip, int n_v
 
 #define TetsurfSubSize		50
 
+/* every thread needs ~35 MB of block scratch (mostly I->Point) */
+#define cTetsurfMaxThread	8
+
 static void copy3fn(float *v1, float *v2)
 {
   v2[0] = v1[0];
@@ -522,10 +528,444 @@ void TetsurfGetRange(PyMOLGlobals * G,
 }
 
 
+/*===========================================================================*/
+static void TetsurfSetBlock(CTetsurf * I, const int *range, int i, int j, int k)
+{
+  int c;
+  I->CurOff[0] = TetsurfSubSize * i;
+  I->CurOff[1] = TetsurfSubSize * j;
+  I->CurOff[2] = TetsurfSubSize * k;
+  for(c = 0; c < 3; c++)
+    I->CurOff[c] += range[c];
+  for(c = 0; c < 3; c++) {
+    I->Max[c] = (range[3 + c] - I->CurOff[c]);
+    if(I->Max[c] > (TetsurfSubSize + 1))
+      I->Max[c] = (TetsurfSubSize + 1);
+  }
+}
+
+
+/*===========================================================================*/
+/* false if the field's min/max pyramid shows the current block is entirely
+ * on one side of the level (TetsurfCodeVertices would return false) */
+static int TetsurfBlockMayContain(CTetsurf * I)
+{
+  int hi[3];
+  int c;
+  for(c = 0; c < 3; c++)
+    hi[c] = I->CurOff[c] + I->Max[c];
+  return IsofieldPyramidMayContain(I->Pyramid, I->CurOff, hi, I->Level);
+}
+
+
+/*===========================================================================*/
+static int TetsurfGetNThread(PyMOLGlobals * G, int n_block)
+{
+  int n_thread;
+  if((n_block < 2) || !G->Setting || !ThreadPoolIsNative())
+    return 1;
+  n_thread = SettingGetGlobal_i(G, cSetting_max_threads);
+  if(n_thread > cTetsurfMaxThread)
+    n_thread = cTetsurfMaxThread;
+  if(n_thread > n_block)
+    n_thread = n_block;
+  if(n_thread < 1)
+    n_thread = 1;
+  return n_thread;
+}
+
+
+/*===========================================================================*/
+typedef struct {
+  ov_uint64 key;
+  int valid;
+  float *V;
+  int *N;
+  int n_vert, n_strip, n_tri;
+} TetsurfCacheBlock;
+
+struct _CTetsurfCache {
+  PyMOLGlobals *G;
+  int valid;
+  float level, carvebuffer;
+  int mode, side, carve;
+  int range[6];
+  int n_block;
+  TetsurfCacheBlock *Block;
+};
+
+CTetsurfCache *TetsurfCacheNew(PyMOLGlobals * G)
+{
+  CTetsurfCache *I = Calloc(CTetsurfCache, 1);
+  if(I)
+    I->G = G;
+  return I;
+}
+
+static void TetsurfCacheClear(CTetsurfCache * I)
+{
+  int b;
+  if(I->Block) {
+    for(b = 0; b < I->n_block; b++) {
+      FreeP(I->Block[b].V);
+      FreeP(I->Block[b].N);
+    }
+    FreeP(I->Block);
+  }
+  I->n_block = 0;
+  I->valid = false;
+}
+
+void TetsurfCacheFree(CTetsurfCache * I)
+{
+  if(I) {
+    TetsurfCacheClear(I);
+    FreeP(I);
+  }
+}
+
+static ov_uint64 TetsurfHash(ov_uint64 h, const void *v, int n)
+{
+  const unsigned int *w = (const unsigned int *) v;
+  while(n--) {
+    h ^= *(w++);
+    h *= 1099511628211ULL;      /* FNV-1a */
+  }
+  return h;
+}
+
+/*
+ * Cache key of the current block: every map value the block reads
+ * (including the one voxel border used for gradients) plus the carve
+ * atoms which can reach its triangles. Atoms are summed, so the key does
+ * not depend on the order in which the voxel map lists them.
+ */
+static ov_uint64 TetsurfBlockKey(CTetsurf * I, MapType * voxelmap, float *a_vert,
+                                 float carvebuffer)
+{
+  ov_uint64 h = 14695981039346656037ULL;
+  float mn[3], mx[3];
+  int lo[3], hi[3];
+  int c, i, j, k;
+
+  for(c = 0; c < 3; c++) {
+    lo[c] = I->CurOff[c] - 1;
+    hi[c] = I->CurOff[c] + I->Max[c] + 1;
+    if(lo[c] < 0)
+      lo[c] = 0;
+    if(hi[c] > I->AbsDim[c])
+      hi[c] = I->AbsDim[c];
+    mn[c] = FLT_MAX;
+    mx[c] = -FLT_MAX;
+  }
+  for(i = lo[0]; i < hi[0]; i++)
+    for(j = lo[1]; j < hi[1]; j++)
+      for(k = lo[2]; k < hi[2]; k++) {
+        float *v = F4Ptr(I->Coord, i, j, k, 0);
+        h = TetsurfHash(h, F3Ptr(I->Data, i, j, k), 1);
+        h = TetsurfHash(h, v, 3);
+        for(c = 0; c < 3; c++) {
+          if(mn[c] > v[c])
+            mn[c] = v[c];
+          if(mx[c] < v[c])
+            mx[c] = v[c];
+        }
+      }
+
+  if(voxelmap) {
+    ov_uint64 carve = 0;
+    int a0, b0, c0, a1, b1, c1, a, b;
+    if(carvebuffer < 0.0F)
+      carvebuffer = -carvebuffer;
+    for(c = 0; c < 3; c++) {
+      mn[c] -= carvebuffer;
+      mx[c] += carvebuffer;
+    }
+    MapLocus(voxelmap, mn, &a0, &b0, &c0);
+    MapLocus(voxelmap, mx, &a1, &b1, &c1);
+    for(a = a0; a <= a1; a++)
+      for(b = b0; b <= b1; b++)
+        for(c = c0; c <= c1; c++) {
+          j = *(MapFirst(voxelmap, a, b, c));
+          while(j >= 0) {
+            float *v = a_vert + 3 * j;
+            if((v[0] >= mn[0]) && (v[0] <= mx[0]) &&
+               (v[1] >= mn[1]) && (v[1] <= mx[1]) &&
+               (v[2] >= mn[2]) && (v[2] <= mx[2])) {
+              carve += TetsurfHash(TetsurfHash(14695981039346656037ULL, &j, 1), v, 3);
+            }
+            j = MapNext(voxelmap, j);
+          }
+        }
+    h ^= carve * 1099511628211ULL;
+  }
+  return h;
+}
+
+
+/*
+ * Block decomposed contouring: the TetsurfSubSize blocks are dealt out
+ * round-robin to private CTetsurf instances, each appending to its own
+ * strip and vertex VLAs. Blocks are independent (every block starts from
+ * zeroed points and a fresh triangle list), so concatenating the
+ * per-block output in serial (i, j, k) order gives exactly the serial
+ * result. With a cache, unchanged blocks are copied instead.
+ */
+typedef struct {
+  int task;                     /* -1: taken from the cache, -2: empty */
+  int vert_start, n_vert;
+  int strip_start, n_strip;
+  int n_tri;
+  ov_uint64 key;
+} TetsurfBlockRec;
+
+typedef struct {
+  CTetsurf *Main;
+  CTetsurf **Task;
+  Isofield *Field;
+  int **Num;
+  float **Vert;
+  int *NVert, *NStrip;
+  TetsurfBlockRec *Block;
+  const int *range, *Steps;
+  int n_block, n_task, mode;
+  MapType *voxelmap;
+  float *a_vert;
+  float carvebuffer;
+  int side;
+  CTetsurfCache *cache;         /* NULL or valid for this request */
+} TetsurfBlockJob;
+
+static void TetsurfBlockTask(void *data, int t)
+{
+  TetsurfBlockJob *job = (TetsurfBlockJob *) data;
+  CTetsurf *M = job->Main;
+  CTetsurf *I = job->Task[t];
+  int ok = true;
+  int alloc = false;
+  int b, c;
+
+  I->Coord = M->Coord;
+  I->Grad = M->Grad;
+  I->Data = M->Data;
+  I->Level = M->Level;
+  I->Pyramid = M->Pyramid;
+  I->TotPrim = 0;
+  for(c = 0; c < 3; c++) {
+    I->AbsDim[c] = M->AbsDim[c];
+    I->CurDim[c] = M->CurDim[c];
+  }
+  for(b = t; ok && b < job->n_block; b += job->n_task) {
+    TetsurfBlockRec *rec = job->Block + b;
+    int i = b / (job->Steps[1] * job->Steps[2]);
+    int j = (b / job->Steps[2]) % job->Steps[1];
+    int k = b % job->Steps[2];
+    int tot_prim = I->TotPrim;
+    TetsurfSetBlock(I, job->range, i, j, k);
+    if(!TetsurfBlockMayContain(I)) {
+      rec->task = -2;
+      continue;
+    }
+    if(job->cache) {
+      TetsurfCacheBlock *cb = job->cache->Block + b;
+      /* only triangles (modes 2 and 3) are carved */
+      rec->key = TetsurfBlockKey(I, (job->mode < 2) ? NULL : job->voxelmap,
+                                 job->a_vert, job->carvebuffer);
+      if(cb->valid && (cb->key == rec->key)) {
+        rec->task = -1;
+        continue;
+      }
+    }
+    if(!alloc) {
+      ok = TetsurfAlloc(I);
+      alloc = true;
+    }
+    rec->task = t;
+    rec->vert_start = job->NVert[t];
+    rec->strip_start = job->NStrip[t];
+    if(ok && TetsurfCodeVertices(I))
+      job->NVert[t] = TetsurfFindActiveBoxes(I, job->mode, job->NStrip + t,
+                                             job->NVert[t], job->Num + t, job->Vert + t,
+                                             job->voxelmap, job->a_vert,
+                                             job->carvebuffer, job->side);
+    rec->n_vert = job->NVert[t] - rec->vert_start;
+    rec->n_strip = job->NStrip[t] - rec->strip_start;
+    rec->n_tri = I->TotPrim - tot_prim;
+  }
+  if(alloc)
+    TetsurfPurge(I);
+}
+
+static int TetsurfVolumeBlocks(CTetsurf * I, Isofield * field,
+                               const int *range, const int *Steps,
+                               int mode, int n_thread, int **num, float **vert,
+                               int *n_strip, int *n_vert,
+                               MapType * voxelmap, float *a_vert,
+                               float carvebuffer, int side, CTetsurfCache * cache)
+{
+  PyMOLGlobals *G = I->G;
+  TetsurfBlockJob job;
+  int ok = true;
+  int n_reused = 0;
+  int b, t;
+
+  job.Main = I;
+  job.Field = field;
+  job.range = range;
+  job.Steps = Steps;
+  job.mode = mode;
+  job.n_block = Steps[0] * Steps[1] * Steps[2];
+  job.n_task = n_thread;
+  job.voxelmap = voxelmap;
+  job.a_vert = a_vert;
+  job.carvebuffer = carvebuffer;
+  job.side = side;
+  job.cache = NULL;
+
+  if(cache) {
+    if(!(cache->valid &&
+         (cache->level == I->Level) && (cache->mode == mode) &&
+         (cache->side == side) && (cache->carve == (voxelmap != NULL)) &&
+         (cache->carvebuffer == carvebuffer) &&
+         (cache->n_block == job.n_block) &&
+         !memcmp(cache->range, range, sizeof(int) * 6))) {
+      TetsurfCacheClear(cache);
+      cache->Block = Calloc(TetsurfCacheBlock, job.n_block);
+      CHECKOK(ok, cache->Block);
+      if(ok) {
+        cache->level = I->Level;
+        cache->mode = mode;
+        cache->side = side;
+        cache->carve = (voxelmap != NULL);
+        cache->carvebuffer = carvebuffer;
+        cache->n_block = job.n_block;
+        memcpy(cache->range, range, sizeof(int) * 6);
+        cache->valid = true;
+      }
+    }
+    if(ok)
+      job.cache = cache;
+  }
+
+  job.Task = Calloc(CTetsurf *, n_thread);
+  job.Num = Calloc(int *, n_thread);
+  job.Vert = Calloc(float *, n_thread);
+  job.NVert = Calloc(int, n_thread);
+  job.NStrip = Calloc(int, n_thread);
+  job.Block = Calloc(TetsurfBlockRec, job.n_block);
+  CHECKOK(ok, job.Task);
+  CHECKOK(ok, job.Num);
+  CHECKOK(ok, job.Vert);
+  CHECKOK(ok, job.NVert);
+  CHECKOK(ok, job.NStrip);
+  CHECKOK(ok, job.Block);
+  for(t = 0; ok && t < n_thread; t++) {
+    job.Task[t] = TetsurfNew(G);
+    job.Num[t] = VLAlloc(int, 1000);
+    job.Vert[t] = VLAlloc(float, 10000);
+    CHECKOK(ok, job.Task[t]);
+    CHECKOK(ok, job.Num[t]);
+    CHECKOK(ok, job.Vert[t]);
+  }
+
+  if(ok)
+    ThreadPoolRun(G, n_thread, n_thread, TetsurfBlockTask, &job);
+
+  /* concatenate in serial block order */
+  I->TotPrim = 0;
+  for(b = 0; ok && b < job.n_block; b++) {
+    TetsurfBlockRec *rec = job.Block + b;
+    const float *v;
+    const int *n;
+    int nv, ns;
+    if(rec->task == -2) {
+      if(job.cache) {
+        TetsurfCacheBlock *cb = cache->Block + b;
+        FreeP(cb->V);
+        FreeP(cb->N);
+        cb->valid = false;
+      }
+      continue;
+    } else if(rec->task < 0) {
+      TetsurfCacheBlock *cb = cache->Block + b;
+      v = cb->V;
+      n = cb->N;
+      nv = cb->n_vert;
+      ns = cb->n_strip;
+      I->TotPrim += cb->n_tri;
+      n_reused++;
+    } else {
+      v = job.Vert[rec->task] + rec->vert_start * 3;
+      n = job.Num[rec->task] + rec->strip_start;
+      nv = rec->n_vert;
+      ns = rec->n_strip;
+      I->TotPrim += rec->n_tri;
+    }
+    if(nv) {
+      VLACheck(*vert, float, (*n_vert + nv) * 3);
+      CHECKOK(ok, *vert);
+      if(ok)
+        memcpy(*vert + *n_vert * 3, v, sizeof(float) * 3 * nv);
+      *n_vert += nv;
+    }
+    if(ok && ns) {
+      VLACheck(*num, int, *n_strip + ns);
+      CHECKOK(ok, *num);
+      if(ok)
+        memcpy(*num + *n_strip, n, sizeof(int) * ns);
+      *n_strip += ns;
+    }
+    if(ok && job.cache && (rec->task >= 0)) {
+      TetsurfCacheBlock *cb = cache->Block + b;
+      FreeP(cb->V);
+      FreeP(cb->N);
+      cb->valid = false;
+      if(nv)
+        cb->V = Alloc(float, nv * 3);
+      if(ns)
+        cb->N = Alloc(int, ns);
+      if((!nv || cb->V) && (!ns || cb->N)) {
+        if(nv)
+          memcpy(cb->V, v, sizeof(float) * 3 * nv);
+        if(ns)
+          memcpy(cb->N, n, sizeof(int) * ns);
+        cb->n_vert = nv;
+        cb->n_strip = ns;
+        cb->n_tri = rec->n_tri;
+        cb->key = rec->key;
+        cb->valid = true;
+      }
+    }
+  }
+  if(!ok && cache)
+    TetsurfCacheClear(cache);
+
+  PRINTFB(G, FB_Isosurface, FB_Blather)
+    " TetsurfVolume: %d blocks on %d threads, %d reused.\n",
+    job.n_block, n_thread, n_reused ENDFB(G);
+
+  if(job.Task) {
+    for(t = 0; t < n_thread; t++) {
+      if(job.Task[t])
+        _TetsurfFree(job.Task[t]);
+      VLAFreeP(job.Num[t]);
+      VLAFreeP(job.Vert[t]);
+    }
+  }
+  FreeP(job.Task);
+  FreeP(job.Num);
+  FreeP(job.Vert);
+  FreeP(job.NVert);
+  FreeP(job.NStrip);
+  FreeP(job.Block);
+  return ok;
+}
+
+
 /*===========================================================================*/
 int TetsurfVolume(PyMOLGlobals * G, Isofield * field, float level, int **num,
                   float **vert, int *range, int mode, MapType * voxelmap, float *a_vert,
-                  float carvebuffer, int side)
+                  float carvebuffer, int side, CTetsurfCache * cache)
 {
 
   CTetsurf *I;
@@ -539,6 +979,7 @@ int TetsurfVolume(PyMOLGlobals * G, Isofield * field, float level, int **num,
     int ok = true;
     int Steps[3];
     int c, i, j, k;
+    int n_thread;
     int range_store[6];
     int n_strip = 0;
     int n_vert = 0;
@@ -575,36 +1016,41 @@ int TetsurfVolume(PyMOLGlobals * G, Isofield * field, float level, int **num,
     I->Grad = field->gradients;
     I->Data = field->data;
     I->Level = level;
-    if(ok)
-      ok = TetsurfAlloc(I);
 
-    if(ok) {
-
-      for(i = 0; i < Steps[0]; i++)
-        for(j = 0; j < Steps[1]; j++)
-          for(k = 0; k < Steps[2]; k++) {
-            I->CurOff[0] = TetsurfSubSize * i;
-            I->CurOff[1] = TetsurfSubSize * j;
-            I->CurOff[2] = TetsurfSubSize * k;
-            for(c = 0; c < 3; c++)
-              I->CurOff[c] += range[c];
-            for(c = 0; c < 3; c++) {
-              I->Max[c] = (range[3 + c] - I->CurOff[c]);
-              if(I->Max[c] > (TetsurfSubSize + 1))
-                I->Max[c] = (TetsurfSubSize + 1);
-            }
-            /*         
-               for(c=0;c<3;c++)
-               printf(" TetsurfVolume: c: %i I->CurOff[c]: %i I->Max[c] %i\n",c,I->CurOff[c],I->Max[c]); 
-             */
-
-            if(ok) {
-              if(TetsurfCodeVertices(I))
-                n_vert = TetsurfFindActiveBoxes(I, mode, &n_strip, n_vert, num, vert,
-                                                voxelmap, a_vert, carvebuffer, side);
+    /* resolve the min/max pyramid here, tasks must not build it */
+    I->Pyramid = IsofieldGetPyramid(G, field);
+    n_thread = TetsurfGetNThread(G, Steps[0] * Steps[1] * Steps[2]);
+    if(cache || (n_thread > 1)) {
+      if(!TetsurfVolumeBlocks(I, field, range, Steps, mode, n_thread, num, vert,
+                              &n_strip, &n_vert, voxelmap, a_vert, carvebuffer,
+                              side, cache)) {
+        n_strip = 0;
+        n_vert = 0;
+        I->TotPrim = 0;
+      }
+    } else {
+      if(ok)
+        ok = TetsurfAlloc(I);
+
+      if(ok) {
+
+        for(i = 0; i < Steps[0]; i++)
+          for(j = 0; j < Steps[1]; j++)
+            for(k = 0; k < Steps[2]; k++) {
+              TetsurfSetBlock(I, range, i, j, k);
+              /*         
+                 for(c=0;c<3;c++)
+                 printf(" TetsurfVolume: c: %i I->CurOff[c]: %i I->Max[c] %i\n",c,I->CurOff[c],I->Max[c]); 
+               */
+
+              if(ok && TetsurfBlockMayContain(I)) {
+                if(TetsurfCodeVertices(I))
+                  n_vert = TetsurfFindActiveBoxes(I, mode, &n_strip, n_vert, num, vert,
+                                                  voxelmap, a_vert, carvebuffer, side);
+              }
             }
-          }
-      TetsurfPurge(I);
+        TetsurfPurge(I);
+      }
     }
 
     if(Feedback(G, FB_Isosurface, FB_Blather)) {
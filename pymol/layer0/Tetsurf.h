@@ -30,9 +30,22 @@ Z* -------------------------------------------------------------------
 #define F4(field,P1,P2,P3,P4) Ffloat4(field,P1,P2,P3,P4)
 #define F4Ptr(field,P1,P2,P3,P4) Ffloat4p(field,P1,P2,P3,P4)
 
+/*
+ * Per-caller memory of the last TetsurfVolume result, kept block by block.
+ * When the same surface is requested again (same level, mode, side and
+ * range), sub-blocks whose map data and nearby carve atoms are unchanged
+ * are copied from the cache instead of being re-triangulated.
+ */
+typedef struct _CTetsurfCache CTetsurfCache;
+
+CTetsurfCache *TetsurfCacheNew(PyMOLGlobals * G);
+void TetsurfCacheFree(CTetsurfCache * cache);
+
+/* cache may be NULL */
 int TetsurfVolume(PyMOLGlobals * G, Isofield * field, float level, int **num,
                   float **vert, int *range, int mode,
-                  MapType * voxelmap, float *a_vert, float carvebuffer, int side);
+                  MapType * voxelmap, float *a_vert, float carvebuffer, int side,
+                  CTetsurfCache * cache);
 void TetsurfGetRange(PyMOLGlobals * G, Isofield * field, CCrystal * cryst, float *mn,
                      float *mx, int *range);
 
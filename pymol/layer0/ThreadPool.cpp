@@ -0,0 +1,205 @@
+/*
+ * Persistent worker thread pool
+ *
+ * (c) Schrodinger, Inc.
+ */
+
+#include "os_predef.h"
+
+#include "ThreadPool.h"
+#include "Base.h"
+
+#ifndef _PYMOL_NO_CXX11
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct _CThreadPool {
+  std::vector<std::thread> workers;
+
+  // serializes concurrent ThreadPoolRun callers
+  std::mutex run_mutex;
+
+  // guards everything below
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+
+  // current job
+  ThreadPoolTaskFn *fn;
+  void *data;
+  int n_task;
+  int n_participant;            // workers with id < n_participant take part
+  int n_busy;                   // participating workers not finished yet
+  unsigned generation;
+  bool quit;
+
+  std::atomic<int> next_task;
+
+  _CThreadPool() : fn(NULL), data(NULL), n_task(0), n_participant(0),
+    n_busy(0), generation(0), quit(false), next_task(0) {}
+};
+
+// set in pool workers and in the caller while a job is running
+static thread_local bool t_in_pool = false;
+
+// set in pool workers only
+static thread_local bool t_worker = false;
+
+static void ThreadPoolDrain(CThreadPool * I)
+{
+  int i;
+  while((i = I->next_task.fetch_add(1)) < I->n_task)
+    I->fn(I->data, i);
+}
+
+static void ThreadPoolWorker(CThreadPool * I, int id, unsigned seen)
+{
+  t_in_pool = true;
+  t_worker = true;
+
+  for(;;) {
+    {
+      std::unique_lock<std::mutex> lock(I->mutex);
+      while(!I->quit && I->generation == seen)
+        I->wake.wait(lock);
+      if(I->quit)
+        return;
+      seen = I->generation;
+      if(id >= I->n_participant)
+        continue;
+    }
+
+    ThreadPoolDrain(I);
+
+    {
+      std::lock_guard<std::mutex> lock(I->mutex);
+      if(!--I->n_busy)
+        I->done.notify_all();
+    }
+  }
+}
+
+int ThreadPoolInit(PyMOLGlobals * G)
+{
+  G->ThreadPool = new CThreadPool();
+  return (G->ThreadPool != NULL);
+}
+
+void ThreadPoolFree(PyMOLGlobals * G)
+{
+  CThreadPool *I = G->ThreadPool;
+  if(!I)
+    return;
+  {
+    std::lock_guard<std::mutex> lock(I->mutex);
+    I->quit = true;
+  }
+  I->wake.notify_all();
+  for(auto & worker : I->workers)
+    worker.join();
+  delete I;
+  G->ThreadPool = NULL;
+}
+
+int ThreadPoolRun(PyMOLGlobals * G, int n_thread, int n_task,
+                  ThreadPoolTaskFn * fn, void *data)
+{
+  CThreadPool *I = G->ThreadPool;
+  int a;
+
+  if(n_thread > n_task)
+    n_thread = n_task;
+  if(n_thread > PYMOL_MAX_THREADS)
+    n_thread = PYMOL_MAX_THREADS;
+
+  if(!I || t_in_pool || n_thread < 2) {
+    for(a = 0; a < n_task; a++)
+      fn(data, a);
+    return 1;
+  }
+
+  std::lock_guard<std::mutex> run_lock(I->run_mutex);
+
+  {
+    std::lock_guard<std::mutex> lock(I->mutex);
+
+    // grow the pool on demand (calling thread counts as one)
+    while(I->workers.size() < (size_t) (n_thread - 1)) {
+      I->workers.push_back(std::thread(ThreadPoolWorker, I,
+            (int) I->workers.size(), I->generation));
+    }
+
+    I->fn = fn;
+    I->data = data;
+    I->n_task = n_task;
+    I->n_participant = n_thread - 1;
+    I->n_busy = n_thread - 1;
+    I->next_task = 1;           // task 0 is reserved for the caller
+    I->generation++;
+  }
+  I->wake.notify_all();
+
+  t_in_pool = true;
+  fn(data, 0);
+  ThreadPoolDrain(I);
+  t_in_pool = false;
+
+  {
+    std::unique_lock<std::mutex> lock(I->mutex);
+    while(I->n_busy)
+      I->done.wait(lock);
+    I->fn = NULL;
+    I->data = NULL;
+  }
+
+  return n_thread;
+}
+
+bool ThreadPoolIsNative()
+{
+  return true;
+}
+
+bool ThreadPoolIsWorker()
+{
+  return t_worker;
+}
+
+#else
+
+/* no C++11 threads: run everything on the calling thread */
+
+int ThreadPoolInit(PyMOLGlobals * G)
+{
+  G->ThreadPool = NULL;
+  return true;
+}
+
+void ThreadPoolFree(PyMOLGlobals * G)
+{
+}
+
+int ThreadPoolRun(PyMOLGlobals * G, int n_thread, int n_task,
+                  ThreadPoolTaskFn * fn, void *data)
+{
+  int a;
+  for(a = 0; a < n_task; a++)
+    fn(data, a);
+  return 1;
+}
+
+bool ThreadPoolIsNative()
+{
+  return false;
+}
+
+bool ThreadPoolIsWorker()
+{
+  return false;
+}
+
+#endif
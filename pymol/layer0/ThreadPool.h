@@ -0,0 +1,50 @@
+/*
+ * Persistent worker thread pool
+ *
+ * (c) Schrodinger, Inc.
+ */
+
+#ifndef _H_ThreadPool
+#define _H_ThreadPool
+
+#include "PyMOLGlobals.h"
+
+/*
+ * Task callback: `data` is the pointer passed to ThreadPoolRun, `index`
+ * the task number in [0, n_task).
+ */
+typedef void ThreadPoolTaskFn(void *data, int index);
+
+int ThreadPoolInit(PyMOLGlobals * G);
+void ThreadPoolFree(PyMOLGlobals * G);
+
+/*
+ * Runs fn(data, i) for all i in [0, n_task) on up to `n_thread` threads
+ * and returns when all tasks are complete.
+ *
+ * The calling thread participates and always executes task 0 itself, so
+ * code which must stay on the main thread (e.g. progress updates) can be
+ * placed there. Tasks must not call into Ortho or Python directly; shared
+ * helpers that print feedback are safe, their output from workers is
+ * discarded (see ThreadPoolIsWorker). Workers are started on demand and kept alive until
+ * ThreadPoolFree. Nested calls from inside a task run serially.
+ *
+ * Returns the number of threads which were used.
+ */
+int ThreadPoolRun(PyMOLGlobals * G, int n_thread, int n_task,
+                  ThreadPoolTaskFn * fn, void *data);
+
+/*
+ * True if the pool runs tasks on native threads (false for builds
+ * without C++11 support, where ThreadPoolRun executes serially)
+ */
+bool ThreadPoolIsNative();
+
+/*
+ * True on pool worker threads (false on the thread which called
+ * ThreadPoolRun, including while it executes tasks). Feedback output and
+ * progress updates touch Ortho and Python state and are dropped there.
+ */
+bool ThreadPoolIsWorker();
+
+#endif
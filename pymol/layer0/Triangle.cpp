@@ -40,6 +40,7 @@ Z* -------------------------------------------------------------------
 #include"Ortho.h"
 #include"Feedback.h"
 #include"Util.h"
+#include"ThreadPool.h"
 
 typedef struct {
   int index;
@@ -1608,25 +1609,144 @@ static int FollowActives(TriangleSurfaceRec * II, float *v, float *vn, int n, in
   return ok;
 }
 
+/* seed searches over fewer vertices than this run serially */
+#define cTriangleParallelMin 20000
+
+/*
+ * Finds the shortest open edge between vertices a_start..a_stop-1 and
+ * their neighbors which can seed a new patch of triangles. Updates
+ * *minDist2, *i1, *i2 and *first_vert only on strict improvement, so the
+ * first best candidate in vertex order wins.
+ */
+static void TriangleFindSeed(TriangleSurfaceRec * I, float *v, float *vn,
+                             int a_start, int a_stop, float *minDist2,
+                             int *i1, int *i2, int *first_vert_used)
+{
+  MapType *map = I->map;
+  int a, i, j, h, k, l, first_vert;
+  float *v0, *n0, *n1;
+
+  for(a = a_start; a < a_stop; a++) {
+    if(!I->edgeStatus[a]) {
+      v0 = v + a * 3;
+      n0 = vn + 3 * a;
+
+      MapLocus(map, v0, &h, &k, &l);
+      i = *(MapEStart(map, h, k, l));
+      if(i) {
+        j = map->EList[i++];
+        first_vert = j;
+        while(j >= 0) {
+          if(j != a) {
+            float dif2 = diffsq3f(v + 3 * j, v0);
+            if(dif2 < *minDist2)
+              if(I->vertActive[a] == -1)
+                if(TriangleEdgeStatus(I, a, j) >= 0) {  /* can we put a triangle here? */
+                  n1 = vn + 3 * j;
+                  if(dot_product3f(n0, n1) > 0.5) {     /* start with vertices pointing the same way */
+                    *minDist2 = dif2;
+                    *i1 = a;
+                    *i2 = j;
+                    *first_vert_used = first_vert;
+                  }
+                }
+          }
+          j = map->EList[i++];
+        }
+      }
+    }
+  }
+}
+
+typedef struct {
+  TriangleSurfaceRec *I;
+  float *v, *vn;
+  int n, n_task;
+  float *minDist2;              /* per task */
+  int *i1, *i2, *first_vert;    /* per task */
+} TriangleSeedJob;
+
+static void TriangleSeedTask(void *data, int t)
+{
+  TriangleSeedJob *job = (TriangleSeedJob *) data;
+  int a_start = (int) (((size_t) job->n * t) / job->n_task);
+  int a_stop = (int) (((size_t) job->n * (t + 1)) / job->n_task);
+  TriangleFindSeed(job->I, job->v, job->vn, a_start, a_stop, job->minDist2 + t,
+                   job->i1 + t, job->i2 + t, job->first_vert + t);
+}
+
+/*
+ * TriangleFindSeed over all vertices, split across threads for large
+ * surfaces. Reducing the per-range results in range order gives the
+ * same seed as the serial scan.
+ */
+static void TriangleSeed(TriangleSurfaceRec * I, float *v, float *vn, int n,
+                         float *minDist2, int *i1, int *i2, int *first_vert_used)
+{
+  PyMOLGlobals *G = I->G;
+  int n_thread = 1;
+  TriangleSeedJob job;
+  int t;
+
+  if((n >= cTriangleParallelMin) && ThreadPoolIsNative()) {
+    n_thread = SettingGetGlobal_i(G, cSetting_max_threads);
+    if(n_thread > PYMOL_MAX_THREADS)
+      n_thread = PYMOL_MAX_THREADS;
+  }
+  if(n_thread < 2) {
+    TriangleFindSeed(I, v, vn, 0, n, minDist2, i1, i2, first_vert_used);
+    return;
+  }
+
+  job.I = I;
+  job.v = v;
+  job.vn = vn;
+  job.n = n;
+  job.n_task = n_thread;
+  job.minDist2 = Alloc(float, n_thread);
+  job.i1 = Alloc(int, 3 * n_thread);
+  if(!(job.minDist2 && job.i1)) {
+    FreeP(job.minDist2);
+    FreeP(job.i1);
+    TriangleFindSeed(I, v, vn, 0, n, minDist2, i1, i2, first_vert_used);
+    return;
+  }
+  job.i2 = job.i1 + n_thread;
+  job.first_vert = job.i2 + n_thread;
+  for(t = 0; t < n_thread; t++) {
+    job.minDist2[t] = *minDist2;
+    job.i1[t] = -1;
+  }
+  ThreadPoolRun(G, n_thread, n_thread, TriangleSeedTask, &job);
+  for(t = 0; t < n_thread; t++) {
+    if((job.i1[t] >= 0) && (job.minDist2[t] < *minDist2)) {
+      *minDist2 = job.minDist2[t];
+      *i1 = job.i1[t];
+      *i2 = job.i2[t];
+      *first_vert_used = job.first_vert[t];
+    }
+  }
+  FreeP(job.minDist2);
+  FreeP(job.i1);
+}
+
 static int TriangleFill(TriangleSurfaceRec * II, float *v, float *vn, int n,
                         int first_time)
 {
   TriangleSurfaceRec *I = II;
   int ok = true;
   int lastTri, lastTri2, lastTri3;
-  int a, i, j, h, k, l;
-  float minDist2, *v0, *n0, *n1;
+  int a;
+  float minDist2;
   int i1, i2 = 0;
   int n_pass = 0;
-  int first_vert = 0, first_vert_used = 0;
+  int first_vert_used = 0;
 
-  MapType *map;
   MapCache *cache;
 
   PRINTFD(I->G, FB_Triangle)
     " TriangleFill-Debug: entered: n=%d\n", n ENDFD;
 
-  map = I->map;
   cache = &I->map_cache;
 
   lastTri3 = -1;
@@ -1640,37 +1760,7 @@ static int TriangleFill(TriangleSurfaceRec * II, float *v, float *vn, int n,
     while(ok && (!I->nActive) && (I->nTri == lastTri3)) {
       i1 = -1;
       minDist2 = I->maxEdgeLenSq;
-
-      for(a = 0; a < n; a++) {
-        if(!I->edgeStatus[a]) {
-          v0 = v + a * 3;
-          n0 = vn + 3 * a;
-
-          MapLocus(map, v0, &h, &k, &l);
-          i = *(MapEStart(map, h, k, l));
-          if(i) {
-            j = map->EList[i++];
-            first_vert = j;
-            while(j >= 0) {
-              if(j != a) {
-                float dif2 = diffsq3f(v + 3 * j, v0);
-                if(dif2 < minDist2)
-                  if(I->vertActive[a] == -1)
-                    if(TriangleEdgeStatus(I, a, j) >= 0) {      /* can we put a triangle here? */
-                      n1 = vn + 3 * j;
-                      if(dot_product3f(n0, n1) > 0.5) { /* start with vertices pointing the same way */
-                        minDist2 = dif2;
-                        i1 = a;
-                        i2 = j;
-                        first_vert_used = first_vert;
-                      }
-                    }
-              }
-              j = map->EList[i++];
-            }
-          }
-        }
-      }
+      TriangleSeed(I, v, vn, n, &minDist2, &i1, &i2, &first_vert_used);
       if(i1 >= 0) {
 
         if(!MapCached(cache, first_vert_used)) {
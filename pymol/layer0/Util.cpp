@@ -66,6 +66,59 @@ int UtilCountStringVLA(char *vla)
   return(result);
 }
 
+/*
+ * IEEE half float conversion (round to nearest even)
+ */
+unsigned short UtilFloatToHalf(float f)
+{
+  unsigned int x, sign, exp, mant, h, rem;
+  int e;
+  memcpy(&x, &f, sizeof(x));
+  sign = (x >> 16) & 0x8000;
+  exp = (x >> 23) & 0xFF;
+  mant = x & 0x7FFFFF;
+  if(exp == 0xFF)               /* inf, nan */
+    return sign | 0x7C00 | (mant ? 0x200 : 0);
+  e = (int) exp - 127 + 15;
+  if(e >= 0x1F)                 /* overflow */
+    return sign | 0x7C00;
+  if(e <= 0) {                  /* subnormal or zero */
+    unsigned int shift = 14 - e;
+    if(shift > 24)
+      return sign;
+    mant |= 0x800000;
+    h = mant >> shift;
+    rem = mant & ((1U << shift) - 1);
+    if((rem > (1U << (shift - 1))) || ((rem == (1U << (shift - 1))) && (h & 1)))
+      h++;
+    return sign | h;
+  }
+  h = (e << 10) | (mant >> 13);
+  rem = mant & 0x1FFF;
+  if((rem > 0x1000) || ((rem == 0x1000) && (h & 1)))
+    h++;                        /* may carry into the exponent, which is correct */
+  return sign | h;
+}
+
+float UtilHalfToFloat(unsigned short h)
+{
+  unsigned int sign = (h & 0x8000) << 16;
+  unsigned int exp = (h >> 10) & 0x1F;
+  unsigned int mant = h & 0x3FF;
+  unsigned int x;
+  float f;
+  if(exp == 0x1F) {
+    x = sign | 0x7F800000 | (mant << 13);
+  } else if(exp) {
+    x = sign | ((exp + 112) << 23) | (mant << 13);
+  } else {
+    f = mant * (1.0F / 16777216.0F);    /* subnormal: mant * 2^-24 */
+    return sign ? -f : f;
+  }
+  memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
 double UtilGetSeconds(PyMOLGlobals *G)
 {
 #ifndef _WIN32
@@ -59,4 +59,8 @@ void UtilSortIndexGlobals(PyMOLGlobals * G, int n, void *array, int *x,
 
 int UtilShouldWePrintQuantity(int quantity);
 
+/* IEEE half float conversion (round to nearest even) */
+unsigned short UtilFloatToHalf(float f);
+float UtilHalfToFloat(unsigned short h);
+
 #endif
@@ -23,6 +23,7 @@ Z* -------------------------------------------------------------------
 #include"MemoryDebug.h"
 #include"Base.h"
 #include"Basis.h"
+#include"BasisPacket.h"
 #include"Err.h"
 #include"Feedback.h"
 #include"Util.h"
@@ -1413,7 +1414,8 @@ void BasisGetTriangleFlatDotglePerspective(CBasis * I, RayInfo * r, int i)
 
 
 /*========================================================================*/
-void BasisGetEllipsoidNormal(CBasis * I, RayInfo * r, int i, int perspective)
+void BasisGetEllipsoidNormal(CBasis * I, RayInfo * r, int i, int perspective,
+                             const float *geom)
 {
   if(perspective) {
     r->impact[0] = r->base[0] + r->dir[0] * r->dist;
@@ -1428,7 +1430,7 @@ void BasisGetEllipsoidNormal(CBasis * I, RayInfo * r, int i, int perspective)
   {
     float *n1 = I->Normal + (3 * I->Vert2Normal[i]);
     float *n2 = n1 + 3, *n3 = n1 + 6;
-    float *scale = r->prim->n0;
+    const float *scale = geom + r->prim->geom + cPrimGeomN0;
     float d1, d2, d3, s1, s2, s3;
     float comp1[3], comp2[3], comp3[3];
     float direct[3], surfnormal[3];
@@ -1471,11 +1473,16 @@ void BasisGetEllipsoidNormal(CBasis * I, RayInfo * r, int i, int perspective)
   }
 }
 
-void BasisGetTriangleNormal(CBasis * I, RayInfo * r, int i, float *fc, int perspective)
+void BasisGetTriangleNormal(CBasis * I, RayInfo * r, int i, float *fc, int perspective,
+                            const float *palette)
 {
   float *n0, w2, fc0, fc1, fc2;
   float vt1[3];
   CPrimitive *lprim = r->prim;
+  const float *c1 = palette + 3 * lprim->c1;
+  const float *c2 = palette + 3 * lprim->c2;
+  const float *c3 = palette + 3 * lprim->c3;
+  const float *tr = palette + 3 * lprim->tr;
 
   if(perspective) {
     r->impact[0] = r->base[0] + r->dir[0] * r->dist;
@@ -1491,11 +1498,11 @@ void BasisGetTriangleNormal(CBasis * I, RayInfo * r, int i, float *fc, int persp
   w2 = 1.0F - (r->tri1 + r->tri2);
   /*  printf("%8.3f %8.3f\n",r->tri[1],r->tri[2]); */
 
-  fc0 = (lprim->c2[0] * r->tri1) + (lprim->c3[0] * r->tri2) + (lprim->c1[0] * w2);
-  fc1 = (lprim->c2[1] * r->tri1) + (lprim->c3[1] * r->tri2) + (lprim->c1[1] * w2);
-  fc2 = (lprim->c2[2] * r->tri1) + (lprim->c3[2] * r->tri2) + (lprim->c1[2] * w2);
+  fc0 = (c2[0] * r->tri1) + (c3[0] * r->tri2) + (c1[0] * w2);
+  fc1 = (c2[1] * r->tri1) + (c3[1] * r->tri2) + (c1[1] * w2);
+  fc2 = (c2[2] * r->tri1) + (c3[2] * r->tri2) + (c1[2] * w2);
 
-  r->trans = (lprim->tr[1] * r->tri1) + (lprim->tr[2] * r->tri2) + (lprim->tr[0] * w2);
+  r->trans = (tr[1] * r->tri1) + (tr[2] * r->tri2) + (tr[0] * w2);
 
   scale3f(n0 + 3, r->tri1, r->surfnormal);
   scale3f(n0 + 6, r->tri2, vt1);
@@ -1512,6 +1519,511 @@ void BasisGetTriangleNormal(CBasis * I, RayInfo * r, int i, float *fc, int persp
 }
 
 
+/*========================================================================*/
+/* Bounding volume hierarchy (ray_bvh)
+ *
+ * An alternative to the uniform voxel map which copes better with scenes
+ * where primitive sizes vary a lot (large surface triangles next to small
+ * label quads) or which span a lot of empty space. Built top-down with a
+ * binned surface area heuristic over the primitive bounding boxes and
+ * stored as a flat depth-first node array. Leaves reference -1 terminated
+ * vertex lists so the intersection loops can consume them exactly like
+ * map voxel lists.
+ *
+ * Images are not pixel-identical to the voxel map: primitives are tested
+ * in a different order, so where two of them are hit at the same distance
+ * (shared triangle edges, touching caps) the other one may win. Expect a
+ * few differing pixels along such edges.
+ */
+
+#define cBVHBins 16
+#define cBVHLeafSize 4          /* always make a leaf at or below this count */
+#define cBVHMaxLeafSize 16      /* never make a leaf above this count (unless too deep) */
+#define cBVHMaxDepth 48
+#define cBVHStack (cBVHMaxDepth + 2)
+#define cBVHRefitLimit 1.5F     /* rebuild once refitting costs this much more */
+
+typedef struct {
+  float min[3], max[3];
+  float cent[3];
+  int vert;
+} BVHRef;
+
+typedef struct {
+  BasisBVH *bvh;
+  BVHRef *ref;
+} BVHBuilder;
+
+static float BVHArea(const float *mn, const float *mx)
+{
+  float dx = mx[0] - mn[0], dy = mx[1] - mn[1], dz = mx[2] - mn[2];
+  return dx * dy + dy * dz + dz * dx;
+}
+
+static void BVHGrow(float *mn, float *mx, const float *bmin, const float *bmax)
+{
+  int d;
+  for(d = 0; d < 3; d++) {
+    if(mn[d] > bmin[d])
+      mn[d] = bmin[d];
+    if(mx[d] < bmax[d])
+      mx[d] = bmax[d];
+  }
+}
+
+static void BVHEmpty(float *mn, float *mx)
+{
+  mn[0] = mn[1] = mn[2] = MAXFLOAT;
+  mx[0] = mx[1] = mx[2] = -MAXFLOAT;
+}
+
+static int BVHBuildNode(BVHBuilder * B, int start, int end, int depth)
+{
+  BasisBVH *bvh = B->bvh;
+  BVHRef *ref = B->ref;
+  int index = bvh->NNode++;
+  BasisBVHNode *node = bvh->Node + index;
+  int n = end - start;
+  int a, d;
+  int best_axis = -1, best_split = 0;
+  float cmin[3], cmax[3];
+
+  BVHEmpty(node->min, node->max);
+  BVHEmpty(cmin, cmax);
+  for(a = start; a < end; a++) {
+    BVHGrow(node->min, node->max, ref[a].min, ref[a].max);
+    BVHGrow(cmin, cmax, ref[a].cent, ref[a].cent);
+  }
+
+  if(bvh->Depth < depth)
+    bvh->Depth = depth;
+
+  if((n > cBVHLeafSize) && (depth < cBVHMaxDepth)) {
+    /* binned SAH: find the cheapest split plane among cBVHBins per axis */
+    float best_cost = MAXFLOAT;
+    float node_area = BVHArea(node->min, node->max);
+
+    for(d = 0; d < 3; d++) {
+      int count[cBVHBins], b;
+      float bmin[cBVHBins][3], bmax[cBVHBins][3];
+      float rmin[3], rmax[3];
+      float right_area[cBVHBins];
+      int right_count[cBVHBins];
+      float extent = cmax[d] - cmin[d];
+      float scale;
+
+      if(extent < R_SMALL8)
+        continue;
+      scale = cBVHBins / extent;
+
+      for(b = 0; b < cBVHBins; b++) {
+        count[b] = 0;
+        BVHEmpty(bmin[b], bmax[b]);
+      }
+      for(a = start; a < end; a++) {
+        b = (int) ((ref[a].cent[d] - cmin[d]) * scale);
+        if(b >= cBVHBins)
+          b = cBVHBins - 1;
+        count[b]++;
+        BVHGrow(bmin[b], bmax[b], ref[a].min, ref[a].max);
+      }
+
+      /* sweep from the right, then evaluate while sweeping from the left */
+      BVHEmpty(rmin, rmax);
+      right_count[0] = 0;
+      right_area[0] = 0.0F;
+      {
+        int rc = 0;
+        for(b = cBVHBins - 1; b > 0; b--) {
+          rc += count[b];
+          if(count[b])
+            BVHGrow(rmin, rmax, bmin[b], bmax[b]);
+          right_count[b] = rc;
+          right_area[b] = rc ? BVHArea(rmin, rmax) : 0.0F;
+        }
+      }
+      {
+        float lmin[3], lmax[3];
+        int lc = 0;
+        BVHEmpty(lmin, lmax);
+        for(b = 0; b < cBVHBins - 1; b++) {
+          float cost;
+          lc += count[b];
+          if(count[b])
+            BVHGrow(lmin, lmax, bmin[b], bmax[b]);
+          if(!lc || !right_count[b + 1])
+            continue;
+          cost = lc * BVHArea(lmin, lmax) + right_count[b + 1] * right_area[b + 1];
+          if(cost < best_cost) {
+            best_cost = cost;
+            best_axis = d;
+            best_split = b;
+          }
+        }
+      }
+    }
+
+    /* an inner node visit costs about as much as one primitive test */
+    if((best_axis >= 0) && (n <= cBVHMaxLeafSize) && (node_area > R_SMALL8) &&
+       ((1.0F + best_cost / node_area) >= n)) {
+      best_axis = -1;
+    }
+
+    if(best_axis < 0 && n > cBVHMaxLeafSize) {
+      /* coincident centroids: split by count along the longest axis */
+      best_axis = 0;
+      for(d = 1; d < 3; d++)
+        if((node->max[d] - node->min[d]) > (node->max[best_axis] - node->min[best_axis]))
+          best_axis = d;
+      best_split = -1;
+    }
+  }
+
+  if(best_axis < 0) {
+    int *item = bvh->Item + bvh->NItem;
+    node->axis = -1;
+    node->offset = bvh->NItem;
+    for(a = start; a < end; a++)
+      *(item++) = ref[a].vert;
+    *(item++) = -1;
+    bvh->NItem += n + 1;
+  } else {
+    int mid;
+    if(best_split < 0) {
+      mid = start + n / 2;
+    } else {
+      /* partition in place around the chosen bin boundary */
+      float scale = cBVHBins / (cmax[best_axis] - cmin[best_axis]);
+      int lo = start, hi = end - 1;
+      while(lo <= hi) {
+        int b = (int) ((ref[lo].cent[best_axis] - cmin[best_axis]) * scale);
+        if(b >= cBVHBins)
+          b = cBVHBins - 1;
+        if(b <= best_split) {
+          lo++;
+        } else {
+          BVHRef tmp = ref[lo];
+          ref[lo] = ref[hi];
+          ref[hi--] = tmp;
+        }
+      }
+      mid = lo;
+      if((mid == start) || (mid == end))
+        mid = start + n / 2;
+    }
+    node->axis = best_axis;
+    BVHBuildNode(B, start, mid, depth + 1);
+    node->offset = BVHBuildNode(B, mid, end, depth + 1);
+  }
+  return index;
+}
+
+/*
+ * Bounding box of one primitive, padded for the intersection tolerances.
+ * Returns false for primitive types the BVH doesn't handle.
+ */
+static int BVHPrimBounds(const CBasis * I, const CPrimitive * prm, float *mn, float *mx)
+{
+  const float *v = I->Vertex + prm->vert * 3;
+  float r = 0.0F, pad = kR_SMALL4;
+  int d;
+
+  copy3f(v, mn);
+  copy3f(v, mx);
+
+  switch (prm->type) {
+  case cPrimTriangle:
+  case cPrimCharacter:
+    BVHGrow(mn, mx, v + 3, v + 3);
+    BVHGrow(mn, mx, v + 6, v + 6);
+    /* allow for ray_triangle_fudge on the barycentric bounds */
+    pad += 0.001F * (mx[0] - mn[0] + mx[1] - mn[1] + mx[2] - mn[2]);
+    break;
+  case cPrimSphere:
+  case cPrimEllipsoid:
+    r = I->Radius[prm->vert];
+    break;
+  case cPrimCone:
+  case cPrimCylinder:
+  case cPrimSausage:
+    {
+      float end[3];
+      const float *n0 = I->Normal + I->Vert2Normal[prm->vert] * 3;
+      r = I->Radius[prm->vert];
+      if((prm->type == cPrimCone) && (prm->r2 > r))
+        r = prm->r2;
+      scale3f(n0, prm->l1, end);
+      add3f(v, end, end);
+      BVHGrow(mn, mx, end, end);
+    }
+    break;
+  default:
+    return false;
+  }
+  for(d = 0; d < 3; d++) {
+    mn[d] -= r + pad;
+    mx[d] += r + pad;
+  }
+  return true;
+}
+
+/*
+ * Summed node surface area relative to the root box, i.e. the expected
+ * number of node visits for a random ray (lower is better)
+ */
+static float BVHCost(const BasisBVH * bvh)
+{
+  int a;
+  double sum = 0.0;
+  float root;
+  if(!bvh->NNode)
+    return 0.0F;
+  root = BVHArea(bvh->Node[0].min, bvh->Node[0].max);
+  if(root <= R_SMALL8)
+    return 0.0F;
+  for(a = 0; a < bvh->NNode; a++)
+    sum += BVHArea(bvh->Node[a].min, bvh->Node[a].max);
+  return (float) (sum / root);
+}
+
+void BasisBVHFree(BasisBVH * bvh)
+{
+  if(bvh) {
+    FreeP(bvh->Node);
+    FreeP(bvh->Item);
+    FreeP(bvh);
+  }
+}
+
+/*
+ * Builds I->BVH over all primitives, to be used by the BasisHit* routines
+ * instead of I->Map. One vertex per primitive (prm->vert) is listed.
+ */
+int BasisMakeBVH(CBasis * I, CPrimitive * prim, int n_prim)
+{
+  PyMOLGlobals *G = I->G;
+  BasisBVH *bvh;
+  BVHBuilder builder;
+  BVHRef *ref;
+  int a, d, n = 0;
+  int ok = true;
+
+  BasisBVHFree(I->BVH);
+  I->BVH = NULL;
+
+  bvh = Calloc(BasisBVH, 1);
+  CHECKOK(ok, bvh);
+  if(!ok)
+    return false;
+
+  ref = Alloc(BVHRef, n_prim + 1);
+  bvh->Node = Alloc(BasisBVHNode, 2 * n_prim + 1);
+  bvh->Item = Alloc(int, 2 * n_prim + 1);
+  if(!(ref && bvh->Node && bvh->Item)) {
+    FreeP(ref);
+    BasisBVHFree(bvh);
+    return false;
+  }
+
+  for(a = 0; a < n_prim; a++) {
+    BVHRef *rf = ref + n;
+    if(!BVHPrimBounds(I, prim + a, rf->min, rf->max))
+      continue;
+    for(d = 0; d < 3; d++)
+      rf->cent[d] = (rf->min[d] + rf->max[d]) * 0.5F;
+    rf->vert = prim[a].vert;
+    n++;
+  }
+
+  if(n) {
+    builder.bvh = bvh;
+    builder.ref = ref;
+    BVHBuildNode(&builder, 0, n, 0);
+  }
+  FreeP(ref);
+  bvh->Cost = BVHCost(bvh);
+
+  I->BVH = bvh;
+
+  PRINTFB(G, FB_Ray, FB_Blather)
+    " BasisMakeBVH: %d primitives, %d nodes, depth %d\n", n, bvh->NNode, bvh->Depth
+    ENDFB(G);
+
+  return ok;
+}
+
+/*
+ * Updates the node bounds of I->BVH for moved vertices (same primitives,
+ * same basis vertex numbering) keeping the tree topology, which is much
+ * cheaper than BasisMakeBVH. Returns false if the refitted tree has become
+ * too loose to be worth keeping, in which case it should be rebuilt.
+ */
+int BasisRefitBVH(CBasis * I, CPrimitive * prim, const int *vert2prim)
+{
+  BasisBVH *bvh = I->BVH;
+  int a;
+  float cost;
+
+  if(!bvh)
+    return false;
+
+  /* children always follow their parent, so a reverse sweep is bottom-up */
+  for(a = bvh->NNode - 1; a >= 0; a--) {
+    BasisBVHNode *node = bvh->Node + a;
+    BVHEmpty(node->min, node->max);
+    if(node->axis < 0) {
+      const int *ip = bvh->Item + node->offset;
+      float mn[3], mx[3];
+      for(; *ip >= 0; ip++) {
+        if(BVHPrimBounds(I, prim + vert2prim[*ip], mn, mx))
+          BVHGrow(node->min, node->max, mn, mx);
+      }
+    } else {
+      const BasisBVHNode *second = bvh->Node + node->offset;
+      BVHGrow(node->min, node->max, node[1].min, node[1].max);
+      BVHGrow(node->min, node->max, second->min, second->max);
+    }
+  }
+
+  cost = BVHCost(bvh);
+  PRINTFB(I->G, FB_Ray, FB_Blather)
+    " BasisRefitBVH: %d nodes, cost %4.1f (%4.1f as built)\n", bvh->NNode, cost,
+    bvh->Cost ENDFB(I->G);
+
+  return (cost <= cBVHRefitLimit * bvh->Cost);
+}
+
+/*
+ * Traversal state: a stack of nodes still to be visited, nearest on top
+ */
+typedef struct {
+  int stack[cBVHStack];
+  int depth;
+} BVHWalk;
+
+#ifdef _PYMOL_INLINE
+__inline__
+#endif
+static void BVHWalkInit(const BasisBVH * bvh, BVHWalk * W)
+{
+  W->stack[0] = 0;
+  W->depth = bvh->NNode ? 1 : 0;
+}
+
+/*
+ * Next leaf hit by the ray starting at `base` heading down -Z (orthoscopic
+ * and shadow rays) whose Z range overlaps [min_dist, max_dist] measured
+ * from base. Returns the vertex list of the leaf or NULL when done.
+ */
+#ifdef _PYMOL_INLINE
+__inline__
+#endif
+static int *BVHNextZ(const BasisBVH * bvh, BVHWalk * W, const float *base,
+                     float min_dist, float max_dist)
+{
+  const BasisBVHNode *nodes = bvh->Node;
+  const float x = base[0], y = base[1];
+  const float z_lo = base[2] - max_dist, z_hi = base[2] - min_dist;
+
+  while(W->depth) {
+    int index = W->stack[--W->depth];
+    const BasisBVHNode *node = nodes + index;
+
+    if((x < node->min[0]) || (x > node->max[0]) ||
+       (y < node->min[1]) || (y > node->max[1]) ||
+       (node->max[2] < z_lo) || (node->min[2] > z_hi))
+      continue;
+
+    if(node->axis < 0)
+      return bvh->Item + node->offset;
+
+    /* visit the child with the larger Z (closer along -Z) first */
+    if(nodes[index + 1].max[2] > nodes[node->offset].max[2]) {
+      W->stack[W->depth++] = node->offset;
+      W->stack[W->depth++] = index + 1;
+    } else {
+      W->stack[W->depth++] = index + 1;
+      W->stack[W->depth++] = node->offset;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Same as BVHNextZ for arbitrary ray directions (perspective rays),
+ * `inv_dir` being the component-wise inverse of the direction.
+ */
+#ifdef _PYMOL_INLINE
+__inline__
+#endif
+static int *BVHNextRay(const BasisBVH * bvh, BVHWalk * W, const float *base,
+                       const float *inv_dir, float min_dist, float max_dist)
+{
+  const BasisBVHNode *nodes = bvh->Node;
+
+  while(W->depth) {
+    int index = W->stack[--W->depth];
+    const BasisBVHNode *node = nodes + index;
+    float t_near = min_dist, t_far = max_dist;
+    int d;
+
+    for(d = 0; d < 3; d++) {
+      float t0 = (node->min[d] - base[d]) * inv_dir[d];
+      float t1 = (node->max[d] - base[d]) * inv_dir[d];
+      if(t0 > t1) {
+        float tmp = t0;
+        t0 = t1;
+        t1 = tmp;
+      }
+      if(t0 > t_near)
+        t_near = t0;
+      if(t1 < t_far)
+        t_far = t1;
+      if(t_near > t_far)
+        break;
+    }
+    if(t_near > t_far)
+      continue;
+
+    if(node->axis < 0)
+      return bvh->Item + node->offset;
+
+    /* the first child holds the lower coordinates along the split axis */
+    if(inv_dir[node->axis] < 0.0F) {
+      W->stack[W->depth++] = index + 1;
+      W->stack[W->depth++] = node->offset;
+    } else {
+      W->stack[W->depth++] = node->offset;
+      W->stack[W->depth++] = index + 1;
+    }
+  }
+  return NULL;
+}
+
+int BasisCacheInit(CBasis * I, MapCache * M, int group_id, int block_base)
+{
+  PyMOLGlobals *G = I->G;
+  int ok = true;
+
+  if(I->Map)
+    return MapCacheInit(M, I->Map, group_id, block_base);
+
+  /* BVH mode: the cache is indexed by primitive, of which there are no
+     more than vertices */
+  M->G = G;
+  M->block_base = block_base;
+  M->Cache =
+    CacheCalloc(G, int, I->NVertex + 1, group_id, block_base + cCache_map_cache_offset);
+  CHECKOK(ok, M->Cache);
+  if (ok)
+    M->CacheLink =
+      CacheAlloc(G, int, I->NVertex + 1, group_id,
+                 block_base + cCache_map_cache_link_offset);
+  CHECKOK(ok, M->CacheLink);
+  M->CacheStart = -1;
+  return ok;
+}
+
 /*========================================================================*/
 
 #ifdef PROFILE_BASIS
@@ -1531,20 +2043,16 @@ int BasisHitPerspective(BasisCallRec * BC)
 {
   CBasis *BI = BC->Basis;
   MapType *map = BI->Map;
-  int iMin0 = map->iMin[0];
-  int iMin1 = map->iMin[1];
-  int iMin2 = map->iMin[2];
-  int iMax0 = map->iMax[0];
-  int iMax1 = map->iMax[1];
-  int iMax2 = map->iMax[2];
+  BasisBVH *bvh = BI->BVH;
+  BVHWalk walk;
+  int iMin0 = 0, iMin1 = 0, iMin2 = 0;
+  int iMax0 = 0, iMax1 = 0, iMax2 = 0;
   int a, b, c;
 
-  float iDiv = map->recipDiv;
+  float iDiv = 0.0F;
   float base0, base1, base2;
 
-  float min0 = map->Min[0] * iDiv;
-  float min1 = map->Min[1] * iDiv;
-  float min2 = map->Min[2] * iDiv;
+  float min0 = 0.0F, min1 = 0.0F, min2 = 0.0F;
 
   int new_ray = !BC->pass;
   RayInfo *r = BC->rr;
@@ -1555,7 +2063,20 @@ int BasisHitPerspective(BasisCallRec * BC)
 
   CPrimitive *r_prim = NULL;
 
-  if(new_ray) {                 /* see if we can eliminate this ray right away using the mask */
+  if(map) {
+    iMin0 = map->iMin[0];
+    iMin1 = map->iMin[1];
+    iMin2 = map->iMin[2];
+    iMax0 = map->iMax[0];
+    iMax1 = map->iMax[1];
+    iMax2 = map->iMax[2];
+    iDiv = map->recipDiv;
+    min0 = map->Min[0] * iDiv;
+    min1 = map->Min[1] * iDiv;
+    min2 = map->Min[2] * iDiv;
+  }
+
+  if(new_ray && map) {          /* see if we can eliminate this ray right away using the mask */
 
     base0 = (r->base[0] * iDiv) - min0;
     base1 = (r->base[1] * iDiv) - min1;
@@ -1592,20 +2113,21 @@ int BasisHitPerspective(BasisCallRec * BC)
     int excl_trans_flag;
     int *elist, local_iflag = false;
     int terminal = -1;
-    int *ehead = map->EHead;
-    int d1d2 = map->D1D2;
-    int d2 = map->Dim[2];
+    int *ehead = NULL;
+    int d1d2 = 0;
+    int d2 = 0;
     const int *vert2prim = BC->vert2prim;
     const float excl_trans = BC->excl_trans;
     const float BasisFudge0 = BC->fudge0;
     const float BasisFudge1 = BC->fudge1;
     int v2p;
     int i, ii;
-    int n_vert = BI->NVertex, n_eElem = map->NEElem;
+    int n_vert = BI->NVertex, n_eElem = 0;
     int except1 = BC->except1;
     int except2 = BC->except2;
     int check_interior_flag = BC->check_interior && !BC->pass;
     float sph[3], vt[3], tri1 = _0, tri2;
+    float inv_dir[3];
     CPrimitive *BC_prim = BC->prim;
     int *BI_Vert2Normal = BI->Vert2Normal;
     float *BI_Vertex = BI->Vertex;
@@ -1615,7 +2137,7 @@ int BasisHitPerspective(BasisCallRec * BC)
     float *BI_Radius2 = BI->Radius2;
     copy3f(r->base, vt);
 
-    elist = map->EList;
+    elist = NULL;
 
     r_dist = MAXFLOAT;
 
@@ -1628,242 +2150,312 @@ int BasisHitPerspective(BasisCallRec * BC)
 
     MapCacheReset(cache);
 
-    {                           /* take steps with a Z-size equil to the grid spacing */
+    walk.depth = 0;              /* only walked with a BVH */
+    if(bvh) {
+      int d;
+      BVHWalkInit(bvh, &walk);
+      for(d = 0; d < 3; d++) {
+        if(fabs(r->dir[d]) > R_SMALL8)
+          inv_dir[d] = _1 / r->dir[d];
+        else
+          inv_dir[d] = (r->dir[d] < _0) ? -1e30F : 1e30F;
+      }
+      step0 = step1 = step2 = _0;
+      base0 = base1 = base2 = _0;
+    } else {                    /* take steps with a Z-size equil to the grid spacing */
       float div = iDiv * (-MapGetDiv(BI->Map) / r->dir[2]);
       step0 = r->dir[0] * div;
       step1 = r->dir[1] * div;
       step2 = r->dir[2] * div;
-    }
 
-    base0 = (r->skip[0] * iDiv) - min0;
-    base1 = (r->skip[1] * iDiv) - min1;
-    base2 = (r->skip[2] * iDiv) - min2;
+      base0 = (r->skip[0] * iDiv) - min0;
+      base1 = (r->skip[1] * iDiv) - min1;
+      base2 = (r->skip[2] * iDiv) - min2;
+
+      ehead = map->EHead;
+      d1d2 = map->D1D2;
+      d2 = map->Dim[2];
+      n_eElem = map->NEElem;
+      elist = map->EList;
+    }
 
     allow_break = false;
     while(1) {
-      int inside_code;
-      int clamped;
+      int new_min_index = -1;
+
+      ip = NULL;
+
+      if(bvh) {
+        /* nothing beyond the closest hit so far can matter */
+        if(!(ip = BVHNextRay(bvh, &walk, r->base, inv_dir, -kR_SMALL4,
+                             (r_dist < back_dist) ? r_dist : back_dist)))
+          break;
+      } else {
+        int inside_code;
+        int clamped;
 
-      a = ((int) base0);
-      b = ((int) base1);
-      c = ((int) base2);
+        a = ((int) base0);
+        b = ((int) base1);
+        c = ((int) base2);
 
-      inside_code = 1;
-      clamped = false;
+        inside_code = 1;
+        clamped = false;
 
-      a += MapBorder;
-      b += MapBorder;
-      c += MapBorder;
+        a += MapBorder;
+        b += MapBorder;
+        c += MapBorder;
 #define EDGE_ALLOWANCE 1
 
-      if(a < iMin0) {
-        if(((iMin0 - a) > EDGE_ALLOWANCE) && allow_break)
-          break;
-        else {
-          a = iMin0;
-          clamped = true;
-        }
-      } else if(a > iMax0) {
-        if(((a - iMax0) > EDGE_ALLOWANCE) && allow_break)
-          break;
-        else {
-          a = iMax0;
-          clamped = true;
-        }
-      }
-      if(b < iMin1) {
-        if(((iMin1 - b) > EDGE_ALLOWANCE) && allow_break)
-          break;
-        else {
-          b = iMin1;
-          clamped = true;
+        if(a < iMin0) {
+          if(((iMin0 - a) > EDGE_ALLOWANCE) && allow_break)
+            break;
+          else {
+            a = iMin0;
+            clamped = true;
+          }
+        } else if(a > iMax0) {
+          if(((a - iMax0) > EDGE_ALLOWANCE) && allow_break)
+            break;
+          else {
+            a = iMax0;
+            clamped = true;
+          }
         }
-      } else if(b > iMax1) {
-        if(((b - iMax1) > EDGE_ALLOWANCE) && allow_break)
-          break;
-        else {
-          b = iMax1;
-          clamped = true;
+        if(b < iMin1) {
+          if(((iMin1 - b) > EDGE_ALLOWANCE) && allow_break)
+            break;
+          else {
+            b = iMin1;
+            clamped = true;
+          }
+        } else if(b > iMax1) {
+          if(((b - iMax1) > EDGE_ALLOWANCE) && allow_break)
+            break;
+          else {
+            b = iMax1;
+            clamped = true;
+          }
         }
-      }
-      if(c < iMin2) {
-        if((iMin2 - c) > EDGE_ALLOWANCE)
-          break;
-        else {
-          c = iMin2;
-          clamped = true;
+        if(c < iMin2) {
+          if((iMin2 - c) > EDGE_ALLOWANCE)
+            break;
+          else {
+            c = iMin2;
+            clamped = true;
+          }
+        } else if(c > iMax2) {
+          if((c - iMax2) > EDGE_ALLOWANCE)
+            inside_code = 0;
+          else {
+            c = iMax2;
+            clamped = true;
+          }
         }
-      } else if(c > iMax2) {
-        if((c - iMax2) > EDGE_ALLOWANCE)
-          inside_code = 0;
-        else {
-          c = iMax2;
-          clamped = true;
+        if(inside_code && (((a != last_a) || (b != last_b) || (c != last_c)))) {
+          h = *(ehead + (d1d2 * a) + (d2 * b) + c);
+
+          if(!clamped)          /* don't discard a ray until it has hit the objective at least once */
+            allow_break = true;
+
+          if((terminal > 0) && (last_c != c)) {
+            if(!terminal--)
+              break;
+          }
+          if((h > 0) && (h < n_eElem)) {
+            ip = elist + h;
+            last_a = a;
+            last_b = b;
+            last_c = c;
+          }
         }
       }
-      if(inside_code && (((a != last_a) || (b != last_b) || (c != last_c)))) {
-        int new_min_index;
-        h = *(ehead + (d1d2 * a) + (d2 * b) + c);
 
-        new_min_index = -1;
+      if(ip && BC->packet)
+        ip = BasisPacketFilter(BI->Packet, ip, n_vert, r->base, r->dir, BC->packet);
 
-        if(!clamped)            /* don't discard a ray until it has hit the objective at least once */
-          allow_break = true;
+      if(ip) {
+        int do_loop;
 
-        if((terminal > 0) && (last_c != c)) {
-          if(!terminal--)
-            break;
-        }
-        if((h > 0) && (h < n_eElem)) {
-          int do_loop;
-
-          ip = elist + h;
-          last_a = a;
-          i = *(ip++);
-          last_b = b;
-          do_loop = ((i >= 0) && (i < n_vert));
-          last_c = c;
-
-          while(do_loop) {      /* n_vert checking is a bug workaround */
-            CPrimitive *prm;
-            v2p = vert2prim[i];
-            ii = *(ip++);
-            prm = BC_prim + v2p;
-            do_loop = ((ii >= 0) && (ii < n_vert));
-            /*            if((v2p != except1) && (v2p != except2) && (!MapCached(cache, v2p))) { */
-            if((v2p != except1) && (v2p != except2) && (!cache_cache[v2p])) {
-              int prm_type = prm->type;
-
-              /*MapCache(cache,v2p); */
-              cache_cache[v2p] = 1;
-              cache_CacheLink[v2p] = cache->CacheStart;
-              cache->CacheStart = v2p;
-
-              switch (prm_type) {
-              case cPrimTriangle:
-              case cPrimCharacter:
-                {
-                  float *dir = r->dir;
-                  float *d10 = BI_Precomp + BI_Vert2Normal[i] * 3;
-                  float *d20 = d10 + 3;
-                  float *v0;
-                  float det, inv_det;
-                  float pvec0, pvec1, pvec2;
-                  float dir0 = dir[0], dir1 = dir[1], dir2 = dir[2];
-                  float d20_0 = d20[0], d20_1 = d20[1], d20_2 = d20[2];
-                  float d10_0 = d10[0], d10_1 = d10[1], d10_2 = d10[2];
-
-                  /* cross_product3f(dir, d20, pvec); */
-
-                  pvec0 = dir1 * d20_2 - dir2 * d20_1;
-                  pvec1 = dir2 * d20_0 - dir0 * d20_2;
-                  pvec2 = dir0 * d20_1 - dir1 * d20_0;
-
-                  /* det = dot_product3f(pvec, d10); */
-
-                  det = pvec0 * d10_0 + pvec1 * d10_1 + pvec2 * d10_2;
-
-                  v0 = BI_Vertex + prm->vert * 3;
-                  if((det >= EPSILON) || (det <= -EPSILON)) {
-                    float tvec0, tvec1, tvec2;
-                    float qvec0, qvec1, qvec2;
-
-                    inv_det = _1 / det;
-
-                    /* subtract3f(vt,v0,tvec); */
-
-                    tvec0 = vt[0] - v0[0];
-                    tvec1 = vt[1] - v0[1];
-                    tvec2 = vt[2] - v0[2];
-
-                    /* dot_product3f(tvec,pvec) * inv_det; */
-                    tri1 = (tvec0 * pvec0 + tvec1 * pvec1 + tvec2 * pvec2) * inv_det;
-
-                    /* cross_product3f(tvec,d10,qvec); */
-
-                    qvec0 = tvec1 * d10_2 - tvec2 * d10_1;
-                    qvec1 = tvec2 * d10_0 - tvec0 * d10_2;
-
-                    if((tri1 >= BasisFudge0) && (tri1 <= BasisFudge1)) {
-                      qvec2 = tvec0 * d10_1 - tvec1 * d10_0;
-
-                      /* dot_product3f(dir, qvec) * inv_det; */
-                      tri2 = (dir0 * qvec0 + dir1 * qvec1 + dir2 * qvec2) * inv_det;
-
-                      /* dot_product3f(d20, qvec) * inv_det; */
-                      dist = (d20_0 * qvec0 + d20_1 * qvec1 + d20_2 * qvec2) * inv_det;
-
-                      if((tri2 >= BasisFudge0) && (tri2 <= BasisFudge1)
-                         && ((tri1 + tri2) <= BasisFudge1)) {
-                        if((dist < r_dist) && (dist >= _0) && (dist <= back_dist)
-                           && (prm->trans != _1)) {
-                          new_min_index = prm->vert;
-                          r_tri1 = tri1;
-                          r_tri2 = tri2;
-                          r_dist = dist;
-                        }
+        i = *(ip++);
+        do_loop = ((i >= 0) && (i < n_vert));
+
+        while(do_loop) {      /* n_vert checking is a bug workaround */
+          CPrimitive *prm;
+          v2p = vert2prim[i];
+          ii = *(ip++);
+          prm = BC_prim + v2p;
+          do_loop = ((ii >= 0) && (ii < n_vert));
+          /*            if((v2p != except1) && (v2p != except2) && (!MapCached(cache, v2p))) { */
+          if((v2p != except1) && (v2p != except2) && (!cache_cache[v2p])) {
+            int prm_type = prm->type;
+
+            /*MapCache(cache,v2p); */
+            cache_cache[v2p] = 1;
+            cache_CacheLink[v2p] = cache->CacheStart;
+            cache->CacheStart = v2p;
+
+            switch (prm_type) {
+            case cPrimTriangle:
+            case cPrimCharacter:
+              {
+                float *dir = r->dir;
+                float *d10 = BI_Precomp + BI_Vert2Normal[i] * 3;
+                float *d20 = d10 + 3;
+                float *v0;
+                float det, inv_det;
+                float pvec0, pvec1, pvec2;
+                float dir0 = dir[0], dir1 = dir[1], dir2 = dir[2];
+                float d20_0 = d20[0], d20_1 = d20[1], d20_2 = d20[2];
+                float d10_0 = d10[0], d10_1 = d10[1], d10_2 = d10[2];
+
+                /* cross_product3f(dir, d20, pvec); */
+
+                pvec0 = dir1 * d20_2 - dir2 * d20_1;
+                pvec1 = dir2 * d20_0 - dir0 * d20_2;
+                pvec2 = dir0 * d20_1 - dir1 * d20_0;
+
+                /* det = dot_product3f(pvec, d10); */
+
+                det = pvec0 * d10_0 + pvec1 * d10_1 + pvec2 * d10_2;
+
+                v0 = BI_Vertex + prm->vert * 3;
+                if((det >= EPSILON) || (det <= -EPSILON)) {
+                  float tvec0, tvec1, tvec2;
+                  float qvec0, qvec1, qvec2;
+
+                  inv_det = _1 / det;
+
+                  /* subtract3f(vt,v0,tvec); */
+
+                  tvec0 = vt[0] - v0[0];
+                  tvec1 = vt[1] - v0[1];
+                  tvec2 = vt[2] - v0[2];
+
+                  /* dot_product3f(tvec,pvec) * inv_det; */
+                  tri1 = (tvec0 * pvec0 + tvec1 * pvec1 + tvec2 * pvec2) * inv_det;
+
+                  /* cross_product3f(tvec,d10,qvec); */
+
+                  qvec0 = tvec1 * d10_2 - tvec2 * d10_1;
+                  qvec1 = tvec2 * d10_0 - tvec0 * d10_2;
+
+                  if((tri1 >= BasisFudge0) && (tri1 <= BasisFudge1)) {
+                    qvec2 = tvec0 * d10_1 - tvec1 * d10_0;
+
+                    /* dot_product3f(dir, qvec) * inv_det; */
+                    tri2 = (dir0 * qvec0 + dir1 * qvec1 + dir2 * qvec2) * inv_det;
+
+                    /* dot_product3f(d20, qvec) * inv_det; */
+                    dist = (d20_0 * qvec0 + d20_1 * qvec1 + d20_2 * qvec2) * inv_det;
+
+                    if((tri2 >= BasisFudge0) && (tri2 <= BasisFudge1)
+                       && ((tri1 + tri2) <= BasisFudge1)) {
+                      if((dist < r_dist) && (dist >= _0) && (dist <= back_dist)
+                         && (prm->trans != _1)) {
+                        new_min_index = prm->vert;
+                        r_tri1 = tri1;
+                        r_tri2 = tri2;
+                        r_dist = dist;
                       }
                     }
                   }
                 }
-                break;
-              case cPrimSphere:
-                {
-                  if(LineClipPoint(r->base, r->dir,
-                                   BI_Vertex + i * 3, &dist,
-                                   BI_Radius[i], BI_Radius2[i])) {
-                    if((dist < r_dist) && (prm->trans != _1)) {
-                      if((dist >= _0) && (dist <= back_dist)) {
-                        new_min_index = prm->vert;
-                        r_dist = dist;
-                      } else if(check_interior_flag && (dist <= back_dist)) {
-                        if(diffsq3f(vt, BI_Vertex + i * 3) < BI_Radius2[i]) {
+              }
+              break;
+            case cPrimSphere:
+              {
+                if(LineClipPoint(r->base, r->dir,
+                                 BI_Vertex + i * 3, &dist,
+                                 BI_Radius[i], BI_Radius2[i])) {
+                  if((dist < r_dist) && (prm->trans != _1)) {
+                    if((dist >= _0) && (dist <= back_dist)) {
+                      new_min_index = prm->vert;
+                      r_dist = dist;
+                    } else if(check_interior_flag && (dist <= back_dist)) {
+                      if(diffsq3f(vt, BI_Vertex + i * 3) < BI_Radius2[i]) {
 
-                          local_iflag = true;
-                          r_prim = prm;
-                          r_dist = _0;
+                        local_iflag = true;
+                        r_prim = prm;
+                        r_dist = _0;
+                        new_min_index = prm->vert;
+                      }
+                    }
+                  }
+                }
+              }
+              break;
+            case cPrimEllipsoid:
+              {
+                if(LineClipPoint(r->base, r->dir,
+                                 BI_Vertex + i * 3, &dist,
+                                 BI_Radius[i], BI_Radius2[i])) {
+                  if((dist < r_dist) && (prm->trans != _1)) {
+                    float *n1 = BI_Normal + BI_Vert2Normal[i] * 3;
+                    if(LineClipEllipsoidPoint(r->base, r->dir,
+                                              BI_Vertex + i * 3, &dist,
+                                              BI_Radius[i], BI_Radius2[i],
+                                              BC->geom + prm->geom + cPrimGeomN0, n1, n1 + 3, n1 + 6)) {
+                      if(dist < r_dist) {
+                        if((dist >= _0) && (dist <= back_dist)) {
                           new_min_index = prm->vert;
+                          r_dist = dist;
                         }
                       }
                     }
                   }
                 }
-                break;
-              case cPrimEllipsoid:
-                {
-                  if(LineClipPoint(r->base, r->dir,
-                                   BI_Vertex + i * 3, &dist,
-                                   BI_Radius[i], BI_Radius2[i])) {
-                    if((dist < r_dist) && (prm->trans != _1)) {
-                      float *n1 = BI_Normal + BI_Vert2Normal[i] * 3;
-                      if(LineClipEllipsoidPoint(r->base, r->dir,
-                                                BI_Vertex + i * 3, &dist,
-                                                BI_Radius[i], BI_Radius2[i],
-                                                prm->n0, n1, n1 + 3, n1 + 6)) {
-                        if(dist < r_dist) {
-                          if((dist >= _0) && (dist <= back_dist)) {
-                            new_min_index = prm->vert;
-                            r_dist = dist;
-                          }
-                        }
+              }
+              break;
+
+            case cPrimCylinder:
+              if(LineToSphereCapped(r->base, r->dir, BI_Vertex + i * 3,
+                                    BI_Normal + BI_Vert2Normal[i] * 3,
+                                    BI_Radius[i], prm->l1, sph, &tri1,
+                                    prm->cap1, prm->cap2)) {
+                if(LineClipPoint
+                   (r->base, r->dir, sph, &dist, BI_Radius[i], BI_Radius2[i])) {
+                  if((dist < r_dist) && (prm->trans != _1)) {
+                    if((dist >= _0) && (dist <= back_dist)) {
+                      if(prm->l1 > kR_SMALL4)
+                        r_tri1 = tri1 / prm->l1;
+
+                      r_sphere0 = sph[0];
+                      r_sphere1 = sph[1];
+                      r_sphere2 = sph[2];
+                      new_min_index = prm->vert;
+                      r_dist = dist;
+                    } else if(check_interior_flag && (dist <= back_dist)) {
+                      if(FrontToInteriorSphereCapped(vt,
+                                                     BI_Vertex + i * 3,
+                                                     BI_Normal + BI_Vert2Normal[i] * 3,
+                                                     BI_Radius[i],
+                                                     BI_Radius2[i],
+                                                     prm->l1, prm->cap1, prm->cap2)) {
+                        local_iflag = true;
+                        r_prim = prm;
+                        r_dist = _0;
+
+                        new_min_index = prm->vert;
                       }
                     }
                   }
                 }
-                break;
+              }
+              break;
+            case cPrimCone:
+              {
+                float sph_rad, sph_rad_sq;
+                if(ConeLineToSphereCapped(r->base, r->dir, BI_Vertex + i * 3,
+                                          BI_Normal + BI_Vert2Normal[i] * 3,
+                                          BI_Radius[i], prm->r2, prm->l1, sph, &tri1,
+                                          &sph_rad, &sph_rad_sq,
+                                          prm->cap1, prm->cap2)) {
 
-              case cPrimCylinder:
-                if(LineToSphereCapped(r->base, r->dir, BI_Vertex + i * 3,
-                                      BI_Normal + BI_Vert2Normal[i] * 3,
-                                      BI_Radius[i], prm->l1, sph, &tri1,
-                                      prm->cap1, prm->cap2)) {
-                  if(LineClipPoint
-                     (r->base, r->dir, sph, &dist, BI_Radius[i], BI_Radius2[i])) {
+                  if(LineClipPoint(r->base, r->dir, sph, &dist, sph_rad, sph_rad_sq)) {
                     if((dist < r_dist) && (prm->trans != _1)) {
                       if((dist >= _0) && (dist <= back_dist)) {
                         if(prm->l1 > kR_SMALL4)
-                          r_tri1 = tri1 / prm->l1;
-
+                          r_tri1 = tri1 / prm->l1;    /* color blending */
                         r_sphere0 = sph[0];
                         r_sphere1 = sph[1];
                         r_sphere2 = sph[2];
@@ -1872,139 +2464,104 @@ int BasisHitPerspective(BasisCallRec * BC)
                       } else if(check_interior_flag && (dist <= back_dist)) {
                         if(FrontToInteriorSphereCapped(vt,
                                                        BI_Vertex + i * 3,
-                                                       BI_Normal + BI_Vert2Normal[i] * 3,
-                                                       BI_Radius[i],
-                                                       BI_Radius2[i],
+                                                       BI_Normal +
+                                                       BI_Vert2Normal[i] * 3,
+                                                       BI_Radius[i], BI_Radius2[i],
                                                        prm->l1, prm->cap1, prm->cap2)) {
                           local_iflag = true;
                           r_prim = prm;
                           r_dist = _0;
-
-                          new_min_index = prm->vert;
-                        }
-                      }
-                    }
-                  }
-                }
-                break;
-              case cPrimCone:
-                {
-                  float sph_rad, sph_rad_sq;
-                  if(ConeLineToSphereCapped(r->base, r->dir, BI_Vertex + i * 3,
-                                            BI_Normal + BI_Vert2Normal[i] * 3,
-                                            BI_Radius[i], prm->r2, prm->l1, sph, &tri1,
-                                            &sph_rad, &sph_rad_sq,
-                                            prm->cap1, prm->cap2)) {
-
-                    if(LineClipPoint(r->base, r->dir, sph, &dist, sph_rad, sph_rad_sq)) {
-                      if((dist < r_dist) && (prm->trans != _1)) {
-                        if((dist >= _0) && (dist <= back_dist)) {
-                          if(prm->l1 > kR_SMALL4)
-                            r_tri1 = tri1 / prm->l1;    /* color blending */
-                          r_sphere0 = sph[0];
-                          r_sphere1 = sph[1];
-                          r_sphere2 = sph[2];
                           new_min_index = prm->vert;
-                          r_dist = dist;
-                        } else if(check_interior_flag && (dist <= back_dist)) {
-                          if(FrontToInteriorSphereCapped(vt,
-                                                         BI_Vertex + i * 3,
-                                                         BI_Normal +
-                                                         BI_Vert2Normal[i] * 3,
-                                                         BI_Radius[i], BI_Radius2[i],
-                                                         prm->l1, prm->cap1, prm->cap2)) {
-                            local_iflag = true;
-                            r_prim = prm;
-                            r_dist = _0;
-                            new_min_index = prm->vert;
-                          }
                         }
                       }
                     }
                   }
                 }
-                break;
-              case cPrimSausage:
-                if(LineToSphere(r->base, r->dir,
-                                BI_Vertex + i * 3, BI_Normal + BI_Vert2Normal[i] * 3,
-                                BI_Radius[i], prm->l1, sph, &tri1)) {
+              }
+              break;
+            case cPrimSausage:
+              if(LineToSphere(r->base, r->dir,
+                              BI_Vertex + i * 3, BI_Normal + BI_Vert2Normal[i] * 3,
+                              BI_Radius[i], prm->l1, sph, &tri1)) {
 
-                  if(LineClipPoint
-                     (r->base, r->dir, sph, &dist, BI_Radius[i], BI_Radius2[i])) {
+                if(LineClipPoint
+                   (r->base, r->dir, sph, &dist, BI_Radius[i], BI_Radius2[i])) {
 
-                    int tmp_flag = false;
-                    if((dist < r_dist) && (prm->trans != _1)) {
-                      if((dist >= _0) && (dist <= back_dist)) {
-                        tmp_flag = true;
-                        if(excl_trans_flag) {
-                          if((prm->trans > _0) && (dist < excl_trans))
-                            tmp_flag = false;
-                        }
-                        if(tmp_flag) {
+                  int tmp_flag = false;
+                  if((dist < r_dist) && (prm->trans != _1)) {
+                    if((dist >= _0) && (dist <= back_dist)) {
+                      tmp_flag = true;
+                      if(excl_trans_flag) {
+                        if((prm->trans > _0) && (dist < excl_trans))
+                          tmp_flag = false;
+                      }
+                      if(tmp_flag) {
 
-                          if(prm->l1 > kR_SMALL4)
-                            r_tri1 = tri1 / prm->l1;
+                        if(prm->l1 > kR_SMALL4)
+                          r_tri1 = tri1 / prm->l1;
 
-                          r_sphere0 = sph[0];
-                          r_sphere1 = sph[1];
-                          r_sphere2 = sph[2];
-                          new_min_index = prm->vert;
-                          r_dist = dist;
+                        r_sphere0 = sph[0];
+                        r_sphere1 = sph[1];
+                        r_sphere2 = sph[2];
+                        new_min_index = prm->vert;
+                        r_dist = dist;
 
-                        }
-                      } else if(check_interior_flag && (dist <= back_dist)) {
-                        if(FrontToInteriorSphere(vt, BI_Vertex + i * 3,
-                                                 BI_Normal + BI_Vert2Normal[i] * 3,
-                                                 BI_Radius[i], BI_Radius2[i], prm->l1)) {
-                          local_iflag = true;
-                          r_prim = prm;
-                          r_dist = _0;
-                          new_min_index = prm->vert;
-                        }
+                      }
+                    } else if(check_interior_flag && (dist <= back_dist)) {
+                      if(FrontToInteriorSphere(vt, BI_Vertex + i * 3,
+                                               BI_Normal + BI_Vert2Normal[i] * 3,
+                                               BI_Radius[i], BI_Radius2[i], prm->l1)) {
+                        local_iflag = true;
+                        r_prim = prm;
+                        r_dist = _0;
+                        new_min_index = prm->vert;
                       }
                     }
                   }
                 }
-                break;
-              }                 /* end of switch */
-            }
-            /* end of if */
-            i = ii;
+              }
+              break;
+            }                 /* end of switch */
+          }
+          /* end of if */
+          i = ii;
 
-          }                     /* end of while */
+        }                     /* end of while */
 
-          if(local_iflag) {
-            r->prim = r_prim;
-            r->dist = r_dist;
+        if(local_iflag) {
+          r->prim = r_prim;
+          r->dist = r_dist;
 
-            break;
-          }
+          break;
+        }
 
-          if(new_min_index > -1) {
+        if(new_min_index > -1) {
 
-            minIndex = new_min_index;
+          minIndex = new_min_index;
 
-            r_prim = BC_prim + vert2prim[minIndex];
+          r_prim = BC_prim + vert2prim[minIndex];
 
-            if((r_prim->type == cPrimSphere) || (r_prim->type == cPrimEllipsoid)) {
-              const float *vv = BI->Vertex + minIndex * 3;
-              r_sphere0 = vv[0];
-              r_sphere1 = vv[1];
-              r_sphere2 = vv[2];
-            }
-
-            BC->interior_flag = local_iflag;
-            r->tri1 = r_tri1;
-            r->tri2 = r_tri2;
-            r->prim = r_prim;
-            r->dist = r_dist;
-            r->sphere[0] = r_sphere0;
-            r->sphere[1] = r_sphere1;
-            r->sphere[2] = r_sphere2;
+          if((r_prim->type == cPrimSphere) || (r_prim->type == cPrimEllipsoid)) {
+            const float *vv = BI->Vertex + minIndex * 3;
+            r_sphere0 = vv[0];
+            r_sphere1 = vv[1];
+            r_sphere2 = vv[2];
           }
-        }                       /* if -- h valid */
+
+          BC->interior_flag = local_iflag;
+          r->tri1 = r_tri1;
+          r->tri2 = r_tri2;
+          r->prim = r_prim;
+          r->dist = r_dist;
+          r->sphere[0] = r_sphere0;
+          r->sphere[1] = r_sphere1;
+          r->sphere[2] = r_sphere2;
+        }
       }
-      /* end of if */
+
+      if(bvh)
+        continue;
+
       if(minIndex > -1) {
         if(terminal < 0)
           terminal = EDGE_ALLOWANCE + 1;
@@ -2036,8 +2593,10 @@ int BasisHitOrthoscopic(BasisCallRec * BC)
 
   CBasis *BI = BC->Basis;
   RayInfo *r = BC->rr;
+  BasisBVH *bvh = BI->BVH;
+  BVHWalk walk;
 
-  if(MapInsideXY(BI->Map, r->base, &a, &b, &c)) {
+  if(bvh || MapInsideXY(BI->Map, r->base, &a, &b, &c)) {
     int minIndex = -1;
     int v2p;
     int i, ii;
@@ -2045,10 +2604,12 @@ int BasisHitOrthoscopic(BasisCallRec * BC)
     int do_loop;
     int except1 = BC->except1;
     int except2 = BC->except2;
-    int n_vert = BI->NVertex, n_eElem = BI->Map->NEElem;
+    int n_vert = BI->NVertex, n_eElem = bvh ? 0 : BI->Map->NEElem;
     const int *vert2prim = BC->vert2prim;
     const float front = BC->front;
     const float back = BC->back;
+    /* ellipsoids accept hits from dist 0, interior checks are made at front */
+    const float min_dist = ((front < _0) ? front : _0) - kR_SMALL4;
     const float excl_trans = BC->excl_trans;
     const float BasisFudge0 = BC->fudge0;
     const float BasisFudge1 = BC->fudge1;
@@ -2075,16 +2636,31 @@ int BasisHitOrthoscopic(BasisCallRec * BC)
 
     r_dist = MAXFLOAT;
 
-    xxtmp = BI->Map->EHead + (a * BI->Map->D1D2) + (b * BI->Map->Dim[2]) + c;
+    walk.depth = 0;              /* only walked with a BVH */
+    if(bvh) {
+      BVHWalkInit(bvh, &walk);
+      xxtmp = elist = NULL;
+    } else {
+      xxtmp = BI->Map->EHead + (a * BI->Map->D1D2) + (b * BI->Map->Dim[2]) + c;
+      elist = BI->Map->EList;
+    }
 
     MapCacheReset(cache);
 
-    elist = BI->Map->EList;
-
-    while(c >= MapBorder) {
-      h = *xxtmp;
-      if((h > 0) && (h < n_eElem)) {
-        ip = elist + h;
+    for(;;) {
+      if(bvh) {
+        /* nothing further away than the closest hit so far can matter */
+        if(!(ip = BVHNextZ(bvh, &walk, r->base, min_dist, (r_dist < back) ? r_dist : back)))
+          break;
+      } else {
+        if(c < MapBorder)
+          break;
+        h = *xxtmp;
+        ip = ((h > 0) && (h < n_eElem)) ? elist + h : NULL;
+      }
+      if(ip && BC->packet)
+        ip = BasisPacketFilter(BI->Packet, ip, n_vert, r->base, minusZ, BC->packet);
+      if(ip) {
         i = *(ip++);
         do_loop = ((i >= 0) && (i < n_vert));
         while(do_loop) {
@@ -2158,7 +2734,7 @@ int BasisHitOrthoscopic(BasisCallRec * BC)
                   if(LineClipEllipsoidPoint(r->base, minusZ,
                                             BI->Vertex + i * 3, &dist,
                                             BI->Radius[i], BI->Radius2[i],
-                                            prm->n0, n1, n1 + 3, n1 + 6)) {
+                                            BC->geom + prm->geom + cPrimGeomN0, n1, n1 + 3, n1 + 6)) {
                     if(dist < r_dist) {
                       if((dist >= _0) && (dist <= back)) {
                         minIndex = prm->vert;
@@ -2300,6 +2876,9 @@ int BasisHitOrthoscopic(BasisCallRec * BC)
       if(local_iflag)
         break;
 
+      if(bvh)
+        continue;
+
       /* we've processed all primitives associated with this voxel, 
          so if an intersection has been found which occurs in front of
          the next voxel, then we can stop */
@@ -2362,14 +2941,16 @@ int BasisHitShadow(BasisCallRec * BC)
 
   CBasis *BI = BC->Basis;
   RayInfo *r = BC->rr;
+  BasisBVH *bvh = BI->BVH;
+  BVHWalk walk;
 
-  if(MapInsideXY(BI->Map, r->base, &a, &b, &c)) {
+  if(bvh || MapInsideXY(BI->Map, r->base, &a, &b, &c)) {
     int minIndex = -1;
     int v2p;
     int i, ii;
     int *xxtmp;
 
-    int n_vert = BI->NVertex, n_eElem = BI->Map->NEElem;
+    int n_vert = BI->NVertex, n_eElem = bvh ? 0 : BI->Map->NEElem;
     int except1 = BC->except1;
     int except2 = BC->except2;
     const int *vert2prim = BC->vert2prim;
@@ -2400,17 +2981,33 @@ int BasisHitShadow(BasisCallRec * BC)
     r_trans = _1;
     r_dist = MAXFLOAT;
 
-    xxtmp = BI->Map->EHead + (a * BI->Map->D1D2) + (b * BI->Map->Dim[2]) + c;
+    walk.depth = 0;              /* only walked with a BVH */
+    if(bvh) {
+      BVHWalkInit(bvh, &walk);
+      xxtmp = elist = NULL;
+    } else {
+      xxtmp = BI->Map->EHead + (a * BI->Map->D1D2) + (b * BI->Map->Dim[2]) + c;
+      elist = BI->Map->EList;
+    }
 
     MapCacheReset(cache);
 
-    elist = BI->Map->EList;
-
-    while(c >= MapBorder) {
-      h = *xxtmp;
-      if((h > 0) && (h < n_eElem)) {
+    for(;;) {
+      if(bvh) {
+        /* only the nearest opaque hit is wanted unless transparency counts */
+        if(!(ip = BVHNextZ(bvh, &walk, r->base, -kR_SMALL4,
+                           (nearest_shadow && !trans_shadows) ? r_dist : MAXFLOAT)))
+          break;
+      } else {
+        if(c < MapBorder)
+          break;
+        h = *xxtmp;
+        ip = ((h > 0) && (h < n_eElem)) ? elist + h : NULL;
+      }
+      if(ip && BC->packet)
+        ip = BasisPacketFilter(BI->Packet, ip, n_vert, r->base, minusZ, BC->packet);
+      if(ip) {
         int do_loop;
-        ip = elist + h;
         i = *(ip++);
         do_loop = ((i >= 0) && (i < n_vert));
         while(do_loop) {
@@ -2457,17 +3054,14 @@ int BasisHitShadow(BasisCallRec * BC)
 
                       {
                         float w2;
+                        const float *c1 = BC->palette + 3 * prm->c1;
+                        const float *c2 = BC->palette + 3 * prm->c2;
+                        const float *c3 = BC->palette + 3 * prm->c3;
                         w2 = _1 - (r->tri1 + r->tri2);
 
-                        fc[0] =
-                          (prm->c2[0] * r->tri1) + (prm->c3[0] * r->tri2) +
-                          (prm->c1[0] * w2);
-                        fc[1] =
-                          (prm->c2[1] * r->tri1) + (prm->c3[1] * r->tri2) +
-                          (prm->c1[1] * w2);
-                        fc[2] =
-                          (prm->c2[2] * r->tri1) + (prm->c3[2] * r->tri2) +
-                          (prm->c1[2] * w2);
+                        fc[0] = (c2[0] * r->tri1) + (c3[0] * r->tri2) + (c1[0] * w2);
+                        fc[1] = (c2[1] * r->tri1) + (c3[1] * r->tri2) + (c1[1] * w2);
+                        fc[2] = (c2[2] * r->tri1) + (c3[2] * r->tri2) + (c1[2] * w2);
                       }
 
                       trans = CharacterInterpolate(BI->G, prm->char_id, fc);
@@ -2521,7 +3115,7 @@ int BasisHitShadow(BasisCallRec * BC)
                   if(!((tri1 < BasisFudge0) ||
                        (tri2 < BasisFudge0) ||
                        (tri1 > BasisFudge1) || ((tri1 + tri2) > BasisFudge1))) {
-                    float *tr = prm->tr;
+                    const float *tr = BC->palette + 3 * prm->tr;
                     float trans = _0;
 
                     dist = (r->base[2] - (tri1 * pre[2]) - (tri2 * pre[5]) - vert0[2]);
@@ -2609,7 +3203,7 @@ int BasisHitShadow(BasisCallRec * BC)
                   if(LineClipEllipsoidPoint(r->base, minusZ,
                                             BI->Vertex + i * 3, &dist,
                                             BI->Radius[i], BI->Radius2[i],
-                                            prm->n0, n1, n1 + 3, n1 + 6)) {
+                                            BC->geom + prm->geom + cPrimGeomN0, n1, n1 + 3, n1 + 6)) {
 
                     if(prm->trans == _0) {
                       if(dist > -kR_SMALL4) {
@@ -2802,6 +3396,9 @@ int BasisHitShadow(BasisCallRec * BC)
       if(local_iflag)
         break;
 
+      if(bvh)
+        continue;
+
       /* we've processed all primitives associated with this voxel, 
          so if an intersection has been found which occurs in front of
          the next voxel, then we can stop */
@@ -3575,7 +4172,7 @@ int BasisMakeMap(CBasis * I, int *vert2prim, CPrimitive * prim, int n_prim,
                                 block_base + cCache_map_ehead_offset);
         MemoryCacheReplaceBlock(I->G, group_id, block_base + cCache_map_elist_new_offset,
                                 block_base + cCache_map_elist_offset);
-        VLACacheSize(G, map->EList, int, map->NEElem, group_id,
+        VLACacheSize(I->G, map->EList, int, map->NEElem, group_id,
                      block_base + cCache_map_elist_offset);
       }
     }
@@ -3627,6 +4224,8 @@ int BasisInit(PyMOLGlobals * G, CBasis * I, int group_id)
     I->Precomp = VLACacheAlloc(I->G, float, 1, group_id, cCache_basis_precomp);
   CHECKOK(ok, I->Precomp);
   I->Map = NULL;
+  I->BVH = NULL;
+  I->Packet = NULL;
   I->NVertex = 0;
   I->NNormal = 0;
   return ok;
@@ -3640,6 +4239,10 @@ void BasisFinish(CBasis * I, int group_id)
     MapFree(I->Map);
     I->Map = NULL;
   }
+  BasisBVHFree(I->BVH);
+  I->BVH = NULL;
+  BasisPacketFree(I->Packet);
+  I->Packet = NULL;
   VLACacheFreeP(I->G, I->Radius2, group_id, cCache_basis_radius2, false);
   VLACacheFreeP(I->G, I->Radius, group_id, cCache_basis_radius, false);
   VLACacheFreeP(I->G, I->Vertex, group_id, cCache_basis_vertex, false);
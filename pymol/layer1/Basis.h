@@ -42,22 +42,59 @@ Z* -------------------------------------------------------------------
 #define cCylCapFlat 1
 #define cCylCapRound 2
 
+/* Primitive record: only what the intersection and shading loops need.
+ * Coordinates and normals live in CRay::PrimGeom, colors (and the other
+ * float triples) in the deduplicated CRay::Palette. */
 typedef struct {
   int vert;
-  float v1[3], v2[3], v3[3];
-  float n0[3], n1[3], n2[3], n3[3];
-  float c1[3], c2[3], c3[3], ic[3], tr[3];      /* ic = interior color, tr = transparency */
+  int geom;                     /* offset into CRay::PrimGeom, see cPrimGeom* */
+  int c1, c2, c3, ic, tr;       /* indices into CRay::Palette: vertex colors, interior color, vertex transparencies */
   float r1, r2, l1;
   float trans;
   int char_id;
   char type, cap1, cap2, cull;
   char wobble, ramped;
   /* float wobble_param[3] eliminated to save space */
-} CPrimitive;                   /* currently 172 bytes -> appoximately 6.5 million primitives per gigabyte */
+} CPrimitive;                   /* currently 56 bytes + 12 (spheres) to 84 (triangles) bytes of geometry */
+
+/* geometry layout in CRay::PrimGeom: each type stores a prefix of
+ * v1 v2 v3 n0 n1 n2 n3 (spheres: v1, cylinders: v1 v2, triangles and
+ * ellipsoids: all) */
+#define cPrimGeomV1 0
+#define cPrimGeomV2 3
+#define cPrimGeomV3 6
+#define cPrimGeomN0 9
+#define cPrimGeomN1 12
+#define cPrimGeomN2 15
+#define cPrimGeomN3 18
+
+#define cPrimGeomSphere 3
+#define cPrimGeomCylinder 6
+#define cPrimGeomTriangle 21
+
+/* flattened bounding volume hierarchy node (depth-first order, so the
+ * first child of an inner node always follows its parent) */
+typedef struct {
+  float min[3], max[3];
+  int offset;                   /* inner: second child, leaf: vertex list in Item */
+  int axis;                     /* inner: split axis, leaf: -1 */
+} BasisBVHNode;
+
+typedef struct {
+  BasisBVHNode *Node;
+  int *Item;                    /* -1 terminated vertex lists, as in MapType::EList */
+  int NNode, NItem;
+  int Depth;
+  float Cost;                   /* relative traversal cost as built */
+} BasisBVH;
+
+typedef struct _BasisPacket BasisPacket;      /* see BasisPacket.h */
 
 typedef struct {
   PyMOLGlobals *G;
   MapType *Map;
+  BasisBVH *BVH;                /* replaces Map when ray_bvh is set */
+  BasisPacket *Packet;          /* SIMD prefilter data (ray_simd), or NULL */
   float *Vertex, *Normal, *Precomp;
   float *Radius, *Radius2, MaxRadius, MinVoxel;
   int *Vert2Normal;
@@ -98,7 +135,10 @@ typedef struct {
   int check_interior;
   int label_shadow_mode;
   CPrimitive *prim;
+  float *geom;                  /* CRay::PrimGeom */
+  const float *palette;         /* CRay::Palette */
   MapCache cache;
+  int *packet;                  /* prefiltered candidate list, NULL to skip */
   float fudge0, fudge1;
   /* returns */
   int interior_flag;
@@ -112,10 +152,17 @@ int BasisMakeMap(CBasis * I, int *vert2prim, CPrimitive * prim, int n_prim,
 		 float *volume,
 		 int group_id, int block_base,
 		 int perspective, float front, float size_hint);
+int BasisMakeBVH(CBasis * I, CPrimitive * prim, int n_prim);
+int BasisRefitBVH(CBasis * I, CPrimitive * prim, const int *vert2prim);
+void BasisBVHFree(BasisBVH * bvh);
+
+int BasisCacheInit(CBasis * I, MapCache * M, int group_id, int block_base);
 
 void BasisSetupMatrix(CBasis * I);
-void BasisGetTriangleNormal(CBasis * I, RayInfo * r, int i, float *fc, int perspective);
-void BasisGetEllipsoidNormal(CBasis * I, RayInfo * r, int i, int perspective);
+void BasisGetTriangleNormal(CBasis * I, RayInfo * r, int i, float *fc, int perspective,
+                            const float *palette);
+void BasisGetEllipsoidNormal(CBasis * I, RayInfo * r, int i, int perspective,
+                             const float *geom);
 void BasisTrianglePrecompute(float *v1, float *v2, float *v3, float *pre);
 void BasisTrianglePrecomputePerspective(float *v1, float *v2, float *v3, float *pre);
 
@@ -0,0 +1,325 @@
+/*
+ * SIMD candidate prefilter for the ray tracer
+ *
+ * (c) Schrodinger, Inc.
+ */
+
+#include "os_predef.h"
+
+#include "BasisPacket.h"
+#include "MemoryDebug.h"
+#include "Feedback.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BASIS_PACKET_SSE2 1
+#define BASIS_PACKET_AVX2 1
+#define BASIS_PACKET_TARGET(isa) __attribute__((target(isa)))
+#include <immintrin.h>
+#elif defined(_MSC_VER) && defined(_M_X64)
+#define BASIS_PACKET_SSE2 1
+#define BASIS_PACKET_TARGET(isa)
+#include <emmintrin.h>
+#endif
+
+/* bounds are inflated a little, so that rounding never drops a hit */
+#define cPacketPadFactor 1.001F
+#define cPacketPad 0.001F
+
+int BasisPacketLevel()
+{
+  static int level = -1;
+  if(level < 0) {
+    int l = 0;
+#if defined(__GNUC__) && defined(BASIS_PACKET_SSE2)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse2"))
+      l = 1;
+    if(l && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+      l = 2;
+#elif defined(BASIS_PACKET_SSE2)
+    l = 1;                      /* part of x86-64 */
+#endif
+    level = l;
+  }
+  return level;
+}
+
+void BasisPacketFree(BasisPacket * P)
+{
+  if(P) {
+    FreeP(P->X);
+    FreeP(P);
+  }
+}
+
+int BasisMakePacket(CBasis * I, CPrimitive * prim, int n_prim)
+{
+  PyMOLGlobals *G = I->G;
+  BasisPacket *P;
+  int a, b, n = I->NVertex;
+  int level = BasisPacketLevel();
+
+  BasisPacketFree(I->Packet);
+  I->Packet = NULL;
+
+  if(!level)
+    return true;
+
+  P = Calloc(BasisPacket, 1);
+  if(!P)
+    return false;
+
+  /* one block for all seven arrays */
+  P->X = Alloc(float, 7 * (n + 1));
+  if(!P->X) {
+    FreeP(P);
+    return false;
+  }
+  P->Y = P->X + (n + 1);
+  P->Z = P->Y + (n + 1);
+  P->DX = P->Z + (n + 1);
+  P->DY = P->DX + (n + 1);
+  P->DZ = P->DY + (n + 1);
+  P->R2 = P->DZ + (n + 1);
+  P->N = n;
+  P->Level = level;
+
+  /* vertices not covered below always pass */
+  for(a = 0; a < n; a++) {
+    P->X[a] = P->Y[a] = P->Z[a] = 0.0F;
+    P->DX[a] = P->DY[a] = P->DZ[a] = 0.0F;
+    P->R2[a] = MAXFLOAT;
+  }
+
+  for(a = 0; a < n_prim; a++) {
+    const CPrimitive *prm = prim + a;
+    int i = prm->vert;
+    const float *v = I->Vertex + i * 3;
+    float c[3], e[3] = { 0.0F, 0.0F, 0.0F }, r = 0.0F;
+    int n_share = 1;
+
+    if(i < 0 || i >= n)
+      continue;
+
+    switch (prm->type) {
+    case cPrimSphere:
+    case cPrimEllipsoid:
+      copy3f(v, c);
+      r = I->Radius[i];
+      break;
+    case cPrimCone:
+    case cPrimCylinder:
+    case cPrimSausage:
+      copy3f(v, c);
+      scale3f(I->Normal + I->Vert2Normal[i] * 3, prm->l1, e);
+      r = I->Radius[i];
+      if((prm->type == cPrimCone) && (prm->r2 > r))
+        r = prm->r2;
+      break;
+    case cPrimTriangle:
+    case cPrimCharacter:
+      /* bounding sphere around the centroid; the extra 1% covers
+         ray_triangle_fudge on the barycentric bounds */
+      if(i + 2 >= n)
+        continue;
+      for(b = 0; b < 3; b++)
+        c[b] = (v[b] + v[b + 3] + v[b + 6]) / 3.0F;
+      for(b = 0; b < 3; b++) {
+        float d = diff3f(c, v + b * 3);
+        if(d > r)
+          r = d;
+      }
+      r *= 1.01F;
+      n_share = 3;
+      break;
+    default:
+      continue;
+    }
+
+    r = r * cPacketPadFactor + cPacketPad;
+    for(b = i; b < i + n_share; b++) {
+      P->X[b] = c[0];
+      P->Y[b] = c[1];
+      P->Z[b] = c[2];
+      P->DX[b] = e[0];
+      P->DY[b] = e[1];
+      P->DZ[b] = e[2];
+      P->R2[b] = r * r;
+    }
+  }
+
+  I->Packet = P;
+
+  PRINTFB(G, FB_Ray, FB_Debugging)
+    " BasisMakePacket: %d vertices, level %d\n", n, level ENDFB(G);
+
+  return true;
+}
+
+/*
+ * Line-to-segment test for one candidate. With w = P - B and the line
+ * direction D of unit length, the segment parameter closest to the line is
+ * s = (b d - e) / (c - b^2), clamped to [0, 1], where b = D.E, c = E.E,
+ * d = D.w, e = E.w. The squared distance is |w + s E - (d + s b) D|^2.
+ */
+static int PacketTestOne(const BasisPacket * P, int i, const float *B, const float *D)
+{
+  float wx = P->X[i] - B[0], wy = P->Y[i] - B[1], wz = P->Z[i] - B[2];
+  float ex = P->DX[i], ey = P->DY[i], ez = P->DZ[i];
+  float b = D[0] * ex + D[1] * ey + D[2] * ez;
+  float c = ex * ex + ey * ey + ez * ez;
+  float d = D[0] * wx + D[1] * wy + D[2] * wz;
+  float e = ex * wx + ey * wy + ez * wz;
+  float den = c - b * b;
+  float s, t, vx, vy, vz;
+
+  if(den < 1e-12F)
+    den = 1e-12F;
+  s = (b * d - e) / den;
+  if(s < 0.0F)
+    s = 0.0F;
+  else if(s > 1.0F)
+    s = 1.0F;
+  t = d + s * b;
+  vx = wx + s * ex - t * D[0];
+  vy = wy + s * ey - t * D[1];
+  vz = wz + s * ez - t * D[2];
+  return (vx * vx + vy * vy + vz * vz) <= P->R2[i];
+}
+
+
+#ifdef BASIS_PACKET_SSE2
+
+/* tests ip[0..n) four at a time (n a multiple of 4), returns hits in op */
+BASIS_PACKET_TARGET("sse2")
+static int PacketFilter4(const BasisPacket * P, const int *ip, int n,
+                         const float *B, const float *D, int *op)
+{
+  const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0F);
+  const __m128 eps = _mm_set1_ps(1e-12F);
+  const __m128 bx = _mm_set1_ps(B[0]), by = _mm_set1_ps(B[1]), bz = _mm_set1_ps(B[2]);
+  const __m128 dx = _mm_set1_ps(D[0]), dy = _mm_set1_ps(D[1]), dz = _mm_set1_ps(D[2]);
+  int a, k, cnt = 0;
+
+  for(a = 0; a < n; a += 4, ip += 4) {
+    int i0 = ip[0], i1 = ip[1], i2 = ip[2], i3 = ip[3];
+    __m128 wx, wy, wz, ex, ey, ez, r2, b, c, d, e, s, t, vx, vy, vz, d2;
+    int mask;
+
+    wx = _mm_sub_ps(_mm_setr_ps(P->X[i0], P->X[i1], P->X[i2], P->X[i3]), bx);
+    wy = _mm_sub_ps(_mm_setr_ps(P->Y[i0], P->Y[i1], P->Y[i2], P->Y[i3]), by);
+    wz = _mm_sub_ps(_mm_setr_ps(P->Z[i0], P->Z[i1], P->Z[i2], P->Z[i3]), bz);
+    ex = _mm_setr_ps(P->DX[i0], P->DX[i1], P->DX[i2], P->DX[i3]);
+    ey = _mm_setr_ps(P->DY[i0], P->DY[i1], P->DY[i2], P->DY[i3]);
+    ez = _mm_setr_ps(P->DZ[i0], P->DZ[i1], P->DZ[i2], P->DZ[i3]);
+    r2 = _mm_setr_ps(P->R2[i0], P->R2[i1], P->R2[i2], P->R2[i3]);
+
+    b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, ex), _mm_mul_ps(dy, ey)), _mm_mul_ps(dz, ez));
+    c = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, ex), _mm_mul_ps(ey, ey)), _mm_mul_ps(ez, ez));
+    d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, wx), _mm_mul_ps(dy, wy)), _mm_mul_ps(dz, wz));
+    e = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, wx), _mm_mul_ps(ey, wy)), _mm_mul_ps(ez, wz));
+    s = _mm_div_ps(_mm_sub_ps(_mm_mul_ps(b, d), e),
+                   _mm_max_ps(_mm_sub_ps(c, _mm_mul_ps(b, b)), eps));
+    s = _mm_min_ps(_mm_max_ps(s, zero), one);
+    t = _mm_add_ps(d, _mm_mul_ps(s, b));
+    vx = _mm_sub_ps(_mm_add_ps(wx, _mm_mul_ps(s, ex)), _mm_mul_ps(t, dx));
+    vy = _mm_sub_ps(_mm_add_ps(wy, _mm_mul_ps(s, ey)), _mm_mul_ps(t, dy));
+    vz = _mm_sub_ps(_mm_add_ps(wz, _mm_mul_ps(s, ez)), _mm_mul_ps(t, dz));
+    d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz));
+
+    mask = _mm_movemask_ps(_mm_cmple_ps(d2, r2));
+    for(k = 0; mask; k++, mask >>= 1)
+      if(mask & 1)
+        op[cnt++] = ip[k];
+  }
+  return cnt;
+}
+
+#endif
+
+#ifdef BASIS_PACKET_AVX2
+
+/* same as PacketFilter4, eight at a time (n a multiple of 8) */
+BASIS_PACKET_TARGET("avx2,fma")
+static int PacketFilter8(const BasisPacket * P, const int *ip, int n,
+                         const float *B, const float *D, int *op)
+{
+  const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0F);
+  const __m256 eps = _mm256_set1_ps(1e-12F);
+  const __m256 bx = _mm256_set1_ps(B[0]), by = _mm256_set1_ps(B[1]), bz = _mm256_set1_ps(B[2]);
+  const __m256 dx = _mm256_set1_ps(D[0]), dy = _mm256_set1_ps(D[1]), dz = _mm256_set1_ps(D[2]);
+  int a, k, cnt = 0;
+
+  for(a = 0; a < n; a += 8, ip += 8) {
+    __m256i idx = _mm256_loadu_si256((const __m256i *) ip);
+    __m256 wx, wy, wz, ex, ey, ez, r2, b, c, d, e, s, t, vx, vy, vz, d2;
+    int mask;
+
+    wx = _mm256_sub_ps(_mm256_i32gather_ps(P->X, idx, 4), bx);
+    wy = _mm256_sub_ps(_mm256_i32gather_ps(P->Y, idx, 4), by);
+    wz = _mm256_sub_ps(_mm256_i32gather_ps(P->Z, idx, 4), bz);
+    ex = _mm256_i32gather_ps(P->DX, idx, 4);
+    ey = _mm256_i32gather_ps(P->DY, idx, 4);
+    ez = _mm256_i32gather_ps(P->DZ, idx, 4);
+    r2 = _mm256_i32gather_ps(P->R2, idx, 4);
+
+    b = _mm256_fmadd_ps(dz, ez, _mm256_fmadd_ps(dy, ey, _mm256_mul_ps(dx, ex)));
+    c = _mm256_fmadd_ps(ez, ez, _mm256_fmadd_ps(ey, ey, _mm256_mul_ps(ex, ex)));
+    d = _mm256_fmadd_ps(dz, wz, _mm256_fmadd_ps(dy, wy, _mm256_mul_ps(dx, wx)));
+    e = _mm256_fmadd_ps(ez, wz, _mm256_fmadd_ps(ey, wy, _mm256_mul_ps(ex, wx)));
+    s = _mm256_div_ps(_mm256_fmsub_ps(b, d, e),
+                      _mm256_max_ps(_mm256_fnmadd_ps(b, b, c), eps));
+    s = _mm256_min_ps(_mm256_max_ps(s, zero), one);
+    t = _mm256_fmadd_ps(s, b, d);
+    vx = _mm256_fnmadd_ps(t, dx, _mm256_fmadd_ps(s, ex, wx));
+    vy = _mm256_fnmadd_ps(t, dy, _mm256_fmadd_ps(s, ey, wy));
+    vz = _mm256_fnmadd_ps(t, dz, _mm256_fmadd_ps(s, ez, wz));
+    d2 = _mm256_fmadd_ps(vz, vz, _mm256_fmadd_ps(vy, vy, _mm256_mul_ps(vx, vx)));
+
+    mask = _mm256_movemask_ps(_mm256_cmp_ps(d2, r2, _CMP_LE_OQ));
+    for(k = 0; mask; k++, mask >>= 1)
+      if(mask & 1)
+        op[cnt++] = ip[k];
+  }
+  return cnt;
+}
+
+#endif
+
+int *BasisPacketFilter(const BasisPacket * P, const int *list, int n_vert,
+                       const float *base, const float *dir, int *out)
+{
+  int n = 0, done = 0, cnt = 0;
+  int i;
+  float D[3];
+
+  /* the kernels only see the leading run of valid indices */
+  while((i = list[n]) >= 0 && i < n_vert)
+    n++;
+
+  /* short lists aren't worth it, and out[] holds at most P->N entries */
+  if(n < 8 || n > P->N)
+    return (int *) list;
+
+  normalize23f(dir, D);
+
+#ifdef BASIS_PACKET_AVX2
+  if(P->Level > 1) {
+    cnt += PacketFilter8(P, list, n & ~7, base, D, out);
+    done = n & ~7;
+  }
+#endif
+#ifdef BASIS_PACKET_SSE2
+  if(n - done >= 4) {
+    cnt += PacketFilter4(P, list + done, (n - done) & ~3, base, D, out + cnt);
+    done += (n - done) & ~3;
+  }
+#endif
+  for(; done < n; done++) {
+    i = list[done];
+    if(PacketTestOne(P, i, base, D))
+      out[cnt++] = i;
+  }
+  out[cnt] = -1;
+  return out;
+}
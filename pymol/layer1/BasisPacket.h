@@ -0,0 +1,48 @@
+/*
+ * SIMD candidate prefilter for the ray tracer
+ *
+ * (c) Schrodinger, Inc.
+ */
+
+#ifndef _H_BasisPacket
+#define _H_BasisPacket
+
+#include "Basis.h"
+
+/*
+ * Structure-of-arrays copy of the primitive bounds, indexed by basis
+ * vertex. Every vertex is bounded by a capsule: the segment from (X,Y,Z)
+ * along (DX,DY,DZ), inflated by sqrt(R2). Spheres and triangles have a
+ * zero length segment.
+ */
+struct _BasisPacket {
+  float *X, *Y, *Z;
+  float *DX, *DY, *DZ;
+  float *R2;
+  int N;
+  int Level;                    /* see BasisPacketLevel */
+};
+
+/*
+ * SIMD instruction set detected at runtime:
+ * 0 = none (scalar path only), 1 = SSE2 (4 wide), 2 = AVX2 (8 wide)
+ */
+int BasisPacketLevel();
+
+/*
+ * Builds I->Packet from the transformed basis. Does nothing (and returns
+ * true) if the CPU has no usable SIMD support.
+ */
+int BasisMakePacket(CBasis * I, CPrimitive * prim, int n_prim);
+void BasisPacketFree(BasisPacket * P);
+
+/*
+ * Copies the candidates of the -1 terminated vertex list `list` whose
+ * bounds may be crossed by the line through `base` along `dir` to `out`
+ * (-1 terminated, order preserved) and returns `out`. As in the
+ * intersection loops, the list also ends at the first index >= n_vert.
+ */
+int *BasisPacketFilter(const BasisPacket * P, const int *list, int n_vert,
+                       const float *base, const float *dir, int *out);
+
+#endif
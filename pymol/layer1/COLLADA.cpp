@@ -1019,20 +1019,20 @@ void RayRenderCOLLADA(CRay * I, int width, int height,
           switch (prim->type) {
             /* 3 vertices defined */
             case cPrimTriangle:
-              if (largest_dim < prim->v3[i]) {
-                largest_dim = prim->v3[i];
+              if (largest_dim < I->primV3(prim)[i]) {
+                largest_dim = I->primV3(prim)[i];
               }
               /* 2 vertices defined */
             case cPrimCone:
             case cPrimCylinder:
-              if (largest_dim < prim->v2[i]) {
-                largest_dim = prim->v2[i];
+              if (largest_dim < I->primV2(prim)[i]) {
+                largest_dim = I->primV2(prim)[i];
               }
               /* only 1 vertex defined */
             case cPrimSphere:
             default:
-              if (largest_dim < prim->v1[i]) {
-                largest_dim = prim->v1[i];
+              if (largest_dim < I->primV1(prim)[i]) {
+                largest_dim = I->primV1(prim)[i];
               }
               break;
           }
@@ -1072,9 +1072,9 @@ void RayRenderCOLLADA(CRay * I, int width, int height,
               for(j = 0; j < (*s); j++) {
                 /* positions */
                 sprintf(next, "%6.4f %6.4f %6.4f ",
-                    prim->v1[0] + (prim->r1 * sp->dot[*q][0]),
-                    prim->v1[1] + (prim->r1 * sp->dot[*q][1]),
-                    prim->v1[2] + (prim->r1 * sp->dot[*q][2]));
+                    I->primV1(prim)[0] + (prim->r1 * sp->dot[*q][0]),
+                    I->primV1(prim)[1] + (prim->r1 * sp->dot[*q][1]),
+                    I->primV1(prim)[2] + (prim->r1 * sp->dot[*q][2]));
 #if COLLADA_DEBUG > 1
                 printf("positions j = %02i: %s\n", j, next);
 #endif
@@ -1093,7 +1093,7 @@ void RayRenderCOLLADA(CRay * I, int width, int height,
 
             /* Colors: only one color per sphere. */
             sprintf(next, "%6.4f %6.4f %6.4f",
-                prim->c1[0], prim->c1[1], prim->c1[2]);
+                I->color(prim->c1)[0], I->color(prim->c1)[1], I->color(prim->c1)[2]);
             UtilConcatVLA(&colors_str, &col_str_cc, next);
 
 
@@ -1263,18 +1263,18 @@ void RayRenderCOLLADA(CRay * I, int width, int height,
             //colorFlag = (prim->c1 != prim->c2) && prim->c2;
 
             /* primary axis vector p0 */
-            p0[0] = (prim->v2[0] - prim->v1[0]);
-            p0[1] = (prim->v2[1] - prim->v1[1]);
-            p0[2] = (prim->v2[2] - prim->v1[2]);
+            p0[0] = (I->primV2(prim)[0] - I->primV1(prim)[0]);
+            p0[1] = (I->primV2(prim)[1] - I->primV1(prim)[1]);
+            p0[2] = (I->primV2(prim)[2] - I->primV1(prim)[2]);
 
             normalize3f(p0);
 
             /* cap1 */
-            copy3f(prim->v1, vv1);
+            copy3f(I->primV1(prim), vv1);
             copy3f(vv1, vvv1);
 
             /* cap2 */
-            copy3f(prim->v2, vv2);
+            copy3f(I->primV2(prim), vv2);
             copy3f(vv2, vvv2);
 
             d[0] = (vv2[0] - vv1[0]);
@@ -1296,7 +1296,7 @@ void RayRenderCOLLADA(CRay * I, int width, int height,
             if(captype[0] == cCylCapRound) {
               if (stick_round_nub) {
                 cgocap[0] = CGONew(I->G);
-                CGORoundNub(cgocap[0], prim->v1, p0, p1, p2, -1, nEdge, prim->r1);
+                CGORoundNub(cgocap[0], I->primV1(prim), p0, p1, p2, -1, nEdge, prim->r1);
               } else {
                 for(i = 0; i < 3; i++) {
                   vv1[i] -= p0[i] * overlap;
@@ -1309,7 +1309,7 @@ void RayRenderCOLLADA(CRay * I, int width, int height,
             if(captype[1] == cCylCapRound) {
               if (stick_round_nub) {
                 cgocap[1] = CGONew(I->G);
-                CGORoundNub(cgocap[1], prim->v2, p0, p1, p2, 1, nEdge, prim->r1);
+                CGORoundNub(cgocap[1], I->primV2(prim), p0, p1, p2, 1, nEdge, prim->r1);
               } else {
                 for(i = 0; i < 3; i++) {
                   vv2[i] += p0[i] * overlap2;
@@ -1320,8 +1320,8 @@ void RayRenderCOLLADA(CRay * I, int width, int height,
 
             /* colors */
             sprintf(next, "%6.4f %6.4f %6.4f %6.4f %6.4f %6.4f ",
-                prim->c1[0], prim->c1[1], prim->c1[2],
-                prim->c2[0], prim->c2[1], prim->c2[2]);
+                I->color(prim->c1)[0], I->color(prim->c1)[1], I->color(prim->c1)[2],
+                I->color(prim->c2)[0], I->color(prim->c2)[1], I->color(prim->c2)[2]);
             UtilConcatVLA(&colors_str, &col_str_cc, next);
 
             /* Generate the data strings */
@@ -1528,29 +1528,29 @@ void RayRenderCOLLADA(CRay * I, int width, int height,
 
             /*** Positions ***/
             sprintf(next, "%6.4f %6.4f %6.4f %6.4f %6.4f %6.4f %6.4f %6.4f %6.4f ",
-                prim->v1[0], prim->v1[1], prim->v1[2],
-                prim->v2[0], prim->v2[1], prim->v2[2],
-                prim->v3[0], prim->v3[1], prim->v3[2]);
+                I->primV1(prim)[0], I->primV1(prim)[1], I->primV1(prim)[2],
+                I->primV2(prim)[0], I->primV2(prim)[1], I->primV2(prim)[2],
+                I->primV3(prim)[0], I->primV3(prim)[1], I->primV3(prim)[2]);
             UtilConcatVLA(&positions_str, &pos_str_cc, (char *)next);
 
             /*** Normals ***/
-            /* prim->n0 is a face normal; prim->n1/2/3 are vertex normals. */
+            /* I->primN0(prim) is a face normal; I->primN1(prim)/2/3 are vertex normals. */
             sprintf(next, "%6.4f %6.4f %6.4f %6.4f %6.4f %6.4f %6.4f %6.4f %6.4f ",
-                prim->n1[0], prim->n1[1], prim->n1[2],
-                prim->n2[0], prim->n2[1], prim->n2[2],
-                prim->n3[0], prim->n3[1], prim->n3[2]);
+                I->primN1(prim)[0], I->primN1(prim)[1], I->primN1(prim)[2],
+                I->primN2(prim)[0], I->primN2(prim)[1], I->primN2(prim)[2],
+                I->primN3(prim)[0], I->primN3(prim)[1], I->primN3(prim)[2]);
             UtilConcatVLA(&normals_str, &norm_str_cc, (char *)next);
 
             /* Colors */
             /* R, G, B per vertex */
             sprintf(next, "%6.4f %6.4f %6.4f %6.4f %6.4f %6.4f %6.4f %6.4f %6.4f ",
-                prim->c1[0], prim->c1[1], prim->c1[2],    // vertex 1
-                prim->c2[0], prim->c2[1], prim->c2[2],    // vertex 2
-                prim->c3[0], prim->c3[1], prim->c3[2]);   // vertex 3
+                I->color(prim->c1)[0], I->color(prim->c1)[1], I->color(prim->c1)[2],    // vertex 1
+                I->color(prim->c2)[0], I->color(prim->c2)[1], I->color(prim->c2)[2],    // vertex 2
+                I->color(prim->c3)[0], I->color(prim->c3)[1], I->color(prim->c3)[2]);   // vertex 3
             UtilConcatVLA(&colors_str, &col_str_cc, next);
 
             /* <p> indices */
-            if (TriangleReverse(prim)) {
+            if (TriangleReverse(I, prim)) {
               sprintf(next, "%i %i %i %i %i %i %i %i %i ",
                   pos, norm, col,
                   pos + 2, norm + 2, col + 2,
@@ -48,6 +48,7 @@ Z* -------------------------------------------------------------------
 #include "CGO.h"
 #include "MyPNG.h"
 #include "MacPyMOL.h"
+#include "ThreadPool.h"
 
 #ifndef true
 #define true 1
@@ -582,8 +583,11 @@ void OrthoBusySlow(PyMOLGlobals * G, int progress, int total)
 void OrthoBusyFast(PyMOLGlobals * G, int progress, int total)
 {
   COrtho *I = G->Ortho;
-  double time_yet = (-I->BusyLastUpdate) + UtilGetSeconds(G);
+  double time_yet;
   short finished = progress == total;
+  if(ThreadPoolIsWorker())      /* no Python thread state */
+    return;
+  time_yet = (-I->BusyLastUpdate) + UtilGetSeconds(G);
   PRINTFD(G, FB_Ortho)
     " OrthoBusyFast-DEBUG: progress %d total %d\n", progress, total ENDFD;
   I->BusyStatus[2] = progress;
@@ -39,6 +39,13 @@ Z* -------------------------------------------------------------------
 #include"Scene.h"
 #include"PConv.h"
 #include"MyPNG.h"
+#include"ThreadPool.h"
+#include"BasisPacket.h"
+
+#ifndef _PYMOL_NO_CXX11
+#include <atomic>
+#include <vector>
+#endif
 
 #define SettingGetfv SettingGetGlobal_3fv
 
@@ -63,9 +70,14 @@ Z* -------------------------------------------------------------------
    number of lights */
 #define MAX_BASIS 12
 
+/* initial slots in the palette hash table, must be a power of 2 */
+#define cRayPaletteHash 1024
+
 typedef float float3[3];
 typedef float float4[4];
 
+typedef struct _CRayTileQueue CRayTileQueue;
+
 struct _CRayThreadInfo {
   CRay *ray;
   int width, height;
@@ -85,10 +97,14 @@ struct _CRayThreadInfo {
   int perspective;
   float fov, pos[3];
   float *depth;
+  CRayTileQueue *tiles;         /* NULL: interleaved scan lines */
+  int step, skip;               /* progressive passes: trace every step-th pixel
+                                   in x and y, except those on the skip grid */
 };
 
 struct _CRayHashThreadInfo {
   CBasis *basis;
+  int refit;                    /* out: kept BVH was refitted */
   int *vert2prim;
   CPrimitive *prim;
   int n_prim;
@@ -100,6 +116,8 @@ struct _CRayHashThreadInfo {
   float front;
   int phase;
   float size_hint;
+  int bvh;
+  int simd;
   CRay *ray;
   float *bkrd_top, *bkrd_bottom;
   short bkrd_is_gradient; /* if not gradient, use bkrd_top as bkrd */
@@ -114,7 +132,210 @@ struct _CRayAntiThreadInfo {
   int mag;
   int phase, n_thread;
   CRay *ray;
+  CRayTileQueue *tiles;         /* NULL: interleaved scan lines */
+};
+
+/*
+ * Tile scheduler for RayTraceThread and RayAntiThread
+ *
+ * The image region is split into square tiles (row-major tile order). Each
+ * thread starts out with a contiguous run of tiles and, once that is
+ * exhausted, steals the back half of the largest remaining run of another
+ * thread. Runs are stored as packed [head, tail) pairs so that both popping
+ * and stealing are a single compare-and-swap.
+ */
+#ifndef _PYMOL_NO_CXX11
+struct _CRayTileQueue {
+  int x_start, x_stop, y_start, y_stop;
+  int size, n_col, n_tile, n_thread;
+  std::vector<std::atomic<uint64_t> > run;
+  std::atomic<int> n_done;
+
+  _CRayTileQueue(int n) : run(n), n_done(0) {}
+};
+
+#define RAY_TILE_RUN(head, tail) ((((uint64_t) (head)) << 32) | (uint32_t) (tail))
+
+static void RayTileQueueReset(CRayTileQueue * Q)
+{
+  int a;
+  for(a = 0; a < Q->n_thread; a++) {
+    Q->run[a] = RAY_TILE_RUN(
+        (a * (int64_t) Q->n_tile) / Q->n_thread,
+        ((a + 1) * (int64_t) Q->n_tile) / Q->n_thread);
+  }
+  Q->n_done = 0;
+}
+
+static CRayTileQueue *RayTileQueueNew(int x_start, int x_stop, int y_start,
+                                      int y_stop, int size, int n_thread)
+{
+  CRayTileQueue *Q;
+  if(size < 1 || n_thread < 2 || x_stop <= x_start || y_stop <= y_start)
+    return NULL;
+  Q = new CRayTileQueue(n_thread);
+  Q->x_start = x_start;
+  Q->x_stop = x_stop;
+  Q->y_start = y_start;
+  Q->y_stop = y_stop;
+  Q->size = size;
+  Q->n_col = (x_stop - x_start + size - 1) / size;
+  Q->n_tile = Q->n_col * ((y_stop - y_start + size - 1) / size);
+  Q->n_thread = n_thread;
+  RayTileQueueReset(Q);
+  return Q;
+}
+
+static void RayTileQueueFree(CRayTileQueue * Q)
+{
+  delete Q;
+}
+
+/*
+ * Get the next tile for thread `phase`, stealing if necessary.
+ * Returns -1 if all tiles have been handed out.
+ */
+static int RayTileQueuePop(CRayTileQueue * Q, int phase)
+{
+  std::atomic<uint64_t> &own = Q->run[phase];
+  uint64_t r = own.load();
+
+  for(;;) {
+    uint32_t head = r >> 32, tail = (uint32_t) r;
+    if(head >= tail)
+      break;
+    if(own.compare_exchange_weak(r, RAY_TILE_RUN(head + 1, tail)))
+      return head;
+  }
+
+  for(;;) {
+    int a, victim = -1;
+    uint32_t best = 0;
+
+    for(a = 0; a < Q->n_thread; a++) {
+      uint64_t v = Q->run[a].load();
+      uint32_t head = v >> 32, tail = (uint32_t) v;
+      if(a != phase && head < tail && tail - head > best) {
+        best = tail - head;
+        victim = a;
+      }
+    }
+    if(victim < 0)
+      return -1;
+
+    r = Q->run[victim].load();
+    uint32_t head = r >> 32, tail = (uint32_t) r;
+    if(head >= tail)
+      continue;
+
+    uint32_t split = tail - (tail - head + 1) / 2;
+    if(Q->run[victim].compare_exchange_strong(r, RAY_TILE_RUN(head, split))) {
+      /* keep the first stolen tile, the rest becomes our new run */
+      own = RAY_TILE_RUN(split + 1, tail);
+      return split;
+    }
+  }
+}
+#else
+struct _CRayTileQueue {
+  int x_start, x_stop, y_start, y_stop;
+  int size, n_col, n_tile;
+  int n_done;
 };
+#define RayTileQueueNew(x0, x1, y0, y1, size, n_thread) ((CRayTileQueue *) NULL)
+#define RayTileQueueReset(Q)
+#define RayTileQueueFree(Q)
+#define RayTileQueuePop(Q, phase) (-1)
+#endif
+
+/*
+ * Iterates the scan line segments one thread has to render: either every
+ * n_thread-th scan line of the full region, or the rows of the tiles it
+ * pulls from the tile queue.
+ */
+typedef struct {
+  CRayTileQueue *tiles;
+  int phase, n_thread;
+  int x_start, x_stop, y_start, y_stop;
+  int offset;
+  int yy;                       /* scan line counter (interleaved mode) */
+  int tile;                     /* current tile (tile mode) */
+  int y_end;
+  /* current scan line segment */
+  int y, x0, x1;
+  /* approximate number of rows completed, for progress reporting */
+  int progress;
+  int new_block;
+} CRayRowCursor;
+
+static void RayRowCursorInit(CRayRowCursor * c, CRayTileQueue * tiles, int phase,
+                             int n_thread, int x_start, int x_stop, int y_start,
+                             int y_stop)
+{
+  int height = y_stop - y_start;
+  c->tiles = tiles;
+  c->phase = phase;
+  c->n_thread = n_thread;
+  c->x_start = x_start;
+  c->x_stop = x_stop;
+  c->y_start = y_start;
+  c->y_stop = y_stop;
+  c->offset = 0;
+  if(height) {
+    c->offset = (phase * height / n_thread);
+    c->offset = c->offset - (c->offset % n_thread) + phase;
+  }
+  c->yy = y_start - 1;
+  c->tile = -1;
+  c->y = c->y_end = 0;
+  c->progress = 0;
+}
+
+static int RayRowCursorNext(CRayRowCursor * c)
+{
+  c->new_block = false;
+
+  if(!c->tiles) {
+    int height = c->y_stop - c->y_start;
+    while(++c->yy < c->y_stop) {
+      /* make sure threads write to different pages */
+      c->y = c->y_start + ((c->yy - c->y_start) + c->offset) % height;
+      c->progress = c->y - c->y_start;
+      c->new_block = !(c->yy & 0xF);
+      if((c->y % c->n_thread) == c->phase) {      /* this is my scan line */
+        c->x0 = c->x_start;
+        c->x1 = c->x_stop;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  if(c->tile >= 0) {
+    if(++c->y < c->y_end)
+      return true;
+    c->tiles->n_done++;
+  }
+
+  if((c->tile = RayTileQueuePop(c->tiles, c->phase)) < 0)
+    return false;
+
+  {
+    CRayTileQueue *Q = c->tiles;
+    int row = c->tile / Q->n_col, col = c->tile % Q->n_col;
+    c->x0 = Q->x_start + col * Q->size;
+    c->x1 = c->x0 + Q->size;
+    if(c->x1 > Q->x_stop)
+      c->x1 = Q->x_stop;
+    c->y = Q->y_start + row * Q->size;
+    c->y_end = c->y + Q->size;
+    if(c->y_end > Q->y_stop)
+      c->y_end = Q->y_stop;
+    c->progress = (int) ((Q->n_done * (int64_t) (Q->y_stop - Q->y_start)) / Q->n_tile);
+    c->new_block = true;
+  }
+  return true;
+}
 
 void RayRelease(CRay * I);
 
@@ -486,32 +707,32 @@ int RayExpandPrimitives(CRay * I)
       basis->Vert2Normal[nVert] = nNorm;
       basis->Vert2Normal[nVert + 1] = nNorm;
       basis->Vert2Normal[nVert + 2] = nNorm;
-      n1 = I->Primitive[a].n0;
+      n1 = I->primN0(I->Primitive + a);
       (*n0++) = (*n1++);
       (*n0++) = (*n1++);
       (*n0++) = (*n1++);
-      n1 = I->Primitive[a].n1;
+      n1 = I->primN1(I->Primitive + a);
       (*n0++) = (*n1++);
       (*n0++) = (*n1++);
       (*n0++) = (*n1++);
-      n1 = I->Primitive[a].n2;
+      n1 = I->primN2(I->Primitive + a);
       (*n0++) = (*n1++);
       (*n0++) = (*n1++);
       (*n0++) = (*n1++);
-      n1 = I->Primitive[a].n3;
+      n1 = I->primN3(I->Primitive + a);
       (*n0++) = (*n1++);
       (*n0++) = (*n1++);
       (*n0++) = (*n1++);
       nNorm += 4;
-      v1 = I->Primitive[a].v1;
+      v1 = I->primV1(I->Primitive + a);
       (*v0++) = (*v1++);
       (*v0++) = (*v1++);
       (*v0++) = (*v1++);
-      v1 = I->Primitive[a].v2;
+      v1 = I->primV2(I->Primitive + a);
       (*v0++) = (*v1++);
       (*v0++) = (*v1++);
       (*v0++) = (*v1++);
-      v1 = I->Primitive[a].v3;
+      v1 = I->primV3(I->Primitive + a);
       (*v0++) = (*v1++);
       (*v0++) = (*v1++);
       (*v0++) = (*v1++);
@@ -520,7 +741,7 @@ int RayExpandPrimitives(CRay * I)
     case cPrimSphere:
       I->Primitive[a].vert = nVert;
       I->Vert2Prim[nVert] = a;
-      v1 = I->Primitive[a].v1;
+      v1 = I->primV1(I->Primitive + a);
       basis->Radius[nVert] = I->Primitive[a].r1;
       basis->Radius2[nVert] = I->Primitive[a].r1 * I->Primitive[a].r1;  /*precompute */
       if(basis->Radius[nVert] > basis->MaxRadius)
@@ -533,7 +754,7 @@ int RayExpandPrimitives(CRay * I)
     case cPrimEllipsoid:
       I->Primitive[a].vert = nVert;
       I->Vert2Prim[nVert] = a;
-      v1 = I->Primitive[a].v1;
+      v1 = I->primV1(I->Primitive + a);
       basis->Radius[nVert] = I->Primitive[a].r1;
       basis->Radius2[nVert] = I->Primitive[a].r1 * I->Primitive[a].r1;  /*precompute */
       if(basis->Radius[nVert] > basis->MaxRadius)
@@ -543,15 +764,15 @@ int RayExpandPrimitives(CRay * I)
       (*v0++) = (*v1++);
       (*v0++) = (*v1++);
       nVert++;
-      n1 = I->Primitive[a].n1;
+      n1 = I->primN1(I->Primitive + a);
       (*n0++) = (*n1++);
       (*n0++) = (*n1++);
       (*n0++) = (*n1++);
-      n1 = I->Primitive[a].n2;
+      n1 = I->primN2(I->Primitive + a);
       (*n0++) = (*n1++);
       (*n0++) = (*n1++);
       (*n0++) = (*n1++);
-      n1 = I->Primitive[a].n3;
+      n1 = I->primN3(I->Primitive + a);
       (*n0++) = (*n1++);
       (*n0++) = (*n1++);
       (*n0++) = (*n1++);
@@ -566,13 +787,13 @@ int RayExpandPrimitives(CRay * I)
       basis->Radius2[nVert] = I->Primitive[a].r1 * I->Primitive[a].r1;  /*precompute */
       if(basis->MinVoxel < voxel_floor)
         basis->MinVoxel = voxel_floor;
-      subtract3f(I->Primitive[a].v2, I->Primitive[a].v1, n0);
+      subtract3f(I->primV2(I->Primitive + a), I->primV1(I->Primitive + a), n0);
       I->Primitive[a].l1 = (float) length3f(n0);
       normalize3f(n0);
       n0 += 3;
       basis->Vert2Normal[nVert] = nNorm;
       nNorm++;
-      v1 = I->Primitive[a].v1;
+      v1 = I->primV1(I->Primitive + a);
       (*v0++) = (*v1++);
       (*v0++) = (*v1++);
       (*v0++) = (*v1++);
@@ -954,7 +1175,7 @@ G3dPrimitive *RayRenderG3d(CRay * I, int width, int height,
       jp->x1 = convert_x(vert[0]);
       jp->y1 = convert_y(vert[1]);
       jp->z1 = convert_z(vert[2]);
-      jp->c = convert_col(prim->c1);
+      jp->c = convert_col(I->color(prim->c1));
       n_jp++;
       break;
     case cPrimSausage:
@@ -972,7 +1193,7 @@ G3dPrimitive *RayRenderG3d(CRay * I, int width, int height,
       jp->x2 = convert_x(vert2[0]);
       jp->y2 = convert_y(vert2[1]);
       jp->z2 = convert_z(vert2[2]);
-      jp->c = convert_col(prim->c1);
+      jp->c = convert_col(I->color(prim->c1));
       n_jp++;
       break;
     case cPrimTriangle:
@@ -988,7 +1209,7 @@ G3dPrimitive *RayRenderG3d(CRay * I, int width, int height,
       jp->x3 = convert_x(vert[6]);
       jp->y3 = convert_y(vert[7]);
       jp->z3 = convert_z(vert[8]);
-      jp->c = convert_col(prim->c1);
+      jp->c = convert_col(I->color(prim->c1));
       n_jp++;
       break;
     }
@@ -1041,7 +1262,7 @@ void RayRenderVRML1(CRay * I, int width, int height,
       case cPrimSphere:
         sprintf(buffer,
                 "Material {\ndiffuseColor %6.4f %6.4f %6.4f\n}\n\n",
-                prim->c1[0], prim->c1[1], prim->c1[2]);
+                I->color(prim->c1)[0], I->color(prim->c1)[1], I->color(prim->c1)[2]);
         UtilConcatVLA(&vla, &cc, buffer);
         UtilConcatVLA(&vla, &cc, "Separator {\n");
         sprintf(buffer,
@@ -1067,15 +1288,15 @@ void RayRenderVRML1(CRay * I, int width, int height,
   *vla_ptr = vla;
 }
 
-int TriangleReverse(CPrimitive * p)
+int TriangleReverse(CRay * I, CPrimitive * p)
 {
   float s1[3], s2[3], n0[3];
 
-  subtract3f(p->v1, p->v2, s1);
-  subtract3f(p->v3, p->v2, s2);
+  subtract3f(I->primV1(p), I->primV2(p), s1);
+  subtract3f(I->primV3(p), I->primV2(p), s2);
   cross_product3f(s1, s2, n0);
 
-  if(dot_product3f(p->n0, n0) < 0.0F)
+  if(dot_product3f(I->primN0(p), n0) < 0.0F)
     return 0;
   else
     return 1;
@@ -1199,7 +1420,7 @@ void RayRenderVRML2(CRay * I, int width, int height,
         UtilConcatVLA(&vla, &cc, "   ]\n" "  }\n" "  coordIndex [\n");
         for(b = mesh_start; b < a; b++) {
           cprim = I->Primitive + b;
-          if(TriangleReverse(cprim))
+          if(TriangleReverse(I, cprim))
             sprintf(buffer, "%d %d %d -1,\n", tri, tri + 2, tri + 1);
           else
             sprintf(buffer, "%d %d %d -1,\n", tri, tri + 1, tri + 2);
@@ -1217,9 +1438,9 @@ void RayRenderVRML2(CRay * I, int width, int height,
                   "%6.4f %6.4f %6.4f,\n"
                   "%6.4f %6.4f %6.4f,\n"
                   "%6.4f %6.4f %6.4f,\n",
-                  cprim->c1[0], cprim->c1[1], cprim->c1[2],
-                  cprim->c2[0], cprim->c2[1], cprim->c2[2],
-                  cprim->c3[0], cprim->c3[1], cprim->c3[2]);
+                  I->color(cprim->c1)[0], I->color(cprim->c1)[1], I->color(cprim->c1)[2],
+                  I->color(cprim->c2)[0], I->color(cprim->c2)[1], I->color(cprim->c2)[2],
+                  I->color(cprim->c3)[0], I->color(cprim->c3)[1], I->color(cprim->c3)[2]);
           UtilConcatVLA(&vla, &cc, buffer);
         }
 
@@ -1241,7 +1462,7 @@ void RayRenderVRML2(CRay * I, int width, int height,
         tri = 0;
         for(b = mesh_start; b < a; b++) {
           cprim = I->Primitive + b;
-          if(TriangleReverse(cprim))
+          if(TriangleReverse(I, cprim))
             sprintf(buffer, "%d %d %d -1,\n", tri, tri + 2, tri + 1);
           else
             sprintf(buffer, "%d %d %d -1,\n", tri, tri + 1, tri + 2);
@@ -1270,7 +1491,7 @@ void RayRenderVRML2(CRay * I, int width, int height,
                 "}\n",
                 vert[0] - mid[0],
                 vert[1] - mid[1],
-                vert[2] - mid[2], prim->r1, prim->c1[0], prim->c1[1], prim->c1[2]);
+                vert[2] - mid[2], prim->r1, I->color(prim->c1)[0], I->color(prim->c1)[1], I->color(prim->c1)[2]);
         UtilConcatVLA(&vla, &cc, buffer);
         break;
       case cPrimCone:
@@ -1328,8 +1549,8 @@ void RayRenderVRML2(CRay * I, int width, int height,
                     "                       shininess 0.8 }\n"
                     "   }\n",
                     prim->r1, prim->l1,
-                    (prim->c1[0] + prim->c2[0]) / 2,
-                    (prim->c1[1] + prim->c2[1]) / 2, (prim->c1[2] + prim->c2[2]) / 2);
+                    (I->color(prim->c1)[0] + I->color(prim->c2)[0]) / 2,
+                    (I->color(prim->c1)[1] + I->color(prim->c2)[1]) / 2, (I->color(prim->c1)[2] + I->color(prim->c2)[2]) / 2);
             /* WLD: format string split to comply with ISO C89 standards */
             sprintf(geom_add,
                     "  }\n"
@@ -1343,7 +1564,7 @@ void RayRenderVRML2(CRay * I, int width, int height,
                     "                       shininess 0.8 }\n"
                     "    }\n"
                     "   }\n"
-                    "  }\n", prim->l1 / 2, prim->r1, prim->c1[0], prim->c1[1], prim->c1[2]
+                    "  }\n", prim->l1 / 2, prim->r1, I->color(prim->c1)[0], I->color(prim->c1)[1], I->color(prim->c1)[2]
               );
             strcat(geometry, geom_add);
             /* WLD: format string split to comply with ISO C89 standards */
@@ -1359,7 +1580,7 @@ void RayRenderVRML2(CRay * I, int width, int height,
                     "    }\n"
                     "   }\n"
                     "  }\n",
-                    -prim->l1 / 2, prim->r1, prim->c2[0], prim->c2[1], prim->c2[2]);
+                    -prim->l1 / 2, prim->r1, I->color(prim->c2)[0], I->color(prim->c2)[1], I->color(prim->c2)[2]);
             strcat(geometry, geom_add);
           } else {
             sprintf(geometry,
@@ -1375,8 +1596,8 @@ void RayRenderVRML2(CRay * I, int width, int height,
                     "   }\n"
                     "  }\n",
                     prim->r1, prim->l1,
-                    (prim->c1[0] + prim->c2[0]) / 2,
-                    (prim->c1[1] + prim->c2[1]) / 2, (prim->c1[2] + prim->c2[2]) / 2);
+                    (I->color(prim->c1)[0] + I->color(prim->c2)[0]) / 2,
+                    (I->color(prim->c1)[1] + I->color(prim->c2)[1]) / 2, (I->color(prim->c1)[2] + I->color(prim->c2)[2]) / 2);
           }
           sprintf(buffer,
                   "Transform {\n"
@@ -1414,7 +1635,7 @@ void RayRenderVRML2(CRay * I, int width, int height,
       UtilConcatVLA(&vla, &cc, "   ]\n" "  }\n" "  coordIndex [\n");
       for(b = mesh_start; b < a; b++) {
         cprim = I->Primitive + b;
-        if(TriangleReverse(cprim))
+        if(TriangleReverse(I, cprim))
           sprintf(buffer, "%d %d %d -1,\n", tri, tri + 2, tri + 1);
         else
           sprintf(buffer, "%d %d %d -1,\n", tri, tri + 1, tri + 2);
@@ -1431,9 +1652,9 @@ void RayRenderVRML2(CRay * I, int width, int height,
                 "%6.4f %6.4f %6.4f,\n"
                 "%6.4f %6.4f %6.4f,\n"
                 "%6.4f %6.4f %6.4f,\n",
-                cprim->c1[0], cprim->c1[1], cprim->c1[2],
-                cprim->c2[0], cprim->c2[1], cprim->c2[2],
-                cprim->c3[0], cprim->c3[1], cprim->c3[2]);
+                I->color(cprim->c1)[0], I->color(cprim->c1)[1], I->color(cprim->c1)[2],
+                I->color(cprim->c2)[0], I->color(cprim->c2)[1], I->color(cprim->c2)[2],
+                I->color(cprim->c3)[0], I->color(cprim->c3)[1], I->color(cprim->c3)[2]);
         UtilConcatVLA(&vla, &cc, buffer);
       }
 
@@ -1455,7 +1676,7 @@ void RayRenderVRML2(CRay * I, int width, int height,
       tri = 0;
       for(b = mesh_start; b < a; b++) {
         cprim = I->Primitive + b;
-        if(TriangleReverse(cprim))
+        if(TriangleReverse(I, cprim))
           sprintf(buffer, "%d %d %d -1,\n", tri, tri + 2, tri + 1);
         else
           sprintf(buffer, "%d %d %d -1,\n", tri, tri + 1, tri + 2);
@@ -2120,7 +2341,7 @@ void RayRenderIDTF(CRay * I, char **node_vla, char **rsrc_vla)
 
               float *vert = base->Vertex + 3 * (prim->vert);
               float *norm = base->Normal + 3 * base->Vert2Normal[prim->vert] + 3;
-              int reverse = TriangleReverse(prim);
+              int reverse = TriangleReverse(I, prim);
               int face_position_count = mesh->face_count * 3;
               int face_normal_count = face_position_count;
               int face_color_count = face_position_count;
@@ -2131,7 +2352,7 @@ void RayRenderIDTF(CRay * I, char **node_vla, char **rsrc_vla)
               unique_vector_add(mesh->normal_hash, norm,
                                 mesh->model_normal_list, &mesh->normal_count,
                                 mesh->face_normal_list, &face_normal_count);
-              unique_color_add(mesh->normal_hash, prim->c1,
+              unique_color_add(mesh->normal_hash, I->color(prim->c1),
                                mesh->model_diffuse_color_list, &mesh->color_count,
                                mesh->face_color_list, &face_color_count,
                                1.0F - prim->trans);
@@ -2144,7 +2365,7 @@ void RayRenderIDTF(CRay * I, char **node_vla, char **rsrc_vla)
                 unique_vector_add(mesh->normal_hash, norm,
                                   mesh->model_normal_list, &mesh->normal_count,
                                   mesh->face_normal_list, &face_normal_count);
-                unique_color_add(mesh->normal_hash, prim->c3,
+                unique_color_add(mesh->normal_hash, I->color(prim->c3),
                                  mesh->model_diffuse_color_list, &mesh->color_count,
                                  mesh->face_color_list, &face_color_count,
                                  1.0F - prim->trans);
@@ -2156,7 +2377,7 @@ void RayRenderIDTF(CRay * I, char **node_vla, char **rsrc_vla)
                 unique_vector_add(mesh->normal_hash, norm,
                                   mesh->model_normal_list, &mesh->normal_count,
                                   mesh->face_normal_list, &face_normal_count);
-                unique_color_add(mesh->normal_hash, prim->c2,
+                unique_color_add(mesh->normal_hash, I->color(prim->c2),
                                  mesh->model_diffuse_color_list, &mesh->color_count,
                                  mesh->face_color_list, &face_color_count,
                                  1.0F - prim->trans);
@@ -2169,7 +2390,7 @@ void RayRenderIDTF(CRay * I, char **node_vla, char **rsrc_vla)
                 unique_vector_add(mesh->normal_hash, norm,
                                   mesh->model_normal_list, &mesh->normal_count,
                                   mesh->face_normal_list, &face_normal_count);
-                unique_color_add(mesh->normal_hash, prim->c2,
+                unique_color_add(mesh->normal_hash, I->color(prim->c2),
                                  mesh->model_diffuse_color_list, &mesh->color_count,
                                  mesh->face_color_list, &face_color_count,
                                  1.0F - prim->trans);
@@ -2181,7 +2402,7 @@ void RayRenderIDTF(CRay * I, char **node_vla, char **rsrc_vla)
                 unique_vector_add(mesh->normal_hash, norm,
                                   mesh->model_normal_list, &mesh->normal_count,
                                   mesh->face_normal_list, &face_normal_count);
-                unique_color_add(mesh->normal_hash, prim->c3,
+                unique_color_add(mesh->normal_hash, I->color(prim->c3),
                                  mesh->model_diffuse_color_list, &mesh->color_count,
                                  mesh->face_color_list, &face_color_count,
                                  1.0F - prim->trans);
@@ -2329,7 +2550,7 @@ void RayRenderObjMtl(CRay * I, int width, int height, char **objVLA_ptr,
         UtilConcatVLA(&objVLA, &oc, buffer);
         sprintf(buffer, "vn %8.6f %8.6f %8.6f\n", norm[6], norm[7], norm[8]);
         UtilConcatVLA(&objVLA, &oc, buffer);
-        if(TriangleReverse(prim)) {
+        if(TriangleReverse(I, prim)) {
           sprintf(buffer, "f %d//%d %d//%d %d//%d\n",
                   vc + 1, nc + 1, vc + 3, nc + 3, vc + 2, nc + 2);
         } else {
@@ -2341,9 +2562,9 @@ void RayRenderObjMtl(CRay * I, int width, int height, char **objVLA_ptr,
         vc += 3;
 
         /*
-           prim->c1[0],prim->c1[1],prim->c1[2])
-           prim->c2[0],prim->c2[1],prim->c2[2],
-           prim->c3[0],prim->c3[1],prim->c3[2]
+           I->color(prim->c1)[0],I->color(prim->c1)[1],I->color(prim->c1)[2])
+           I->color(prim->c2)[0],I->color(prim->c2)[1],I->color(prim->c2)[2],
+           I->color(prim->c3)[0],I->color(prim->c3)[1],I->color(prim->c3)[2]
            UtilConcatVLA(&vla,&oc,buffer);
            UtilConcatVLA(&vla,&oc,buffer);
          */
@@ -2576,7 +2797,7 @@ void RayRenderPOV(CRay * I, int width, int height, char **headerVLA_ptr,
               vert[0], vert[1], vert[2], prim->r1);
       UtilConcatVLA(&charVLA, &cc, buffer);
       sprintf(buffer, "pigment{color rgb<%6.4f,%6.4f,%6.4f>}}\n",
-              prim->c1[0], prim->c1[1], prim->c1[2]);
+              I->color(prim->c1)[0], I->color(prim->c1)[1], I->color(prim->c1)[2]);
       UtilConcatVLA(&charVLA, &cc, buffer);
       break;
     case cPrimCylinder:
@@ -2588,8 +2809,8 @@ void RayRenderPOV(CRay * I, int width, int height, char **headerVLA_ptr,
               vert[0], vert[1], vert[2], vert2[0], vert2[1], vert2[2], prim->r1);
       UtilConcatVLA(&charVLA, &cc, buffer);
       sprintf(buffer, "pigment{color rgb<%6.4f1,%6.4f,%6.4f>}}\n",
-              (prim->c1[0] + prim->c2[0]) / 2,
-              (prim->c1[1] + prim->c2[1]) / 2, (prim->c1[2] + prim->c2[2]) / 2);
+              (I->color(prim->c1)[0] + I->color(prim->c2)[0]) / 2,
+              (I->color(prim->c1)[1] + I->color(prim->c2)[1]) / 2, (I->color(prim->c1)[2] + I->color(prim->c2)[2]) / 2);
       UtilConcatVLA(&charVLA, &cc, buffer);
       break;
     case cPrimSausage:
@@ -2601,22 +2822,22 @@ void RayRenderPOV(CRay * I, int width, int height, char **headerVLA_ptr,
               vert[0], vert[1], vert[2], vert2[0], vert2[1], vert2[2], prim->r1);
       UtilConcatVLA(&charVLA, &cc, buffer);
       sprintf(buffer, "pigment{color rgb<%6.4f1,%6.4f,%6.4f>}}\n",
-              (prim->c1[0] + prim->c2[0]) / 2,
-              (prim->c1[1] + prim->c2[1]) / 2, (prim->c1[2] + prim->c2[2]) / 2);
+              (I->color(prim->c1)[0] + I->color(prim->c2)[0]) / 2,
+              (I->color(prim->c1)[1] + I->color(prim->c2)[1]) / 2, (I->color(prim->c1)[2] + I->color(prim->c2)[2]) / 2);
       UtilConcatVLA(&charVLA, &cc, buffer);
 
       sprintf(buffer, "sphere{<%12.10f,%12.10f,%12.10f>, %12.10f\n",
               vert[0], vert[1], vert[2], prim->r1);
       UtilConcatVLA(&charVLA, &cc, buffer);
       sprintf(buffer, "pigment{color rgb<%6.4f1,%6.4f,%6.4f>}}\n",
-              prim->c1[0], prim->c1[1], prim->c1[2]);
+              I->color(prim->c1)[0], I->color(prim->c1)[1], I->color(prim->c1)[2]);
       UtilConcatVLA(&charVLA, &cc, buffer);
 
       sprintf(buffer, "sphere{<%12.10f,%12.10f,%12.10f>, %12.10f\n",
               vert2[0], vert2[1], vert2[2], prim->r1);
       UtilConcatVLA(&charVLA, &cc, buffer);
       sprintf(buffer, "pigment{color rgb<%6.4f1,%6.4f,%6.4f>}}\n",
-              prim->c2[0], prim->c2[1], prim->c2[2]);
+              I->color(prim->c2)[0], I->color(prim->c2)[1], I->color(prim->c2)[2]);
       UtilConcatVLA(&charVLA, &cc, buffer);
 
       break;
@@ -2628,11 +2849,11 @@ void RayRenderPOV(CRay * I, int width, int height, char **headerVLA_ptr,
         if(smooth_color_triangle) {
           sprintf(buffer,
                   "smooth_color_triangle{<%12.10f,%12.10f,%12.10f>,\n<%12.10f,%12.10f,%12.10f>,\n<%6.4f1,%6.4f,%6.4f>,\n<%12.10f,%12.10f,%12.10f>,\n<%12.10f,%12.10f,%12.10f>,\n<%6.4f1,%6.4f,%6.4f>,\n<%12.10f,%12.10f,%12.10f>,\n<%12.10f,%12.10f,%12.10f>,\n<%6.4f1,%6.4f,%6.4f> }\n",
-                  vert[0], vert[1], vert[2], norm[0], norm[1], norm[2], prim->c1[0],
-                  prim->c1[1], prim->c1[2], vert[3], vert[4], vert[5], norm[3], norm[4],
-                  norm[5], prim->c2[0], prim->c2[1], prim->c2[2], vert[6], vert[7],
-                  vert[8], norm[6], norm[7], norm[8], prim->c3[0], prim->c3[1],
-                  prim->c3[2]
+                  vert[0], vert[1], vert[2], norm[0], norm[1], norm[2], I->color(prim->c1)[0],
+                  I->color(prim->c1)[1], I->color(prim->c1)[2], vert[3], vert[4], vert[5], norm[3], norm[4],
+                  norm[5], I->color(prim->c2)[0], I->color(prim->c2)[1], I->color(prim->c2)[2], vert[6], vert[7],
+                  vert[8], norm[6], norm[7], norm[8], I->color(prim->c3)[0], I->color(prim->c3)[1],
+                  I->color(prim->c3)[2]
             );
           UtilConcatVLA(&charVLA, &cc, buffer);
         } else {
@@ -2656,15 +2877,15 @@ void RayRenderPOV(CRay * I, int width, int height, char **headerVLA_ptr,
           UtilConcatVLA(&charVLA, &cc, buffer);
 
           sprintf(buffer, "texture { pigment{color rgb<%6.4f1,%6.4f,%6.4f> %s}}\n",
-                  prim->c1[0], prim->c1[1], prim->c1[2], transmit);
+                  I->color(prim->c1)[0], I->color(prim->c1)[1], I->color(prim->c1)[2], transmit);
           UtilConcatVLA(&charVLA, &cc, buffer);
 
           sprintf(buffer, ",texture { pigment{color rgb<%6.4f1,%6.4f,%6.4f> %s}}\n",
-                  prim->c2[0], prim->c2[1], prim->c2[2], transmit);
+                  I->color(prim->c2)[0], I->color(prim->c2)[1], I->color(prim->c2)[2], transmit);
           UtilConcatVLA(&charVLA, &cc, buffer);
 
           sprintf(buffer, ",texture { pigment{color rgb<%6.4f1,%6.4f,%6.4f> %s}} }\n",
-                  prim->c3[0], prim->c3[1], prim->c3[2], transmit);
+                  I->color(prim->c3)[0], I->color(prim->c3)[1], I->color(prim->c3)[2], transmit);
           UtilConcatVLA(&charVLA, &cc, buffer);
 
           sprintf(buffer, "face_indices { 1, <0,1,2>, 0, 1, 2 } }\n");
@@ -2726,66 +2947,231 @@ void RayProjectTriangle(CRay * I, RayInfo * r, float *light, float *v0, float *n
   }
 }
 
+static void RayHashTask(void *data, int index)
+{
+  RayHashThread(((CRayHashThreadInfo *) data) + index);
+}
+
+static void RayTraceTask(void *data, int index)
+{
+  RayTraceThread(((CRayThreadInfo *) data) + index);
+}
+
+static void RayAntiTask(void *data, int index)
+{
+  RayAntiThread(((CRayAntiThreadInfo *) data) + index);
+}
+
+/*
+ * Should the ray tracing phases run on the native thread pool? Otherwise
+ * they are dispatched through Python threads (cmd._ray_*_spawn).
+ */
+static int RayUseThreadPool(PyMOLGlobals * G)
+{
+  if(!ThreadPoolIsNative())
+    return false;
 #ifndef _PYMOL_NOPY
+  if(!SettingGetGlobal_b(G, cSetting_ray_native_threads))
+    return false;
+#endif
+  return true;
+}
+
 static void RayHashSpawn(CRayHashThreadInfo * Thread, int n_thread, int n_total)
 {
-  int blocked;
-  PyObject *info_list;
-  int a, c, n = 0;
   CRay *I = Thread->ray;
   PyMOLGlobals *G = I->G;
 
-  blocked = PAutoBlock(G);
-
   PRINTFB(I->G, FB_Ray, FB_Blather)
     " Ray: filling voxels with %d threads...\n", n_thread ENDFB(I->G);
-  while(n < n_total) {
-    c = n;
-    info_list = PyList_New(n_thread);
-    for(a = 0; a < n_thread; a++) {
-      if((c + a) < n_total) {
-        PyList_SetItem(info_list, a, PyCObject_FromVoidPtr(Thread + c + a, NULL));
-      } else {
-        PyList_SetItem(info_list, a, PConvAutoNone(NULL));
+
+  if(RayUseThreadPool(G)) {
+    ThreadPoolRun(G, n_thread, n_total, RayHashTask, Thread);
+    return;
+  }
+#ifndef _PYMOL_NOPY
+  {
+    int blocked;
+    PyObject *info_list;
+    int a, c, n = 0;
+
+    blocked = PAutoBlock(G);
+
+    while(n < n_total) {
+      c = n;
+      info_list = PyList_New(n_thread);
+      for(a = 0; a < n_thread; a++) {
+        if((c + a) < n_total) {
+          PyList_SetItem(info_list, a, PyCObject_FromVoidPtr(Thread + c + a, NULL));
+        } else {
+          PyList_SetItem(info_list, a, PConvAutoNone(NULL));
+        }
+        n++;
       }
-      n++;
+      PXDecRef(PYOBJECT_CALLMETHOD
+               (G->P_inst->cmd, "_ray_hash_spawn", "OO", info_list, G->P_inst->cmd));
+      Py_DECREF(info_list);
     }
-    PXDecRef(PYOBJECT_CALLMETHOD
-             (G->P_inst->cmd, "_ray_hash_spawn", "OO", info_list, G->P_inst->cmd));
-    Py_DECREF(info_list);
+    PAutoUnblock(G, blocked);
   }
-  PAutoUnblock(G, blocked);
-}
 #endif
+}
 
-#ifndef _PYMOL_NOPY
 static void RayAntiSpawn(CRayAntiThreadInfo * Thread, int n_thread)
 {
-  int blocked;
-  PyObject *info_list;
-  int a;
   CRay *I = Thread->ray;
   PyMOLGlobals *G = I->G;
 
-  blocked = PAutoBlock(G);
-
   PRINTFB(I->G, FB_Ray, FB_Blather)
     " Ray: antialiasing with %d threads...\n", n_thread ENDFB(I->G);
-  info_list = PyList_New(n_thread);
-  for(a = 0; a < n_thread; a++) {
-    PyList_SetItem(info_list, a, PyCObject_FromVoidPtr(Thread + a, NULL));
-  }
-  PXDecRef(PYOBJECT_CALLMETHOD
-           (G->P_inst->cmd, "_ray_anti_spawn", "OO", info_list, G->P_inst->cmd));
-  Py_DECREF(info_list);
-  PAutoUnblock(G, blocked);
-}
+
+  if(RayUseThreadPool(G)) {
+    ThreadPoolRun(G, n_thread, n_thread, RayAntiTask, Thread);
+    return;
+  }
+#ifndef _PYMOL_NOPY
+  {
+    int blocked;
+    PyObject *info_list;
+    int a;
+
+    blocked = PAutoBlock(G);
+
+    info_list = PyList_New(n_thread);
+    for(a = 0; a < n_thread; a++) {
+      PyList_SetItem(info_list, a, PyCObject_FromVoidPtr(Thread + a, NULL));
+    }
+    PXDecRef(PYOBJECT_CALLMETHOD
+             (G->P_inst->cmd, "_ray_anti_spawn", "OO", info_list, G->P_inst->cmd));
+    Py_DECREF(info_list);
+    PAutoUnblock(G, blocked);
+  }
 #endif
+}
+
+/*
+ * Acceleration structures kept between RayRender calls (ray_bvh_reuse).
+ * BVHs are view independent in topology, so if the world space geometry
+ * is unchanged (e.g. movie spins) they are just refitted to the new camera
+ * and light space vertices instead of being rebuilt.
+ */
+struct _CRayCache {
+  uint64_t key;
+  int n_primitive;
+  BasisBVH *BVH[MAX_BASIS];
+};
+
+static void RayCacheClear(CRayCache * C)
+{
+  int a;
+  for(a = 0; a < MAX_BASIS; a++) {
+    BasisBVHFree(C->BVH[a]);
+    C->BVH[a] = NULL;
+  }
+  C->key = 0;
+  C->n_primitive = 0;
+}
+
+void RayCacheFree(PyMOLGlobals * G)
+{
+  if(G->RayCache) {
+    RayCacheClear(G->RayCache);
+    FreeP(G->RayCache);
+  }
+}
+
+static uint64_t RayHashBytes(uint64_t h, const void *data, size_t n)
+{
+  const unsigned char *p = (const unsigned char *) data;
+  size_t i;
+  uint64_t w;
+  for(i = 0; i + 8 <= n; i += 8) {
+    memcpy(&w, p + i, 8);
+    h = (h ^ w) * 0x100000001b3ULL;
+    h ^= h >> 29;
+  }
+  for(; i < n; i++)
+    h = (h ^ p[i]) * 0x100000001b3ULL;
+  return h;
+}
+
+/* hash of the world space primitive geometry (before RayExpandPrimitives).
+ * Labels face the camera, so only their glyphs count: when just the view
+ * changes their quads move and the kept BVHs are refitted around them. */
+static uint64_t RayGeometryKey(CRay * I)
+{
+  uint64_t h = 0xcbf29ce484222325ULL ^ (uint64_t) I->NPrimitive;
+  int a;
+
+  for(a = 0; a < I->NPrimitive; a++) {
+    const CPrimitive *prim = I->Primitive + a;
+    int geom_end = (a + 1 < I->NPrimitive) ? prim[1].geom : I->NPrimGeom;
+    if(prim->type == cPrimCharacter) {
+      h = RayHashBytes(h, &prim->type, sizeof(prim->type));
+      h = RayHashBytes(h, &prim->char_id, sizeof(prim->char_id));
+    } else {
+      h = RayHashBytes(h, prim, sizeof(CPrimitive));
+      h = RayHashBytes(h, I->PrimGeom + prim->geom,
+                       sizeof(float) * (geom_end - prim->geom));
+    }
+  }
+  return h;
+}
+
+/* hands the BVHs of the previous frame to the bases if the geometry matches */
+static void RayCacheRestore(CRay * I, uint64_t key)
+{
+  CRayCache *C = I->G->RayCache;
+  int bc;
+  if(!C)
+    return;
+  if((C->key == key) && (C->n_primitive == I->NPrimitive)) {
+    for(bc = 1; bc < I->NBasis; bc++) {
+      BasisBVHFree(I->Basis[bc].BVH);
+      I->Basis[bc].BVH = C->BVH[bc];
+      C->BVH[bc] = NULL;
+    }
+  }
+  RayCacheClear(C);
+}
+
+/* takes over the BVHs of this frame for the next one */
+static void RayCacheStore(CRay * I, uint64_t key)
+{
+  CRayCache *C = I->G->RayCache;
+  int bc;
+  if(!C) {
+    C = I->G->RayCache = Calloc(CRayCache, 1);
+    if(!C)
+      return;
+  }
+  RayCacheClear(C);
+  for(bc = 1; bc < I->NBasis; bc++) {
+    C->BVH[bc] = I->Basis[bc].BVH;
+    I->Basis[bc].BVH = NULL;
+  }
+  C->key = key;
+  C->n_primitive = I->NPrimitive;
+}
+
+/* BVH for one basis: refits the one of the previous frame if possible.
+ * Returns 2 for a refit, 1 for a new BVH and 0 on failure. */
+static int RayBasisBVH(CBasis * basis, CPrimitive * prim, int n_prim, const int *vert2prim)
+{
+  if(basis->BVH && BasisRefitBVH(basis, prim, vert2prim))
+    return 2;
+  return BasisMakeBVH(basis, prim, n_prim) ? 1 : 0;
+}
 
 int RayHashThread(CRayHashThreadInfo * T)
 {
-  BasisMakeMap(T->basis, T->vert2prim, T->prim, T->n_prim, T->clipBox, T->phase,
-               cCache_ray_map, T->perspective, T->front, T->size_hint);
+  if(T->bvh)
+    T->refit = (RayBasisBVH(T->basis, T->prim, T->n_prim, T->vert2prim) == 2);
+  else
+    BasisMakeMap(T->basis, T->vert2prim, T->prim, T->n_prim, T->clipBox, T->phase,
+                 cCache_ray_map, T->perspective, T->front, T->size_hint);
+  if(T->simd)
+    BasisMakePacket(T->basis, T->prim, T->n_prim);
 
   /* utilize a little extra wasted CPU time in thread 0 which computes the smaller map... */
   if(!T->phase) {
@@ -2799,30 +3185,37 @@ int RayHashThread(CRayHashThreadInfo * T)
   return 1;
 }
 
-#ifndef _PYMOL_NOPY
 static void RayTraceSpawn(CRayThreadInfo * Thread, int n_thread)
 {
-  int blocked;
-  PyObject *info_list;
-  int a;
   CRay *I = Thread->ray;
   PyMOLGlobals *G = I->G;
 
-  blocked = PAutoBlock(G);
-
   PRINTFB(I->G, FB_Ray, FB_Blather)
     " Ray: rendering with %d threads...\n", n_thread ENDFB(I->G);
-  info_list = PyList_New(n_thread);
-  for(a = 0; a < n_thread; a++) {
-    PyList_SetItem(info_list, a, PyCObject_FromVoidPtr(Thread + a, NULL));
+
+  if(RayUseThreadPool(G)) {
+    ThreadPoolRun(G, n_thread, n_thread, RayTraceTask, Thread);
+    return;
   }
-  PXDecRef(PYOBJECT_CALLMETHOD
-           (G->P_inst->cmd, "_ray_spawn", "OO", info_list, G->P_inst->cmd));
-  Py_DECREF(info_list);
-  PAutoUnblock(G, blocked);
+#ifndef _PYMOL_NOPY
+  {
+    int blocked;
+    PyObject *info_list;
+    int a;
 
-}
+    blocked = PAutoBlock(G);
+
+    info_list = PyList_New(n_thread);
+    for(a = 0; a < n_thread; a++) {
+      PyList_SetItem(info_list, a, PyCObject_FromVoidPtr(Thread + a, NULL));
+    }
+    PXDecRef(PYOBJECT_CALLMETHOD
+             (G->P_inst->cmd, "_ray_spawn", "OO", info_list, G->P_inst->cmd));
+    Py_DECREF(info_list);
+    PAutoUnblock(G, blocked);
+  }
 #endif
+}
 
 static int find_edge(unsigned int *ptr, float *depth, unsigned int width,
                      int threshold, int back)
@@ -2940,10 +3333,12 @@ static int find_edge(unsigned int *ptr, float *depth, unsigned int width,
   return 0;
 }
 
-static void RayPrimGetColorRamped(PyMOLGlobals * G, float *matrix, RayInfo * r, float *fc)
+static void RayPrimGetColorRamped(PyMOLGlobals * G, float *matrix, RayInfo * r, float *fc,
+                                  const float *palette)
 {
   float fc1[3], fc2[3], fc3[3];
-  float *c1, *c2, *c3, w2;
+  const float *c1, *c2, *c3;
+  float w2;
   float back_pact[3];
   const float _0 = 0.0F, _1 = 1.0F, _01 = 0.1F;
   CPrimitive *lprim = r->prim;
@@ -2952,17 +3347,17 @@ static void RayPrimGetColorRamped(PyMOLGlobals * G, float *matrix, RayInfo * r,
   switch (lprim->type) {
   case cPrimTriangle:
     w2 = 1.0F - (r->tri1 + r->tri2);
-    c1 = lprim->c1;
+    c1 = palette + 3 * lprim->c1;
     if(c1[0] <= _0) {
       ColorGetRamped(G, (int) (c1[0] - _01), back_pact, fc1, -1);
       c1 = fc1;
     }
-    c2 = lprim->c2;
+    c2 = palette + 3 * lprim->c2;
     if(c2[0] <= _0) {
       ColorGetRamped(G, (int) (c2[0] - _01), back_pact, fc2, -1);
       c2 = fc2;
     }
-    c3 = lprim->c3;
+    c3 = palette + 3 * lprim->c3;
     if(c3[0] <= _0) {
       ColorGetRamped(G, (int) (c3[0] - _01), back_pact, fc3, -1);
       c3 = fc3;
@@ -2972,7 +3367,7 @@ static void RayPrimGetColorRamped(PyMOLGlobals * G, float *matrix, RayInfo * r,
     fc[2] = (c2[2] * r->tri1) + (c3[2] * r->tri2) + (c1[2] * w2);
     break;
   case cPrimSphere:
-    c1 = lprim->c1;
+    c1 = palette + 3 * lprim->c1;
     if(c1[0] <= _0) {
       ColorGetRamped(G, (int) (c1[0] - _01), back_pact, fc1, -1);
       c1 = fc1;
@@ -2986,12 +3381,12 @@ static void RayPrimGetColorRamped(PyMOLGlobals * G, float *matrix, RayInfo * r,
   case cPrimCylinder:
   case cPrimSausage:
     w2 = r->tri1;
-    c1 = lprim->c1;
+    c1 = palette + 3 * lprim->c1;
     if(c1[0] <= _0) {
       ColorGetRamped(G, (int) (c1[0] - _01), back_pact, fc1, -1);
       c1 = fc1;
     }
-    c2 = lprim->c2;
+    c2 = palette + 3 * lprim->c2;
     if(c2[0] <= _0) {
       ColorGetRamped(G, (int) (c2[0] - _01), back_pact, fc2, -1);
       c2 = fc2;
@@ -3063,8 +3458,10 @@ int RayTraceThread(CRayThreadInfo * T)
   float invWdthRange, vol0;
   float vol2;
   CBasis *bp1, *bp2;
-  int render_height;
-  int offset = 0;
+  CRayRowCursor cursor;
+  int step = (T->step > 1) ? T->step : 1;
+  int sparse = (step > 1) || T->skip;
+  int skip_row = false;
   BasisCallRec BasisCall[MAX_BASIS];
   float border_offset;
   int edge_sampling = false;
@@ -3307,12 +3704,8 @@ int RayTraceThread(CRayThreadInfo * T)
   else
     bp2 = NULL;
 
-  render_height = T->y_stop - T->y_start;
-
-  if(render_height) {
-    offset = (T->phase * render_height / T->n_thread);
-    offset = offset - (offset % T->n_thread) + T->phase;
-  }
+  RayRowCursorInit(&cursor, T->tiles, T->phase, T->n_thread,
+                   T->x_start, T->x_stop, T->y_start, T->y_stop);
   if((interior_color != -1) || I->CheckInterior) {
 
     if(interior_color != -1)
@@ -3335,6 +3728,8 @@ int RayTraceThread(CRayThreadInfo * T)
   BasisCall[0].rr = &r1;
   BasisCall[0].vert2prim = I->Vert2Prim;
   BasisCall[0].prim = I->Primitive;
+  BasisCall[0].geom = I->PrimGeom;
+  BasisCall[0].palette = I->Palette;
   BasisCall[0].shadow = false;
   BasisCall[0].back = T->back;
   BasisCall[0].trans_shadows = trans_shadows;
@@ -3343,7 +3738,8 @@ int RayTraceThread(CRayThreadInfo * T)
   BasisCall[0].fudge0 = BasisFudge0;
   BasisCall[0].fudge1 = BasisFudge1;
 
-  MapCacheInit(&BasisCall[0].cache, I->Basis[1].Map, T->phase, cCache_map_scene_cache);
+  BasisCacheInit(I->Basis + 1, &BasisCall[0].cache, T->phase, cCache_map_scene_cache);
+  BasisCall[0].packet = I->Basis[1].Packet ? Alloc(int, I->Basis[1].NVertex + 1) : NULL;
 
   if(shadows && (n_basis > 2)) {
     int bc;
@@ -3352,6 +3748,8 @@ int RayTraceThread(CRayThreadInfo * T)
       BasisCall[bc].rr = &r2;
       BasisCall[bc].vert2prim = I->Vert2Prim;
       BasisCall[bc].prim = I->Primitive;
+      BasisCall[bc].geom = I->PrimGeom;
+      BasisCall[bc].palette = I->Palette;
       BasisCall[bc].shadow = true;
       BasisCall[bc].front = _0;
       BasisCall[bc].back = _0;
@@ -3362,8 +3760,10 @@ int RayTraceThread(CRayThreadInfo * T)
       BasisCall[bc].fudge0 = BasisFudge0;
       BasisCall[bc].fudge1 = BasisFudge1;
       BasisCall[bc].label_shadow_mode = label_shadow_mode;
-      MapCacheInit(&BasisCall[bc].cache, I->Basis[bc].Map, T->phase,
-                   cCache_map_shadow_cache);
+      BasisCacheInit(I->Basis + bc, &BasisCall[bc].cache, T->phase,
+                     cCache_map_shadow_cache);
+      BasisCall[bc].packet = I->Basis[bc].Packet ?
+        Alloc(int, I->Basis[bc].NVertex + 1) : NULL;
     }
   }
 
@@ -3382,14 +3782,14 @@ int RayTraceThread(CRayThreadInfo * T)
       back_mask = 0x00000000;
     }
   }
-  for(yy = T->y_start; (yy < T->y_stop); yy++) {
+  while(RayRowCursorNext(&cursor)) {
     float perc, bkrd[4];
     unsigned int bkrd_value;
 
     if(I->G->Interrupt)
       break;
 
-    y = T->y_start + ((yy - T->y_start) + offset) % (render_height);    /* make sure threads write to different pages */
+    y = cursor.y;
     if (T->bkrd_is_gradient){
       /* for RayTraceThread, y is from bottom to top */
       perc = y/(float)T->height;
@@ -3419,23 +3819,33 @@ int RayTraceThread(CRayThreadInfo * T)
 	bkrd[3] = 0.f;
       }
     }
-    if((!T->phase) && !(yy & 0xF)) {    /* don't slow down rendering too much */
+    if((!T->phase) && cursor.new_block) {       /* don't slow down rendering too much */
+      yy = T->y_start + cursor.progress;
       if(T->edging_cutoff) {
         if(T->edging) {
-          OrthoBusyFast(I->G, (int) (2.5F * T->height / 3 + 0.5F * y), 4 * T->height / 3);
+          OrthoBusyFast(I->G, (int) (2.5F * T->height / 3 + 0.5F * yy), 4 * T->height / 3);
         } else {
-          OrthoBusyFast(I->G, (int) (T->height / 3 + 0.5F * y), 4 * T->height / 3);
+          OrthoBusyFast(I->G, (int) (T->height / 3 + 0.5F * yy), 4 * T->height / 3);
         }
       } else {
-        OrthoBusyFast(I->G, T->height / 3 + y, 4 * T->height / 3);
+        OrthoBusyFast(I->G, T->height / 3 + yy, 4 * T->height / 3);
       }
     }
-    pixel = T->image + (T->width * y) + T->x_start;
+    if(sparse) {
+      if(y % step)
+        continue;
+      skip_row = T->skip && !(y % T->skip);
+    }
+    pixel = T->image + (T->width * y) + cursor.x0;
 
-    if((y % T->n_thread) == T->phase) { /* this is my scan line */
+    {                           /* this is my scan line segment */
       pixel_base[1] = ((y + 0.5F + border_offset) * invHgtRange) + vol2;
 
-      for(x = T->x_start; (x < T->x_stop); x++) {
+      for(x = cursor.x0; (x < cursor.x1); x++) {
+        if(sparse && ((x % step) || (skip_row && !(x % T->skip)))) {
+          pixel++;              /* not in this pass */
+          continue;
+        }
         pixel_base[0] = (((x + 0.5F + border_offset)) * invWdthRange) + vol0;
 
         while(1) {
@@ -3617,7 +4027,7 @@ int RayTraceThread(CRayThreadInfo * T)
 
                 dotgle = -r1.dotgle;
                 if((interior_color < 0) && (interior_color > cColorExtCutoff)) {
-                  copy3f(r1.prim->ic, fc);
+                  copy3f(I->color(r1.prim->ic), fc);
                 } else {
                   copy3f(inter, fc);
                 }
@@ -3628,11 +4038,11 @@ int RayTraceThread(CRayThreadInfo * T)
                 switch (r1.prim->type) {
                 case cPrimTriangle:
 
-                  BasisGetTriangleNormal(bp1, &r1, i, fc, perspective);
+                  BasisGetTriangleNormal(bp1, &r1, i, fc, perspective, I->Palette);
                   r1.trans = (float) pow(r1.trans, inv_trans_cont);
 
                   if(r1.prim->ramped) {
-                    RayPrimGetColorRamped(I->G, I->ModelView, &r1, fc);
+                    RayPrimGetColorRamped(I->G, I->ModelView, &r1, fc, I->Palette);
                   }
                   if(bp2) {
                     RayProjectTriangle(I, &r1, bp2->LightNormal,
@@ -3649,7 +4059,7 @@ int RayTraceThread(CRayThreadInfo * T)
                   }
                   break;
                 case cPrimCharacter:
-                  BasisGetTriangleNormal(bp1, &r1, i, fc, perspective);
+                  BasisGetTriangleNormal(bp1, &r1, i, fc, perspective, I->Palette);
 
                   r1.trans = CharacterInterpolate(I->G, r1.prim->char_id, fc);
 
@@ -3659,12 +4069,10 @@ int RayTraceThread(CRayThreadInfo * T)
 
                 case cPrimEllipsoid:
 
-                  BasisGetEllipsoidNormal(bp1, &r1, i, perspective);
+                  BasisGetEllipsoidNormal(bp1, &r1, i, perspective, I->PrimGeom);
                   RayReflectAndTexture(I, &r1, perspective);
 
-                  fc[0] = r1.prim->c1[0];
-                  fc[1] = r1.prim->c1[1];
-                  fc[2] = r1.prim->c1[2];
+                  copy3f(I->color(r1.prim->c1), fc);
                   break;
 
                 default:       /* sphere, cylinder, sausage, etc. */
@@ -3680,21 +4088,23 @@ int RayTraceThread(CRayThreadInfo * T)
                   RayReflectAndTexture(I, &r1, perspective);
 
                   if(r1.prim->ramped) {
-                    RayPrimGetColorRamped(I->G, I->ModelView, &r1, fc);
+                    RayPrimGetColorRamped(I->G, I->ModelView, &r1, fc, I->Palette);
                   } else {
                     switch (r1.prim->type) {
                     case cPrimCylinder:
                     case cPrimSausage:
                     case cPrimCone:
-                      ft = r1.tri1;
-                      fc[0] = (r1.prim->c1[0] * (_1 - ft)) + (r1.prim->c2[0] * ft);
-                      fc[1] = (r1.prim->c1[1] * (_1 - ft)) + (r1.prim->c2[1] * ft);
-                      fc[2] = (r1.prim->c1[2] * (_1 - ft)) + (r1.prim->c2[2] * ft);
+                      {
+                        const float *c1 = I->color(r1.prim->c1);
+                        const float *c2 = I->color(r1.prim->c2);
+                        ft = r1.tri1;
+                        fc[0] = (c1[0] * (_1 - ft)) + (c2[0] * ft);
+                        fc[1] = (c1[1] * (_1 - ft)) + (c2[1] * ft);
+                        fc[2] = (c1[2] * (_1 - ft)) + (c2[2] * ft);
+                      }
                       break;
                     default:
-                      fc[0] = r1.prim->c1[0];
-                      fc[1] = r1.prim->c1[1];
-                      fc[2] = r1.prim->c1[2];
+                      copy3f(I->color(r1.prim->c1), fc);
                       break;
                     }
                   }
@@ -3751,7 +4161,7 @@ int RayTraceThread(CRayThreadInfo * T)
 
                     dotgle = -r1.dotgle;
                     if((interior_color < 0) && (interior_color > cColorExtCutoff)) {
-                      copy3f(r1.prim->ic, fc);
+                      copy3f(I->color(r1.prim->ic), fc);
                     } else {
                       copy3f(inter, fc);
                     }
@@ -4291,11 +4701,13 @@ int RayTraceThread(CRayThreadInfo * T)
   /*  if(T->n_thread>1) 
      printf(" Ray: Thread %d: Complete.\n",T->phase+1); */
   MapCacheFree(&BasisCall[0].cache, T->phase, cCache_map_scene_cache);
+  FreeP(BasisCall[0].packet);
 
   if(shadows && (I->NBasis > 2)) {
     int bc;
     for(bc = 2; bc < I->NBasis; bc++) {
       MapCacheFree(&BasisCall[bc].cache, T->phase, cCache_map_shadow_cache);
+      FreeP(BasisCall[bc].packet);
     }
   }
   return (n_hit);
@@ -4411,33 +4823,33 @@ int RayAntiThread(CRayAntiThreadInfo * T)
   /*   unsigned int m00FF=0x00FF,mFF00=0xFF00,mFFFF=0xFFFF; */
   int width;
   int height;
-  int x, y, yy;
+  int x, y;
   unsigned int *p;
-  int offset = 0;
+  CRayRowCursor cursor;
   CRay *I = T->ray;
 
-  OrthoBusyFast(I->G, 9, 10);
+  if(!T->phase)                 /* main thread */
+    OrthoBusyFast(I->G, 9, 10);
   width = (T->width / T->mag) - 2;
   height = (T->height / T->mag) - 2;
 
   src_row_pixels = T->width;
 
-  offset = (T->phase * height) / T->n_thread;
-  offset = offset - (offset % T->n_thread) + T->phase;
+  RayRowCursorInit(&cursor, T->tiles, T->phase, T->n_thread, 0, width, 0, height);
 
-  for(yy = 0; yy < height; yy++) {
-    y = (yy + offset) % height; /* make sure threads write to different pages */
+  while(RayRowCursorNext(&cursor)) {
+    y = cursor.y;
 
-    if((y % T->n_thread) == T->phase) { /* this is my scan line */
+    {                           /* this is my scan line segment */
       unsigned long c1, c2, c3, c4, a;
       unsigned char *c;
 
       pSrc = T->image + src_row_pixels * (y * T->mag);
-      pDst = T->image_copy + width * y;
+      pDst = T->image_copy + width * y + cursor.x0;
       switch (T->mag) {
       case 2:
         {
-          for(x = 0; x < width; x++) {
+          for(x = cursor.x0; x < cursor.x1; x++) {
 
             c = (unsigned char *) (p = pSrc + (x * T->mag));
             c1 = c2 = c3 = c4 = a = 0;
@@ -4631,7 +5043,7 @@ int RayAntiThread(CRayAntiThreadInfo * T)
         break;
       case 3:
         {
-          for(x = 0; x < width; x++) {
+          for(x = cursor.x0; x < cursor.x1; x++) {
 
             c = (unsigned char *) (p = pSrc + (x * T->mag));
             c1 = c2 = c3 = c4 = a = 0;
@@ -4908,7 +5320,7 @@ int RayAntiThread(CRayAntiThreadInfo * T)
         break;
       case 4:
         {
-          for(x = 0; x < width; x++) {
+          for(x = cursor.x0; x < cursor.x1; x++) {
 
             c = (unsigned char *) (p = pSrc + (x * T->mag));
             c1 = c2 = c3 = c4 = a = 0;
@@ -5309,8 +5721,30 @@ float *rayDepthPixels = NULL;
 int rayVolume = 0;
 
 /*========================================================================*/
+/*
+ * Progressive ray tracing: nearest sample upscaling of a sparse pass (every
+ * step-th pixel of the trace buffer) into a width x height preview.
+ */
+static void RayPreviewFill(const unsigned int *image, int src_width, int mag,
+                           int step, unsigned int *preview, int width, int height)
+{
+  int x, y, sx, sy;
+  int border = (mag > 1);       /* antialiased buffers have a 1 pixel border */
+  const unsigned int *src;
+
+  for(y = 0; y < height; y++) {
+    sy = (y + border) * mag;
+    src = image + src_width * (sy - (sy % step));
+    for(x = 0; x < width; x++) {
+      sx = (x + border) * mag;
+      *(preview++) = src[sx - (sx % step)];
+    }
+  }
+}
+
 void RayRender(CRay * I, unsigned int *image, double timing,
-               float angle, int antialias, unsigned int *return_bg)
+               float angle, int antialias, unsigned int *return_bg,
+               int progressive)
 {
   int a, x, y;
   unsigned int *image_copy = NULL;
@@ -5323,8 +5757,11 @@ void RayRender(CRay * I, unsigned int *image, double timing,
   float bkrd_top[3], bkrd_bottom[3];
   short bkrd_is_gradient; /* if not gradient, use bkrd_top as bkrd */
   double now;
+  double phase_start, time_hash = 0.0, time_trace = 0.0, time_anti = 0.0;
   int shadows;
   int n_thread;
+  int tile_size = SettingGetGlobal_i(I->G, cSetting_ray_tile_size);
+  CRayTileQueue *tiles = NULL;
   int mag = 1;
   int oversample_cutoff;
   int perspective = SettingGetGlobal_i(I->G, cSetting_ray_orthoscopic);
@@ -5340,6 +5777,13 @@ void RayRender(CRay * I, unsigned int *image, double timing,
   int ray_trace_mode;
   const float _0 = 0.0F, _p499 = 0.499F;
   int volume;
+  int use_bvh = SettingGetGlobal_b(I->G, cSetting_ray_bvh);
+  int use_simd = SettingGetGlobal_b(I->G, cSetting_ray_simd) && BasisPacketLevel();
+  unsigned int *preview = NULL;
+  int preview_ready = false;
+  int reuse = use_bvh && SettingGetGlobal_b(I->G, cSetting_ray_bvh_reuse);
+  int n_refit = 0;
+  uint64_t geometry_key = 0;
   int ok = true;
 
   if(n_light > 10)
@@ -5350,6 +5794,8 @@ void RayRender(CRay * I, unsigned int *image, double timing,
   perspective = !perspective;
 
   VLACacheSize(I->G, I->Primitive, CPrimitive, I->NPrimitive, 0, cCache_ray_primitive);
+  if(I->PrimGeom)
+    VLASize(I->PrimGeom, float, I->NPrimGeom);
 #ifdef PROFILE_BASIS
   n_cells = 0;
   n_prims = 0;
@@ -5365,6 +5811,10 @@ void RayRender(CRay * I, unsigned int *image, double timing,
     n_thread = 1;
   if(n_thread > PYMOL_MAX_THREADS)
     n_thread = PYMOL_MAX_THREADS;
+#ifdef _PYMOL_NOPY
+  if(!RayUseThreadPool(I->G))
+    n_thread = 1;               /* serial execution */
+#endif
   opaque_back = SettingGetGlobal_i(I->G, cSetting_ray_opaque_background);
   if(opaque_back < 0)
     opaque_back = SettingGetGlobal_i(I->G, cSetting_opaque_background);
@@ -5555,6 +6005,10 @@ void RayRender(CRay * I, unsigned int *image, double timing,
       I->PrimSize = 0.0F;
     }
     ok &= !I->G->Interrupt;
+    if(reuse)
+      geometry_key = RayGeometryKey(I);
+    else if(I->G->RayCache)
+      RayCacheClear(I->G->RayCache);
     if (ok)
       ok &= RayExpandPrimitives(I);
     if (ok)
@@ -5644,8 +6098,11 @@ void RayRender(CRay * I, unsigned int *image, double timing,
       }
     }
 
+    if(ok && reuse)
+      RayCacheRestore(I, geometry_key);
+
     OrthoBusyFast(I->G, 4, 20);
-#ifndef _PYMOL_NOPY
+    phase_start = UtilGetSeconds(I->G);
     if(shadows && (n_thread > 1)) {     /* parallel execution */
 
       CRayHashThreadInfo *thread_info = Calloc(CRayHashThreadInfo, I->NBasis);
@@ -5675,6 +6132,8 @@ void RayRender(CRay * I, unsigned int *image, double timing,
       thread_info[0].bytes = width * (unsigned int) height;
       thread_info[0].ray = I;   /* for compute box */
       thread_info[0].size_hint = I->PrimSize;
+      thread_info[0].bvh = use_bvh;
+      thread_info[0].simd = use_simd;
       /* shadow map */
 
       {
@@ -5691,6 +6150,8 @@ void RayRender(CRay * I, unsigned int *image, double timing,
           thread_info[bc - 1].front = _0;
           /* allowing these maps to be more fine helps performance */
           thread_info[bc - 1].size_hint = I->PrimSize * factor;
+          thread_info[bc - 1].bvh = use_bvh;
+          thread_info[bc - 1].simd = use_simd;
         }
       }
 
@@ -5698,21 +6159,32 @@ void RayRender(CRay * I, unsigned int *image, double timing,
          under the assumption that it will usually just be a few threads */
       RayHashSpawn(thread_info, n_thread, I->NBasis - 1);
 
+      for(a = 0; a < I->NBasis - 1; a++)
+        n_refit += thread_info[a].refit;
       FreeP(thread_info);
-    } else
-#endif
-    if (ok){ 
-#ifdef _PYMOL_NOPY
-      n_thread = 1;          /* serial execution */
-#endif
-      ok &= BasisMakeMap(I->Basis + 1, I->Vert2Prim, I->Primitive, I->NPrimitive,
-			 I->Volume, 0, cCache_ray_map, perspective, front, I->PrimSize);
+    } else if (ok){
+      if(use_bvh) {
+        int r = RayBasisBVH(I->Basis + 1, I->Primitive, I->NPrimitive, I->Vert2Prim);
+        ok &= (r != 0);
+        n_refit += (r == 2);
+      } else
+        ok &= BasisMakeMap(I->Basis + 1, I->Vert2Prim, I->Primitive, I->NPrimitive,
+                           I->Volume, 0, cCache_ray_map, perspective, front, I->PrimSize);
+      if(ok && use_simd)
+        ok &= BasisMakePacket(I->Basis + 1, I->Primitive, I->NPrimitive);
       if(ok && shadows) {
         int bc;
         float factor = SettingGetGlobal_f(I->G, cSetting_ray_hint_shadow);
         for(bc = 2; ok && bc < I->NBasis; bc++) {
-          ok &= BasisMakeMap(I->Basis + bc, I->Vert2Prim, I->Primitive, I->NPrimitive,
-			     NULL, bc - 1, cCache_ray_map, false, _0, I->PrimSize * factor);
+          if(use_bvh) {
+            int r = RayBasisBVH(I->Basis + bc, I->Primitive, I->NPrimitive, I->Vert2Prim);
+            ok &= (r != 0);
+            n_refit += (r == 2);
+          } else
+            ok &= BasisMakeMap(I->Basis + bc, I->Vert2Prim, I->Primitive, I->NPrimitive,
+                               NULL, bc - 1, cCache_ray_map, false, _0, I->PrimSize * factor);
+          if(ok && use_simd)
+            ok &= BasisMakePacket(I->Basis + bc, I->Primitive, I->NPrimitive);
         }
       }
 
@@ -5731,8 +6203,14 @@ void RayRender(CRay * I, unsigned int *image, double timing,
 
     OrthoBusyFast(I->G, 5, 20);
     now = UtilGetSeconds(I->G) - timing;
-
-    if (ok){
+    time_hash = UtilGetSeconds(I->G) - phase_start;
+
+    if (ok && use_bvh && I->Basis[1].BVH){
+      PRINTFB(I->G, FB_Ray, FB_Blather)
+        " Ray: bvh: %d nodes, depth %d, %d of %d refitted in %4.2f sec.\n",
+        I->Basis[1].BVH->NNode, I->Basis[1].BVH->Depth, n_refit,
+        shadows ? I->NBasis - 1 : 1, time_hash ENDFB(I->G);
+    } else if (ok){
       if(shadows) {
 	PRINTFB(I->G, FB_Ray, FB_Blather)
 	  " Ray: voxels: [%4.2f:%dx%dx%d], [%4.2f:%dx%dx%d], %4.2f sec.\n",
@@ -5747,6 +6225,11 @@ void RayRender(CRay * I, unsigned int *image, double timing,
 	  I->Basis[1].Map->Dim[1], I->Basis[1].Map->Dim[2], now ENDFB(I->G);
       }
     }
+    if (ok && I->Basis[1].Packet){
+      PRINTFB(I->G, FB_Ray, FB_Blather)
+        " Ray: simd prefilter: %d-wide\n", (I->Basis[1].Packet->Level > 1) ? 8 : 4
+        ENDFB(I->G);
+    }
     /* IMAGING */
 
     if (ok){
@@ -5837,6 +6320,9 @@ void RayRender(CRay * I, unsigned int *image, double timing,
       if(y_stop > height)
         y_stop = height;
 
+      if(n_thread > 1)
+        tiles = RayTileQueueNew(x_start, x_stop, y_start, y_stop, tile_size, n_thread);
+
       for(a = 0; a < n_thread; a++) {
         rt[a].ray = I;
         rt[a].width = width;
@@ -5868,15 +6354,57 @@ void RayRender(CRay * I, unsigned int *image, double timing,
         rt[a].fov = fov;
         rt[a].pos[2] = pos[2];
         rt[a].depth = depth;
+        rt[a].tiles = tiles;
+        rt[a].step = 1;
+      }
+
+      phase_start = UtilGetSeconds(I->G);
+
+      if(progressive) {
+        /* coarse passes at 1/8, 1/4 and 1/2 resolution (plus a full
+           resolution one ahead of antialiasing), each only tracing the
+           pixels the previous passes haven't, so the refinements are
+           nearly free */
+        int step, skip = 0;
+        preview = Alloc(unsigned int, I->Width * I->Height);
+        for(step = 8 * mag; preview && (step > 1) && (step >= mag); step /= 2) {
+          for(a = 0; a < n_thread; a++) {
+            rt[a].step = step;
+            rt[a].skip = skip;
+          }
+          if(tiles)
+            RayTileQueueReset(tiles);
+          if(n_thread > 1)
+            RayTraceSpawn(rt, n_thread);
+          else
+            RayTraceThread(rt);
+          if(I->G->Interrupt)
+            break;
+          RayPreviewFill(image, width, mag, step, preview, I->Width, I->Height);
+          SceneSetRayPreview(I->G, preview, I->Width, I->Height);
+          preview_ready = true;
+          PRINTFB(I->G, FB_Ray, FB_Blather)
+            " Ray: preview 1/%d, %4.2f sec.\n", step / mag,
+            UtilGetSeconds(I->G) - phase_start ENDFB(I->G);
+          skip = step;
+        }
+        for(a = 0; a < n_thread; a++) {
+          rt[a].step = 1;
+          rt[a].skip = skip;
+        }
+        if(tiles)
+          RayTileQueueReset(tiles);
       }
 
-#ifndef _PYMOL_NOPY
       if(n_thread > 1)
         RayTraceSpawn(rt, n_thread);
       else
-#endif
         RayTraceThread(rt);
 
+      for(a = 0; a < n_thread; a++) {
+        rt[a].skip = 0;
+      }
+
       if(oversample_cutoff) {   /* perform edge oversampling, if requested */
         unsigned int *edging;
 
@@ -5888,16 +6416,20 @@ void RayRender(CRay * I, unsigned int *image, double timing,
           rt[a].edging = edging;
         }
 
-#ifndef _PYMOL_NOPY
+        if(tiles)
+          RayTileQueueReset(tiles);
+
         if(n_thread > 1)
           RayTraceSpawn(rt, n_thread);
         else
-#endif
           RayTraceThread(rt);
 
         CacheFreeP(I->G, edging, 0, cCache_ray_edging_buffer, false);
       }
       FreeP(rt);
+      RayTileQueueFree(tiles);
+
+      time_trace = UtilGetSeconds(I->G) - phase_start;
     }
   }
 
@@ -6271,6 +6803,10 @@ void RayRender(CRay * I, unsigned int *image, double timing,
     /* now spawn threads as needed */
     CRayAntiThreadInfo *rt = Calloc(CRayAntiThreadInfo, n_thread);
 
+    tiles = NULL;
+    if(n_thread > 1)
+      tiles = RayTileQueueNew(0, width / mag - 2, 0, height / mag - 2, tile_size, n_thread);
+
     for(a = 0; a < n_thread; a++) {
       rt[a].width = width;
       rt[a].height = height;
@@ -6280,19 +6816,39 @@ void RayRender(CRay * I, unsigned int *image, double timing,
       rt[a].mag = mag;          /* fold magnification */
       rt[a].n_thread = n_thread;
       rt[a].ray = I;
+      rt[a].tiles = tiles;
     }
 
-#ifndef _PYMOL_NOPY
+    phase_start = UtilGetSeconds(I->G);
+
     if(n_thread > 1)
       RayAntiSpawn(rt, n_thread);
     else
-#endif
       RayAntiThread(rt);
     FreeP(rt);
+    RayTileQueueFree(tiles);
+
+    time_anti = UtilGetSeconds(I->G) - phase_start;
     CacheFreeP(I->G, image, 0, cCache_ray_antialias_buffer, false);
     image = image_copy;
   }
 
+  if(ok && reuse && I->NPrimitive)
+    RayCacheStore(I, geometry_key);
+
+  if(preview) {
+    /* cancelled: keep the last complete refinement rather than a partially
+       traced image */
+    if(I->G->Interrupt && preview_ready && ((antialias < 2) || (image == image_copy)))
+      memcpy(image, preview, sizeof(unsigned int) * I->Width * I->Height);
+    FreeP(preview);
+  }
+
+  PRINTFB(I->G, FB_Ray, FB_Blather)
+    " Ray: phases: hash %4.2f, trace %4.2f, antialias %4.2f sec. (%d %s threads)\n",
+    time_hash, time_trace, time_anti, n_thread,
+    RayUseThreadPool(I->G) ? "native" : "python" ENDFB(I->G);
+
   PRINTFD(I->G, FB_Ray)
     " RayRender: n_hit %d\n", n_hit ENDFD;
 #ifdef PROFILE_BASIS
@@ -6366,6 +6922,102 @@ void RayRenderColorTable(CRay * I, int width, int height, int *image)
 }
 
 
+/*========================================================================*/
+static unsigned int RayPaletteHashBits(const unsigned int *bits)
+{
+  unsigned int hash = (bits[0] * 73856093U) ^ (bits[1] * 19349663U) ^ (bits[2] * 83492791U);
+  return hash ^ (hash >> 16);
+}
+
+/* (re)builds the open addressing palette hash with n_slot slots (power
+ * of 2) from the current palette */
+static int RayPaletteRehash(CRay * I, int n_slot)
+{
+  int *hash = Calloc(int, n_slot);
+  unsigned int bits[3], h;
+  int a;
+  if(!hash)
+    return false;
+  for(a = 0; a < I->NPalette; a++) {
+    memcpy(bits, I->Palette + 3 * a, sizeof(bits));
+    h = RayPaletteHashBits(bits) & (n_slot - 1);
+    while(hash[h])
+      h = (h + 1) & (n_slot - 1);
+    hash[h] = a + 1;
+  }
+  FreeP(I->PaletteHash);
+  I->PaletteHash = hash;
+  I->NPaletteHash = n_slot;
+  return true;
+}
+
+/*========================================================================*/
+/* index of the float triple v in the palette, appending it if it is not
+ * there yet (lookup is bitwise, so the palette is lossless); -1 if out of
+ * memory */
+int CRay::paletteIndex(const float *v)
+{
+  CRay * I = this;
+  unsigned int bits[3], h, mask;
+  int *slot;
+  int index;
+
+  /* keep the load factor at or below 1/2 */
+  if(2 * (I->NPalette + 1) > I->NPaletteHash &&
+     !RayPaletteRehash(I, I->NPaletteHash ? 2 * I->NPaletteHash : cRayPaletteHash))
+    return -1;
+
+  memcpy(bits, v, sizeof(bits));
+  mask = I->NPaletteHash - 1;
+  h = RayPaletteHashBits(bits) & mask;
+  while(*(slot = I->PaletteHash + h)) {
+    if(!memcmp(I->Palette + 3 * (*slot - 1), bits, sizeof(bits)))
+      return *slot - 1;
+    h = (h + 1) & mask;
+  }
+
+  index = I->NPalette;
+  VLACheck(I->Palette, float, 3 * index + 2);
+  if(!I->Palette)
+    return -1;
+  copy3f(v, I->Palette + 3 * index);
+  I->NPalette++;
+  *slot = index + 1;
+  return index;
+}
+
+
+/*========================================================================*/
+/* appends a zeroed primitive with n_geom floats of geometry (see
+ * cPrimGeom*), the caller increments NPrimitive */
+static CPrimitive *RayNewPrimitive(CRay * I, int n_geom)
+{
+  CPrimitive *p;
+  VLACacheCheck(I->G, I->Primitive, CPrimitive, I->NPrimitive, 0, cCache_ray_primitive);
+  if(!I->Primitive)
+    return NULL;
+  VLACheck(I->PrimGeom, float, I->NPrimGeom + n_geom - 1);
+  if(!I->PrimGeom)
+    return NULL;
+  p = I->Primitive + I->NPrimitive;
+  UtilZeroMem(p, sizeof(CPrimitive));
+  p->geom = I->NPrimGeom;
+  I->NPrimGeom += n_geom;
+  return p;
+}
+
+/* false if one of the palette indices of p could not be assigned, then
+ * drops the geometry of p (and of any primitive appended after it) */
+static int RayPrimitivePaletteOk(CRay * I, const CPrimitive * p)
+{
+  if((p->c1 < 0) || (p->c2 < 0) || (p->c3 < 0) || (p->ic < 0) || (p->tr < 0)) {
+    I->NPrimGeom = p->geom;
+    return false;
+  }
+  return true;
+}
+
+
 /*========================================================================*/
 void CRay::wobble(int mode, const float *v)
 {
@@ -6416,11 +7068,10 @@ int CRay::sphere3fv(const float *v, float r)
   int ok = true;
   float *vv;
 
-  VLACacheCheck(I->G, I->Primitive, CPrimitive, I->NPrimitive, 0, cCache_ray_primitive);
-  CHECKOK(ok, I->Primitive);
+  p = RayNewPrimitive(I, cPrimGeomSphere);
+  CHECKOK(ok, p);
   if (!ok)
     return false;
-  p = I->Primitive + I->NPrimitive;
 
   p->type = cPrimSphere;
   p->r1 = r;
@@ -6433,31 +7084,26 @@ int CRay::sphere3fv(const float *v, float r)
 
   /* 
      copy3f(I->WobbleParam,p->wobble_param); */
-  vv = p->v1;
+  vv = I->primV1(p);
   (*vv++) = (*v++);
   (*vv++) = (*v++);
   (*vv++) = (*v++);
 
-  vv = p->c1;
-  v = I->CurColor;
-  (*vv++) = (*v++);
-  (*vv++) = (*v++);
-  (*vv++) = (*v++);
+  p->c1 = I->paletteIndex(I->CurColor);
 
-  vv = p->ic;
-  v = I->IntColor;
-  (*vv++) = (*v++);
-  (*vv++) = (*v++);
-  (*vv++) = (*v++);
+  p->ic = I->paletteIndex(I->IntColor);
 
   if(I->TTTFlag) {
-    transformTTT44f3f(I->TTT, p->v1, p->v1);
+    transformTTT44f3f(I->TTT, I->primV1(p), I->primV1(p));
   }
 
   if(I->Context) {
-    RayApplyContextToVertex(I, p->v1);
+    RayApplyContextToVertex(I, I->primV1(p));
   }
 
+  if(!RayPrimitivePaletteOk(I, p))
+    return false;
+
   I->NPrimitive++;
   return true;
 }
@@ -6506,7 +7152,10 @@ int CRay::character(int char_id)
   CHECKOK(ok, I->Primitive);
   if (!ok)
     return false;
-  p = I->Primitive + I->NPrimitive;
+  p = RayNewPrimitive(I, cPrimGeomTriangle);
+  CHECKOK(ok, p);
+  if (!ok)
+    return false;
 
   p->type = cPrimCharacter;
   p->trans = I->Trans;
@@ -6516,20 +7165,20 @@ int CRay::character(int char_id)
   /*
      copy3f(I->WobbleParam,p->wobble_param); */
 
-  vv = p->v1;
+  vv = I->primV1(p);
   (*vv++) = v[0];
   (*vv++) = v[1];
   (*vv++) = v[2];
 
   if(I->TTTFlag) {
-    transformTTT44f3f(I->TTT, p->v1, p->v1);
+    transformTTT44f3f(I->TTT, I->primV1(p), I->primV1(p));
   }
   /* what's the width of 1 screen window pixel at this point in space? */
 
-  v_scale = RayGetScreenVertexScale(I, p->v1) / I->Sampling;
+  v_scale = RayGetScreenVertexScale(I, I->primV1(p)) / I->Sampling;
 
   if(I->Context) {
-    RayApplyContextToVertex(I, p->v1);
+    RayApplyContextToVertex(I, I->primV1(p));
   }
 
   {
@@ -6540,7 +7189,7 @@ int CRay::character(int char_id)
     float scale;
     float xorig, yorig, advance;
     int width_i, height_i;
-    CPrimitive *pp = p + 1;
+    CPrimitive *pp;
 
     RayApplyMatrixInverse33(1, (float3 *) xn, I->Rotation, (float3 *) xn);
     RayApplyMatrixInverse33(1, (float3 *) yn, I->Rotation, (float3 *) yn);
@@ -6560,66 +7209,79 @@ int CRay::character(int char_id)
     /*    scale = ((-xorig)-0.5F)*I->PixelRadius; */
     scale = ((-xorig) - 0.0F) * v_scale;
     scale3f(xn, scale, sc);
-    add3f(sc, p->v1, p->v1);
+    add3f(sc, I->primV1(p), I->primV1(p));
 
     scale = ((-yorig) - 0.0F) * v_scale;
     scale3f(yn, scale, sc);
-    add3f(sc, p->v1, p->v1);
+    add3f(sc, I->primV1(p), I->primV1(p));
 
     scale = v_scale * width;
     scale3f(xn, scale, xn);
     scale = v_scale * height;
     scale3f(yn, scale, yn);
 
-    copy3f(zn, p->n0);
-    copy3f(zn, p->n1);
-    copy3f(zn, p->n2);
-    copy3f(zn, p->n3);
-
-    *(pp) = (*p);
+    copy3f(zn, I->primN0(p));
+    copy3f(zn, I->primN1(p));
+    copy3f(zn, I->primN2(p));
+    copy3f(zn, I->primN3(p));
+
+    I->NPrimitive++;
+    pp = RayNewPrimitive(I, cPrimGeomTriangle);
+    I->NPrimitive--;
+    CHECKOK(ok, pp);
+    if (!ok)
+      return false;
+    {
+      int geom = pp->geom;
+      *(pp) = (*p);
+      pp->geom = geom;
+      copy3f(I->primN0(p), I->primN0(pp));
+      copy3f(I->primN1(p), I->primN1(pp));
+      copy3f(I->primN2(p), I->primN2(pp));
+      copy3f(I->primN3(p), I->primN3(pp));
+    }
 
     /* define coordinates of first triangle */
 
-    add3f(p->v1, xn, p->v2);
-    add3f(p->v1, yn, p->v3);
+    add3f(I->primV1(p), xn, I->primV2(p));
+    add3f(I->primV1(p), yn, I->primV3(p));
 
     I->PrimSize +=
-      2 * (diff3f(p->v1, p->v2) + diff3f(p->v1, p->v3) + diff3f(p->v2, p->v3));
+      2 * (diff3f(I->primV1(p), I->primV2(p)) + diff3f(I->primV1(p), I->primV3(p)) + diff3f(I->primV2(p), I->primV3(p)));
     I->PrimSizeCnt += 6;
 
     /* encode characters coordinates in the colors  */
 
-    zero3f(p->c1);
-    set3f(p->c2, width, 0.0F, 0.0F);
-    set3f(p->c3, 0.0F, height, 0.0F);
+    set3f(sc, 0.0F, 0.0F, 0.0F);
+    p->c1 = I->paletteIndex(sc);
+    set3f(sc, width, 0.0F, 0.0F);
+    p->c2 = I->paletteIndex(sc);
+    set3f(sc, 0.0F, height, 0.0F);
+    p->c3 = I->paletteIndex(sc);
 
     /* define coordinates of second triangle */
 
-    add3f(yn, xn, pp->v1);
-    add3f(p->v1, pp->v1, pp->v1);
-    add3f(p->v1, yn, pp->v2);
-    add3f(p->v1, xn, pp->v3);
+    add3f(yn, xn, I->primV1(pp));
+    add3f(I->primV1(p), I->primV1(pp), I->primV1(pp));
+    add3f(I->primV1(p), yn, I->primV2(pp));
+    add3f(I->primV1(p), xn, I->primV3(pp));
 
-    {
-      float *v, *vv;
-      vv = p->ic;
-      v = I->IntColor;
-      (*vv++) = (*v++);
-      (*vv++) = (*v++);
-      (*vv++) = (*v++);
-      vv = pp->ic;
-      v = I->IntColor;
-      (*vv++) = (*v++);
-      (*vv++) = (*v++);
-      (*vv++) = (*v++);
-    }
+    p->ic = I->paletteIndex(I->IntColor);
+    pp->ic = p->ic;
 
     /* encode integral character coordinates into the vertex colors  */
 
-    set3f(pp->c1, width, height, 0.0F);
-    set3f(pp->c2, 0.0F, height, 0.0F);
-    set3f(pp->c3, width, 0.0F, 0.0F);
+    set3f(sc, width, height, 0.0F);
+    pp->c1 = I->paletteIndex(sc);
+    set3f(sc, 0.0F, height, 0.0F);
+    pp->c2 = I->paletteIndex(sc);
+    set3f(sc, width, 0.0F, 0.0F);
+    pp->c3 = I->paletteIndex(sc);
 
+    if(!RayPrimitivePaletteOk(I, pp) || !RayPrimitivePaletteOk(I, p)) {
+      I->NPrimGeom = p->geom;
+      return false;
+    }
   }
 
   I->NPrimitive += 2;
@@ -6635,11 +7297,10 @@ int CRay::cylinder3fv(const float *v1, const float *v2, float r, const float *c1
   int ok = true;
   float *vv;
 
-  VLACacheCheck(I->G, I->Primitive, CPrimitive, I->NPrimitive, 0, cCache_ray_primitive);
-  CHECKOK(ok, I->Primitive);
+  p = RayNewPrimitive(I, cPrimGeomCylinder);
+  CHECKOK(ok, p);
   if (!ok)
     return false;
-  p = I->Primitive + I->NPrimitive;
 
   p->type = cPrimCylinder;
   p->r1 = r;
@@ -6651,45 +7312,35 @@ int CRay::cylinder3fv(const float *v1, const float *v2, float r, const float *c1
   /* 
      copy3f(I->WobbleParam,p->wobble_param); */
 
-  vv = p->v1;
+  vv = I->primV1(p);
   (*vv++) = (*v1++);
   (*vv++) = (*v1++);
   (*vv++) = (*v1++);
-  vv = p->v2;
+  vv = I->primV2(p);
   (*vv++) = (*v2++);
   (*vv++) = (*v2++);
   (*vv++) = (*v2++);
 
-  I->PrimSize += diff3f(p->v1, p->v2) + 2 * r;
+  I->PrimSize += diff3f(I->primV1(p), I->primV2(p)) + 2 * r;
   I->PrimSizeCnt++;
 
   if(I->TTTFlag) {
-    transformTTT44f3f(I->TTT, p->v1, p->v1);
-    transformTTT44f3f(I->TTT, p->v2, p->v2);
+    transformTTT44f3f(I->TTT, I->primV1(p), I->primV1(p));
+    transformTTT44f3f(I->TTT, I->primV2(p), I->primV2(p));
   }
 
   if(I->Context) {
-    RayApplyContextToVertex(I, p->v1);
-    RayApplyContextToVertex(I, p->v2);
+    RayApplyContextToVertex(I, I->primV1(p));
+    RayApplyContextToVertex(I, I->primV2(p));
   }
 
-  vv = p->c1;
-  (*vv++) = (*c1++);
-  (*vv++) = (*c1++);
-  (*vv++) = (*c1++);
-  vv = p->c2;
-  (*vv++) = (*c2++);
-  (*vv++) = (*c2++);
-  (*vv++) = (*c2++);
+  p->c1 = I->paletteIndex(c1);
+  p->c2 = I->paletteIndex(c2);
 
-  {
-    float *v;
-    vv = p->ic;
-    v = I->IntColor;
-    (*vv++) = (*v++);
-    (*vv++) = (*v++);
-    (*vv++) = (*v++);
-  }
+  p->ic = I->paletteIndex(I->IntColor);
+
+  if(!RayPrimitivePaletteOk(I, p))
+    return false;
 
   I->NPrimitive++;
   return true;
@@ -6705,11 +7356,10 @@ int CRay::customCylinder3fv(const float *v1, const float *v2, float r,
   int ok = true;
   float *vv;
 
-  VLACacheCheck(I->G, I->Primitive, CPrimitive, I->NPrimitive, 0, cCache_ray_primitive);
-  CHECKOK(ok, I->Primitive);
+  p = RayNewPrimitive(I, cPrimGeomCylinder);
+  CHECKOK(ok, p);
   if (!ok)
     return false;
-  p = I->Primitive + I->NPrimitive;
 
   p->type = cPrimCylinder;
   p->r1 = r;
@@ -6721,46 +7371,35 @@ int CRay::customCylinder3fv(const float *v1, const float *v2, float r,
   /*
      copy3f(I->WobbleParam,p->wobble_param); */
 
-  vv = p->v1;
+  vv = I->primV1(p);
   (*vv++) = (*v1++);
   (*vv++) = (*v1++);
   (*vv++) = (*v1++);
-  vv = p->v2;
+  vv = I->primV2(p);
   (*vv++) = (*v2++);
   (*vv++) = (*v2++);
   (*vv++) = (*v2++);
 
-  I->PrimSize += diff3f(p->v1, p->v2) + 2 * r;
+  I->PrimSize += diff3f(I->primV1(p), I->primV2(p)) + 2 * r;
   I->PrimSizeCnt++;
 
   if(I->TTTFlag) {
-    transformTTT44f3f(I->TTT, p->v1, p->v1);
-    transformTTT44f3f(I->TTT, p->v2, p->v2);
+    transformTTT44f3f(I->TTT, I->primV1(p), I->primV1(p));
+    transformTTT44f3f(I->TTT, I->primV2(p), I->primV2(p));
   }
 
   if(I->Context) {
-    RayApplyContextToVertex(I, p->v1);
-    RayApplyContextToVertex(I, p->v2);
-  }
-
-  vv = p->c1;
-  (*vv++) = (*c1++);
-  (*vv++) = (*c1++);
-  (*vv++) = (*c1++);
-  vv = p->c2;
-  (*vv++) = (*c2++);
-  (*vv++) = (*c2++);
-  (*vv++) = (*c2++);
-  vv = p->ic;
-  {
-    float *v;
-    vv = p->ic;
-    v = I->IntColor;
-    (*vv++) = (*v++);
-    (*vv++) = (*v++);
-    (*vv++) = (*v++);
+    RayApplyContextToVertex(I, I->primV1(p));
+    RayApplyContextToVertex(I, I->primV2(p));
   }
 
+  p->c1 = I->paletteIndex(c1);
+  p->c2 = I->paletteIndex(c2);
+  p->ic = I->paletteIndex(I->IntColor);
+
+  if(!RayPrimitivePaletteOk(I, p))
+    return false;
+
   I->NPrimitive++;
   return true;
 }
@@ -6792,11 +7431,10 @@ int CRay::cone3fv(const float *v1, const float *v2, float r1, float r2,
     cap1 = ti;
   }
 
-  VLACacheCheck(I->G, I->Primitive, CPrimitive, I->NPrimitive, 0, cCache_ray_primitive);
-  CHECKOK(ok, I->Primitive);
+  p = RayNewPrimitive(I, cPrimGeomCylinder);
+  CHECKOK(ok, p);
   if (!ok)
     return false;
-  p = I->Primitive + I->NPrimitive;
 
   p->type = cPrimCone;
   p->r1 = r1;
@@ -6815,46 +7453,35 @@ int CRay::cone3fv(const float *v1, const float *v2, float r1, float r2,
   /*
      copy3f(I->WobbleParam,p->wobble_param); */
 
-  vv = p->v1;
+  vv = I->primV1(p);
   (*vv++) = (*v1++);
   (*vv++) = (*v1++);
   (*vv++) = (*v1++);
-  vv = p->v2;
+  vv = I->primV2(p);
   (*vv++) = (*v2++);
   (*vv++) = (*v2++);
   (*vv++) = (*v2++);
 
-  I->PrimSize += diff3f(p->v1, p->v2) + 2 * r_max;
+  I->PrimSize += diff3f(I->primV1(p), I->primV2(p)) + 2 * r_max;
   I->PrimSizeCnt++;
 
   if(I->TTTFlag) {
-    transformTTT44f3f(I->TTT, p->v1, p->v1);
-    transformTTT44f3f(I->TTT, p->v2, p->v2);
+    transformTTT44f3f(I->TTT, I->primV1(p), I->primV1(p));
+    transformTTT44f3f(I->TTT, I->primV2(p), I->primV2(p));
   }
 
   if(I->Context) {
-    RayApplyContextToVertex(I, p->v1);
-    RayApplyContextToVertex(I, p->v2);
-  }
-
-  vv = p->c1;
-  (*vv++) = (*c1++);
-  (*vv++) = (*c1++);
-  (*vv++) = (*c1++);
-  vv = p->c2;
-  (*vv++) = (*c2++);
-  (*vv++) = (*c2++);
-  (*vv++) = (*c2++);
-  vv = p->ic;
-  {
-    float *v;
-    vv = p->ic;
-    v = I->IntColor;
-    (*vv++) = (*v++);
-    (*vv++) = (*v++);
-    (*vv++) = (*v++);
+    RayApplyContextToVertex(I, I->primV1(p));
+    RayApplyContextToVertex(I, I->primV2(p));
   }
 
+  p->c1 = I->paletteIndex(c1);
+  p->c2 = I->paletteIndex(c2);
+  p->ic = I->paletteIndex(I->IntColor);
+
+  if(!RayPrimitivePaletteOk(I, p))
+    return false;
+
   I->NPrimitive++;
   return true;
 }
@@ -6868,11 +7495,10 @@ int CRay::sausage3fv(const float *v1, const float *v2, float r, const float *c1,
   int ok = true;
   float *vv;
 
-  VLACacheCheck(I->G, I->Primitive, CPrimitive, I->NPrimitive, 0, cCache_ray_primitive);
-  CHECKOK(ok, I->Primitive);
+  p = RayNewPrimitive(I, cPrimGeomCylinder);
+  CHECKOK(ok, p);
   if (!ok)
     return false;
-  p = I->Primitive + I->NPrimitive;
 
   p->type = cPrimSausage;
   p->r1 = r;
@@ -6882,45 +7508,34 @@ int CRay::sausage3fv(const float *v1, const float *v2, float r, const float *c1,
   /*  
      copy3f(I->WobbleParam,p->wobble_param); */
 
-  vv = p->v1;
+  vv = I->primV1(p);
   (*vv++) = (*v1++);
   (*vv++) = (*v1++);
   (*vv++) = (*v1++);
-  vv = p->v2;
+  vv = I->primV2(p);
   (*vv++) = (*v2++);
   (*vv++) = (*v2++);
   (*vv++) = (*v2++);
 
-  I->PrimSize += diff3f(p->v1, p->v2) + 2 * r;
+  I->PrimSize += diff3f(I->primV1(p), I->primV2(p)) + 2 * r;
   I->PrimSizeCnt++;
 
   if(I->TTTFlag) {
-    transformTTT44f3f(I->TTT, p->v1, p->v1);
-    transformTTT44f3f(I->TTT, p->v2, p->v2);
+    transformTTT44f3f(I->TTT, I->primV1(p), I->primV1(p));
+    transformTTT44f3f(I->TTT, I->primV2(p), I->primV2(p));
   }
 
   if(I->Context) {
-    RayApplyContextToVertex(I, p->v1);
-    RayApplyContextToVertex(I, p->v2);
+    RayApplyContextToVertex(I, I->primV1(p));
+    RayApplyContextToVertex(I, I->primV2(p));
   }
 
-  vv = p->c1;
-  (*vv++) = (*c1++);
-  (*vv++) = (*c1++);
-  (*vv++) = (*c1++);
-  vv = p->c2;
-  (*vv++) = (*c2++);
-  (*vv++) = (*c2++);
-  (*vv++) = (*c2++);
-  vv = p->ic;
+  p->c1 = I->paletteIndex(c1);
+  p->c2 = I->paletteIndex(c2);
+  p->ic = I->paletteIndex(I->IntColor);
 
-  {
-    float *v = I->IntColor;
-    vv = p->ic;
-    (*vv++) = (*v++);
-    (*vv++) = (*v++);
-    (*vv++) = (*v++);
-  }
+  if(!RayPrimitivePaletteOk(I, p))
+    return false;
 
   I->NPrimitive++;
   return true;
@@ -6933,11 +7548,10 @@ int CRay::ellipsoid3fv(const float *v, float r, const float *n1, const float *n2
   int ok = true;
   float *vv;
 
-  VLACacheCheck(I->G, I->Primitive, CPrimitive, I->NPrimitive, 0, cCache_ray_primitive);
-  CHECKOK(ok, I->Primitive);
+  p = RayNewPrimitive(I, cPrimGeomTriangle);
+  CHECKOK(ok, p);
   if (!ok)
     return false;
-  p = I->Primitive + I->NPrimitive;
 
   p->type = cPrimEllipsoid;
   p->r1 = r;                    /* maximum extent */
@@ -6948,7 +7562,7 @@ int CRay::ellipsoid3fv(const float *v, float r, const float *n1, const float *n2
   I->PrimSize += 2 * r;
   I->PrimSizeCnt++;
 
-  vv = p->n0;                   /* storing lengths of the direction vectors in n0 */
+  vv = I->primN0(p);                   /* storing lengths of the direction vectors in n0 */
 
   (*vv++) = length3f(n1);
   (*vv++) = length3f(n2);
@@ -6956,10 +7570,10 @@ int CRay::ellipsoid3fv(const float *v, float r, const float *n1, const float *n2
 
   /* normalize the ellipsoid axes */
 
-  vv = p->n1;
-  if(p->n0[0] > R_SMALL8) {
+  vv = I->primN1(p);
+  if(I->primN0(p)[0] > R_SMALL8) {
     float factor;
-    factor = 1.0F / p->n0[0];
+    factor = 1.0F / I->primN0(p)[0];
     (*vv++) = (*n1++) * factor;
     (*vv++) = (*n1++) * factor;
     (*vv++) = (*n1++) * factor;
@@ -6969,10 +7583,10 @@ int CRay::ellipsoid3fv(const float *v, float r, const float *n1, const float *n2
     (*vv++) = 0.0F;
   }
 
-  vv = p->n2;
-  if(p->n0[1] > R_SMALL8) {
+  vv = I->primN2(p);
+  if(I->primN0(p)[1] > R_SMALL8) {
     float factor;
-    factor = 1.0F / p->n0[1];
+    factor = 1.0F / I->primN0(p)[1];
     (*vv++) = (*n2++) * factor;
     (*vv++) = (*n2++) * factor;
     (*vv++) = (*n2++) * factor;
@@ -6982,10 +7596,10 @@ int CRay::ellipsoid3fv(const float *v, float r, const float *n1, const float *n2
     (*vv++) = 0.0F;
   }
 
-  vv = p->n3;
-  if(p->n0[2] > R_SMALL8) {
+  vv = I->primN3(p);
+  if(I->primN0(p)[2] > R_SMALL8) {
     float factor;
-    factor = 1.0F / p->n0[2];
+    factor = 1.0F / I->primN0(p)[2];
     (*vv++) = (*n3++) * factor;
     (*vv++) = (*n3++) * factor;
     (*vv++) = (*n3++) * factor;
@@ -6995,37 +7609,32 @@ int CRay::ellipsoid3fv(const float *v, float r, const float *n1, const float *n2
     (*vv++) = 0.0F;
   }
 
-  vv = p->v1;
+  vv = I->primV1(p);
   (*vv++) = (*v++);
   (*vv++) = (*v++);
   (*vv++) = (*v++);
 
-  vv = p->c1;
-  v = I->CurColor;
-  (*vv++) = (*v++);
-  (*vv++) = (*v++);
-  (*vv++) = (*v++);
+  p->c1 = I->paletteIndex(I->CurColor);
 
-  vv = p->ic;
-  v = I->IntColor;
-  (*vv++) = (*v++);
-  (*vv++) = (*v++);
-  (*vv++) = (*v++);
+  p->ic = I->paletteIndex(I->IntColor);
 
   if(I->TTTFlag) {
-    transformTTT44f3f(I->TTT, p->v1, p->v1);
-    transform_normalTTT44f3f(I->TTT, p->n1, p->n1);
-    transform_normalTTT44f3f(I->TTT, p->n2, p->n2);
-    transform_normalTTT44f3f(I->TTT, p->n3, p->n3);
+    transformTTT44f3f(I->TTT, I->primV1(p), I->primV1(p));
+    transform_normalTTT44f3f(I->TTT, I->primN1(p), I->primN1(p));
+    transform_normalTTT44f3f(I->TTT, I->primN2(p), I->primN2(p));
+    transform_normalTTT44f3f(I->TTT, I->primN3(p), I->primN3(p));
   }
 
   if(I->Context) {
-    RayApplyContextToVertex(I, p->v1);
-    RayApplyContextToNormal(I, p->n1);
-    RayApplyContextToNormal(I, p->n2);
-    RayApplyContextToNormal(I, p->n3);
+    RayApplyContextToVertex(I, I->primV1(p));
+    RayApplyContextToNormal(I, I->primN1(p));
+    RayApplyContextToNormal(I, I->primN2(p));
+    RayApplyContextToNormal(I, I->primN3(p));
   }
 
+  if(!RayPrimitivePaletteOk(I, p))
+    return false;
+
   I->NPrimitive++;
   return true;
 }
@@ -7066,17 +7675,17 @@ int CRay::triangle3fv(
      dump3f(c1," c1");
      dump3f(c2," c2");
      dump3f(c3," c3"); */
-  VLACacheCheck(I->G, I->Primitive, CPrimitive, I->NPrimitive, 0, cCache_ray_primitive);
-  CHECKOK(ok, I->Primitive);
+  p = RayNewPrimitive(I, cPrimGeomTriangle);
+  CHECKOK(ok, p);
   if (!ok)
     return false;
-  p = I->Primitive + I->NPrimitive;
 
   p->type = cPrimTriangle;
   p->trans = I->Trans;
-  p->tr[0] = I->Trans;
-  p->tr[1] = I->Trans;
-  p->tr[2] = I->Trans;
+  {
+    float tr[3] = { I->Trans, I->Trans, I->Trans };
+    p->tr = I->paletteIndex(tr);
+  }
   p->wobble = I->Wobble;
   p->ramped = ((c1[0] < 0.0F) || (c2[0] < 0.0F) || (c3[0] < 0.0F));
   /*
@@ -7100,7 +7709,7 @@ int CRay::triangle3fv(
   }
   normalize3f(n0);
 
-  vv = p->n0;
+  vv = I->primN0(p);
   (*vv++) = n0[0];
   (*vv++) = n0[1];
   (*vv++) = n0[2];
@@ -7126,91 +7735,79 @@ int CRay::triangle3fv(
      printf("%8.3f %8.3f %8.3f\n",s3[0],s3[1],s3[2]);
      } */
 
-  vv = p->v1;
+  vv = I->primV1(p);
   (*vv++) = (*v1++);
   (*vv++) = (*v1++);
   (*vv++) = (*v1++);
-  vv = p->v2;
+  vv = I->primV2(p);
   (*vv++) = (*v2++);
   (*vv++) = (*v2++);
   (*vv++) = (*v2++);
-  vv = p->v3;
+  vv = I->primV3(p);
   (*vv++) = (*v3++);
   (*vv++) = (*v3++);
   (*vv++) = (*v3++);
 
-  I->PrimSize += diff3f(p->v1, p->v2) + diff3f(p->v1, p->v3) + diff3f(p->v2, p->v3);
+  I->PrimSize += diff3f(I->primV1(p), I->primV2(p)) + diff3f(I->primV1(p), I->primV3(p)) + diff3f(I->primV2(p), I->primV3(p));
   I->PrimSizeCnt += 3;
 
-  vv = p->c1;
-  (*vv++) = (*c1++);
-  (*vv++) = (*c1++);
-  (*vv++) = (*c1++);
-  vv = p->c2;
-  (*vv++) = (*c2++);
-  (*vv++) = (*c2++);
-  (*vv++) = (*c2++);
-  vv = p->c3;
-  (*vv++) = (*c3++);
-  (*vv++) = (*c3++);
-  (*vv++) = (*c3++);
+  p->c1 = I->paletteIndex(c1);
+  p->c2 = I->paletteIndex(c2);
+  p->c3 = I->paletteIndex(c3);
 
-  {
-    float *v = I->IntColor;
-    vv = p->ic;
-    (*vv++) = (*v++);
-    (*vv++) = (*v++);
-    (*vv++) = (*v++);
-  }
+  p->ic = I->paletteIndex(I->IntColor);
 
   if (normals_exist){
-    vv = p->n1;
+    vv = I->primN1(p);
     (*vv++) = (*n1++);
     (*vv++) = (*n1++);
     (*vv++) = (*n1++);
-    vv = p->n2;
+    vv = I->primN2(p);
     (*vv++) = (*n2++);
     (*vv++) = (*n2++);
     (*vv++) = (*n2++);
-    vv = p->n3;
+    vv = I->primN3(p);
     (*vv++) = (*n3++);
     (*vv++) = (*n3++);
     (*vv++) = (*n3++);
   } else {
-    vv = p->n1;
+    vv = I->primN1(p);
     (*vv++) = n0[0];
     (*vv++) = n0[1];
     (*vv++) = n0[2];
-    vv = p->n2;
+    vv = I->primN2(p);
     (*vv++) = n0[0];
     (*vv++) = n0[1];
     (*vv++) = n0[2];
-    vv = p->n3;
+    vv = I->primN3(p);
     (*vv++) = n0[0];
     (*vv++) = n0[1];
     (*vv++) = n0[2];
   }
 
   if(I->TTTFlag) {
-    transformTTT44f3f(I->TTT, p->v1, p->v1);
-    transformTTT44f3f(I->TTT, p->v2, p->v2);
-    transformTTT44f3f(I->TTT, p->v3, p->v3);
-    transform_normalTTT44f3f(I->TTT, p->n0, p->n0);
-    transform_normalTTT44f3f(I->TTT, p->n1, p->n1);
-    transform_normalTTT44f3f(I->TTT, p->n2, p->n2);
-    transform_normalTTT44f3f(I->TTT, p->n3, p->n3);
+    transformTTT44f3f(I->TTT, I->primV1(p), I->primV1(p));
+    transformTTT44f3f(I->TTT, I->primV2(p), I->primV2(p));
+    transformTTT44f3f(I->TTT, I->primV3(p), I->primV3(p));
+    transform_normalTTT44f3f(I->TTT, I->primN0(p), I->primN0(p));
+    transform_normalTTT44f3f(I->TTT, I->primN1(p), I->primN1(p));
+    transform_normalTTT44f3f(I->TTT, I->primN2(p), I->primN2(p));
+    transform_normalTTT44f3f(I->TTT, I->primN3(p), I->primN3(p));
   }
 
   if(I->Context) {
-    RayApplyContextToVertex(I, p->v1);
-    RayApplyContextToVertex(I, p->v2);
-    RayApplyContextToVertex(I, p->v3);
-    RayApplyContextToNormal(I, p->n0);
-    RayApplyContextToNormal(I, p->n1);
-    RayApplyContextToNormal(I, p->n2);
-    RayApplyContextToNormal(I, p->n3);
+    RayApplyContextToVertex(I, I->primV1(p));
+    RayApplyContextToVertex(I, I->primV2(p));
+    RayApplyContextToVertex(I, I->primV3(p));
+    RayApplyContextToNormal(I, I->primN0(p));
+    RayApplyContextToNormal(I, I->primN1(p));
+    RayApplyContextToNormal(I, I->primN2(p));
+    RayApplyContextToNormal(I, I->primN3(p));
   }
 
+  if(!RayPrimitivePaletteOk(I, p))
+    return false;
+
   I->NPrimitive++;
   return true;
 }
@@ -7228,9 +7825,14 @@ int CRay::triangleTrans3fv(
     return false;
   p = I->Primitive + I->NPrimitive - 1;
 
-  p->tr[0] = t1;
-  p->tr[1] = t2;
-  p->tr[2] = t3;
+  {
+    float tr[3] = { t1, t2, t3 };
+    p->tr = I->paletteIndex(tr);
+  }
+  if(!RayPrimitivePaletteOk(I, p)) {
+    I->NPrimitive--;
+    return false;
+  }
   p->trans = (t1 + t2 + t3) / 3.0F;
   return true;
 }
@@ -7262,6 +7864,12 @@ CRay *RayNew(PyMOLGlobals * G, int antialias)
   I->NBasis = 2;
   I->Primitive = NULL;
   I->NPrimitive = 0;
+  I->PrimGeom = NULL;
+  I->NPrimGeom = 0;
+  I->Palette = NULL;
+  I->NPalette = 0;
+  I->PaletteHash = NULL;
+  I->NPaletteHash = 0;
   I->TTTStackVLA = NULL;
   I->TTTStackDepth = 0;
   I->CheckInterior = false;
@@ -7307,6 +7915,17 @@ void RayPrepare(CRay * I, float v0, float v1, float v2,
   int a;
   if(!I->Primitive)
     I->Primitive = VLACacheAlloc(I->G, CPrimitive, 10000, 3, cCache_ray_primitive);
+  if(!I->PrimGeom) {
+    I->PrimGeom = VLAlloc(float, 30000);
+    I->NPrimGeom = 0;
+  }
+  if(!I->Palette) {
+    /* entry 0 is black, the default for unset colors */
+    I->Palette = VLACalloc(float, 300);
+    I->NPalette = 1;
+  }
+  if(!I->PaletteHash)
+    RayPaletteRehash(I, cRayPaletteHash);
   if(!I->Vert2Prim)
     I->Vert2Prim = VLACacheAlloc(I->G, int, 10000, 3, cCache_ray_vert2prim);
   I->Volume[0] = v0;
@@ -7390,6 +8009,9 @@ void RayRelease(CRay * I)
   }
   I->NBasis = 0;
   VLACacheFreeP(I->G, I->Primitive, 0, cCache_ray_primitive, false);
+  VLAFreeP(I->PrimGeom);
+  VLAFreeP(I->Palette);
+  FreeP(I->PaletteHash);
   VLACacheFreeP(I->G, I->Vert2Prim, 0, cCache_ray_vert2prim, false);
 }
 
@@ -37,7 +37,8 @@ void RayPrepare(CRay * I, float v0, float v1, float v2,
                 float pixel_scale, int ortho, float pixel_ratio,
                 float back_ratio, float magnified);
 void RayRender(CRay * I, unsigned int *image,
-               double timing, float angle, int antialias, unsigned int *return_bg);
+               double timing, float angle, int antialias, unsigned int *return_bg,
+               int progressive);
 void RayRenderPOV(CRay * I, int width, int height, char **headerVLA,
                   char **charVLA, float front, float back, float fov, float angle,
                   int antialias);
@@ -73,7 +74,8 @@ int RayAntiThread(CRayAntiThreadInfo * T);
 int RayExpandPrimitives(CRay * I);
 int RayTransformFirst(CRay * I, int perspective, int identity);
 void RayComputeBox(CRay * I);
-int TriangleReverse(CPrimitive * p);
+int TriangleReverse(CRay * I, CPrimitive * p);
+void RayCacheFree(PyMOLGlobals * G);
 
 
 typedef struct {
@@ -114,10 +116,27 @@ struct _CRay {
   int ellipsoid3fv(const float *v, float r, const float *n1, const float *n2, const float *n3);
   int setLastToNoLighting(char no_lighting);
 
+  /* cold primitive data (see CPrimitive) */
+  float *primV1(const CPrimitive * p) { return PrimGeom + p->geom + cPrimGeomV1; }
+  float *primV2(const CPrimitive * p) { return PrimGeom + p->geom + cPrimGeomV2; }
+  float *primV3(const CPrimitive * p) { return PrimGeom + p->geom + cPrimGeomV3; }
+  float *primN0(const CPrimitive * p) { return PrimGeom + p->geom + cPrimGeomN0; }
+  float *primN1(const CPrimitive * p) { return PrimGeom + p->geom + cPrimGeomN1; }
+  float *primN2(const CPrimitive * p) { return PrimGeom + p->geom + cPrimGeomN2; }
+  float *primN3(const CPrimitive * p) { return PrimGeom + p->geom + cPrimGeomN3; }
+  float *color(int index) const { return Palette + 3 * index; }
+  int paletteIndex(const float *v);
+
   /* everything below should be private */
   PyMOLGlobals *G;
   CPrimitive *Primitive;
   int NPrimitive;
+  float *PrimGeom;              /* primitive coordinates and normals, VLA */
+  int NPrimGeom;
+  float *Palette;               /* distinct float triples referenced by primitives, VLA */
+  int NPalette;
+  int *PaletteHash;             /* open addressing table of palette index + 1, 0 = empty */
+  int NPaletteHash;             /* slots in PaletteHash, a power of 2 */
   CBasis *Basis;
   int NBasis;
   int *Vert2Prim;
@@ -6603,6 +6603,30 @@ static void SceneApplyImageGamma(PyMOLGlobals * G, unsigned int *buffer, int wid
 }
 
 
+/*========================================================================*/
+void SceneSetRayPreview(PyMOLGlobals * G, const unsigned int *image, int width,
+                        int height)
+{
+  /* progressive ray tracing: hand an intermediate image to the host
+     while RayRender is still refining it (NULL drops it) */
+  unsigned int *copy;
+
+  if(!G->PyMOL)
+    return;
+  if(!image) {
+    PyMOL_SetRayPreview(G->PyMOL, NULL, 0, 0);
+    return;
+  }
+  copy = Alloc(unsigned int, width * height);
+  if(!copy)
+    return;
+  memcpy(copy, image, sizeof(unsigned int) * width * height);
+  SceneApplyImageGamma(G, copy, width, height);
+  PyMOL_SetRayPreview(G->PyMOL, copy, width, height);
+  FreeP(copy);
+}
+
+
 /*========================================================================*/
 
 static double accumTiming = 0.0;
@@ -7087,7 +7111,11 @@ bool SceneRay(PyMOLGlobals * G,
           unsigned int background;
           ErrChkPtr(G, buffer);
 
-          RayRender(ray, buffer, timing, angle, antialias, &background);
+          RayRender(ray, buffer, timing, angle, antialias, &background,
+                    SettingGetGlobal_b(G, cSetting_ray_progressive) &&
+                    !I->grid.active && !stereo_hand);
+
+          SceneSetRayPreview(G, NULL, 0, 0);
 
           /*    RayRenderColorTable(ray,ray_width,ray_height,buffer); */
           if(!I->grid.active) {
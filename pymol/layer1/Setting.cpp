@@ -24,6 +24,7 @@ Z* -------------------------------------------------------------------
 #include"Base.h"
 #include"OOMac.h"
 #include"MemoryDebug.h"
+#include"MemoryCache.h"
 #include"Ortho.h"
 #include"Setting.h"
 #include"Scene.h"
@@ -1927,6 +1928,10 @@ void SettingGenerateSideEffects(PyMOLGlobals * G, int index, const char *sele, i
   case cSetting_defer_builds_mode:
     ExecutiveRebuildAll(G);
     break;
+  case cSetting_cache_memory:
+  case cSetting_cache_memory_max:
+    MemoryCacheTrim(G);
+    break;
   case cSetting_seq_view:
   case cSetting_seq_view_label_spacing:
   case cSetting_seq_view_label_mode:
@@ -344,7 +344,7 @@ enum {
   REC_i( 261, max_threads                             , object    , 1 ),
   REC_i( 262, show_progress                           , global    , 1 ),
   REC_i( 263, use_display_lists                       , unused    , 0 ),
-  REC_i( 264, cache_memory                            , global    , 0 ),        /* doesn't seem to do any good :( */
+  REC_i( 264, cache_memory                            , global    , 1 ),        /* pool ray tracer & map buffers */
   REC_b( 265, simplify_display_lists                  , unused    , 0 ),
   REC_i( 266, retain_order                            , object    , 0 ),
   REC_i( 267, pdb_hetatm_sort                         , object    , 0 ),
@@ -872,6 +872,16 @@ enum {
   REC_b( 764, colored_feedback                        , global    , 0 ),
   REC_b( 765, sdf_write_zero_order_bonds              , global    , 0 ),
   REC_b( 766, cif_metalc_as_zero_order_bonds          , global    , 1 ),
+  REC_b( 767, ray_native_threads                      , global    , 1 ),
+  REC_i( 768, ray_tile_size                           , global    , 32 ), // 0: interleaved scan lines
+  REC_b( 769, ray_bvh                                 , global    , 0 ),        /* not pixel-identical to the voxel map, see Basis.cpp */
+  REC_b( 770, ray_simd                                , global    , 1 ),
+  REC_b( 771, ray_progressive                         , global    , 0 ),
+  REC_b( 772, ray_bvh_reuse                           , global    , 1 ),
+  REC_i( 773, cache_memory_max                        , global    , 256 ),      /* MB */
+  REC_i( 774, frame_store                             , object    , 0 ),        // 1: float, 2: half float, 3: 16-bit quantized
+  REC_b( 775, frame_stream                            , object    , 0 ),
+  REC_i( 776, frame_stream_cache                      , object    , 256 ),      /* MB */
 
 #ifdef SETTINGINFO_IMPLEMENTATION
 #undef SETTINGINFO_IMPLEMENTATION
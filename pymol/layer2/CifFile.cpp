@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
 #include <vector>
 #include <iostream>
 
@@ -17,6 +18,25 @@
 #include "File.h"
 #include "MemoryDebug.h"
 #include "strcasecmp.h"
+#include "Base.h"
+#include "Setting.h"
+#include "ThreadPool.h"
+
+// smallest file size for parallel tokenizing
+#define CIF_PARALLEL_MIN (1 << 20)
+
+// string storage block size, and buffer size for numeric values
+#define CIF_STRINGS_BLOCK (1 << 16)
+#define CIF_NUMBER_MAX 64
+
+// token types
+enum {
+  CIF_TOKEN_NULL,       // '.' (inapplicable) or '?' (unknown), NULL pointer
+  CIF_TOKEN_BARE,       // ends at whitespace, only these can be keys
+  CIF_TOKEN_QUOTE,      // points to the opening quote
+  CIF_TOKEN_TEXT,       // ends at a line feed followed by a semicolon
+  CIF_TOKEN_STRING      // NULL terminated copy
+};
 
 // basic IO and string handling
 
@@ -67,22 +87,89 @@ static bool isquote(char c) {
 #undef isspecial
 #endif
 
-// Return true if token is a STAR keyword
+// Return true if the unquoted token is "word" (case insensitive)
+static bool tokenis(const char *token, const char *word) {
+  size_t n = strlen(word);
+  return (strncasecmp(word, token, n) == 0 && iswhitespace0(token[n]));
+}
+
+// Return true if the unquoted token is a STAR keyword
 static bool isspecial(const char *token) {
   return (token[0] == '_'
       || strncasecmp("data_", token, 5) == 0
       || strncasecmp("save_", token, 5) == 0
-      || strcasecmp("loop_", token) == 0
-      || strcasecmp("stop_", token) == 0
-      || strcasecmp("global_", token) == 0);
+      || tokenis(token, "loop_")
+      || tokenis(token, "stop_")
+      || tokenis(token, "global_"));
 }
 
-// convert all chars to lowercase
-static void tolowerinplace(char *p) {
-  for (; *p; p++) {
-    if (*p <= 'Z' && *p >= 'A')
-      *p -= 'Z' - 'z';
+/*
+ * Get the end of a token which isn't NULL terminated, and advance p to
+ * its first character (past the opening quote)
+ */
+static const char * tokenend(const char *&p, unsigned char type) {
+  const char * q = p;
+  switch (type) {
+  case CIF_TOKEN_QUOTE: {
+    char quote = *(p++);
+    for (q = p; *q && !(*q == quote && iswhitespace0(q[1])); ++q);
+    break;
+  }
+  case CIF_TOKEN_TEXT:
+    for (; *q && !(islinefeed(*q) && q[1] == ';'); ++q);
+    break;
+  case CIF_TOKEN_BARE:
+    for (; !iswhitespace0(*q); ++q);
+    break;
+  default:
+    q += strlen(q);
   }
+  return q;
+}
+
+// NULL terminated copy of a token (optionally lowercase)
+static const char * tokencopy(cif_strings &strings, const char *p,
+    unsigned char type, bool lower = false) {
+  if (!p || type == CIF_TOKEN_STRING)
+    return p;
+  const char * end = tokenend(p, type);
+  return strings.copy(p, end - p, lower);
+}
+
+cif_strings::~cif_strings() {
+  for (std::vector<char*>::iterator it = blocks.begin(),
+      it_end = blocks.end(); it != it_end; ++it)
+    mfree(*it);
+}
+
+// copy len chars of s (converted to lowercase if lower is true)
+const char * cif_strings::copy(const char * s, size_t len, bool lower) {
+  char * d;
+
+  if (len >= CIF_STRINGS_BLOCK / 4) {
+    // large values get a block of their own
+    d = (char *) mmalloc(len + 1);
+    blocks.push_back(d);
+  } else {
+    if (len + 1 > left) {
+      next = (char *) mmalloc(CIF_STRINGS_BLOCK);
+      left = CIF_STRINGS_BLOCK;
+      blocks.push_back(next);
+    }
+    d = next;
+    next += len + 1;
+    left -= len + 1;
+  }
+
+  if (lower) {
+    for (size_t i = 0; i < len; ++i)
+      d[i] = (s[i] <= 'Z' && s[i] >= 'A') ? s[i] - ('Z' - 'z') : s[i];
+  } else {
+    memcpy(d, s, len);
+  }
+
+  d[len] = 0;
+  return d;
 }
 
 // CIF stuff
@@ -99,16 +186,50 @@ public:
   int ncols;
   int nrows;
   const char **values;
+  unsigned char *types;
+  cif_strings *strings;
 
   // methods
+  const char * get_token(int row, int col) const;
   const char * get_value_raw(int row, int col) const;
+  const char * get_value_raw(int row, int col, char * buf, size_t size) const;
 };
 
+// get table token (maybe not NULL terminated), return NULL if indices out
+// of bounds
+const char * cif_loop::get_token(int row, int col) const {
+  if (row >= nrows)
+    return NULL;
+  return values[row * ncols + col];
+}
+
 // get table value, return NULL if indices out of bounds
+// (values are copied to the string storage on first access)
 const char * cif_loop::get_value_raw(int row, int col) const {
   if (row >= nrows)
     return NULL;
-  return values[row * ncols + col];
+  int i = row * ncols + col;
+  if (values[i] && types[i] != CIF_TOKEN_STRING) {
+    values[i] = tokencopy(*strings, values[i], types[i]);
+    types[i] = CIF_TOKEN_STRING;
+  }
+  return values[i];
+}
+
+// get table value, copied to buf if it's short and not a copy yet
+const char * cif_loop::get_value_raw(int row, int col, char * buf, size_t size) const {
+  if (row >= nrows)
+    return NULL;
+  int i = row * ncols + col;
+  const char * p = values[i];
+  if (!p || types[i] == CIF_TOKEN_STRING)
+    return p;
+  const char * end = tokenend(p, types[i]);
+  if ((size_t) (end - p) >= size)
+    return get_value_raw(row, col);
+  memcpy(buf, p, end - p);
+  buf[end - p] = 0;
+  return buf;
 }
 
 // get the number of elements in this array
@@ -124,6 +245,13 @@ const char * cif_array::get_value(int row) const {
   return pointer.loop->get_value_raw(row, col);
 }
 
+// get array value, short values may be copied to buf
+const char * cif_array::get_value(int row, char * buf, size_t size) const {
+  if (col < 0)
+    return (row > 0) ? NULL : pointer.value;
+  return pointer.loop->get_value_raw(row, col, buf, size);
+}
+
 // get array value, return an empty string if missing
 const char * cif_array::as_s(int row) const {
   const char * s = get_value(row);
@@ -132,16 +260,25 @@ const char * cif_array::as_s(int row) const {
 
 // get array value as integer, return d (default 0) if missing
 int cif_array::as_i(int row, int d) const {
-  const char * s = get_value(row);
+  char buf[CIF_NUMBER_MAX];
+  const char * s = get_value(row, buf, sizeof(buf));
   return s ? atoi(s) : d;
 }
 
 // get array value as double, return d (default 0.0) if missing
 double cif_array::as_d(int row, double d) const {
-  const char * s = get_value(row);
+  char buf[CIF_NUMBER_MAX];
+  const char * s = get_value(row, buf, sizeof(buf));
   return s ? scifloat(s) : d;
 }
 
+// true if value in ['.', '?']
+bool cif_array::is_missing(int row) const {
+  if (col < 0)
+    return (row > 0) || !pointer.value;
+  return !pointer.loop->get_token(row, col);
+}
+
 // true if all values in ['.', '?']
 bool cif_array::is_missing_all() const {
   int n = get_nrows();
@@ -202,17 +339,23 @@ const cif_array * cif_data::get_opt(const char * key, const char * alias1, const
 }
 
 // constructor
-cif_file::cif_file(const char* filename, const char* contents_) {
+cif_file::cif_file(const char* filename, const char* contents_, PyMOLGlobals * G) {
+  view.data = NULL;
+  view.size = 0;
+  view.mapped = false;
+  contents = NULL;
+
   if (contents_) {
+    // the string may not live as long as the parsed data
     contents = mstrdup(contents_);
+    if (contents)
+      parse(G, contents, strlen(contents));
+  } else if (FileViewOpenText(&view, filename)) {
+    // tokens point into the (read-only) view
+    parse(G, view.data, view.size);
   } else {
-    contents = FileGetContents(filename, NULL);
-    if (!contents)
-      std::cerr << "ERROR: Failed to load file '" << filename << "'" << std::endl;
+    std::cerr << "ERROR: Failed to load file '" << filename << "'" << std::endl;
   }
-
-  if (contents)
-    parse();
 }
 
 // destructor
@@ -223,6 +366,8 @@ cif_file::~cif_file() {
 
   if (contents)
     mfree(contents);
+
+  FileViewClose(&view);
 }
 
 // destructor
@@ -236,64 +381,178 @@ cif_data::~cif_data() {
     delete *it;
 }
 
-// parse CIF contents
-bool cif_file::parse() {
-  char *p = contents;
+/*
+ * Tokenize the string from p to end (which starts a line if prev is a line
+ * feed). The string is not modified, tokens end at the next whitespace,
+ * closing quote or text field delimiter. The values '.' and '?' are stored
+ * as NULL. Only unquoted tokens can be keys.
+ */
+static void tokenize(const char * p, const char * end, char prev,
+    std::vector<const char*> &tokens, std::vector<unsigned char> &types) {
   char quote;
-  char prev = '\0';
-
-  std::vector<bool> keypossible;
 
-  // tokenize
   while (true) {
-    while (iswhitespace(*p))
+    while (p < end && iswhitespace(*p))
       prev = *(p++);
 
-    if (!*p)
+    if (p == end || !*p)
       break;
 
     if (*p == '#') {
-      while (!(islinefeed0(*++p)));
+      while (++p < end && !islinefeed0(*p));
       prev = *p;
-    } else if (isquote(*p)) { // will NULL the closing quote
+    } else if (isquote(*p)) { // ends at the closing quote
       quote = *p;
-      keypossible.push_back(false);
-      tokens.push_back(p + 1);
-      while (*++p && !(*p == quote && iswhitespace0(p[1])));
-      if (*p)
-        *(p++) = 0;
+      types.push_back(CIF_TOKEN_QUOTE);
+      tokens.push_back(p);
+      while (++p < end && *p && !(*p == quote && iswhitespace0(p[1])));
+      if (p < end && *p)
+        p++;
       prev = *p;
-    } else if (*p == ';' && islinefeed(prev)) { // will NULL the line feed before the closing semicolon
-      keypossible.push_back(false);
+    } else if (*p == ';' && islinefeed(prev)) { // ends at the line feed before the closing semicolon
+      types.push_back(CIF_TOKEN_TEXT);
       tokens.push_back(p + 1);
-      while (*++p && !(islinefeed(*p) && p[1] == ';'));
-      if (*p) {
-        *p = 0;
+      while (++p < end && *p && !(islinefeed(*p) && p[1] == ';'));
+      if (p < end && *p)
         p += 2;
-      }
       prev = ';';
-    } else { // will null the whitespace
-      char * q = p++;
-      while (!iswhitespace0(*p)) ++p;
+    } else { // ends at whitespace
+      const char * q = p++;
+      while (p < end && !iswhitespace0(*p)) ++p;
       prev = *p;
       if (p - q == 1 && (*q == '?' || *q == '.')) {
         // store values '.' (inapplicable) and '?' (unknown) as null-pointers
-        q = NULL;
-        keypossible.push_back(false);
+        types.push_back(CIF_TOKEN_NULL);
+        tokens.push_back(NULL);
       } else {
-        if (*p)
-          *(p++) = 0;
-        keypossible.push_back(true);
+        types.push_back(CIF_TOKEN_BARE);
+        tokens.push_back(q);
       }
-      tokens.push_back(q);
     }
   }
+}
+
+/*
+ * Parallel tokenizing: the contents are cut into chunks at line feeds
+ * which are not inside a text field (text fields are delimited by lines
+ * starting with a semicolon), and each chunk is tokenized on its own.
+ * The chunk results are then copied in order into the file's token list.
+ */
+struct cif_tokenize_job {
+  std::vector<const char*> begin;
+  std::vector<std::vector<const char*> > tokens;
+  std::vector<std::vector<unsigned char> > types;
+  std::vector<size_t> offset;
+  const char * end;
+  std::vector<const char*> * all_tokens;
+  std::vector<unsigned char> * all_types;
+};
+
+static void cif_tokenize_task(void * data, int i) {
+  cif_tokenize_job * job = (cif_tokenize_job *) data;
+  const char * end = (i + 1 < (int) job->begin.size()) ? job->begin[i + 1] : job->end;
+  tokenize(job->begin[i], end, i ? '\n' : '\0', job->tokens[i], job->types[i]);
+}
+
+static void cif_merge_task(void * data, int i) {
+  cif_tokenize_job * job = (cif_tokenize_job *) data;
+  size_t n = job->tokens[i].size();
+  if (n) {
+    memcpy(&(*job->all_tokens)[job->offset[i]], &job->tokens[i][0], n * sizeof(const char*));
+    memcpy(&(*job->all_types)[job->offset[i]], &job->types[i][0], n);
+  }
+  std::vector<const char*>().swap(job->tokens[i]);
+  std::vector<unsigned char>().swap(job->types[i]);
+}
+
+static int cif_get_nthread(PyMOLGlobals * G, size_t len) {
+  int n_thread;
+  if (!G || !G->Setting || len < CIF_PARALLEL_MIN || !ThreadPoolIsNative())
+    return 1;
+  n_thread = SettingGetGlobal_i(G, cSetting_max_threads);
+  if (n_thread < 1)
+    n_thread = 1;
+  if (n_thread > PYMOL_MAX_THREADS)
+    n_thread = PYMOL_MAX_THREADS;
+  return n_thread;
+}
+
+// returns false (having done nothing) if the contents don't split
+static bool tokenize_parallel(PyMOLGlobals * G, const char * contents, size_t len,
+    int n_thread, std::vector<const char*> &tokens, std::vector<unsigned char> &types) {
+  const char * end = contents + len;
+  std::vector<const char*> delim;
+  cif_tokenize_job job;
+  int n_chunk;
+
+  // text field delimiters
+  for (const char * s = contents + 1;
+      (s = (const char *) memchr(s, ';', end - s)); ++s)
+    if (islinefeed(s[-1]))
+      delim.push_back(s);
+
+  // chunk boundaries (after a line feed with an even number of delimiters before)
+  job.begin.push_back(contents);
+  for (int k = 1; k < n_thread; ++k) {
+    const char * p = contents + len / n_thread * k;
+    if (p < job.begin.back())
+      p = job.begin.back();
+    while ((p = (const char *) memchr(p, '\n', end - p))) {
+      size_t i = std::lower_bound(delim.begin(), delim.end(), p) - delim.begin();
+      if (i % 2 == 0)
+        break;
+      if (i == delim.size()) {
+        p = NULL; // unterminated text field
+        break;
+      }
+      p = delim[i];
+    }
+    if (!p || p + 1 >= end)
+      break;
+    job.begin.push_back(p + 1);
+  }
+
+  n_chunk = job.begin.size();
+  if (n_chunk < 2)
+    return false;
+
+  job.end = end;
+  job.tokens.resize(n_chunk);
+  job.types.resize(n_chunk);
+  ThreadPoolRun(G, n_thread, n_chunk, cif_tokenize_task, &job);
+
+  job.offset.resize(n_chunk);
+  size_t n = 0;
+  for (int i = 0; i < n_chunk; ++i) {
+    job.offset[i] = n;
+    n += job.tokens[i].size();
+  }
+  tokens.resize(n);
+  types.resize(n);
+  job.all_tokens = &tokens;
+  job.all_types = &types;
+  ThreadPoolRun(G, n_thread, n_chunk, cif_merge_task, &job);
+
+  return true;
+}
+
+// parse CIF contents
+bool cif_file::parse(PyMOLGlobals * G, const char * data, size_t len) {
+  const char * nul = (const char *) memchr(data, 0, len);
+  if (nul)
+    len = nul - data;
+
+  int n_thread = cif_get_nthread(G, len);
+
+  // tokenize
+  if (n_thread < 2 || !tokenize_parallel(G, data, len, n_thread, tokens, types))
+    tokenize(data, data + len, '\0', tokens, types);
 
   cif_data *current_data = NULL, *current_frame = NULL, *global_block = NULL;
 
   // parse into dictionary
   for (unsigned int i = 0, n = tokens.size(); i < n; i++) {
-    if (!keypossible[i]) {
+    if (types[i] != CIF_TOKEN_BARE) {
       std::cout << "ERROR" << std::endl;
       break;
     } else if (tokens[i][0] == '_') {
@@ -303,12 +562,13 @@ bool cif_file::parse() {
       }
 
       if (current_frame) {
-        tolowerinplace(tokens[i]);
-        current_frame->dict[tokens[i]].set_value(tokens[i + 1]);
+        const char * key = tokencopy(strings, tokens[i], types[i], true);
+        current_frame->dict[key].set_value(
+            tokencopy(strings, tokens[i + 1], types[i + 1]));
       }
 
       i++;
-    } else if (strcasecmp("loop_", tokens[i]) == 0) {
+    } else if (tokenis(tokens[i], "loop_")) {
       int ncols = 0;
       int nrows = 0;
       cif_loop *loop = NULL;
@@ -322,11 +582,10 @@ bool cif_file::parse() {
       }
 
       // columns
-      while (++i < n && keypossible[i] && tokens[i][0] == '_') {
-        tolowerinplace(tokens[i]);
-
+      while (++i < n && types[i] == CIF_TOKEN_BARE && tokens[i][0] == '_') {
         if (current_frame) {
-          current_frame->dict[tokens[i]].set_loop(loop, ncols);
+          const char * key = tokencopy(strings, tokens[i], types[i], true);
+          current_frame->dict[key].set_loop(loop, ncols);
         }
 
         ncols++;
@@ -334,12 +593,14 @@ bool cif_file::parse() {
 
       if (loop) {
         // loop data
-        loop->values = (const char **) &tokens[i];
+        loop->values = &tokens[i];
+        loop->types = &types[i];
+        loop->strings = &strings;
         loop->ncols = ncols;
       }
 
       // rows
-      while (i < n && !(keypossible[i] && isspecial(tokens[i]))) {
+      while (i < n && !(types[i] == CIF_TOKEN_BARE && isspecial(tokens[i]))) {
         i += ncols;
 
         if (i > n) {
@@ -358,7 +619,7 @@ bool cif_file::parse() {
       i--;
 
     } else if (strncasecmp("data_", tokens[i], 5) == 0) {
-      const char * key(tokens[i] + 5);
+      const char * key = tokencopy(strings, tokens[i] + 5, CIF_TOKEN_BARE);
       datablocks[key] = current_data = current_frame = new cif_data;
 
     } else if (strncasecmp("global_", tokens[i], 5) == 0) {
@@ -366,9 +627,9 @@ bool cif_file::parse() {
       global_block = current_data = current_frame = new cif_data;
 
     } else if (strncasecmp("save_", tokens[i], 5) == 0) {
-      if (tokens[i][5] && current_data) {
+      if (!iswhitespace0(tokens[i][5]) && current_data) {
         // begin
-        const char * key(tokens[i] + 5);
+        const char * key = tokencopy(strings, tokens[i] + 5, CIF_TOKEN_BARE);
         current_data->saveframes[key] = current_frame = new cif_data;
       } else {
         // end
@@ -10,8 +10,15 @@
 #include <vector>
 #include <map>
 
+#ifndef _PYMOL_NO_CXX11
+#include <unordered_map>
+#endif
+
 #include <string.h>
 
+#include "PyMOLGlobals.h"
+#include "File.h"
+
 /*
  * C string comparison class
  */
@@ -21,17 +28,58 @@ struct strless2_t {
   }
 };
 
+#ifndef _PYMOL_NO_CXX11
+/*
+ * C string hashing (FNV-1a) and equality, for hashed key lookup
+ */
+struct strhash_t {
+  size_t operator()(const char * s) const {
+    size_t h = 2166136261U;
+    for (; *s; ++s)
+      h = (h ^ (unsigned char) *s) * 16777619U;
+    return h;
+  }
+};
+
+struct strequal_t {
+  bool operator()(const char * a, const char * b) const {
+    return strcmp(a, b) == 0;
+  }
+};
+#endif
+
 // cif data types
 class cif_data;
 class cif_loop;
 class cif_array;
 typedef std::vector<cif_loop*> v_cifloopp_t;
 typedef std::map<const char*, cif_data*, strless2_t> m_str_cifdatap_t;
+#ifndef _PYMOL_NO_CXX11
+typedef std::unordered_map<const char*, cif_array, strhash_t, strequal_t> m_str_cifarray_t;
+#else
 typedef std::map<const char*, cif_array, strless2_t> m_str_cifarray_t;
+#endif
 
 // atof with uncertanty notation handling
 double scifloat(const char *);
 
+/*
+ * Storage for NULL terminated copies of tokens (the contents are never
+ * modified, tokens are only terminated by the following whitespace)
+ */
+class cif_strings {
+  std::vector<char*> blocks;
+  char * next;
+  size_t left;
+
+public:
+  cif_strings() : next(NULL), left(0) {
+  };
+  ~cif_strings();
+
+  const char * copy(const char * s, size_t len, bool lower = false);
+};
+
 /*
  * Class for reading CIF files.
  * Parses the entire file and exposes its data blocks.
@@ -41,16 +89,21 @@ public:
   m_str_cifdatap_t datablocks;
 
   // constructors & destructor
-  cif_file(const char* filename, const char* contents=NULL);
+  // (with G, large files are tokenized on max_threads threads)
+  cif_file(const char* filename, const char* contents=NULL, PyMOLGlobals * G=NULL);
   ~cif_file();
 
 private:
+  // mapped file, or copy of the contents string
+  CFileView view;
   char * contents;
 
-  std::vector<char*> tokens;
+  std::vector<const char*> tokens;
+  std::vector<unsigned char> types;
+  cif_strings strings;
 
   // methods
-  bool parse();
+  bool parse(PyMOLGlobals * G, const char * data, size_t len);
 };
 
 /*
@@ -72,6 +125,10 @@ private:
   // methods
   const char * get_value(int row = 0) const;
 
+  // like get_value, but short values which are not NULL terminated yet
+  // are copied to buf instead of the file's string storage
+  const char * get_value(int row, char * buf, size_t size) const;
+
   // point this array to a loop (only for parsing)
   void set_loop(const cif_loop * loop, short col_) {
     col = col_;
@@ -104,9 +161,7 @@ public:
   double       as_d(int row = 0, double d = 0.0) const;
 
   // true if value in ['.', '?']
-  bool is_missing(int row = 0) const {
-    return !get_value(row);
-  }
+  bool is_missing(int row = 0) const;
 
   // true if all values in ['.', '?']
   bool is_missing_all() const;
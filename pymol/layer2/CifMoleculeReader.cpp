@@ -2250,7 +2250,7 @@ static ObjectMolecule *ObjectMoleculeReadCifData(PyMOLGlobals * G,
 ObjectMolecule *ObjectMoleculeReadCifStr(PyMOLGlobals * G, ObjectMolecule * I,
                                       const char *st, int frame,
                                       int discrete, int quiet, int multiplex,
-                                      int zoom)
+                                      int zoom, const char *filename)
 {
   if (I) {
     PRINTFB(G, FB_ObjectMolecule, FB_Errors)
@@ -2266,11 +2266,11 @@ ObjectMolecule *ObjectMoleculeReadCifStr(PyMOLGlobals * G, ObjectMolecule * I,
     return NULL;
   }
 
-  const char * filename = NULL;
+  // with a file name (and st == NULL) the file is mapped, not copied
 #ifndef _PYMOL_NO_CXX11
-  auto cif = std::make_shared<cif_file>(filename, st);
+  auto cif = std::make_shared<cif_file>(filename, st, G);
 #else
-  cif_file _cif_stack(filename, st);
+  cif_file _cif_stack(filename, st, G);
   auto cif = &_cif_stack;
 #endif
 
@@ -1125,7 +1125,7 @@ void CoordSetUpdateCoord2IdxMap(CoordSet * I, float cutoff)
     cutoff = R_SMALL4;
   if(I->NIndex > 10) {
     if(I->Coord2Idx) {
-      if((I->Coord2IdxDiv < cutoff) ||
+      if((I->Coord2IdxDiv < cutoff) || (I->Coord2Idx->NVert != I->NIndex) ||
          (((cutoff - I->Coord2IdxReq) / I->Coord2IdxReq) < -0.5F)) {
         MapFree(I->Coord2Idx);
         I->Coord2Idx = NULL;
@@ -1135,6 +1135,8 @@ void CoordSetUpdateCoord2IdxMap(CoordSet * I, float cutoff)
       I->Coord2IdxReq = cutoff;
       I->Coord2IdxDiv = cutoff * 1.25F;
       I->Coord2Idx = MapNew(I->State.G, I->Coord2IdxDiv, I->Coord, I->NIndex, NULL);
+      if(!I->Coord2Idx)
+        return;
       if(I->Coord2IdxDiv < I->Coord2Idx->Div)
         I->Coord2IdxDiv = I->Coord2Idx->Div;
     }
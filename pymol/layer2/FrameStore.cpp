@@ -0,0 +1,931 @@
+/* 
+A* -------------------------------------------------------------------
+B* This file contains source code for the PyMOL computer program
+C* Copyright (c) Schrodinger, LLC. 
+D* -------------------------------------------------------------------
+E* It is unlawful to modify or remove this copyright notice.
+F* -------------------------------------------------------------------
+G* Please see the accompanying LICENSE file for further information. 
+H* -------------------------------------------------------------------
+I* Additional authors of this source file include:
+-* 
+-* 
+-*
+Z* -------------------------------------------------------------------
+*/
+#include"os_python.h"
+#include"os_predef.h"
+#include"os_std.h"
+
+#include<deque>
+#include<vector>
+
+#ifndef _PYMOL_NO_CXX11
+#include<condition_variable>
+#include<mutex>
+#include<thread>
+#endif
+
+#include"OOMac.h"
+#include"MemoryDebug.h"
+#include"Feedback.h"
+#include"Util.h"
+#include"Map.h"
+#include"CGO.h"
+#include"Crystal.h"
+#include"CoordSet.h"
+#include"FrameStore.h"
+
+#define cFrameStoreKeep 4       /* recently used states kept outside the window */
+#define cFrameStorePrefetch 8   /* streamed states read ahead during playback */
+
+typedef struct {
+  void *Data;                   /* NULL: state not stored (or not read yet) */
+  float Origin[3], Step[3];     /* half: center; quantized: minimum and step */
+  float Box[6];                 /* dimensions and angles, Box[0] == 0: no box */
+  int Resident;                 /* materialized by the store */
+  int Streamed;                 /* Data can be read again from the source */
+  int Prev, Next;               /* cache list, while Data && Streamed */
+} FrameStoreRec;
+
+typedef struct {
+  int State;
+  CoordSet *cs;
+} FrameStoreResident;
+
+typedef struct {
+  int State;
+  FrameStoreRec Rec;
+} FrameStreamResult;
+
+/*
+ * Streaming state. The prefetch thread only reads the source, the layout
+ * size and SourceIdx; it hands its frames over through Done, everything
+ * else belongs to the main thread. Purge (which changes the layout) waits
+ * for the thread to be idle first.
+ */
+struct CFrameStream {
+  FrameStoreSource Source;
+  int State0;                   /* first streamed state */
+  int NFrame;
+  int NAtom;                    /* atoms per source frame */
+  int *SourceIdx;               /* VLA: source atom of each layout index */
+  float *Raw, *Coord;           /* VLAs: read buffers of the main thread */
+  ov_size CacheSize;            /* bytes of frames in the cache list */
+  int Head, Tail;               /* cache list, most recently used first */
+  std::deque<int> Queue;        /* states to prefetch */
+  std::vector<FrameStreamResult> Done;
+#ifndef _PYMOL_NO_CXX11
+  std::mutex SourceMutex;       /* the source reads one frame at a time */
+  std::mutex Mutex;             /* guards Queue, Done and Busy */
+  std::condition_variable Wake, Idle;
+  std::thread Thread;
+  bool Busy, Quit;
+#endif
+};
+
+struct CFrameStore {
+  PyMOLGlobals *G;
+  ObjectMolecule *Obj;
+  CoordSet *Layout;
+  int Format;
+  FrameStoreRec *Frame;         /* VLA, by state */
+  int NFrame;
+  FrameStoreResident *Resident; /* VLA, least recently loaded first */
+  int NResident;
+  CoordSet *Spare;              /* recycled coordinate set */
+  float *Scratch;               /* VLA */
+  CFrameStream *Stream;
+};
+
+static int FrameStoreValueSize(const CFrameStore * I)
+{
+  return (I->Format == cFrameStoreFloat) ? sizeof(float) : sizeof(unsigned short);
+}
+
+static ov_size FrameStoreFrameSize(const CFrameStore * I)
+{
+  return FrameStoreValueSize(I) * 3 * (ov_size) I->Layout->NIndex;
+}
+
+static int FrameStoreHas(const FrameStoreRec * rec)
+{
+  return rec->Data || rec->Streamed;
+}
+
+static void FrameStoreEncode(const CFrameStore * I, FrameStoreRec * rec, const float *coord)
+{
+  int n = I->Layout->NIndex;
+  int a, c;
+  float mn[3], mx[3];
+
+  switch (I->Format) {
+  case cFrameStoreFloat:
+    memcpy(rec->Data, coord, sizeof(float) * 3 * n);
+    return;
+  }
+
+  copy3f(coord, mn);
+  copy3f(coord, mx);
+  for(a = 1; a < n; a++) {
+    const float *v = coord + 3 * a;
+    for(c = 0; c < 3; c++) {
+      if(mn[c] > v[c])
+        mn[c] = v[c];
+      if(mx[c] < v[c])
+        mx[c] = v[c];
+    }
+  }
+
+  if(I->Format == cFrameStoreHalf) {
+    unsigned short *h = (unsigned short *) rec->Data;
+    for(c = 0; c < 3; c++) {
+      rec->Origin[c] = 0.5F * (mn[c] + mx[c]);
+      rec->Step[c] = 0.0F;
+    }
+    for(a = 0; a < n; a++)
+      for(c = 0; c < 3; c++)
+        *(h++) = UtilFloatToHalf(*(coord++) - rec->Origin[c]);
+  } else {
+    unsigned short *q = (unsigned short *) rec->Data;
+    float scale[3];
+    for(c = 0; c < 3; c++) {
+      rec->Origin[c] = mn[c];
+      rec->Step[c] = (mx[c] - mn[c]) / 65535.0F;
+      scale[c] = (rec->Step[c] > 0.0F) ? 1.0F / rec->Step[c] : 0.0F;
+    }
+    for(a = 0; a < n; a++)
+      for(c = 0; c < 3; c++) {
+        int v = (int) ((*(coord++) - rec->Origin[c]) * scale[c] + 0.5F);
+        *(q++) = (unsigned short) ((v < 0) ? 0 : (v > 65535) ? 65535 : v);
+      }
+  }
+}
+
+static void FrameStoreDecode(const CFrameStore * I, const FrameStoreRec * rec, float *coord)
+{
+  int n = I->Layout->NIndex;
+  int a, c;
+
+  switch (I->Format) {
+  case cFrameStoreFloat:
+    memcpy(coord, rec->Data, sizeof(float) * 3 * n);
+    break;
+  case cFrameStoreHalf:
+    {
+      const unsigned short *h = (const unsigned short *) rec->Data;
+      for(a = 0; a < n; a++)
+        for(c = 0; c < 3; c++)
+          *(coord++) = rec->Origin[c] + UtilHalfToFloat(*(h++));
+    }
+    break;
+  default:
+    {
+      const unsigned short *q = (const unsigned short *) rec->Data;
+      for(a = 0; a < n; a++)
+        for(c = 0; c < 3; c++)
+          *(coord++) = rec->Origin[c] + rec->Step[c] * *(q++);
+    }
+    break;
+  }
+}
+
+/*========================================================================*/
+/* cache list of streamed frames which have been read */
+
+static void FrameStreamLink(CFrameStore * I, int state)
+{
+  CFrameStream *S = I->Stream;
+  FrameStoreRec *rec = I->Frame + state;
+  rec->Prev = -1;
+  rec->Next = S->Head;
+  if(S->Head >= 0)
+    I->Frame[S->Head].Prev = state;
+  else
+    S->Tail = state;
+  S->Head = state;
+  S->CacheSize += FrameStoreFrameSize(I);
+}
+
+static void FrameStreamUnlink(CFrameStore * I, int state)
+{
+  CFrameStream *S = I->Stream;
+  FrameStoreRec *rec = I->Frame + state;
+  if(rec->Prev >= 0)
+    I->Frame[rec->Prev].Next = rec->Next;
+  else
+    S->Head = rec->Next;
+  if(rec->Next >= 0)
+    I->Frame[rec->Next].Prev = rec->Prev;
+  else
+    S->Tail = rec->Prev;
+  S->CacheSize -= FrameStoreFrameSize(I);
+}
+
+/* the stored data is the only copy from now on */
+static void FrameStoreUnstream(CFrameStore * I, int state)
+{
+  FrameStoreRec *rec = I->Frame + state;
+  if(rec->Data && rec->Streamed)
+    FrameStreamUnlink(I, state);
+  rec->Streamed = false;
+}
+
+/* drops read frames, least recently used first, down to frame_stream_cache */
+static void FrameStreamShrink(CFrameStore * I)
+{
+  CFrameStream *S = I->Stream;
+  ov_size budget = ((ov_size) SettingGet_i(I->G, I->Obj->Obj.Setting, NULL,
+                                           cSetting_frame_stream_cache)) << 20;
+  int state = S->Tail;
+  while((state >= 0) && (S->CacheSize > budget)) {
+    FrameStoreRec *rec = I->Frame + state;
+    int prev = rec->Prev;
+    if(!rec->Resident) {
+      FrameStreamUnlink(I, state);
+      FreeP(rec->Data);
+    }
+    state = prev;
+  }
+}
+
+/*
+ * Reads streamed state `state` into rec (Data, Origin, Step, Box), using
+ * raw (3 * NAtom) and coord (3 * NIndex) as buffers. Safe to call from
+ * the prefetch thread.
+ */
+static int FrameStreamRead(const CFrameStore * I, int state, FrameStoreRec * rec,
+                           float *raw, float *coord)
+{
+  CFrameStream *S = I->Stream;
+  int n = I->Layout->NIndex;
+  int a, ok;
+
+  rec->Box[0] = 0.0F;
+  {
+#ifndef _PYMOL_NO_CXX11
+    std::lock_guard<std::mutex> lock(S->SourceMutex);
+#endif
+    ok = S->Source.read(S->Source.data, state - S->State0, raw, rec->Box);
+  }
+  if(!ok)
+    return false;
+  for(a = 0; a < n; a++)
+    copy3f(raw + 3 * S->SourceIdx[a], coord + 3 * a);
+  if(!(rec->Data = mmalloc(FrameStoreFrameSize(I))))
+    return false;
+  FrameStoreEncode(I, rec, coord);
+  return true;
+}
+
+/* takes over a frame read by FrameStreamRead */
+static void FrameStreamInstall(CFrameStore * I, int state, const FrameStoreRec * src)
+{
+  FrameStoreRec *rec = I->Frame + state;
+  const CCrystal *box = I->Layout->PeriodicBox;
+
+  rec->Data = src->Data;
+  copy3f(src->Origin, rec->Origin);
+  copy3f(src->Step, rec->Step);
+  memcpy(rec->Box, src->Box, sizeof(rec->Box));
+  if((rec->Box[0] <= 0.0F) && box) {
+    /* no box in the trajectory: keep the topology's */
+    copy3f(box->Dim, rec->Box);
+    copy3f(box->Angle, rec->Box + 3);
+  }
+  FrameStreamLink(I, state);
+}
+
+/* takes over the frames the prefetch thread has read */
+static void FrameStreamDrain(CFrameStore * I)
+{
+  CFrameStream *S = I->Stream;
+  std::vector<FrameStreamResult> done;
+  size_t a;
+
+#ifndef _PYMOL_NO_CXX11
+  {
+    std::lock_guard<std::mutex> lock(S->Mutex);
+    done.swap(S->Done);
+  }
+#endif
+  for(a = 0; a < done.size(); a++) {
+    int state = done[a].State;
+    FrameStoreRec *rec = I->Frame + state;
+    if((state < I->NFrame) && rec->Streamed && !rec->Data) {
+      FrameStreamInstall(I, state, &done[a].Rec);
+    } else {
+      FreeP(done[a].Rec.Data);  /* read meanwhile, or no longer streamed */
+    }
+  }
+}
+
+/* cancels prefetching and waits for the frame in progress */
+static void FrameStreamWait(CFrameStore * I)
+{
+#ifndef _PYMOL_NO_CXX11
+  CFrameStream *S = I->Stream;
+  std::unique_lock<std::mutex> lock(S->Mutex);
+  S->Queue.clear();
+  while(S->Busy)
+    S->Idle.wait(lock);
+#endif
+}
+
+#ifndef _PYMOL_NO_CXX11
+static void FrameStreamWorker(CFrameStore * I)
+{
+  CFrameStream *S = I->Stream;
+  float *raw = Alloc(float, 3 * S->NAtom);
+  float *coord = Alloc(float, 3 * S->NAtom);
+
+  for(;;) {
+    FrameStreamResult result;
+    {
+      std::unique_lock<std::mutex> lock(S->Mutex);
+      S->Busy = false;
+      S->Idle.notify_all();
+      while(!S->Quit && S->Queue.empty())
+        S->Wake.wait(lock);
+      if(S->Quit)
+        break;
+      result.State = S->Queue.front();
+      S->Queue.pop_front();
+      S->Busy = true;
+    }
+    memset(&result.Rec, 0, sizeof(FrameStoreRec));
+    if(raw && coord && FrameStreamRead(I, result.State, &result.Rec, raw, coord)) {
+      std::lock_guard<std::mutex> lock(S->Mutex);
+      S->Done.push_back(result);
+    }
+  }
+  FreeP(raw);
+  FreeP(coord);
+}
+#endif
+
+static CFrameStream *FrameStreamNew(const FrameStoreSource * source, int state,
+                                    int n_frame, int n_atom)
+{
+  CFrameStream *S = new CFrameStream();
+  S->Source = *source;
+  S->State0 = state;
+  S->NFrame = n_frame;
+  S->NAtom = n_atom;
+  S->SourceIdx = VLAlloc(int, n_atom);
+  S->Raw = VLAlloc(float, 3 * n_atom);
+  S->Coord = VLAlloc(float, 3 * n_atom);
+  S->CacheSize = 0;
+  S->Head = S->Tail = -1;
+#ifndef _PYMOL_NO_CXX11
+  S->Busy = S->Quit = false;
+#endif
+  if(!S->SourceIdx || !S->Raw || !S->Coord) {
+    VLAFreeP(S->SourceIdx);
+    VLAFreeP(S->Raw);
+    VLAFreeP(S->Coord);
+    delete S;
+    return NULL;
+  }
+  return S;
+}
+
+static void FrameStreamFree(CFrameStream * S)
+{
+  size_t a;
+#ifndef _PYMOL_NO_CXX11
+  if(S->Thread.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(S->Mutex);
+      S->Quit = true;
+    }
+    S->Wake.notify_all();
+    S->Thread.join();
+  }
+#endif
+  for(a = 0; a < S->Done.size(); a++)
+    FreeP(S->Done[a].Rec.Data);
+  if(S->Source.free)
+    S->Source.free(S->Source.data);
+  VLAFreeP(S->SourceIdx);
+  VLAFreeP(S->Raw);
+  VLAFreeP(S->Coord);
+  delete S;
+}
+
+/* reads streamed state `state` on the main thread, unless it was prefetched */
+static int FrameStreamFetch(CFrameStore * I, int state)
+{
+  CFrameStream *S = I->Stream;
+  FrameStoreRec *rec = I->Frame + state;
+  FrameStoreRec result;
+
+  FrameStreamDrain(I);
+  if(rec->Data)
+    return true;
+  memset(&result, 0, sizeof(FrameStoreRec));
+  if(!FrameStreamRead(I, state, &result, S->Raw, S->Coord)) {
+    FreeP(result.Data);
+    rec->Streamed = false;      /* don't try again */
+    PRINTFB(I->G, FB_ObjectMolecule, FB_Errors)
+      " FrameStore-Error: unable to read state %d of the trajectory.\n", state + 1
+      ENDFB(I->G);
+    return false;
+  }
+  FrameStreamInstall(I, state, &result);
+  return true;
+}
+
+/*========================================================================*/
+static void FrameStoreDrop(CFrameStore * I, int state)
+{
+  if(state < I->NFrame) {
+    FrameStoreRec *rec = I->Frame + state;
+    FrameStoreUnstream(I, state);
+    FreeP(rec->Data);
+    rec->Resident = false;
+  }
+}
+
+/* frees the coordinate set in obj->CSet[state] */
+static void FrameStoreClearState(CFrameStore * I, int state)
+{
+  ObjectMolecule *obj = I->Obj;
+  FrameStoreRec *rec = I->Frame + state;
+  int a;
+
+  if(!obj->CSet[state])
+    return;
+  if(rec->Resident) {
+    for(a = 0; a < I->NResident; a++)
+      if(I->Resident[a].State == state) {
+        I->NResident--;
+        memmove(I->Resident + a, I->Resident + a + 1,
+                sizeof(FrameStoreResident) * (I->NResident - a));
+        break;
+      }
+    rec->Resident = false;
+  }
+  obj->CSet[state]->fFree();
+  obj->CSet[state] = NULL;
+}
+
+/* same atoms in the same order as the layout */
+static int FrameStoreMatches(const CFrameStore * I, const CoordSet * cs)
+{
+  const CoordSet *L = I->Layout;
+  return (cs->NIndex == L->NIndex) &&
+    !memcmp(cs->IdxToAtm, L->IdxToAtm, sizeof(int) * L->NIndex);
+}
+
+/* nothing but coordinates and box differ from the layout */
+static int FrameStoreFits(const CFrameStore * I, const CoordSet * cs)
+{
+  const CoordSet *L = I->Layout;
+  const double *m0 = cs->State.Matrix, *m1 = L->State.Matrix;
+  if(cs->Setting || cs->LabPos || cs->RefPos || cs->Spheroid ||
+     strcmp(cs->Name, L->Name) || (cs->NAtIndex != L->NAtIndex))
+    return false;
+  if((!m0 != !m1) || (m0 && memcmp(m0, m1, sizeof(double) * 16)))
+    return false;
+  return FrameStoreMatches(I, cs);
+}
+
+/*========================================================================*/
+CFrameStore *FrameStoreNew(ObjectMolecule * obj, const CoordSet * layout, int format)
+{
+  PyMOLGlobals *G = obj->Obj.G;
+  int ok = true;
+
+  if(!layout || !layout->NIndex || obj->DiscreteFlag)
+    return NULL;
+  if((format < cFrameStoreFloat) || (format > cFrameStoreQuant))
+    format = cFrameStoreFloat;
+  {
+    OOCalloc(G, CFrameStore);
+    CHECKOK(ok, I);
+    if(ok) {
+      I->G = G;
+      I->Obj = obj;
+      I->Format = format;
+      I->Layout = CoordSetCopy(layout);
+      CHECKOK(ok, I->Layout);
+    }
+    if(ok) {
+      I->Layout->Obj = obj;
+      I->Frame = VLACalloc(FrameStoreRec, 10);
+      CHECKOK(ok, I->Frame);
+    }
+    if(ok) {
+      I->Resident = VLAlloc(FrameStoreResident, 10);
+      CHECKOK(ok, I->Resident);
+    }
+    if(!ok && I) {
+      FrameStoreFree(I);
+      I = NULL;
+    }
+    return I;
+  }
+}
+
+CFrameStore *FrameStoreCopy(CFrameStore * src, ObjectMolecule * obj)
+{
+  CFrameStore *I = NULL;
+  CFrameStream *S;
+  int a;
+
+  if(!src || !(I = FrameStoreNew(obj, src->Layout, src->Format)))
+    return I;
+
+  /* the copy gets a reader of its own, if the source can provide one */
+  if((S = src->Stream)) {
+    FrameStoreSource source = S->Source;
+    source.data = S->Source.copy ? S->Source.copy(S->Source.data) : NULL;
+    if(source.data) {
+      I->Stream = FrameStreamNew(&source, S->State0, S->NFrame, S->NAtom);
+      if(I->Stream)
+        memcpy(I->Stream->SourceIdx, S->SourceIdx, sizeof(int) * I->Layout->NIndex);
+      else
+        source.free(source.data);
+    }
+    FrameStreamDrain(src);
+  }
+
+  VLACheck(I->Frame, FrameStoreRec, src->NFrame);
+  I->NFrame = src->NFrame;
+  for(a = 0; a < src->NFrame; a++) {
+    const FrameStoreRec *from = src->Frame + a;
+    FrameStoreRec *rec = I->Frame + a;
+    if(from->Streamed && I->Stream) {
+      rec->Streamed = true;     /* read again when needed */
+      continue;
+    }
+    if(from->Streamed && !from->Data && !FrameStreamFetch(src, a))
+      continue;
+    copy3f(from->Origin, rec->Origin);
+    copy3f(from->Step, rec->Step);
+    memcpy(rec->Box, from->Box, sizeof(rec->Box));
+    if(from->Data && (rec->Data = mmalloc(FrameStoreFrameSize(src))))
+      memcpy(rec->Data, from->Data, FrameStoreFrameSize(src));
+    if(from->Streamed)
+      FrameStreamShrink(src);
+  }
+  return I;
+}
+
+void FrameStoreFree(CFrameStore * I)
+{
+  int a;
+  if(!I)
+    return;
+  if(I->Stream)
+    FrameStreamFree(I->Stream);
+  for(a = 0; a < I->NFrame; a++)
+    FreeP(I->Frame[a].Data);
+  VLAFreeP(I->Frame);
+  VLAFreeP(I->Resident);
+  VLAFreeP(I->Scratch);
+  if(I->Layout)
+    I->Layout->fFree();
+  if(I->Spare)
+    I->Spare->fFree();
+  OOFreeP(I);
+}
+
+/*========================================================================*/
+int FrameStoreAdd(ObjectMolecule * obj, int state, const CoordSet * cs)
+{
+  CFrameStore *I = obj->Frames;
+  FrameStoreRec *rec;
+
+  if(!I || (state < 0) || !FrameStoreMatches(I, cs))
+    return false;
+  VLACheck(I->Frame, FrameStoreRec, state);
+  if(!I->Frame)
+    return false;
+  rec = I->Frame + state;
+  FrameStoreUnstream(I, state);
+  if(!rec->Data) {
+    rec->Data = mmalloc(FrameStoreFrameSize(I));
+    if(!rec->Data)
+      return false;
+  }
+  FrameStoreEncode(I, rec, cs->Coord);
+  if(cs->PeriodicBox) {
+    copy3f(cs->PeriodicBox->Dim, rec->Box);
+    copy3f(cs->PeriodicBox->Angle, rec->Box + 3);
+  } else {
+    rec->Box[0] = 0.0F;
+  }
+  if(I->NFrame <= state)
+    I->NFrame = state + 1;
+
+  VLACheck(obj->CSet, CoordSet *, state);
+  if(obj->NCSet <= state)
+    obj->NCSet = state + 1;
+  FrameStoreClearState(I, state);
+  return true;
+}
+
+int FrameStoreStream(ObjectMolecule * obj, int state, int n_frame, int n_atom,
+                     const FrameStoreSource * source)
+{
+  CFrameStore *I = obj->Frames;
+  int a, stop = state + n_frame;
+
+  if(!I || I->Stream || (state < 0) || (n_frame < 1) || (I->Layout->NIndex != n_atom))
+    return false;
+  VLACheck(I->Frame, FrameStoreRec, stop - 1);
+  VLACheck(obj->CSet, CoordSet *, stop - 1);
+  if(!I->Frame || !obj->CSet)
+    return false;
+  if(!(I->Stream = FrameStreamNew(source, state, n_frame, n_atom)))
+    return false;
+  for(a = 0; a < n_atom; a++)
+    I->Stream->SourceIdx[a] = a;
+
+  for(a = state; a < stop; a++) {
+    if(a < I->NFrame)
+      FrameStoreDrop(I, a);
+    if(a < obj->NCSet)
+      FrameStoreClearState(I, a);
+    I->Frame[a].Streamed = true;
+  }
+  if(I->NFrame < stop)
+    I->NFrame = stop;
+  if(obj->NCSet < stop)
+    obj->NCSet = stop;
+  return true;
+}
+
+/*========================================================================*/
+static void FrameStoreMaterialize(CFrameStore * I, int state)
+{
+  ObjectMolecule *obj = I->Obj;
+  CoordSet *L = I->Layout;
+  FrameStoreRec *rec = I->Frame + state;
+  CoordSet *cs;
+
+  if(!rec->Data) {
+    if(!I->Stream || !FrameStreamFetch(I, state))
+      return;
+  } else if(rec->Streamed) {
+    FrameStreamUnlink(I, state);        /* most recently used */
+    FrameStreamLink(I, state);
+  }
+
+  if(L->NAtIndex < obj->NAtom)  /* atoms were added since */
+    L->extendIndices(obj->NAtom);
+
+  cs = I->Spare;
+  I->Spare = NULL;
+  if(cs && !FrameStoreFits(I, cs)) {
+    cs->fFree();
+    cs = NULL;
+  }
+  if(!cs && !(cs = CoordSetCopy(L)))
+    return;
+  cs->Obj = obj;
+  FrameStoreDecode(I, rec, cs->Coord);
+  if(rec->Box[0] > 0.0F) {
+    if(!cs->PeriodicBox)
+      cs->PeriodicBox = CrystalNew(I->G);
+    if(cs->PeriodicBox) {
+      copy3f(rec->Box, cs->PeriodicBox->Dim);
+      copy3f(rec->Box + 3, cs->PeriodicBox->Angle);
+      CrystalUpdate(cs->PeriodicBox);
+    }
+  } else if(cs->PeriodicBox) {
+    CrystalFree(cs->PeriodicBox);
+    cs->PeriodicBox = NULL;
+  }
+
+  VLACheck(I->Resident, FrameStoreResident, I->NResident);
+  if(!I->Resident) {
+    cs->fFree();
+    return;
+  }
+  I->Resident[I->NResident].State = state;
+  I->Resident[I->NResident].cs = cs;
+  I->NResident++;
+  rec->Resident = true;
+  obj->CSet[state] = cs;
+
+  if(I->Stream)
+    FrameStreamShrink(I);
+}
+
+void FrameStoreLoad(ObjectMolecule * obj, int state)
+{
+  CFrameStore *I = obj->Frames;
+  int a, stop;
+
+  if(!I)
+    return;
+  if(state < 0) {
+    stop = (I->NFrame < obj->NCSet) ? I->NFrame : obj->NCSet;
+    for(a = 0; a < stop; a++)
+      if(FrameStoreHas(I->Frame + a) && !obj->CSet[a])
+        FrameStoreMaterialize(I, a);
+  } else if((state < I->NFrame) && (state < obj->NCSet) && FrameStoreHas(I->Frame + state)) {
+    if(!obj->CSet[state]) {
+      FrameStoreMaterialize(I, state);
+    } else if(I->Frame[state].Resident) {
+      /* mark as recently used */
+      for(a = I->NResident - 1; a >= 0; a--)
+        if(I->Resident[a].State == state) {
+          FrameStoreResident r = I->Resident[a];
+          memmove(I->Resident + a, I->Resident + a + 1,
+                  sizeof(FrameStoreResident) * (I->NResident - a - 1));
+          I->Resident[I->NResident - 1] = r;
+          break;
+        }
+    }
+  }
+}
+
+void FrameStorePrefetch(ObjectMolecule * obj, int state)
+{
+  CFrameStore *I = obj->Frames;
+  CFrameStream *S;
+
+  if(!I || !(S = I->Stream))
+    return;
+  FrameStreamDrain(I);
+#ifndef _PYMOL_NO_CXX11
+  {
+    ov_size budget = ((ov_size) SettingGet_i(I->G, obj->Obj.Setting, NULL,
+                                             cSetting_frame_stream_cache)) << 20;
+    ov_size n_fit = budget / (FrameStoreFrameSize(I) + 1);
+    int n = cFrameStorePrefetch;
+    int a;
+    if((ov_size) n > n_fit / 2)
+      n = (int) (n_fit / 2);    /* don't push out what is being shown */
+    int queued;
+    {
+      std::lock_guard<std::mutex> lock(S->Mutex);
+      S->Queue.clear();
+      for(a = 1; (a <= n) && (obj->NCSet > 0); a++) {
+        int next = (state + a) % obj->NCSet;    /* playback wraps around */
+        FrameStoreRec *rec = I->Frame + next;
+        if((next < I->NFrame) && rec->Streamed && !rec->Data)
+          S->Queue.push_back(next);
+      }
+      queued = !S->Queue.empty();
+    }
+    if(queued) {
+      if(!S->Thread.joinable())
+        S->Thread = std::thread(FrameStreamWorker, I);
+      S->Wake.notify_one();
+    }
+  }
+#endif
+}
+
+/*
+ * Hands resident state `state` back to the store, unless it picked up
+ * data the store can't hold, in which case it stays a regular coordinate
+ * set.
+ */
+static void FrameStoreEvict(CFrameStore * I, int state, CoordSet * cs)
+{
+  ObjectMolecule *obj = I->Obj;
+  FrameStoreRec *rec = I->Frame + state;
+
+  rec->Resident = false;
+  if((state >= obj->NCSet) || (obj->CSet[state] != cs) || !FrameStoreFits(I, cs)) {
+    FrameStoreDrop(I, state);   /* replaced, or no longer just coordinates */
+    return;
+  }
+  {
+    int changed;
+    if(I->Format == cFrameStoreFloat) {
+      changed = memcmp(rec->Data, cs->Coord, sizeof(float) * 3 * cs->NIndex);
+    } else {
+      VLACheck(I->Scratch, float, 3 * cs->NIndex);
+      if(!I->Scratch) {
+        FrameStoreDrop(I, state);
+        return;
+      }
+      FrameStoreDecode(I, rec, I->Scratch);
+      changed = memcmp(I->Scratch, cs->Coord, sizeof(float) * 3 * cs->NIndex);
+    }
+    if(changed) {
+      FrameStoreUnstream(I, state);     /* edited, keep it */
+      FrameStoreEncode(I, rec, cs->Coord);
+    }
+  }
+  obj->CSet[state] = NULL;
+  if(I->Spare) {
+    cs->fFree();
+  } else {
+    int a;
+    for(a = 0; a < cRepCnt; a++)
+      if(cs->Rep[a]) {
+        cs->Rep[a]->fFree(cs->Rep[a]);
+        cs->Rep[a] = NULL;
+      }
+    MapFree(cs->Coord2Idx);
+    cs->Coord2Idx = NULL;
+    CGOFree(cs->SculptCGO);
+    CGOFree(cs->SculptShaderCGO);
+    I->Spare = cs;
+  }
+}
+
+void FrameStoreTrim(ObjectMolecule * obj, int start, int stop)
+{
+  CFrameStore *I = obj->Frames;
+  int a, n, n_out = 0;
+
+  if(!I)
+    return;
+
+  /* states loaded over by other means */
+  for(a = 0; a < I->NFrame; a++) {
+    FrameStoreRec *rec = I->Frame + a;
+    if(FrameStoreHas(rec) && !rec->Resident && (a < obj->NCSet) && obj->CSet[a])
+      FrameStoreDrop(I, a);
+  }
+
+  for(a = 0; a < I->NResident; a++) {
+    int state = I->Resident[a].State;
+    if((state < start) || (state >= stop))
+      n_out++;
+  }
+  for(a = 0, n = 0; a < I->NResident; a++) {
+    FrameStoreResident r = I->Resident[a];
+    if((n_out > cFrameStoreKeep) && ((r.State < start) || (r.State >= stop))) {
+      FrameStoreEvict(I, r.State, r.cs);
+      n_out--;
+    } else {
+      I->Resident[n++] = r;
+    }
+  }
+  I->NResident = n;
+
+  if(I->Stream)
+    FrameStreamShrink(I);
+}
+
+void FrameStoreRelease(ObjectMolecule * obj)
+{
+  if(obj->Frames) {
+    FrameStoreLoad(obj, -1);
+    FrameStoreFree(obj->Frames);
+    obj->Frames = NULL;
+  }
+}
+
+/*========================================================================*/
+void FrameStorePurge(ObjectMolecule * obj)
+{
+  CFrameStore *I = obj->Frames;
+  CFrameStream *S;
+  CoordSet *L;
+  int *keep;
+  int a, f, n = 0;
+  int size;
+
+  if(!I)
+    return;
+  if((S = I->Stream)) {
+    FrameStreamWait(I);         /* the thread reads the layout size */
+    FrameStreamDrain(I);
+  }
+  L = I->Layout;
+  size = FrameStoreValueSize(I) * 3;
+  keep = Alloc(int, L->NIndex);
+  if(!keep) {
+    FrameStoreRelease(obj);
+    return;
+  }
+  for(a = 0; a < L->NIndex; a++)
+    if(!obj->AtomInfo[L->IdxToAtm[a]].deleteFlag)
+      keep[n++] = a;
+  if(n < L->NIndex) {
+    for(f = 0; f < I->NFrame; f++) {
+      char *data = (char *) I->Frame[f].Data;
+      if(data)
+        for(a = 0; a < n; a++)
+          if(keep[a] != a)
+            memmove(data + size * a, data + size * keep[a], size);
+    }
+    if(S) {
+      for(a = 0; a < n; a++)
+        S->SourceIdx[a] = S->SourceIdx[keep[a]];
+    }
+    CoordSetPurge(L);
+    if(S) {
+      S->CacheSize = 0;
+      for(f = S->Head; f >= 0; f = I->Frame[f].Next)
+        S->CacheSize += FrameStoreFrameSize(I);
+    }
+  }
+  FreeP(keep);
+}
+
+CoordSet *FrameStoreGetLayout(ObjectMolecule * obj)
+{
+  return obj->Frames ? obj->Frames->Layout : NULL;
+}
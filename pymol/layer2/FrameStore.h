@@ -0,0 +1,86 @@
+/* 
+A* -------------------------------------------------------------------
+B* This file contains source code for the PyMOL computer program
+C* Copyright (c) Schrodinger, LLC. 
+D* -------------------------------------------------------------------
+E* It is unlawful to modify or remove this copyright notice.
+F* -------------------------------------------------------------------
+G* Please see the accompanying LICENSE file for further information. 
+H* -------------------------------------------------------------------
+I* Additional authors of this source file include:
+-* 
+-* 
+-*
+Z* -------------------------------------------------------------------
+*/
+#ifndef _H_FrameStore
+#define _H_FrameStore
+
+#include"ObjectMolecule.h"
+
+/*
+ * Compact trajectory storage (setting frame_store).
+ *
+ * A frame store keeps the coordinates (and periodic box) of trajectory
+ * states next to a single layout coordinate set which holds what the
+ * frames share: atom indices, symmetry, state settings. A stored state
+ * has no CoordSet of its own (obj->CSet[state] is NULL) until
+ * FrameStoreLoad materializes it; FrameStoreTrim hands materialized
+ * states back to the store, writing back coordinates which were changed.
+ * States which pick up per-state data (settings, label positions, a
+ * different atom layout, ...) leave the store and stay regular coordinate
+ * sets.
+ *
+ * Streamed trajectories (setting frame_stream) are not read at load time:
+ * their frames come from a source on demand and stay in a least recently
+ * used cache of frame_stream_cache MB. During movie playback the frames
+ * ahead of the current state are read on a background thread.
+ */
+
+#define cFrameStoreFloat 1      /* float, lossless */
+#define cFrameStoreHalf  2      /* half float, relative to the frame center */
+#define cFrameStoreQuant 3      /* 16 bits per coordinate over the frame extent */
+
+typedef struct CFrameStore CFrameStore;
+
+CFrameStore *FrameStoreNew(ObjectMolecule * obj, const CoordSet * layout, int format);
+CFrameStore *FrameStoreCopy(CFrameStore * src, ObjectMolecule * obj);
+void FrameStoreFree(CFrameStore * I);
+
+/* stores cs (laid out like the store's layout) as state `state` of obj */
+int FrameStoreAdd(ObjectMolecule * obj, int state, const CoordSet * cs);
+
+/* random access frame reader of a streamed trajectory */
+typedef struct {
+  void *data;
+  /* reads frame `frame` into coord (3 * n_atom) and box (dimensions and
+   * angles, box[0] == 0: no box); may be called from the prefetch thread */
+  int (*read) (void *data, int frame, float *coord, float *box);
+  void *(*copy) (void *data);  /* independent reader, or NULL */
+  void (*free) (void *data);
+} FrameStoreSource;
+
+/*
+ * streams `n_frame` frames of `n_atom` atoms (laid out like the store's
+ * layout) into the states from `state` on; takes over the source on success
+ */
+int FrameStoreStream(ObjectMolecule * obj, int state, int n_frame, int n_atom,
+                     const FrameStoreSource * source);
+
+/* reads the streamed states following `state` ahead of time */
+void FrameStorePrefetch(ObjectMolecule * obj, int state);
+
+/* materializes a stored state (state < 0: all of them) */
+void FrameStoreLoad(ObjectMolecule * obj, int state);
+
+/* returns materialized states outside of [start, stop) to the store */
+void FrameStoreTrim(ObjectMolecule * obj, int start, int stop);
+
+/* materializes all states and drops the store (state numbering changes) */
+void FrameStoreRelease(ObjectMolecule * obj);
+
+/* atom removal: drops the coordinates of atoms with deleteFlag */
+void FrameStorePurge(ObjectMolecule * obj);
+CoordSet *FrameStoreGetLayout(ObjectMolecule * obj);
+
+#endif
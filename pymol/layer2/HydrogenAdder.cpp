@@ -6,6 +6,7 @@
 
 #include "CoordSet.h"
 #include "ObjectMolecule.h"
+#include "FrameStore.h"
 #include "Selector.h"
 #include "HydrogenAdder.h"
 #include "Err.h"
@@ -288,6 +289,12 @@ int ObjectMoleculeAddSeleHydrogensRefactored(ObjectMolecule* I, int sele, int st
 
   ObjectMoleculeUpdateNeighbors(I);
 
+  // states which get coordinates must not be in the frame store
+  if (I->Frames) {
+    for (StateIterator iter(G, I->Obj.Setting, state, I->NCSet); iter.next();)
+      FrameStoreLoad(I, iter.state);
+  }
+
   // add hydrogens (without coordinates)
   for (unsigned atm = 0; atm < n_atom_old; ++atm) {
     const auto ai = I->AtomInfo + atm;
@@ -44,6 +44,7 @@ Z* -------------------------------------------------------------------
 #include"CGO.h"
 #include"File.h"
 #include"Executive.h"
+#include"ThreadPool.h"
 
 #define n_space_group_numbers 231
 static const char * space_group_numbers[] = {
@@ -328,24 +329,8 @@ int ObjectMapStateGetExcludedStats(PyMOLGlobals * G, ObjectMapState * ms, float
 int ObjectMapStateGetDataRange(PyMOLGlobals * G, ObjectMapState * ms, float *min,
                                float *max)
 {
-  float max_val = 0.0F, min_val = 0.0F;
-  CField *data = ms->Field->data;
-  int cnt = data->dim[0] * data->dim[1] * data->dim[2];
-  float *raw_data = (float *) data->data;
-  if(cnt) {
-    int a;
-    min_val = (max_val = *(raw_data++));
-    for(a = 1; a < cnt; a++) {
-      double f_val = *(raw_data++);
-      if(min_val > f_val)
-        min_val = f_val;
-      if(max_val < f_val)
-        max_val = f_val;
-    }
-  }
-  *min = min_val;
-  *max = max_val;
-  return cnt;
+  /* answered from the (cached) block pyramid of the field */
+  return IsofieldGetStats(G, ms->Field, min, max, NULL, NULL);
 }
 
 /* MapState::ObjectMapStateGetHistogram -- compute a map histogram
@@ -369,27 +354,13 @@ int ObjectMapStateGetHistogram(PyMOLGlobals * G, ObjectMapState * ms,
                                float min_arg, float max_arg)
 {
   float max_val = 0.0f, min_val = 0.0f;
-  float sum = 0.0f, sumsq = 0.0f;
-  float min_his, max_his, irange, mean, stdev;
-  int pos;
-  CField *data = ms->Field->data;
-  int cnt = data->dim[0] * data->dim[1] * data->dim[2];
-  float *raw_data = (float *) data->data;
+  double sum = 0.0, sumsq = 0.0;
+  float min_his, max_his, mean, stdev;
+  int cnt = IsofieldGetStats(G, ms->Field, &min_val, &max_val, &sum, &sumsq);
   if(cnt) {
     int a;
 
-    // compute min/max/mean/stdev
-    sum = min_val = (max_val = *(raw_data++));
-    sumsq = sum*sum;
-    for(a = 1; a < cnt; a++) {
-      double f_val = *(raw_data++);
-      if(min_val > f_val)
-        min_val = f_val;
-      if(max_val < f_val)
-        max_val = f_val;
-      sum += f_val;
-      sumsq += f_val*f_val;
-    }
+    // min/max/mean/stdev
     mean = (float) (sum / cnt);
     stdev = (float) sqrt1d((sumsq - (sum * sum / cnt)) / (cnt));
 
@@ -411,17 +382,9 @@ int ObjectMapStateGetHistogram(PyMOLGlobals * G, ObjectMapState * ms,
 
     // Compute the histogram
     if(n_points > 0) {
-      irange = (float)(n_points-1) / (max_his - min_his);
       for (a = 0; a < n_points; a++)
         histogram[a+4] = 0.0f;
-      raw_data = (float *) data->data;
-      for (a = 0; a < cnt; a++) {
-        double f_val = *(raw_data++);
-        pos = (int)(irange * (f_val-min_his));
-        if (pos >= 0 && pos < n_points) {
-          histogram[pos+4] += 1.0;
-        }
-      }
+      IsofieldHistogram(G, ms->Field, n_points, min_his, max_his, histogram + 4);
     }
     histogram[0] = min_his;
     histogram[1] = max_his;
@@ -1743,6 +1706,7 @@ void ObjectMapStateClamp(ObjectMapState * I, float clamp_floor, float clamp_ceil
         else if(*fp > clamp_ceiling)
           *fp = clamp_ceiling;
       }
+  IsofieldInvalidate(I->Field);
 }
 
 int ObjectMapStateSetBorder(ObjectMapState * I, float level)
@@ -1770,6 +1734,7 @@ int ObjectMapStateSetBorder(ObjectMapState * I, float level)
       F3(I->Field->data, a, 0, c) = level;
       F3(I->Field->data, a, b, c) = level;
     }
+  IsofieldInvalidate(I->Field);
   return (result);
 }
 
@@ -1827,6 +1792,13 @@ static void ObjectMapInvalidate(ObjectMap * I, int rep, int level, int state)
         I->State[a].have_range = false;
     }
   }
+  if(level >= cRepInvAll) {
+    int a;
+    for(a = 0; a < I->NState; a++) {
+      if(I->State[a].Active && I->State[a].Field)
+        IsofieldInvalidate(I->State[a].Field);
+    }
+  }
   SceneInvalidate(I->Obj.G);
 }
 
@@ -2264,46 +2236,217 @@ ObjectMapState *ObjectMapNewStateFromDesc(PyMOLGlobals * G, ObjectMap * I,
 
 
 /*========================================================================*/
-static float ccp4_next_value(char ** pp, int mode) {
-  char * p = *pp;
+/* swaps n*width bytes in memory starting at p */
+static void swap_endian(char * p, int n, int width) {
+  char tmp, *q, *pstop = p + (n - 1) * width + 1;
+  int w2 = width/2, wm1 = width - 1;
+  for(; p < pstop; p += w2) {
+    for(q = p + wm1; p < q; p++, q--) {
+      tmp = *p; *p = *q; *q = tmp;
+    }
+  }
+}
+
+/* value n of a CCP4 data block; the block is read-only (it may be a file
+ * mapping) and need not be aligned */
+static float ccp4_get_value(const char * q, size_t n, int mode, int swap) {
   switch(mode) {
     case 0:
-      *pp += 1;
-      return (float) *((int8_t *) p);
+      return (float) ((const int8_t *) q)[n];
     case 1:
-      *pp += 2;
-      return (float) *((int16_t *) p);
+      {
+        int16_t v;
+        memcpy(&v, q + 2 * n, 2);
+        if(swap)
+          swap_endian((char *) &v, 1, 2);
+        return (float) v;
+      }
     case 2:
-      *pp += 4;
-      return *((float *) p);
+      {
+        float v;
+        memcpy(&v, q + 4 * n, 4);
+        if(swap)
+          swap_endian((char *) &v, 1, 4);
+        return v;
+      }
   }
   printf("ERROR unsupported mode\n");
   return 0.f;
 }
 
-/* swaps n*width bytes in memory starting at p */
-static void swap_endian(char * p, int n, int width) {
-  char tmp, *q, *pstop = p + (n - 1) * width + 1;
-  int w2 = width/2, wm1 = width - 1;
-  for(; p < pstop; p += w2) {
-    for(q = p + wm1; p < q; p++, q--) {
-      tmp = *p; *p = *q; *q = tmp;
+/*
+ * CCP4 data is filled in by sections (slowest file axis), which are
+ * independent and run on the thread pool. Pass 0 reads the values (and
+ * sums them if the map is to be normalized to its own mean and stdev),
+ * pass 1 applies that normalization.
+ */
+typedef struct {
+  ObjectMapState *ms;
+  const char *q;
+  int map_mode, swap;
+  int mapc, mapr, maps;
+  int pass;
+  int normalize;                /* normalize in pass 0 with mean/stdev */
+  int sums;                     /* accumulate sum and sumsq in pass 0 */
+  float mean, stdev;
+  float *mind, *maxd;           /* per section */
+  double *sum, *sumsq;          /* per section */
+} CCP4FillJob;
+
+static void ObjectMapCCP4SectionTask(void *data, int s)
+{
+  CCP4FillJob *job = (CCP4FillJob *) data;
+  ObjectMapState *ms = job->ms;
+  int mapc = job->mapc, mapr = job->mapr, maps = job->maps;
+  size_t n = (size_t) s * ms->FDim[mapr] * ms->FDim[mapc];
+  float maxd = -FLT_MAX, mind = FLT_MAX;
+  double sum = 0.0, sumsq = 0.0;
+  float dens, v[3], vr[3];
+  int cc[3];
+  int e;
+
+  cc[maps] = s;
+  v[maps] = (cc[maps] + ms->Min[maps]) / ((float) ms->Div[maps]);
+
+  for(cc[mapr] = 0; cc[mapr] < ms->FDim[mapr]; cc[mapr]++) {
+    v[mapr] = (cc[mapr] + ms->Min[mapr]) / ((float) ms->Div[mapr]);
+
+    for(cc[mapc] = 0; cc[mapc] < ms->FDim[mapc]; cc[mapc]++, n++) {
+      float *fp = F3Ptr(ms->Field->data, cc[0], cc[1], cc[2]);
+
+      if(job->pass) {
+        dens = (*fp - job->mean) / job->stdev;
+      } else {
+        v[mapc] = (cc[mapc] + ms->Min[mapc]) / ((float) ms->Div[mapc]);
+        transform33f3f(ms->Symmetry->Crystal->FracToReal, v, vr);
+        for(e = 0; e < 3; e++)
+          F4(ms->Field->points, cc[0], cc[1], cc[2], e) = vr[e];
+
+        dens = ccp4_get_value(job->q, n, job->map_mode, job->swap);
+        if(job->sums) {
+          sumsq += dens * dens;
+          sum += dens;
+        }
+        if(job->normalize)
+          dens = (dens - job->mean) / job->stdev;
+      }
+      *fp = dens;
+      if(maxd < dens)
+        maxd = dens;
+      if(mind > dens)
+        mind = dens;
     }
   }
+  job->mind[s] = mind;
+  job->maxd[s] = maxd;
+  if(job->sums) {
+    job->sum[s] = sum;
+    job->sumsq[s] = sumsq;
+  }
 }
 
-static int ObjectMapCCP4StrToMap(ObjectMap * I, char *CCP4Str, int bytes, int state,
-                                 int quiet)
+/* maps with fewer points than this are filled serially */
+#define cCCP4ParallelMin 1000000
+
+/*
+ * Fills ms->Field (values and points) from the CCP4 data block q. With
+ * normalize == 1 the map is normalized to its own mean and stdev, which
+ * are returned; otherwise (normalize == 2) the given header values are
+ * used. Returns the range of the stored values in mind/maxd.
+ */
+static int ObjectMapCCP4FillField(PyMOLGlobals * G, ObjectMapState * ms,
+                                  const char *q, int map_mode, int swap,
+                                  int mapc, int mapr, int maps, int normalize,
+                                  size_t n_pts, float *mean, float *stdev,
+                                  float *mind, float *maxd)
 {
+  CCP4FillJob job;
+  int ok = true;
+  int n_sec = ms->FDim[maps];
+  int n_thread = 1;
+  int s;
+
+  job.ms = ms;
+  job.q = q;
+  job.map_mode = map_mode;
+  job.swap = swap;
+  job.mapc = mapc;
+  job.mapr = mapr;
+  job.maps = maps;
+  job.pass = 0;
+  // with normalize == 2, use mean and stdev from file header
+  job.sums = (normalize == 1 && n_pts > 1);
+  job.normalize = normalize && !job.sums;
+  job.mean = *mean;
+  job.stdev = *stdev;
+  job.mind = Alloc(float, n_sec);
+  job.maxd = Alloc(float, n_sec);
+  job.sum = Alloc(double, n_sec);
+  job.sumsq = Alloc(double, n_sec);
+  CHECKOK(ok, job.mind);
+  CHECKOK(ok, job.maxd);
+  CHECKOK(ok, job.sum);
+  CHECKOK(ok, job.sumsq);
+
+  if(ok) {
+    if((n_pts >= cCCP4ParallelMin) && G->Setting && ThreadPoolIsNative()) {
+      n_thread = SettingGetGlobal_i(G, cSetting_max_threads);
+      if(n_thread > PYMOL_MAX_THREADS)
+        n_thread = PYMOL_MAX_THREADS;
+      if(n_thread > n_sec)
+        n_thread = n_sec;
+      if(n_thread < 1)
+        n_thread = 1;
+    }
+
+    ThreadPoolRun(G, n_thread, n_sec, ObjectMapCCP4SectionTask, &job);
+
+    if(job.sums) {
+      double sum = 0.0, sumsq = 0.0;
+      for(s = 0; s < n_sec; s++) {
+        sum += job.sum[s];
+        sumsq += job.sumsq[s];
+      }
+      *mean = (float) (sum / n_pts);
+      *stdev = (float) sqrt1d((sumsq - (sum * sum / n_pts)) / (n_pts - 1));
+      if(*stdev < 0.000001)
+        *stdev = 1.0;
+      job.mean = *mean;
+      job.stdev = *stdev;
+      job.sums = false;
+      job.pass = 1;
+      ThreadPoolRun(G, n_thread, n_sec, ObjectMapCCP4SectionTask, &job);
+    }
+
+    *maxd = -FLT_MAX;
+    *mind = FLT_MAX;
+    for(s = 0; s < n_sec; s++) {
+      if(*maxd < job.maxd[s])
+        *maxd = job.maxd[s];
+      if(*mind > job.mind[s])
+        *mind = job.mind[s];
+    }
+  }
+  FreeP(job.mind);
+  FreeP(job.maxd);
+  FreeP(job.sum);
+  FreeP(job.sumsq);
+  return ok;
+}
+
+static int ObjectMapCCP4StrToMap(ObjectMap * I, const char *CCP4Str, long bytes,
+                                 int state, int quiet)
+{
+  PyMOLGlobals *G = I->Obj.G;
+  int header[256];
   char *p;
   int *i;
   size_t bytes_per_pt;
-  char *q;
-  float dens;
-  int a, b, c, d, e;
+  const char *q;
+  int a, b, c, d;
   float v[3], vr[3], maxd, mind;
   int ok = true;
-  int little_endian = 1, map_endian;
+  int little_endian = 1, map_endian, swap;
   /* CCP4 named from their docs */
   int nc, nr, ns;
   int map_mode;
@@ -2313,15 +2456,13 @@ static int ObjectMapCCP4StrToMap(ObjectMap * I, char *CCP4Str, int bytes, int st
   int ispg; // space group number
   int sym_skip;
   int mapc, mapr, maps;
-  int cc[3];
-  int n_pts;
-  double sum, sumsq;
+  size_t n_pts;
   float mean, stdev;
   int normalize;
   ObjectMapState *ms;
-  int expectation;
+  long expectation;
 
-  if(bytes < 256 * sizeof(int)) {
+  if(bytes < (long) sizeof(header)) {
     PRINTFB(I->Obj.G, FB_ObjectMap, FB_Errors)
       " ObjectMapCCP4: Map appears to be truncated -- aborting." ENDFB(I->Obj.G);
     return (0);
@@ -2340,11 +2481,14 @@ static int ObjectMapCCP4StrToMap(ObjectMap * I, char *CCP4Str, int bytes, int st
 
   normalize = SettingGetGlobal_b(I->Obj.G, cSetting_normalize_ccp4_maps);
 
-  p = CCP4Str;
+  /* the data is only read, the header is swapped in a copy */
+  memcpy(header, CCP4Str, sizeof(header));
+  p = (char *) header;
   little_endian = *((char *) &little_endian);
   map_endian = (*p || *(p + 1)); // NOTE: this assumes 0x0 < NC < 0x10000
+  swap = (little_endian != map_endian);
 
-  if(little_endian != map_endian) {
+  if(swap) {
     if(!quiet) {
       PRINTFB(I->Obj.G, FB_ObjectMap, FB_Blather)
         " ObjectMapCCP4: Map appears to be reverse endian, swapping...\n" ENDFB(I->Obj.G);
@@ -2483,7 +2627,7 @@ static int ObjectMapCCP4StrToMap(ObjectMap * I, char *CCP4Str, int bytes, int st
       " ObjectMapCCP4: AMIN %f AMAX %f AMEAN %f ARMS %f\n", mind, maxd, mean, stdev ENDFB(I->Obj.G);
   }
 
-  n_pts = nc * ns * nr;
+  n_pts = (size_t) nc * ns * nr;
 
   /* at least one EM map encountered lacks NZ, so we'll try to guess it */
 
@@ -2497,11 +2641,11 @@ static int ObjectMapCCP4StrToMap(ObjectMap * I, char *CCP4Str, int bytes, int st
     }
   }
 
-  expectation = sym_skip + sizeof(int) * 256 + bytes_per_pt * n_pts;
+  expectation = sym_skip + sizeof(header) + bytes_per_pt * n_pts;
 
   if(!quiet) {
     PRINTFB(I->Obj.G, FB_ObjectMap, FB_Blather)
-      " ObjectMapCCP4: sym_skip %d bytes %d expectation %d\n",
+      " ObjectMapCCP4: sym_skip %d bytes %ld expectation %ld\n",
       sym_skip, bytes, expectation ENDFB(I->Obj.G);
   }
 
@@ -2524,29 +2668,7 @@ static int ObjectMapCCP4StrToMap(ObjectMap * I, char *CCP4Str, int bytes, int st
     }
   }
 
-  q = p + (sizeof(int) * 256) + sym_skip;
-
-  if(little_endian != map_endian && bytes_per_pt > 1) {
-    swap_endian(q, n_pts, bytes_per_pt);
-  }
-
-  // with normalize == 2, use mean and stdev from file header
-  if(normalize == 1 && n_pts > 1) {
-    c = n_pts;
-    sum = 0.0;
-    sumsq = 0.0;
-    while(c--) {
-      dens = ccp4_next_value(&q, map_mode);
-      sumsq += dens * dens;
-      sum += dens;
-    }
-    mean = (float) (sum / n_pts);
-    stdev = (float) sqrt1d((sumsq - (sum * sum / n_pts)) / (n_pts - 1));
-    if(stdev < 0.000001)
-      stdev = 1.0;
-  }
-
-  q = p + (sizeof(int) * 256) + sym_skip;
+  q = CCP4Str + sizeof(header) + sym_skip;
   mapc--;                       /* convert to C indexing... */
   mapr--;
   maps--;
@@ -2605,33 +2727,8 @@ static int ObjectMapCCP4StrToMap(ObjectMap * I, char *CCP4Str, int bytes, int st
     ms->MapSource = cMapSourceCCP4;
     ms->Field->save_points = false;
 
-    maxd = -FLT_MAX;
-    mind = FLT_MAX;
-
-    for(cc[maps] = 0; cc[maps] < ms->FDim[maps]; cc[maps]++) {
-      v[maps] = (cc[maps] + ms->Min[maps]) / ((float) ms->Div[maps]);
-
-      for(cc[mapr] = 0; cc[mapr] < ms->FDim[mapr]; cc[mapr]++) {
-        v[mapr] = (cc[mapr] + ms->Min[mapr]) / ((float) ms->Div[mapr]);
-
-        for(cc[mapc] = 0; cc[mapc] < ms->FDim[mapc]; cc[mapc]++) {
-          v[mapc] = (cc[mapc] + ms->Min[mapc]) / ((float) ms->Div[mapc]);
-
-          dens = ccp4_next_value(&q, map_mode);
-
-          if(normalize)
-            dens = (dens - mean) / stdev;
-          F3(ms->Field->data, cc[0], cc[1], cc[2]) = dens;
-          if(maxd < dens)
-            maxd = dens;
-          if(mind > dens)
-            mind = dens;
-          transform33f3f(ms->Symmetry->Crystal->FracToReal, v, vr);
-          for(e = 0; e < 3; e++)
-            F4(ms->Field->points, cc[0], cc[1], cc[2], e) = vr[e];
-        }
-      }
-    }
+    ok = ObjectMapCCP4FillField(G, ms, q, map_mode, swap, mapc, mapr, maps,
+                                normalize, n_pts, &mean, &stdev, &mind, &maxd);
   }
   if(ok) {
     d = 0;
@@ -4559,8 +4656,9 @@ static ObjectMap *ObjectMapReadXPLORStr(PyMOLGlobals * G, ObjectMap * I, char *X
 
 
 /*========================================================================*/
-static ObjectMap *ObjectMapReadCCP4Str(PyMOLGlobals * G, ObjectMap * I, char *XPLORStr,
-                                       int bytes, int state, int quiet)
+static ObjectMap *ObjectMapReadCCP4Str(PyMOLGlobals * G, ObjectMap * I,
+                                       const char *XPLORStr, long bytes,
+                                       int state, int quiet)
 {
   int ok = true;
   int isNew = true;
@@ -4589,28 +4687,28 @@ ObjectMap *ObjectMapLoadCCP4(PyMOLGlobals * G, ObjectMap * obj, const char *fnam
                              int is_string, int bytes, int quiet)
 {
   ObjectMap *I = NULL;
-  char *buffer;
-  long size;
+  CFileView view;
 
   if(!is_string) {
     if (!quiet)
       PRINTFB(G, FB_ObjectMap, FB_Actions)
         " ObjectMapLoadCCP4File: Loading from '%s'.\n", fname ENDFB(G);
 
-    buffer = FileGetContents(fname, &size);
-
-    if(!buffer)
+    /* mapped rather than read: the data is streamed once into the field */
+    if(FileViewOpen(&view, fname))
+      FileViewAdviseSequential(&view);
+    else
       ErrMessage(G, "ObjectMapLoadCCP4File", "Unable to open file!");
   } else {
-    buffer = (char*) fname;
-    size = (long) bytes;
+    view.data = fname;
+    view.size = (long) bytes;
   }
 
-  if (buffer) {
-    I = ObjectMapReadCCP4Str(G, obj, buffer, size, state, quiet);
+  if (view.data) {
+    I = ObjectMapReadCCP4Str(G, obj, view.data, view.size, state, quiet);
 
     if(!is_string)
-      mfree(buffer);
+      FileViewClose(&view);
 
     if(!quiet) {
       if(state < 0)
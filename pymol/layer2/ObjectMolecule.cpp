@@ -51,6 +51,8 @@ Z* -------------------------------------------------------------------
 #include"CGO.h"
 #include"Editor.h"
 #include"Sculpt.h"
+#include"FrameStore.h"
+#include"Movie.h"
 #include"OVContext.h"
 #include"OVOneToOne.h"
 #include"OVLexicon.h"
@@ -1011,6 +1013,8 @@ ObjectMolecule *ObjectMoleculeLoadTRJFile(PyMOLGlobals * G, ObjectMolecule * I,
   int n_avg = 0;
   int icnt;
   int ncnt = 0;
+  int stored = false;
+  int first_stored = -1;
   int sele0 = SelectorIndexByName(G, sele);
   int *xref = NULL;
   float zerovector[3] = { 0.0, 0.0, 0.0 };
@@ -1075,6 +1079,11 @@ ObjectMolecule *ObjectMoleculeLoadTRJFile(PyMOLGlobals * G, ObjectMolecule * I,
       VLASize(cs->IdxToAtm, int, cs->NIndex + 1);
       VLASize(cs->Coord, float, cs->NIndex * 3);
     }
+    if(!I->Frames) {
+      int format = SettingGet_i(G, I->Obj.Setting, NULL, cSetting_frame_store);
+      if(format)
+        I->Frames = FrameStoreNew(I, cs, format);
+    }
     PRINTFB(G, FB_ObjectMolecule, FB_Blather)
       " ObjMolLoadTRJFile: Loading from \"%s\".\n", fname ENDFB(G);
     buffer = (char *) mmalloc(BUFSIZE + 1);     /* 1 MB read buffer */
@@ -1316,12 +1325,19 @@ ObjectMolecule *ObjectMoleculeLoadTRJFile(PyMOLGlobals * G, ObjectMolecule * I,
                     zoom_flag = true;
                   }
 
-                  VLACheck(I->CSet, CoordSet *, frame);
-                  if(I->NCSet <= frame)
-                    I->NCSet = frame + 1;
-                  if(I->CSet[frame])
-                    I->CSet[frame]->fFree();
-                  I->CSet[frame] = cs;
+                  /* frame_store: cs stays the read buffer */
+                  stored = I->Frames && FrameStoreAdd(I, frame, cs);
+                  if(stored) {
+                    if(first_stored < 0)
+                      first_stored = frame;
+                  } else {
+                    VLACheck(I->CSet, CoordSet *, frame);
+                    if(I->NCSet <= frame)
+                      I->NCSet = frame + 1;
+                    if(I->CSet[frame])
+                      I->CSet[frame]->fFree();
+                    I->CSet[frame] = cs;
+                  }
                   ncnt++;
 
                   if(average < 2) {
@@ -1336,7 +1352,8 @@ ObjectMolecule *ObjectMoleculeLoadTRJFile(PyMOLGlobals * G, ObjectMolecule * I,
                       ENDFB(G);
                   }
                   frame++;
-                  cs = CoordSetCopy(cs);
+                  if(!stored)
+                    cs = CoordSetCopy(cs);
                   n_avg = 0;
                   if((stop > 0) && (cnt >= stop))
                     break;
@@ -1362,6 +1379,8 @@ ObjectMolecule *ObjectMoleculeLoadTRJFile(PyMOLGlobals * G, ObjectMolecule * I,
   }
   if(cs)
     cs->fFree();
+  if(first_stored >= 0)
+    FrameStoreLoad(I, first_stored);
   SceneChanged(G);
   SceneCountFrames(G);
   if(zoom_flag)
@@ -2424,7 +2443,7 @@ ok_except1:
 
 /*========================================================================*/
 static ObjectMolecule *ObjectMoleculeReadTOPStr(PyMOLGlobals * G, ObjectMolecule * I,
-                                         char *TOPStr, int frame, int discrete)
+                                         const char *TOPStr, int frame, int discrete)
 {
   CoordSet *cset = NULL;
   AtomInfoType *atInfo;
@@ -2523,18 +2542,16 @@ ObjectMolecule *ObjectMoleculeLoadTOPFile(PyMOLGlobals * G, ObjectMolecule * obj
                                           const char *fname, int frame, int discrete)
 {
   ObjectMolecule *I = NULL;
-  char *buffer;
+  CFileView view;
 
-  buffer = FileGetContents(fname, NULL);
-
-  if(!buffer)
+  if(!FileViewOpenText(&view, fname))
     ErrMessage(G, "ObjectMoleculeLoadTOPFile", "Unable to open file!");
   else {
     PRINTFB(G, FB_ObjectMolecule, FB_Blather)
       " ObjectMoleculeLoadTOPFile: Loading from %s.\n", fname ENDFB(G);
 
-    I = ObjectMoleculeReadTOPStr(G, obj, buffer, frame, discrete);
-    mfree(buffer);
+    I = ObjectMoleculeReadTOPStr(G, obj, view.data, frame, discrete);
+    FileViewClose(&view);
   }
 
   return (I);
@@ -4206,6 +4223,8 @@ void ObjectMoleculeCreateSpheroid(ObjectMolecule * I, int average)
   fsum = Alloc(float, nRow);
   max_sq = Alloc(float, I->NAtom);
 
+  FrameStoreRelease(I);       /* spheroids replace the states */
+
   spheroid_smooth = SettingGetGlobal_f(I->Obj.G, cSetting_spheroid_smooth);
   spheroid_fill = SettingGetGlobal_f(I->Obj.G, cSetting_spheroid_fill);
   /* first compute average coordinate */
@@ -4884,6 +4903,7 @@ void ObjectMoleculePurge(ObjectMolecule * I)
   if(I->CSTmpl) {
     CoordSetPurge(I->CSTmpl);
   }
+  FrameStorePurge(I);
   PRINTFD(I->Obj.G, FB_ObjectMolecule)
     " ObjMolPurge-Debug: step 3, old-to-new mapping\n" ENDFD;
 
@@ -4915,6 +4935,8 @@ void ObjectMoleculePurge(ObjectMolecule * I)
     for(a = 0; a < I->NCSet; a++)
       if(I->CSet[a])
 	CoordSetAdjustAtmIdx(I->CSet[a], oldToNew, I->NAtom);
+    if(I->Frames)
+      CoordSetAdjustAtmIdx(FrameStoreGetLayout(I), oldToNew, I->NAtom);
   }
 
   PRINTFD(I->Obj.G, FB_ObjectMolecule)
@@ -6658,6 +6680,7 @@ int ObjectMoleculeTransformSelection(ObjectMolecule * I, int state,
         break;
     }
     if(state < I->NCSet) {
+      FrameStoreLoad(I, state); /* stored trajectory frame */
       cs = I->CSet[state];
       if(cs) {
         int use_matrices = SettingGet_i(G, I->Obj.Setting,
@@ -7987,6 +8010,8 @@ int ObjectMoleculeExtendIndices(ObjectMolecule * I, int state)
       cs = (a < 0) ? I->CSTmpl : I->CSet[a];
       ok_assert(1, (!cs) || cs->extendIndices(I->NAtom));
     }
+    cs = FrameStoreGetLayout(I);
+    ok_assert(1, (!cs) || cs->extendIndices(I->NAtom));
   }
   return true;
 ok_except1:
@@ -9496,6 +9521,71 @@ void ObjectMoleculeTransformTTTf(ObjectMolecule * I, float *ttt, int frame)
 
 
 /*========================================================================*/
+/*========================================================================*/
+/* materializes the stored trajectory frames (see FrameStore.h) which op
+ * reads or writes coordinates of; the next update hands them back */
+static void ObjectMoleculeSeleOpLoadFrames(ObjectMolecule * I, int sele,
+                                           ObjectMoleculeOpRec * op)
+{
+  PyMOLGlobals *G = I->Obj.G;
+  int a, start = 0, stop = 0;
+
+  for(a = 0; a < I->NAtom; a++)
+    if(SelectorIsMember(G, I->AtomInfo[a].selEntry, sele))
+      break;
+  if(a == I->NAtom)             /* not involved */
+    return;
+
+  switch (op->code) {
+  case OMOP_ReferenceStore:
+  case OMOP_ReferenceRecall:
+  case OMOP_ReferenceValidate:
+  case OMOP_ReferenceSwap:
+  case OMOP_SFIT:
+  case OMOP_SUMC:
+  case OMOP_MNMX:
+  case OMOP_CameraMinMax:
+  case OMOP_MaxDistToPt:
+  case OMOP_MDST:
+  case OMOP_VERT:
+  case OMOP_SVRT:
+  case OMOP_MOME:
+    FrameStoreLoad(I, -1);
+    return;
+  case OMOP_AVRT:
+    start = op->i1;
+    stop = I->NCSet;
+    break;
+  case OMOP_StateVRT:
+    start = op->i1;
+    stop = op->i1 + 1;
+    break;
+  case OMOP_AlterState:
+    start = op->i2;
+    stop = op->i2 + 1;
+    break;
+  case OMOP_CSetIdxGetAndFlag:
+  case OMOP_CSetIdxSetFlagged:
+    start = op->cs1;
+    stop = op->cs2 + 1;
+    break;
+  case OMOP_SingleStateVertices:
+  case OMOP_CSetMinMax:
+  case OMOP_CSetCameraMinMax:
+  case OMOP_CSetMaxDistToPt:
+  case OMOP_CSetSumSqDistToPt:
+  case OMOP_CSetSumVertices:
+  case OMOP_CSetMoment:
+    start = op->cs1;
+    stop = op->cs1 + 1;
+    break;
+  }
+  if(start < 0)
+    start = 0;
+  for(a = start; a < stop; a++)
+    FrameStoreLoad(I, a);
+}
+
 void ObjectMoleculeSeleOp(ObjectMolecule * I, int sele, ObjectMoleculeOpRec * op)
 {
   float *coord;
@@ -9523,6 +9613,8 @@ void ObjectMoleculeSeleOp(ObjectMolecule * I, int sele, ObjectMoleculeOpRec * op
 #endif
   PRINTFD(G, FB_ObjectMolecule)
     " ObjectMoleculeSeleOp-DEBUG: sele %d op->code %d\n", sele, op->code ENDFD;
+  if(I->Frames && (sele >= 0))
+    ObjectMoleculeSeleOpLoadFrames(I, sele, op);
   if(sele >= 0) {
     const char *errstr = "Alter";
     /* always run on entry */
@@ -11249,6 +11341,15 @@ static void ObjectMoleculeUpdate(ObjectMolecule * I)
     if(stop > I->NCSet)
       stop = I->NCSet;
 
+    /* states in range come out of the frame store, others go back */
+    if(I->Frames) {
+      FrameStoreTrim(I, start, stop);
+      for(a = start; a < stop; a++)
+        FrameStoreLoad(I, a);
+      if(MoviePlaying(G))
+        FrameStorePrefetch(I, stop - 1);
+    }
+
     /* single and multithreaded coord set updates */
     {
 #ifndef _PYMOL_NOPY
@@ -11959,6 +12060,7 @@ ObjectMolecule *ObjectMoleculeCopy(const ObjectMolecule * obj)
 
   if(obj->CSTmpl)
     I->CSTmpl = CoordSetCopy(obj->CSTmpl);
+  I->Frames = FrameStoreCopy(obj->Frames, I);
 
   if (obj->DiscreteFlag){
     int sz = VLAGetSize(obj->DiscreteAtmToIdx);
@@ -11993,6 +12095,8 @@ int ObjectMoleculeSetStateOrder(ObjectMolecule * I, int * order, int len) {
 
   ok_assert(1, len == I->NCSet);
 
+  FrameStoreRelease(I);
+
   // invalidate
   ObjectMoleculeInvalidate(I, cRepAll, cRepInvAll, -1);
 
@@ -12063,6 +12167,7 @@ void ObjectMoleculeFree(ObjectMolecule * I)
     SculptFree(I->Sculpt);
   if(I->CSTmpl)
     I->CSTmpl->fFree();
+  FrameStoreFree(I->Frames);
   ObjectPurge(&I->Obj);
   OOFreeP(I);
 }
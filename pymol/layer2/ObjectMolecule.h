@@ -58,6 +58,7 @@ typedef struct ObjectMolecule {
 	/* number of coordinate sets */
   int NCSet;
   struct CoordSet *CSTmpl;      /* template for trajectories, etc. */
+  struct CFrameStore *Frames;   /* compactly stored states, see FrameStore.h */
 	/* array of bonds */
   BondType *Bond;
 	/* array of atoms (infos) */
@@ -526,7 +527,8 @@ int *AtomInfoGetSortedIndex(PyMOLGlobals * G, ObjectMolecule * obj, AtomInfoType
 ObjectMolecule *ObjectMoleculeReadMmtfStr(PyMOLGlobals * G, ObjectMolecule * I,
     const char *st, int st_len, int frame, int discrete, int quiet, int multiplex, int zoom);
 ObjectMolecule *ObjectMoleculeReadCifStr(PyMOLGlobals * G, ObjectMolecule * I,
-    const char *st, int frame, int discrete, int quiet, int multiplex, int zoom);
+    const char *st, int frame, int discrete, int quiet, int multiplex, int zoom,
+    const char *fname=NULL);
 
 // object and object-state level setting
 template <typename V> void SettingSet(int index, V value, ObjectMolecule * I, int state=-1) {
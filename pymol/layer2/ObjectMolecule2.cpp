@@ -30,6 +30,7 @@
 #include"Vector.h"
 #include"PConv.h"
 #include"ObjectMolecule.h"
+#include"FrameStore.h"
 #include"Feedback.h"
 #include"Util.h"
 #include"Util2.h"
@@ -41,11 +42,13 @@
 #include"ObjectCGO.h"
 #include"Scene.h"
 #include "Lex.h"
+#include"ThreadPool.h"
 
 #include"AtomInfoHistory.h"
 #include"BondTypeHistory.h"
 #include <iostream>
 #include <map>
+#include <vector>
 
 #ifdef _PYMOL_NO_CXX11
 #define STD_MOVE(x) (x)
@@ -1914,9 +1917,11 @@ ok_except1:
 }
 
 /*
- * Assign ai->ssType
+ * Assign ai->ssType, only from the first n_ss entries (the records which
+ * were read before the atom; later entries are always in front)
  */
-static void sshash_lookup(SSHash *hash, AtomInfoType *ai, unsigned char ss_chain1) {
+static void sshash_lookup(SSHash *hash, AtomInfoType *ai, unsigned char ss_chain1,
+    int n_ss) {
   int index, ssi;
   SSEntry *sst = NULL;
 
@@ -1926,7 +1931,8 @@ static void sshash_lookup(SSHash *hash, AtomInfoType *ai, unsigned char ss_chain
     while(ssi) {
       sst = hash->ss_list + ssi;
       /* contains shared entry, or unique linked list for each residue */
-      if(    ai->resv >= sst->resv1
+      if(    ssi < n_ss
+          && ai->resv >= sst->resv1
           && ai->resv <= sst->resv2
           && (ai->resv != sst->resv1 || ai->inscode >= sst->inscode1)
           && (ai->resv != sst->resv2 || ai->inscode <= sst->inscode2))
@@ -2031,6 +2037,354 @@ static int parse_pqr_atom_line(PyMOLGlobals * G,
   return PQR_COLUMNS_DELIM;
 }
 
+/*
+ * Atom records are collected during PASS 2 and decoded afterwards: the
+ * fixed columns on max_threads threads (PDBAtomDecode), everything which
+ * goes through the lexicon or global tables serially in file order
+ * (PDBAtomMerge).
+ */
+#define cPDBParallelMin 20000
+
+typedef struct {
+  const char *line;             /* start of the ATOM/HETATM record */
+  int n_ss;                     /* secondary structure entries read before it */
+  char hetatm;
+  char pqr_delim;               /* white space delimited PQR, fully parsed */
+  char segi_overflow;           /* atom ID overflow into the segi columns */
+  char chain;
+  AtomName literal_name;
+  char resn[5];
+  char segi[5];
+} PDBAtomRec;
+
+typedef struct {
+  PyMOLGlobals *G;
+  PDBAtomRec *rec;
+  AtomInfoType *atInfo;
+  float *coord;
+  int n_atom, n_chunk;
+  int is_pqr, is_pdbqt;
+  int truncate_resn, bogus_name_alignment;
+  int literal_names, reformat_names, ignore_pdb_segi;
+  int ssFlag, auto_show;
+  SSHash *ss_hash;
+  lexidx_t segi_override_idx;
+} PDBAtomJob;
+
+/*
+ * Decode the columns of an atom record which need no shared state
+ * (only PQR records go through the lexicon here: they are decoded serially)
+ */
+static void PDBAtomDecode(const PDBAtomJob * job, int index)
+{
+  PDBAtomRec *rec = job->rec + index;
+  AtomInfoType *ai = job->atInfo + index;
+  float *coord = job->coord + 3 * index;
+  const char *p = nskip(rec->line, 6);
+  const char *literal_name = rec->literal_name;
+  char cc[MAXLINELEN];
+
+  ai->rank = index;
+
+  bool pqr_legacy_mixed_mode = false;
+  if(job->is_pqr) {
+    switch (parse_pqr_atom_line(job->G, p, ai, coord)) {
+      case PQR_COLUMNS_DELIM:
+        rec->pqr_delim = true;
+        return;
+      case PQR_COLUMNS_MIXED:
+        pqr_legacy_mixed_mode = true;
+    }
+  }
+
+  p = ncopy(cc, p, 5);
+  if(!sscanf(cc, "%d", &ai->id))
+    ai->id = 0;
+
+  p = nskip(p, 1);          /* to 12 */
+  p = ncopy(rec->literal_name, p, 4);
+
+  p = ncopy(cc, p, 1);
+  if(*cc == 32)
+    ai->alt[0] = 0;
+  else {
+    ai->alt[0] = *cc;
+    ai->alt[1] = 0;
+  }
+
+  p = ntrim(cc, p, 4); /* now allowing for 4-letter residues */
+  if (job->truncate_resn)   /* unless specifically disabled */
+    cc[3] = 0;
+  UtilNCopy(rec->resn, cc, sizeof(rec->resn));
+
+  p = ncopy(cc, p, 1);
+  rec->chain = *cc;
+
+  p = ncopy(cc, p, 4);
+  if(!sscanf(cc, "%d", &ai->resv))
+    ai->resv = 0;
+  ai->setInscode(*p);
+  p = nskip(p, 1);
+
+  if (pqr_legacy_mixed_mode) {
+    // Note: not sure if this branch is ever reached (if such files exist)
+    // or if it's fully obsolete with the new space delimited parsing in
+    // parse_pqr_atom_line.
+    p = ParseWordNumberCopy(cc, p, MAXLINELEN - 1);
+    sscanf(cc, "%f", coord);
+    p = ParseWordNumberCopy(cc, p, MAXLINELEN - 1);
+    sscanf(cc, "%f", coord + 1);
+    p = ParseWordNumberCopy(cc, p, MAXLINELEN - 1);
+    sscanf(cc, "%f", coord + 2);
+  } else {
+    p = nskip(p, 3);
+    p = ncopy(cc, p, 8);
+    sscanf(cc, "%f", coord);
+    p = ncopy(cc, p, 8);
+    sscanf(cc, "%f", coord + 1);
+    p = ncopy(cc, p, 8);
+    sscanf(cc, "%f", coord + 2);
+  }
+
+  if(!job->is_pqr) {          /* standard PDB file */
+    p = ncopy(cc, p, 6);
+    if(!sscanf(cc, "%f", &ai->q))
+      ai->q = 1.0;
+
+    p = ncopy(cc, p, 6);
+    if(!sscanf(cc, "%f", &ai->b))
+      ai->b = 0.0;
+
+    if (job->is_pdbqt) {
+      p = nskip(p, 4);
+      p = ncopy(cc, p, 6);
+      if(!sscanf(cc, "%f", &ai->partialCharge))
+        ai->partialCharge = 0.0;
+
+      // type is 78-79 in pdbqt, 77-78 in pdb
+      p = nskip(p, 1);
+    } else {
+      p = nskip(p, 6);
+      p = ncopy(cc, p, 4);
+
+      rec->segi_overflow = (cc[3] == '1' && strncmp(p, "0000", 4) == 0);
+      UtilCleanStr(cc);
+      UtilNCopy(rec->segi, cc, sizeof(rec->segi));
+    }
+
+    p = ncopy(cc, p, 2);
+    if(!sscanf(cc, "%s", ai->elem))
+      ai->elem[0] = 0;
+    else if(!((((ai->elem[0] >= 'a') && (ai->elem[0] <= 'z')) ||    /* don't get confused by PDB misuse */
+               ((ai->elem[0] >= 'A') && (ai->elem[0] <= 'Z'))) &&
+              (((ai->elem[1] == 0) ||
+                ((ai->elem[1] >= 'a') && (ai->elem[1] <= 'z')) ||
+                ((ai->elem[1] >= 'A') && (ai->elem[1] <= 'Z'))))))
+      ai->elem[0] = 0;
+    else if (job->is_pdbqt) {
+      if (strcmp(ai->elem, "A") == 0) {
+        // aromatic carbon
+        ai->elem[0] = 'C';
+      } else if (isupper(ai->elem[1])) {
+        // h-bond donor or acceptor
+        ai->elem[1] = 0;
+      }
+    }
+
+    if(!ai->elem[0]) {
+      if(((literal_name[0] == ' ') || ((literal_name[0] >= '0') && (literal_name[0] <= '9'))) && (literal_name[1] >= 'A') && (literal_name[1] <= 'Z')) {    /* infer element from name column */
+        ai->elem[0] = literal_name[1];
+        ai->elem[1] = 0;
+      } else if(((literal_name[0] >= 'A') && (literal_name[0] <= 'Z')) && (((literal_name[1] >= 'A') && (literal_name[1] <= 'Z')) || ((literal_name[1] >= 'a') && (literal_name[1] <= 'z')))) {     /* infer element from name column */
+        ai->elem[0] = literal_name[0];
+        ai->elem[2] = 0;
+        if((literal_name[1] >= 'A') && (literal_name[1] <= 'Z')) {  /* second letter is capitalized */
+          if(job->bogus_name_alignment) {
+            /* if other atom names aren't properly aligned */
+            ai->elem[1] = 0;        /* kill 2nd letter */
+          } else if(literal_name[0] == 'H') {
+            /* or if this is an ultra-bogus PDB with inconsistent 
+               indendentation, and this is likely a hydrogen */
+            ai->elem[1] = 0;        /* kill 2nd letter */
+          } else {
+            ai->elem[1] = tolower(literal_name[1]);
+          }
+        } else
+          ai->elem[1] = literal_name[1];
+      }
+    }
+
+    p = ncopy(cc, p, 2);
+    if((cc[1] == '-') || (cc[1] == '+')) {
+      /* only read formal charge when sign is present */
+      char ctmp = cc[0];
+      cc[0] = cc[1];
+      cc[1] = ctmp;
+      if(!sscanf(cc, "%hhi", &ai->formalCharge))
+        ai->formalCharge = 0;
+    }
+
+    /* end normal PDB */
+  } else {
+    p = ParseWordNumberCopy(cc, p, MAXLINELEN - 1);
+    if(!sscanf(cc, "%f", &ai->partialCharge))
+      ai->partialCharge = 0.0F;
+
+    p = ParseWordNumberCopy(cc, p, MAXLINELEN - 1);
+    if(sscanf(cc, "%f", &ai->elec_radius) != 1)
+      ai->elec_radius = 0.0F;
+  }
+}
+
+static void PDBAtomDecodeTask(void *data, int i)
+{
+  const PDBAtomJob *job = (const PDBAtomJob *) data;
+  int start = (int) (((size_t) job->n_atom) * i / job->n_chunk);
+  int stop = (int) (((size_t) job->n_atom) * (i + 1) / job->n_chunk);
+  for(int a = start; a < stop; a++)
+    PDBAtomDecode(job, a);
+}
+
+/*
+ * Assign the lexicon strings and derived properties of a decoded atom
+ * record (in file order: the segi of an ID overflow record is inherited
+ * from the previous atom)
+ */
+static void PDBAtomMerge(PDBAtomJob * job, int index)
+{
+  PyMOLGlobals *G = job->G;
+  PDBAtomRec *rec = job->rec + index;
+  AtomInfoType *ai = job->atInfo + index;
+  float *coord = job->coord + 3 * index;
+  char cc[MAXLINELEN];
+  unsigned char ss_chain1;
+
+  if(!rec->pqr_delim) {
+    if(job->literal_names) {
+      LexAssign(G, ai->name, rec->literal_name);
+    } else {
+      ParseNTrim(cc, rec->literal_name, 4);
+      LexAssign(G, ai->name, cc);
+    }
+
+    LexAssign(G, ai->resn, rec->resn);
+
+    if(ai->name) {
+      const char * ai_name = LexStr(G, ai->name);
+      int name_len = strlen(ai_name);
+      char name[5];
+      switch (job->reformat_names) {
+      case 1:                /* pdb compliant: HH12 becomes 2HH1, etc. */
+        if(name_len > 3) {
+          if((ai_name[0] >= 'A') && ((ai_name[0] <= 'Z')) &&
+              isdigit(ai_name[3])) {
+            if(!(((ai_name[1] >= 'a') && (ai_name[1] <= 'z')) ||
+                 ((ai_name[0] == 'C') && (ai_name[1] == 'L')) ||    /* try to be smart about */
+                 ((ai_name[0] == 'B') && (ai_name[1] == 'R')) ||    /* distinguishing common atoms */
+                 ((ai_name[0] == 'C') && (ai_name[1] == 'A')) ||    /* in all-caps from typical */
+                 ((ai_name[0] == 'F') && (ai_name[1] == 'E')) ||    /* nonatomic abbreviations */
+                 ((ai_name[0] == 'C') && (ai_name[1] == 'U')) ||
+                 ((ai_name[0] == 'N') && (ai_name[1] == 'A')) ||
+                 ((ai_name[0] == 'N') && (ai_name[1] == 'I')) ||
+                 ((ai_name[0] == 'M') && (ai_name[1] == 'G')) ||
+                 ((ai_name[0] == 'M') && (ai_name[1] == 'N')) ||
+                 ((ai_name[0] == 'H') && (ai_name[1] == 'G')) ||
+                 ((ai_name[0] == 'S') && (ai_name[1] == 'E')) ||
+                 ((ai_name[0] == 'S') && (ai_name[1] == 'I')) ||
+                 ((ai_name[0] == 'Z') && (ai_name[1] == 'N'))
+               )) {
+              strncpy(name + 1, ai_name, 3);
+              name[0] = ai_name[3];
+              name[4] = 0;
+              LexAssign(G, ai->name, name);
+            }
+          }
+        } else if(name_len == 3) {
+          if((ai_name[0] == 'H') &&
+             (ai_name[1] >= 'A') && ((ai_name[1] <= 'Z')) &&
+             isdigit(ai_name[2])) {
+            AtomInfoGetPDB3LetHydroName(G, LexStr(G, ai->resn), ai_name, name);
+            LexAssign(G, ai->name, (name[0] == ' ') ? (name + 1) : name);
+          }
+        }
+        break;
+      case 2:                /* amber compliant: 2HH1 becomes HH12 */
+      case 3:                /* pdb compliant, but use IUPAC within PyMOL */
+        if(ai_name[0]) {
+          if(isdigit(ai_name[0]) && ai_name[1] && (!isdigit(ai_name[1]))) {
+            if (1 < name_len && name_len < 5) {
+              strcpy(name, ai_name + 1);
+              name[name_len - 1] = ai_name[0];
+              name[name_len] = 0;
+              LexAssign(G, ai->name, name);
+            }
+            break;
+      default:               /* AS IS */
+            break;
+          }
+        }
+        break;
+      case 4:                /* simply read trim and write back out with 3-letter names starting from the
+                                 second column, and four-letter names starting in the first */
+        ntrim(cc, ai_name, 4);
+        LexAssign(G, ai->name, cc);
+        break;
+      }
+    }
+
+    cc[0] = rec->chain;
+    cc[1] = 0;
+    if(*cc == ' ') {
+      ss_chain1 = 0;
+      ai->chain = 0;
+    } else {
+      ss_chain1 = *cc;
+      ai->chain = LexIdx(G, cc);
+    }
+
+    if(job->ssFlag) {         /* get secondary structure information (if avail) */
+      sshash_lookup(job->ss_hash, ai, ss_chain1, rec->n_ss);
+    } else {
+      ai->cartoon = cCartoon_tube;
+    }
+
+    if(!job->is_pqr) {
+      if(!job->ignore_pdb_segi) {
+        if(!job->segi_override_idx) {
+          if(rec->segi_overflow && index) {
+            /* atom ID overflow? (nonstandard use...)... */
+            LexAssign(G, job->segi_override_idx, (ai - 1)->segi);
+            LexAssign(G, ai->segi,               (ai - 1)->segi);
+          } else {
+            LexAssign(G, ai->segi, rec->segi);
+          }
+        } else {
+          LexAssign(G, ai->segi, job->segi_override_idx);
+        }
+      } else {
+        LexAssign(G, ai->segi, 0);
+      }
+    }
+  }
+
+  ai->visRep = job->auto_show;
+
+  if(!rec->hetatm)
+    ai->hetatm = 0;
+  else {
+    ai->hetatm = 1;
+    ai->flags = cAtomFlag_ignore;
+  }
+
+  AtomInfoAssignParameters(G, ai);
+  AtomInfoAssignColors(G, ai);
+
+  PRINTFD(G, FB_ObjectMolecule)
+    "%s %s %d%c %s %8.3f %8.3f %8.3f %6.2f %6.2f %s\n",
+    LexStr(G, ai->name), LexStr(G, ai->resn), ai->resv, ai->getInscode(true), LexStr(G, ai->chain),
+    coord[0], coord[1], coord[2], ai->b, ai->q, LexStr(G, ai->segi) ENDFD;
+}
+
 CoordSet *ObjectMoleculePDBStr2CoordSet(PyMOLGlobals * G,
                                         const char *buffer,
                                         AtomInfoType ** atInfoPtr,
@@ -2078,7 +2432,8 @@ CoordSet *ObjectMoleculePDBStr2CoordSet(PyMOLGlobals * G,
   int is_end_of_object = false;
   int literal_names = SettingGetGlobal_b(G, cSetting_pdb_literal_names);
   int bogus_name_alignment = true;
-  AtomName literal_name = "";
+  PDBAtomRec *atom_rec = NULL;
+  std::vector<std::pair<int, const char *> > anisou_rec;
   int ok = true;
   lexidx_t segi_override_idx = LexIdx(G, segi_override);
 
@@ -2168,6 +2523,11 @@ CoordSet *ObjectMoleculePDBStr2CoordSet(PyMOLGlobals * G,
   PRINTFB(G, FB_ObjectMolecule, FB_Blather)
     " ObjectMoleculeReadPDB: Found %i atoms...\n", nAtom ENDFB(G);
 
+  if(ok && nAtom) {
+    atom_rec = Calloc(PDBAtomRec, nAtom);
+    CHECKOK(ok, atom_rec);
+  }
+
   if(ok && ssFlag) {
     ss_hash = sshash_new();
   }
@@ -2682,27 +3042,8 @@ CoordSet *ObjectMoleculePDBStr2CoordSet(PyMOLGlobals * G,
         }
       }
     } else if(strstartswith(p, "ANISOU") && (!*restart_model) && (atomCount)) {
-      ai = atInfo + atomCount - 1;
-
-      /* TODO: check atom identifier match */
-
-      {
-        int dummy;
-        p = nskip(p, 6);
-        p = ncopy(cc, p, 5);
-        if(!sscanf(cc, "%d", &dummy))
-          dummy = 0;
-        if(dummy == ai->id) {   /* ATOM ID must match */
-            int dummy;
-          float * anisou = ai->get_anisou();
-          p = nskip(p, 17);
-          for (int i = 0; i < 6; ++i) {
-            p = ncopy(cc, p, 7);
-            if(sscanf(cc, "%d", &dummy))
-              anisou[i] = dummy / 10000.0F;
-          }
-        }
-      }
+      /* applies to the preceding atom, read after its record is decoded */
+      anisou_rec.push_back(std::make_pair(atomCount - 1, p));
     }
 
     /* END KEYWORDS */
@@ -2714,287 +3055,84 @@ CoordSet *ObjectMoleculePDBStr2CoordSet(PyMOLGlobals * G,
           ss_chain1, ss_resv1, ss_inscode1,
           ss_chain2, ss_resv2, ss_inscode2, SSCode);
     }
-    /* Atom records */
+    /* Atom records (decoded after PASS 2) */
 
     if(ok && AFlag && (!*restart_model)) {
-      ai = atInfo + atomCount;
-      p = nskip(p, 6);
-
-      ai->rank = atomCount;
-
-      bool pqr_legacy_mixed_mode = false;
-      if(info && info->is_pqr_file()) {
-        switch (parse_pqr_atom_line(G, p, ai, coord + a)) {
-          case PQR_COLUMNS_DELIM:
-            goto pqr_done;
-          case PQR_COLUMNS_MIXED:
-            pqr_legacy_mixed_mode = true;
-        }
-      }
-
-      p = ncopy(cc, p, 5);
-      if(!sscanf(cc, "%d", &ai->id))
-        ai->id = 0;
-
-      p = nskip(p, 1);          /* to 12 */
-      p = ncopy(literal_name, p, 4);
-      if(literal_names) {
-        LexAssign(G, ai->name, literal_name);
-      } else {
-        ParseNTrim(cc, literal_name, 4);
-        LexAssign(G, ai->name, cc);
-      }
-
-      p = ncopy(cc, p, 1);
-      if(*cc == 32)
-        ai->alt[0] = 0;
-      else {
-        ai->alt[0] = *cc;
-        ai->alt[1] = 0;
-      }
-
-      p = ntrim(cc, p, 4); /* now allowing for 4-letter residues */
-      if (truncate_resn)        /* unless specifically disabled */
-        cc[3] = 0;
-
-      LexAssign(G, ai->resn, cc);
-
-      if(ai->name) {
-        const char * ai_name = LexStr(G, ai->name);
-        int name_len = strlen(ai_name);
-        char name[5];
-        switch (reformat_names) {
-        case 1:                /* pdb compliant: HH12 becomes 2HH1, etc. */
-          if(name_len > 3) {
-            if((ai_name[0] >= 'A') && ((ai_name[0] <= 'Z')) &&
-                isdigit(ai_name[3])) {
-              if(!(((ai_name[1] >= 'a') && (ai_name[1] <= 'z')) ||
-                   ((ai_name[0] == 'C') && (ai_name[1] == 'L')) ||    /* try to be smart about */
-                   ((ai_name[0] == 'B') && (ai_name[1] == 'R')) ||    /* distinguishing common atoms */
-                   ((ai_name[0] == 'C') && (ai_name[1] == 'A')) ||    /* in all-caps from typical */
-                   ((ai_name[0] == 'F') && (ai_name[1] == 'E')) ||    /* nonatomic abbreviations */
-                   ((ai_name[0] == 'C') && (ai_name[1] == 'U')) ||
-                   ((ai_name[0] == 'N') && (ai_name[1] == 'A')) ||
-                   ((ai_name[0] == 'N') && (ai_name[1] == 'I')) ||
-                   ((ai_name[0] == 'M') && (ai_name[1] == 'G')) ||
-                   ((ai_name[0] == 'M') && (ai_name[1] == 'N')) ||
-                   ((ai_name[0] == 'H') && (ai_name[1] == 'G')) ||
-                   ((ai_name[0] == 'S') && (ai_name[1] == 'E')) ||
-                   ((ai_name[0] == 'S') && (ai_name[1] == 'I')) ||
-                   ((ai_name[0] == 'Z') && (ai_name[1] == 'N'))
-                 )) {
-                strncpy(name + 1, ai_name, 3);
-                name[0] = ai_name[3];
-                name[4] = 0;
-                LexAssign(G, ai->name, name);
-              }
-            }
-          } else if(name_len == 3) {
-            if((ai_name[0] == 'H') &&
-               (ai_name[1] >= 'A') && ((ai_name[1] <= 'Z')) &&
-               isdigit(ai_name[2])) {
-              AtomInfoGetPDB3LetHydroName(G, LexStr(G, ai->resn), ai_name, name);
-              LexAssign(G, ai->name, (name[0] == ' ') ? (name + 1) : name);
-            }
-          }
-          break;
-        case 2:                /* amber compliant: 2HH1 becomes HH12 */
-        case 3:                /* pdb compliant, but use IUPAC within PyMOL */
-          if(ai_name[0]) {
-            if(isdigit(ai_name[0]) && ai_name[1] && (!isdigit(ai_name[1]))) {
-              if (1 < name_len && name_len < 5) {
-                strcpy(name, ai_name + 1);
-                name[name_len - 1] = ai_name[0];
-                name[name_len] = 0;
-                LexAssign(G, ai->name, name);
-              }
-              break;
-        default:               /* AS IS */
-              break;
-            }
-          }
-          break;
-        case 4:                /* simply read trim and write back out with 3-letter names starting from the
-                                   second column, and four-letter names starting in the first */
-          ntrim(cc, ai_name, 4);
-          LexAssign(G, ai->name, cc);
-          break;
-        }
-      }
-
-      p = ncopy(cc, p, 1);
-      if(*cc == ' ') {
-        ss_chain1 = 0;
-        ai->chain = 0;
-      } else {
-        ss_chain1 = *cc;
-        ai->chain = LexIdx(G, cc);
+      if(atomCount < nAtom) {     /* safety */
+        PDBAtomRec *rec = atom_rec + atomCount;
+        rec->line = p;
+        rec->hetatm = (AFlag == 2);
+        rec->n_ss = ss_hash ? ss_hash->n_ss : 0;
+        atomCount++;
       }
+    }
+    p = nextline(p);
+  }
 
-      p = ncopy(cc, p, 4);
-      if(!sscanf(cc, "%d", &ai->resv))
-        ai->resv = 0;
-      ai->setInscode(*p);
-      p = nskip(p, 1);
+  /* END PASS 2 */
 
-      if(ssFlag) {              /* get secondary structure information (if avail) */
-        sshash_lookup(ss_hash, ai, ss_chain1);
-      } else {
-        ai->cartoon = cCartoon_tube;
-      }
+  /* decode atom records */
+  if(ok && atomCount) {
+    PDBAtomJob job;
+    int n_thread = 1;
+
+    job.G = G;
+    job.rec = atom_rec;
+    job.atInfo = atInfo;
+    job.coord = coord;
+    job.n_atom = atomCount;
+    job.is_pqr = info && info->is_pqr_file();
+    job.is_pdbqt = info && info->variant == PDB_VARIANT_PDBQT;
+    job.truncate_resn = truncate_resn;
+    job.bogus_name_alignment = bogus_name_alignment;
+    job.literal_names = literal_names;
+    job.reformat_names = reformat_names;
+    job.ignore_pdb_segi = ignore_pdb_segi || (job.is_pdbqt && !job.is_pqr);
+    job.ssFlag = ssFlag;
+    job.auto_show = auto_show;
+    job.ss_hash = ss_hash;
+    job.segi_override_idx = segi_override_idx;
+
+    /* PQR records may go through the lexicon while being decoded */
+    if((atomCount >= cPDBParallelMin) && !job.is_pqr && ThreadPoolIsNative()) {
+      n_thread = SettingGetGlobal_i(G, cSetting_max_threads);
+      if(n_thread > PYMOL_MAX_THREADS)
+        n_thread = PYMOL_MAX_THREADS;
+    }
 
-      if (pqr_legacy_mixed_mode) {
-        // Note: not sure if this branch is ever reached (if such files exist)
-        // or if it's fully obsolete with the new space delimited parsing in
-        // parse_pqr_atom_line.
-        p = ParseWordNumberCopy(cc, p, MAXLINELEN - 1);
-        sscanf(cc, "%f", coord + a);
-        p = ParseWordNumberCopy(cc, p, MAXLINELEN - 1);
-        sscanf(cc, "%f", coord + (a + 1));
-        p = ParseWordNumberCopy(cc, p, MAXLINELEN - 1);
-        sscanf(cc, "%f", coord + (a + 2));
-      } else {
-        p = nskip(p, 3);
-        p = ncopy(cc, p, 8);
-        sscanf(cc, "%f", coord + a);
-        p = ncopy(cc, p, 8);
-        sscanf(cc, "%f", coord + (a + 1));
-        p = ncopy(cc, p, 8);
-        sscanf(cc, "%f", coord + (a + 2));
+    if(n_thread < 2) {
+      for(a = 0; a < atomCount; a++) {
+        PDBAtomDecode(&job, a);
+        PDBAtomMerge(&job, a);
       }
+    } else {
+      job.n_chunk = n_thread;
+      ThreadPoolRun(G, n_thread, job.n_chunk, PDBAtomDecodeTask, &job);
+      for(a = 0; a < atomCount; a++)
+        PDBAtomMerge(&job, a);
+    }
 
-      if((!info) || (!info->is_pqr_file())) {     /* standard PDB file */
-        p = ncopy(cc, p, 6);
-        if(!sscanf(cc, "%f", &ai->q))
-          ai->q = 1.0;
-
-        p = ncopy(cc, p, 6);
-        if(!sscanf(cc, "%f", &ai->b))
-          ai->b = 0.0;
-
-        if (info->variant == PDB_VARIANT_PDBQT) {
-          ignore_pdb_segi = true;
-          p = nskip(p, 4);
-          p = ncopy(cc, p, 6);
-          if(!sscanf(cc, "%f", &ai->partialCharge))
-            ai->partialCharge = 0.0;
-
-          // type is 78-79 in pdbqt, 77-78 in pdb
-          p = nskip(p, 1);
-        } else {
-          p = nskip(p, 6);
-          p = ncopy(cc, p, 4);
-        }
-
-        if(!ignore_pdb_segi) {
-          if(!segi_override_idx) {
-            if(cc[3] == '1' && atomCount && strncmp(p, "0000", 4) == 0) {
-              /* atom ID overflow? (nonstandard use...)... */
-              LexAssign(G, segi_override_idx, (ai - 1)->segi);
-              LexAssign(G, ai->segi,          (ai - 1)->segi);
-            } else {
-              UtilCleanStr(cc);
-              LexAssign(G, ai->segi, cc);
-            }
-          } else {
-            LexAssign(G, ai->segi, segi_override_idx);
-          }
-        } else {
-          LexAssign(G, ai->segi, 0);
-        }
-
-        p = ncopy(cc, p, 2);
-        if(!sscanf(cc, "%s", ai->elem))
-          ai->elem[0] = 0;
-        else if(!((((ai->elem[0] >= 'a') && (ai->elem[0] <= 'z')) ||    /* don't get confused by PDB misuse */
-                   ((ai->elem[0] >= 'A') && (ai->elem[0] <= 'Z'))) &&
-                  (((ai->elem[1] == 0) ||
-                    ((ai->elem[1] >= 'a') && (ai->elem[1] <= 'z')) ||
-                    ((ai->elem[1] >= 'A') && (ai->elem[1] <= 'Z'))))))
-          ai->elem[0] = 0;
-        else if (info->variant == PDB_VARIANT_PDBQT) {
-          if (strcmp(ai->elem, "A") == 0) {
-            // aromatic carbon
-            ai->elem[0] = 'C';
-          } else if (isupper(ai->elem[1])) {
-            // h-bond donor or acceptor
-            ai->elem[1] = 0;
-          }
-        }
+    segi_override_idx = job.segi_override_idx;
 
-        if(!ai->elem[0]) {
-          if(((literal_name[0] == ' ') || ((literal_name[0] >= '0') && (literal_name[0] <= '9'))) && (literal_name[1] >= 'A') && (literal_name[1] <= 'Z')) {    /* infer element from name column */
-            ai->elem[0] = literal_name[1];
-            ai->elem[1] = 0;
-          } else if(((literal_name[0] >= 'A') && (literal_name[0] <= 'Z')) && (((literal_name[1] >= 'A') && (literal_name[1] <= 'Z')) || ((literal_name[1] >= 'a') && (literal_name[1] <= 'z')))) {     /* infer element from name column */
-            ai->elem[0] = literal_name[0];
-            ai->elem[2] = 0;
-            if((literal_name[1] >= 'A') && (literal_name[1] <= 'Z')) {  /* second letter is capitalized */
-              if(bogus_name_alignment) {
-                /* if other atom names aren't properly aligned */
-                ai->elem[1] = 0;        /* kill 2nd letter */
-              } else if(literal_name[0] == 'H') {
-                /* or if this is an ultra-bogus PDB with inconsistent 
-                   indendentation, and this is likely a hydrogen */
-                ai->elem[1] = 0;        /* kill 2nd letter */
-              } else {
-                ai->elem[1] = tolower(literal_name[1]);
-              }
-            } else
-              ai->elem[1] = literal_name[1];
-          }
-        }
-
-        p = ncopy(cc, p, 2);
-        if((cc[1] == '-') || (cc[1] == '+')) {
-          /* only read formal charge when sign is present */
-          char ctmp = cc[0];
-          cc[0] = cc[1];
-          cc[1] = ctmp;
-          if(!sscanf(cc, "%hhi", &ai->formalCharge))
-            ai->formalCharge = 0;
+    for(size_t r = 0; r < anisou_rec.size(); r++) {
+      int dummy;
+      ai = atInfo + anisou_rec[r].first;
+      p = nskip(anisou_rec[r].second, 6);
+      p = ncopy(cc, p, 5);
+      if(!sscanf(cc, "%d", &dummy))
+        dummy = 0;
+      if(dummy == ai->id) {   /* ATOM ID must match */
+        float * anisou = ai->get_anisou();
+        p = nskip(p, 17);
+        for (int i = 0; i < 6; ++i) {
+          p = ncopy(cc, p, 7);
+          if(sscanf(cc, "%d", &dummy))
+            anisou[i] = dummy / 10000.0F;
         }
-
-        /* end normal PDB */
-      } else if(info && info->is_pqr_file()) {
-        p = ParseWordNumberCopy(cc, p, MAXLINELEN - 1);
-        if(!sscanf(cc, "%f", &ai->partialCharge))
-          ai->partialCharge = 0.0F;
-
-        p = ParseWordNumberCopy(cc, p, MAXLINELEN - 1);
-        if(sscanf(cc, "%f", &ai->elec_radius) != 1)
-          ai->elec_radius = 0.0F;
-      }
-
-pqr_done:
-
-      ai->visRep = auto_show;
-
-      if(AFlag == 1)
-        ai->hetatm = 0;
-      else {
-        ai->hetatm = 1;
-        ai->flags = cAtomFlag_ignore;
-      }
-
-      AtomInfoAssignParameters(G, ai);
-      AtomInfoAssignColors(G, ai);
-
-      PRINTFD(G, FB_ObjectMolecule)
-        "%s %s %d%c %s %8.3f %8.3f %8.3f %6.2f %6.2f %s\n",
-        LexStr(G, ai->name), LexStr(G, ai->resn), ai->resv, ai->getInscode(true), LexStr(G, ai->chain),
-        *(coord + a), *(coord + a + 1), *(coord + a + 2), ai->b, ai->q, LexStr(G, ai->segi) ENDFD;
-
-      if(atomCount < nAtom) {     /* safety */
-        a += 3;
-        atomCount++;
       }
     }
-    p = nextline(p);
   }
 
-  /* END PASS 2 */
-
   if(ok && bondFlag) {
     UtilSortInPlace(G, bond, nBond, sizeof(BondType), (UtilOrderFn *) BondInOrder);
     if(nBond) {
@@ -3152,6 +3290,7 @@ pqr_done:
     }
   }
   sshash_free(ss_hash);
+  FreeP(atom_rec);
   
   if (ok){
     if(!seen_model)
@@ -3554,6 +3693,11 @@ static PyObject *ObjectMoleculeCSetAsPyList(ObjectMolecule * I)
   int a;
   result = PyList_New(I->NCSet);
   for(a = 0; a < I->NCSet; a++) {
+    if(I->Frames) {
+      /* one state at a time, keeps stored trajectories compact */
+      FrameStoreTrim(I, a, a + 1);
+      FrameStoreLoad(I, a);
+    }
     if(I->CSet[a]) {
       PyList_SetItem(result, a, CoordSetAsPyList(I->CSet[a]));
     } else {
@@ -4115,7 +4259,7 @@ int ObjectMoleculeConnect(ObjectMolecule * I, int *nbond, BondType ** bond, Atom
 {
 #define cMULT 1
   PyMOLGlobals *G = I->Obj.G;
-  int a, b, c, d, e, f, i, j;
+  int a, b, c, d, e, i, j;
   int a1, a2;
   float *v1, *v2, dst;
   int maxBond;
@@ -4203,9 +4347,8 @@ int ObjectMoleculeConnect(ObjectMolecule * I, int *nbond, BondType ** bond, Atom
 	    map = MapNew(G, max_cutoff + MAX_VDW, cs->Coord, cs->NIndex, NULL);
 	  CHECKOK(ok, map);
           if(ok) {
-            int dim12 = map->D1D2;
-            int dim2 = map->Dim[2];
-
+            /* cell-sorted copy, so neighbors are streamed from memory */
+            ok = MapSetupCells(map, cs->Coord);
             for(i = 0; ok && i < cs->NIndex; i++) {
               if(nBond > maxBond)
                 break;
@@ -4218,18 +4361,16 @@ int ObjectMoleculeConnect(ObjectMolecule * I, int *nbond, BondType ** bond, Atom
               MapLocus(map, v1, &a, &b, &c);
 	      /* d = [a-1, a, a+1] */
               for(d = a - 1; ok && d <= a + 1; d++) {
-                int *j_ptr1 = map->Head + d * dim12 + (b - 1) * dim2;
 		/* e = [b-1, b, b+1] */
                 for(e = b - 1; ok && e <= b + 1; e++) {
-                  int *j_ptr2 = j_ptr1 + c - 1;
-                  j_ptr1 += dim2;
-		  /* f = [c-1, c, c+1] */
-                  for(f = c - 1; ok && f <= c + 1; f++) {
-                    j = *(j_ptr2++);    /*  *MapFirst(map,d,e,f)); */
-                    while(ok && j >= 0) {
-                      if(i < j) {
+                  int x, x_stop;
+		  /* cells [c-1, c, c+1] in one contiguous run */
+                  MapCellRun(map, d, e, c, x, x_stop);
+                  for(; ok && x < x_stop; x++) {
+                    j = map->CellList[x];
+                    if(i < j) {
 			/* position in space for atom 2 */
-                        v2 = cs->Coord + (3 * j);
+                        v2 = map->CellVert + (3 * x);
                         a2 = cs->IdxToAtm[j];
                         ai2 = ai + a2;
 
@@ -4281,8 +4422,6 @@ int ObjectMoleculeConnect(ObjectMolecule * I, int *nbond, BondType ** bond, Atom
                             nBond++;
                           }
                         }
-                      }
-                      j = MapNext(map, j);
                     }
                   }
                 }
@@ -4488,8 +4627,10 @@ int ObjectMoleculeSort(ObjectMolecule * I)
         I->Bond[a].index[1] = outdex[I->Bond[a].index[1]];
       }
 
-      for(a = -1; a < I->NCSet; a++) {  /* coordinate set mapping */
-        if(a < 0) {
+      for(a = -2; a < I->NCSet; a++) {  /* coordinate set mapping */
+        if(a == -2) {
+          cs = I->Frames ? FrameStoreGetLayout(I) : NULL;
+        } else if(a < 0) {
           cs = I->CSTmpl;
         } else {
           cs = I->CSet[a];
@@ -231,6 +231,10 @@ static void ObjectSurfaceStateFree(ObjectSurfaceState * ms)
   FreeP(ms->RC);
   VLAFreeP(ms->AtomVertex);
   CGOFree(ms->UnitCellCGO);
+  TetsurfCacheFree(ms->Cache[0]);
+  TetsurfCacheFree(ms->Cache[1]);
+  ms->Cache[0] = NULL;
+  ms->Cache[1] = NULL;
 }
 
 static void ObjectSurfaceFree(ObjectSurface * I)
@@ -548,12 +552,16 @@ static void ObjectSurfaceUpdate(ObjectSurface * I)
                 MapSetupExpress(voxelmap);
             }
 
+            if(!ms->Cache[0])
+              ms->Cache[0] = TetsurfCacheNew(I->Obj.G);
+
             ms->nT = TetsurfVolume(I->Obj.G, oms->Field,
                                    ms->Level,
                                    &ms->N, &ms->V,
                                    ms->Range,
                                    ms->Mode,
-                                   voxelmap, ms->AtomVertex, ms->CarveBuffer, ms->Side);
+                                   voxelmap, ms->AtomVertex, ms->CarveBuffer, ms->Side,
+                                   ms->Cache[0]);
 
             if(!SettingGet_b
                (I->Obj.G, I->Obj.Setting, NULL, cSetting_surface_negative_visible)) {
@@ -565,12 +573,16 @@ static void ObjectSurfaceUpdate(ObjectSurface * I)
               int *N2 = VLAlloc(int, 10000);
               float *V2 = VLAlloc(float, 10000);
 
+              if(!ms->Cache[1])
+                ms->Cache[1] = TetsurfCacheNew(I->Obj.G);
+
               nT2 = TetsurfVolume(I->Obj.G, oms->Field,
                                   -ms->Level,
                                   &N2, &V2,
                                   ms->Range,
                                   ms->Mode,
-                                  voxelmap, ms->AtomVertex, ms->CarveBuffer, ms->Side);
+                                  voxelmap, ms->AtomVertex, ms->CarveBuffer, ms->Side,
+                                  ms->Cache[1]);
               if(N2 && V2) {
 
                 int base_n_N = VLAGetSize(ms->N);
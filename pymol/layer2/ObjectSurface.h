@@ -19,6 +19,7 @@ Z* -------------------------------------------------------------------
 
 #include"os_gl.h"
 #include"ObjectMap.h"
+#include"Tetsurf.h"
 
 typedef struct {
   CObjectState State;
@@ -48,6 +49,7 @@ typedef struct {
   CGO *UnitCellCGO;
   int Side;
   CGO *shaderCGO;
+  CTetsurfCache *Cache[2];      /* level and negative level */
 } ObjectSurfaceState;
 
 typedef struct ObjectSurface {
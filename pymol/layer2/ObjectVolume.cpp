@@ -45,6 +45,7 @@ Z* -------------------------------------------------------------------
 #include"ObjectGadgetRamp.h"
 #include"ShaderMgr.h"
 #include"Field.h"
+#include"Util.h"
 
 #define clamp(x,l,h) ((x) < (l) ? (l) : (x) > (h) ? (h) : (x))
 
@@ -389,18 +390,29 @@ static void ObjectVolumeInvalidate(ObjectVolume * I, int rep, int level, int sta
  * Get the field either from the associated map, or from vs->Field in case
  * this is a reduced or symmetry expanded volume.
  */
-static CField * ObjectVolumeStateGetField(ObjectVolumeState * vs) {
+static Isofield * ObjectVolumeStateGetIsofield(ObjectVolumeState * vs) {
+  ObjectMapState *oms;
   if (!vs)
     return NULL;
   if(vs->Field)
-    return vs->Field->data;
-  return ObjectVolumeStateGetMapState(vs)->Field->data;
+    return vs->Field;
+  oms = ObjectVolumeStateGetMapState(vs);
+  return oms ? oms->Field : NULL;
+}
+
+static CField * ObjectVolumeStateGetField(ObjectVolumeState * vs) {
+  Isofield *field = ObjectVolumeStateGetIsofield(vs);
+  return field ? field->data : NULL;
 }
 
 CField * ObjectVolumeGetField(ObjectVolume * I) {
   return ObjectVolumeStateGetField(ObjectVolumeGetActiveState(I));
 }
 
+Isofield * ObjectVolumeGetIsofield(ObjectVolume * I) {
+  return ObjectVolumeStateGetIsofield(ObjectVolumeGetActiveState(I));
+}
+
 /*
  * Get a 4x4 (incl. translation) FracToReal from corner array
  */
@@ -845,9 +857,23 @@ static void ObjectVolumeRender(ObjectVolume * I, RenderInfo * info)
 
       // Create a 3D texture
       vs->textures[0] = tex3dGenBind();
-      glTexImage3D(GL_TEXTURE_3D, 0, volume_bit_depth,
-          field->dim[2], field->dim[1], field->dim[0], 0,
-          GL_RED, GL_FLOAT, field->data);
+      {
+        unsigned short *half = NULL;
+        if(volume_bit_depth == GL_R16F) {
+          // convert to half floats here, halves the data handed to the driver
+          unsigned int a, n_elem = field->size / field->base_size;
+          const float *v = (const float *) field->data;
+          half = Alloc(unsigned short, n_elem);
+          if(half)
+            for(a = 0; a < n_elem; a++)
+              half[a] = UtilFloatToHalf(v[a]);
+        }
+        glTexImage3D(GL_TEXTURE_3D, 0, volume_bit_depth,
+            field->dim[2], field->dim[1], field->dim[0], 0,
+            GL_RED, half ? GL_HALF_FLOAT : GL_FLOAT,
+            half ? (void *) half : (void *) field->data);
+        FreeP(half);
+      }
 
       // Create 3D carve mask texture
       if(vs->carvemask) {
@@ -76,6 +76,7 @@ int ObjectVolumeInvalidateMapName(ObjectVolume * I, const char *name, const char
 int ObjectVolumeColor(ObjectVolume * I, float * colors, int ncolors);
 
 CField   * ObjectVolumeGetField(ObjectVolume* I);
+Isofield * ObjectVolumeGetIsofield(ObjectVolume* I);
 PyObject * ObjectVolumeGetRamp(ObjectVolume* I);
 int        ObjectVolumeSetRamp(ObjectVolume* I, float *ramp_list, int list_size);
 
@@ -39,11 +39,18 @@ Z* -------------------------------------------------------------------
 #include"PConv.h"
 #include"Selector.h"
 #include"ShaderMgr.h"
+#include"ThreadPool.h"
+#include"Isosurf.h"
+#include"Tetsurf.h"
+
+#include <algorithm>
 
 #ifdef NT
 #undef NT
 #endif
 
+typedef struct _CSurfacePatches CSurfacePatches;
+
 typedef struct RepSurface {
   Rep R;
   int N;
@@ -62,6 +69,7 @@ typedef struct RepSurface {
   int Type;
   float max_vdw;
   CGO *debug;
+  CSurfacePatches *Patches;     /* kept for incremental rebuilds (surface_type 7) */
 
   /* These variables are for using the shader.  All of them */
   /* are allocated/set when generate_shader_cgo to minimize */
@@ -78,6 +86,8 @@ typedef struct RepSurface {
 void RepSurfaceFree(RepSurface * I);
 int RepSurfaceSameVis(RepSurface * I, CoordSet * cs);
 void RepSurfaceColor(RepSurface * I, CoordSet * cs);
+static void SurfacePatchesFree(CSurfacePatches * I);
+static Rep *RepSurfaceNewFromPatches(CoordSet * cs, int state, CSurfacePatches * patches);
 
 void RepSurfaceFree(RepSurface * I)
 {
@@ -117,6 +127,7 @@ void RepSurfaceFree(RepSurface * I)
   VLAFreeP(I->T);
   VLAFreeP(I->S);
   VLAFreeP(I->AT);
+  SurfacePatchesFree(I->Patches);
   RepPurge(&I->R);              /* unnecessary, but a good idea */
   OOFreeP(I);
 }
@@ -295,7 +306,8 @@ static void RepSurfaceRender(RepSurface * I, RenderInfo * info)
           vc += 3;
           v += 3;
         }
-    } else if((I->Type == 0) || (I->Type == 3) || (I->Type == 4) || (I->Type == 5)) {   /* solid surface */
+    } else if((I->Type == 0) || (I->Type == 3) || (I->Type == 4) || (I->Type == 5) ||
+              (I->Type == 7)) {   /* solid surface */
       c = I->NT;
 
       if(I->oneColorFlag) {
@@ -2892,7 +2904,7 @@ void RepSurfaceColor(RepSurface * I, CoordSet * cs)
         0 : SettingGetGlobal_i(G, cSetting_surface_color_smoothing);
       float color_smoothing_threshold = SettingGetGlobal_f(G, cSetting_surface_color_smoothing_threshold);
       int atm, ok = true;
-      MapSetupExpress(map);
+      ok &= MapSetupCells(map, cs->Coord);
       ok &= !G->Interrupt;
       if (ok && !I->AT)
 	I->AT = VLACalloc(int, I->N);
@@ -2909,39 +2921,44 @@ void RepSurfaceColor(RepSurface * I, CoordSet * cs)
         n0 = I->VN + 3 * a;
         vi = I->Vis + a;
         /* colors */
-        i = *(MapLocusEStart(map, v0));
-        if(i && map->EList) {
-          j = map->EList[i++];
-          while(j >= 0) {
-	    atm = cs->IdxToAtm[j];
-            ai2 = obj->AtomInfo + atm;
-            if((inclH || (!ai2->isHydrogen())) &&
-               ((!cullByFlag) || (!(ai2->flags & cAtomFlag_ignore)))) {
-              dist = (float) diff3f(v0, cs->Coord + j * 3) - ai2->vdw;
-              if(color_smoothing){
-		if (dist < minDist){
-		  /* switching closest to 2nd closest */
-		  pi2 = pi;
-		  pai2 = pai;
-		  minDist2 = minDist;
-		  pi = j;
-		  catm = atm;
-		  pai = ai2;
-		  minDist = dist;
-		} else if (dist < minDist2){
-		  /* just setting second closest */
-		  pi2 = j;
-		  pai2 = ai2;
-		  minDist2 = dist;
-		}
-	      } else if (dist < minDist) {
-                i0 = j;
-		catm = atm;
-                ai0 = ai2;
-                minDist = dist;
+        {
+          int h, k, l, d1, e1, x, x_stop;
+          MapLocus(map, v0, &h, &k, &l);
+          for(d1 = h - 1; d1 <= h + 1; d1++) {
+            for(e1 = k - 1; e1 <= k + 1; e1++) {
+              MapCellRun(map, d1, e1, l, x, x_stop);
+              for(; x < x_stop; x++) {
+                j = map->CellList[x];
+		atm = cs->IdxToAtm[j];
+                ai2 = obj->AtomInfo + atm;
+                if((inclH || (!ai2->isHydrogen())) &&
+                   ((!cullByFlag) || (!(ai2->flags & cAtomFlag_ignore)))) {
+                  dist = (float) diff3f(v0, map->CellVert + 3 * x) - ai2->vdw;
+                  if(color_smoothing){
+		    if (dist < minDist){
+		      /* switching closest to 2nd closest */
+		      pi2 = pi;
+		      pai2 = pai;
+		      minDist2 = minDist;
+		      pi = j;
+		      catm = atm;
+		      pai = ai2;
+		      minDist = dist;
+		    } else if (dist < minDist2){
+		      /* just setting second closest */
+		      pi2 = j;
+		      pai2 = ai2;
+		      minDist2 = dist;
+		    }
+		  } else if (dist < minDist) {
+                    i0 = j;
+		    catm = atm;
+                    ai0 = ai2;
+                    minDist = dist;
+                  }
+                }
               }
             }
-            j = map->EList[i++];
           }
         }
 	I->AT[a] = catm;
@@ -3181,6 +3198,9 @@ typedef struct {
   float *V, *VN;
   int N, *T, *S, NT;
 
+  /* patches of the previous surface on input, of this one on output */
+  CSurfacePatches *patches;
+
 } SurfaceJob;
 
 static void SurfaceJobPurgeResult(PyMOLGlobals * G, SurfaceJob * I)
@@ -3333,396 +3353,1764 @@ static void SurfaceJobFree(PyMOLGlobals * G, SurfaceJob * I)
   VLAFreeP(I->presentVla);
   VLAFreeP(I->atomInfo);
   VLAFreeP(I->carveVla);
+  SurfacePatchesFree(I->patches);
   OOFreeP(I);
 }
 
-static int SurfaceJobRun(PyMOLGlobals * G, SurfaceJob * I)
+/* surface passes over fewer atoms (or dots) than this run serially */
+#define cSurfaceParallelMin 1000
+
+/*
+ * Number of threads to use for a surface pass over n atoms or dots
+ */
+static int SurfaceJobGetNThread(PyMOLGlobals * G, int n)
 {
-  int ok = true;
-  int MaxN;
-  int n_index = VLAGetSize(I->atomInfo);
-  int n_present = I->nPresent;
-  SphereRec *sp = G->Sphere->Sphere[I->sphereIndex];
-  SphereRec *ssp = G->Sphere->Sphere[I->solventSphereIndex];
+  int n_thread;
+  if((n < cSurfaceParallelMin) || !G->Setting || !ThreadPoolIsNative())
+    return 1;
+  n_thread = SettingGetGlobal_i(G, cSetting_max_threads);
+  if(n_thread < 1)
+    n_thread = 1;
+  if(n_thread > PYMOL_MAX_THREADS)
+    n_thread = PYMOL_MAX_THREADS;
+  return n_thread;
+}
 
-  SurfaceJobPurgeResult(G, I);
+/*
+ * Number of tasks for a pass over n items on n_thread threads (several
+ * tasks per thread, since the work per atom varies a lot)
+ */
+static int SurfaceJobGetNTask(int n, int n_thread)
+{
+  int n_task = (n_thread > 1) ? 4 * n_thread : 1;
+  if(n_task > n)
+    n_task = (n > 0) ? n : 1;
+  return n_task;
+}
 
-  {
-    /* compute limiting storage requirements */
-    int tmp = n_present;
-    if(tmp < 1)
-      tmp = 1;
-    if(sp->nDot < ssp->nDot)
-      MaxN = tmp * ssp->nDot;
-    else
-      MaxN = tmp * sp->nDot;
-  }
+static void SurfaceJobRange(int n, int n_task, int t, int *start, int *stop)
+{
+  *start = (int) (((size_t) n * t) / n_task);
+  *stop = (int) (((size_t) n * (t + 1)) / n_task);
+}
 
-  I->V = VLAlloc(float, (MaxN + 1) * 3);
-  CHECKOK(ok, I->V);
-  if (ok)
-    I->VN = VLAlloc(float, (MaxN + 1) * 3);
-  CHECKOK(ok, I->VN);
+/*
+ * Points generated by one task. The chunks of a pass are concatenated in
+ * task order, which reproduces the serial output exactly.
+ */
+typedef struct {
+  float *v, *vn;                /* VLAs, vn is optional */
+  int n;
+  int ok;
+} SurfaceDotChunk;
 
-  ok &= !G->Interrupt;
+static SurfaceDotChunk *SurfaceDotChunkNew(int n_task, int normals)
+{
+  int ok = true;
+  int t;
+  SurfaceDotChunk *chunk = Calloc(SurfaceDotChunk, n_task);
+  CHECKOK(ok, chunk);
+  for(t = 0; ok && t < n_task; t++) {
+    chunk[t].v = VLAlloc(float, 3000);
+    CHECKOK(ok, chunk[t].v);
+    if(ok && normals) {
+      chunk[t].vn = VLAlloc(float, 3000);
+      CHECKOK(ok, chunk[t].vn);
+    }
+    chunk[t].ok = ok;
+  }
+  if(!ok && chunk) {
+    for(t = 0; t < n_task; t++) {
+      VLAFreeP(chunk[t].v);
+      VLAFreeP(chunk[t].vn);
+    }
+    FreeP(chunk);
+  }
+  return chunk;
+}
 
-  if(!(I->V && I->VN) || (!ok)) {       /* bail out point -- try to reduce crashes */
-    PRINTFB(G, FB_RepSurface, FB_Errors)
-      "Error-RepSurface: insufficient memory to calculate surface at this quality.\n"
-      ENDFB(G);
-    VLAFreeP(I->V);
-    I->V = NULL;
-    VLAFreeP(I->VN);
-    I->VN = NULL;
-    ok = false;
-  } else {
-    SolventDot *sol_dot = NULL;
-    float *v = I->V;
-    float *vn = I->VN;
-    MapType *carve_map = NULL;
-    float probe_radius = I->probeRadius;
-    int circumscribe = I->circumscribe;
-    int surface_type = I->surfaceType;
-    float point_sep = I->pointSep;
-    float *I_coord = I->coord;
-    int *present_vla = I->presentVla;
-    SurfaceJobAtomInfo *I_atom_info = I->atomInfo;
+static void SurfaceDotChunkFree(SurfaceDotChunk * chunk, int n_task)
+{
+  int t;
+  if(chunk) {
+    for(t = 0; t < n_task; t++) {
+      VLAFreeP(chunk[t].v);
+      VLAFreeP(chunk[t].vn);
+    }
+    FreeP(chunk);
+  }
+}
 
-    I->N = 0;
+/*
+ * Makes room for n_more points, returns false when out of memory
+ */
+static int SurfaceDotChunkCheck(SurfaceDotChunk * chunk, int n_more)
+{
+  int size = 3 * (chunk->n + n_more);
+  VLACheck(chunk->v, float, size);
+  CHECKOK(chunk->ok, chunk->v);
+  if(chunk->ok && chunk->vn) {
+    VLACheck(chunk->vn, float, size);
+    CHECKOK(chunk->ok, chunk->vn);
+  }
+  return chunk->ok;
+}
 
-    sol_dot = SolventDotNew(G, I->coord, I->atomInfo, probe_radius,
-                            ssp, present_vla,
-                            circumscribe, I->surfaceMode, I->surfaceSolvent,
-                            I->cavityCull, I->allVisibleFlag, I->maxVdw,
-                            I->cavityMode, I->cavityRadius, I->cavityCutoff);
-    CHECKOK(ok, sol_dot);
-    ok &= !G->Interrupt;
-    if(ok && sol_dot) {
-      if(!I->surfaceSolvent) {
+/*
+ * Appends the chunks of a pass to the VLAs *v (and *vn) holding *n
+ * points, keeping at most n_max points in total (no limit if negative)
+ */
+static int SurfaceDotChunkMerge(SurfaceDotChunk * chunk, int n_task,
+                                float **v, float **vn, int *n, int n_max)
+{
+  int ok = true;
+  int t;
+  for(t = 0; ok && t < n_task; t++) {
+    int cnt = chunk[t].n;
+    ok &= chunk[t].ok;
+    if((n_max >= 0) && (cnt > n_max - *n))
+      cnt = n_max - *n;
+    if(ok && cnt > 0) {
+      VLACheck(*v, float, 3 * (*n + cnt));
+      CHECKOK(ok, *v);
+      if(ok)
+        memcpy(*v + 3 * (*n), chunk[t].v, sizeof(float) * 3 * cnt);
+      if(ok && vn) {
+        VLACheck(*vn, float, 3 * (*n + cnt));
+        CHECKOK(ok, *vn);
+        if(ok)
+          memcpy(*vn + 3 * (*n), chunk[t].vn, sizeof(float) * 3 * cnt);
+      }
+      if(ok)
+        *n += cnt;
+    }
+  }
+  return ok;
+}
 
-        float solv_tole = point_sep * 0.04F;
-        float probe_rad_more;
-        float probe_rad_less;
-        float probe_rad_less2;
+/*
+ * Flags the points v[0..n) which lie within cutoff of any point in map.
+ * With atom_info, the cutoff is extended by the vdw radius of the point
+ * found.
+ */
+typedef struct {
+  PyMOLGlobals *G;
+  MapType *map;
+  float *point;
+  SurfaceJobAtomInfo *atom_info;
+  int *present;
+  float cutoff;
+  float *v;
+  int n, n_task;
+  int *flag;
+  int *ok;                      /* per task */
+} SurfaceFlagJob;
 
-        if(probe_radius < (2.5F * point_sep)) { /* minimum probe radius allowed */
-          probe_radius = 2.5F * point_sep;
+static void SurfaceFlagTask(void *data, int t)
+{
+  SurfaceFlagJob *job = (SurfaceFlagJob *) data;
+  MapType *map = job->map;
+  int a, a_start, a_stop;
+
+  SurfaceJobRange(job->n, job->n_task, t, &a_start, &a_stop);
+  for(a = a_start; a < a_stop; a++) {
+    float *v = job->v + 3 * a;
+    int i = *(MapLocusEStart(map, v));
+    if(i && map->EList) {
+      int j = map->EList[i++];
+      while(j >= 0) {
+        if((!job->present) || job->present[j]) {
+          float cutoff = job->atom_info ? job->atom_info[j].vdw + job->cutoff : job->cutoff;
+          if(within3f(job->point + 3 * j, v, cutoff)) {
+            job->flag[a] = true;
+            break;
+          }
         }
+        j = map->EList[i++];
+      }
+    }
+    if(job->G->Interrupt) {
+      job->ok[t] = false;
+      break;
+    }
+  }
+}
 
-        probe_rad_more = probe_radius * (1.0F + solv_tole);
+static int SurfaceFlagPoints(PyMOLGlobals * G, MapType * map, float *point,
+                             SurfaceJobAtomInfo * atom_info, int *present,
+                             float cutoff, float *v, int n, int *flag)
+{
+  int ok = true;
+  int t, n_thread = SurfaceJobGetNThread(G, n);
+  SurfaceFlagJob job;
+
+  job.G = G;
+  job.map = map;
+  job.point = point;
+  job.atom_info = atom_info;
+  job.present = present;
+  job.cutoff = cutoff;
+  job.v = v;
+  job.n = n;
+  job.n_task = SurfaceJobGetNTask(n, n_thread);
+  job.flag = flag;
+  job.ok = Alloc(int, job.n_task);
+  CHECKOK(ok, job.ok);
+  if(ok) {
+    for(t = 0; t < job.n_task; t++)
+      job.ok[t] = true;
+    ThreadPoolRun(G, n_thread, job.n_task, SurfaceFlagTask, &job);
+    for(t = 0; t < job.n_task; t++)
+      ok &= job.ok[t];
+  }
+  FreeP(job.ok);
+  return ok;
+}
 
-        switch (surface_type) {
-        case 0:                /* solid */
-        case 3:
-        case 4:
-        case 5:
-        case 6:
-          probe_rad_less = probe_radius;
-          break;
-        default:
-          probe_rad_less = probe_radius * (1.0F - solv_tole);
-          break;
+/*
+ * Solvent dots are generated atom by atom: first the exposed points of
+ * each atom's solvent sphere, then (optionally) circles scribed around
+ * the intersections of neighboring spheres.
+ */
+typedef struct {
+  PyMOLGlobals *G;
+  float *coord;
+  SurfaceJobAtomInfo *atom_info;
+  int *present;
+  MapType *map;                 /* atoms, for exposure checks */
+  MapType *map2;                /* atoms, for neighbor pairs (scribing) */
+  SphereRec *sp;
+  float radius;                 /* probe (or cavity) radius */
+  int circumscribe;
+  int n_coord, n_task;
+  SurfaceDotChunk *chunk;       /* per task */
+} SolventDotJob;
+
+/* true if atom a duplicates a trailing atom of the same radius */
+static int SolventDotIsSingular(SolventDotJob * job, MapType * map, int a)
+{
+  float *coord = job->coord;
+  SurfaceJobAtomInfo *atom_info = job->atom_info;
+  int *present = job->present;
+  float *v0 = coord + 3 * a;
+  int i = *(MapLocusEStart(map, v0));
+  if(i && map->EList) {
+    int j = map->EList[i++];
+    while(j >= 0) {
+      if(j > a)                 /* only check if this is atom trails */
+        if((!present) || present[j]) {
+          if(atom_info[j].vdw == atom_info[a].vdw) {    /* handle singularities */
+            float *v1 = coord + 3 * j;
+            if((v0[0] == v1[0]) && (v0[1] == v1[1]) && (v0[2] == v1[2]))
+              return true;
+          }
         }
-        probe_rad_less2 = probe_rad_less * probe_rad_less;
+      j = map->EList[i++];
+    }
+  }
+  return false;
+}
 
-        if(surface_type >= 5) { /* effectively double-weights atom points */
-          if(sol_dot->nDot) {
-            int a;
-            float *v0 = sol_dot->dot;
-            float *n0 = sol_dot->dotNormal;
-            for(a = 0; a < sol_dot->nDot; a++) {
-              scale3f(n0, -probe_radius, v);
-              add3f(v0, v, v);
-              copy3f(n0, vn);
-              v += 3;
-              vn += 3;
-              n0 += 3;
-              v0 += 3;
-              I->N++;
+static void SolventDotAtomDots(SolventDotJob * job, int a, SurfaceDotChunk * chunk)
+{
+  float *coord = job->coord;
+  SurfaceJobAtomInfo *atom_info = job->atom_info;
+  SurfaceJobAtomInfo *a_atom_info = atom_info + a;
+  int *present = job->present;
+  MapType *map = job->map;
+  SphereRec *sp = job->sp;
+  float *v0 = coord + 3 * a;
+  float vdw = a_atom_info->vdw + job->radius;
+  int b;
+
+  if(SolventDotIsSingular(job, map, a) || !SurfaceDotChunkCheck(chunk, sp->nDot))
+    return;
+
+  for(b = 0; b < sp->nDot; b++) {
+    float *sp_dot_b = (float *) (sp->dot + b);
+    float *v = chunk->v + 3 * chunk->n;
+    int i;
+    int flag = true;
+    v[0] = v0[0] + vdw * sp_dot_b[0];
+    v[1] = v0[1] + vdw * sp_dot_b[1];
+    v[2] = v0[2] + vdw * sp_dot_b[2];
+    i = *(MapLocusEStart(map, v));
+    if(i) {
+      int j = map->EList[i++];
+      while(j >= 0) {
+        SurfaceJobAtomInfo *j_atom_info = atom_info + j;
+        if((!present) || present[j]) {
+          if(j != a) {
+            int skip_flag = false;
+            if(j_atom_info->vdw == a_atom_info->vdw) {  /* handle singularities */
+              float *v1 = coord + 3 * j;
+              if((v0[0] == v1[0]) && (v0[1] == v1[1]) && (v0[2] == v1[2]))
+                skip_flag = true;
             }
+            if(!skip_flag)
+              if(within3f(coord + 3 * j, v, j_atom_info->vdw + job->radius)) {
+                flag = false;
+                break;
+              }
           }
         }
-	ok &= !G->Interrupt;
-        if(ok) {
-          MapType *map, *solv_map = NULL;
-          map = MapNewFlagged(G, I->maxVdw + probe_rad_more,
-                              I->coord, VLAGetSize(I->coord) / 3, NULL, NULL);
-	  CHECKOK(ok, map);
-	  if (ok)
-	    solv_map = MapNew(G, probe_rad_less, sol_dot->dot, sol_dot->nDot, NULL);
-	  CHECKOK(ok, solv_map);
-          if(ok) {
-            ok &= MapSetupExpress(solv_map);
-	    if (ok)
-	      ok &= MapSetupExpress(map);
-	    ok &= !G->Interrupt;
-	    ok &= map->EList && solv_map->EList;
-            if(sol_dot->nDot && ok) {
-              int *dc = sol_dot->dotCode;
-              Vector3f *dot = Alloc(Vector3f, sp->nDot);
-              float *v0, *n0;
-	      CHECKOK(ok, dot);
-              if (ok){
-                int b;
-                for(b = 0; b < sp->nDot; b++) {
-                  scale3f(sp->dot[b], probe_radius, dot[b]);
-                }
-              }
-              v0 = sol_dot->dot;
-              n0 = sol_dot->dotNormal;
-              if (ok) {
-                int a, b;
-                float dist2 = probe_rad_less2;
-                int sp_nDot = sp->nDot;
-                for(a = 0; ok && a < sol_dot->nDot; a++) {
-                  if(dc[a] || (surface_type < 6)) {     /* surface type 6 is completely scribed */
-                    OrthoBusyFast(G, a + sol_dot->nDot * 2, sol_dot->nDot * 5); /* 2/5 to 3/5 */
-                    for(b = 0; ok && b < sp_nDot; b++) {
-                      float *dot_b = dot[b];
-                      v[0] = v0[0] + dot_b[0];
-                      v[1] = v0[1] + dot_b[1];
-                      v[2] = v0[2] + dot_b[2];
-                      {
-                        int flag = true;
-                        int ii;
-			ii = *(MapLocusEStart(solv_map, v));
-                        if(ii && solv_map->EList) {
-                          float *i_dot = sol_dot->dot;
-                          float dist = probe_rad_less;
-                          int *elist_ii = solv_map->EList + ii;
-                          float v_0 = v[0];
-                          int jj_next, jj = *(elist_ii++);
-                          float v_1 = v[1];
-                          float *v1 = i_dot + 3 * jj;
-                          float v_2 = v[2];
-                          while(jj >= 0) {
-                            /* huge bottleneck -- optimized for superscaler processors */
-                            float dx = v1[0], dy, dz;
-                            jj_next = *(elist_ii++);
-                            dx -= v_0;
-                            if(jj != a) {
-                              dx = (dx < 0.0F) ? -dx : dx;
-                              dy = v1[1] - v_1;
-                              if(!(dx > dist)) {
-                                dy = (dy < 0.0F) ? -dy : dy;
-                                dz = v1[2] - v_2;
-                                if(!(dy > dist)) {
-                                  dx = dx * dx;
-                                  dz = (dz < 0.0F) ? -dz : dz;
-                                  dy = dy * dy;
-                                  if(!(dz > dist)) {
-                                    dx = dx + dy;
-                                    dz = dz * dz;
-                                    if(!(dx > dist2))
-                                      if((dx + dz) <= dist2) {
-                                        flag = false;
-                                        break;
-                                      }
-                                  }
-                                }
-                              }
-                            }
-                            v1 = i_dot + 3 * jj_next;
-                            jj = jj_next;
-                          }
-                        }
+        j = map->EList[i++];
+      }
+    }
+    if(flag) {
+      if(chunk->vn)
+        copy3f(sp_dot_b, chunk->vn + 3 * chunk->n);
+      chunk->n++;
+    }
+  }
+}
 
-                        /* at this point, we have points on the interior of the solvent surface,
-                           so now we need to further trim that surface to cover atoms that are present */
-
-                        if(flag) {
-                          int i = *(MapLocusEStart(map, v));
-                          if(i && map->EList) {
-                            int j = map->EList[i++];
-                            while(j >= 0) {
-                              SurfaceJobAtomInfo *atom_info = I_atom_info + j;
-                              if((!present_vla) || present_vla[j]) {
-                                if(within3f
-                                   (I_coord + 3 * j, v,
-                                    atom_info->vdw + probe_rad_more)) {
-                                  flag = false;
-                                  break;
-                                }
-                              }
-                              j = map->EList[i++];
-                            }
-                          }
-                          if(!flag) {   /* compute the normals */
-                            vn[0] = -sp->dot[b][0];
-                            vn[1] = -sp->dot[b][1];
-                            vn[2] = -sp->dot[b][2];
-                            if(I->N < MaxN) {
-                              I->N++;
-                              v += 3;
-                              vn += 3;
-                            } else {
-                              int v_offset = v - I->V;
-                              int vn_offset = vn - I->VN;
-                              MaxN = MaxN * 2;
-                              VLASize(I->V, float, (MaxN + 1) * 3);
-			      CHECKOK(ok, I->V);
-			      if (ok)
-				VLASize(I->VN, float, (MaxN + 1) * 3);
-			      CHECKOK(ok, I->VN);
-			      if (ok){
-				v = I->V + v_offset;
-				vn = I->VN + vn_offset;
-			      }
-                            }
-                          }
-                        }
+static void SolventDotAtomScribe(SolventDotJob * job, int a, SurfaceDotChunk * chunk)
+{
+  float *coord = job->coord;
+  SurfaceJobAtomInfo *atom_info = job->atom_info;
+  SurfaceJobAtomInfo *a_atom_info = atom_info + a;
+  int *present = job->present;
+  MapType *map = job->map, *map2 = job->map2;
+  int circumscribe = job->circumscribe;
+  float probe_radius = job->radius;
+  float *v0 = coord + 3 * a;
+  float vdw = a_atom_info->vdw + probe_radius;
+  float vdw2 = vdw * vdw;
+  int b, ii;
+
+  if(SolventDotIsSingular(job, map2, a))
+    return;
+
+  ii = *(MapLocusEStart(map2, v0));
+  if(ii) {
+    int jj = map2->EList[ii++];
+    while(jj >= 0) {
+      SurfaceJobAtomInfo *jj_atom_info = atom_info + jj;
+      float dist;
+      if(jj > a)                /* only check if this is atom trails */
+        if((!present) || present[jj]) {
+          float vdw3 = jj_atom_info->vdw + probe_radius;
+
+          float *v2 = coord + 3 * jj;
+          dist = (float) diff3f(v0, v2);
+          if((dist > R_SMALL4) && (dist < (vdw + vdw3))) {
+            float vz[3], vx[3], vy[3], vp[3];
+            float tri_a = vdw, tri_b = vdw3, tri_c = dist;
+            float tri_s = (tri_a + tri_b + tri_c) * 0.5F;
+            float area = (float) sqrt1f(tri_s * (tri_s - tri_a) *
+                                        (tri_s - tri_b) * (tri_s - tri_c));
+            float radius = (2 * area) / dist;
+            float adj = (float) sqrt1f(vdw2 - radius * radius);
+
+            subtract3f(v2, v0, vz);
+            get_system1f3f(vz, vx, vy);
+
+            copy3f(vz, vp);
+            scale3f(vp, adj, vp);
+            add3f(v0, vp, vp);
+
+            if(!SurfaceDotChunkCheck(chunk, circumscribe + 1))
+              return;
+
+            for(b = 0; b <= circumscribe; b++) {
+              float xcos = (float) cos((b * 2 * cPI) / circumscribe);
+              float ysin = (float) sin((b * 2 * cPI) / circumscribe);
+              float xcosr = xcos * radius;
+              float ysinr = ysin * radius;
+              float *v = chunk->v + 3 * chunk->n;
+              int i;
+              int flag = true;
+              v[0] = vp[0] + vx[0] * xcosr + vy[0] * ysinr;
+              v[1] = vp[1] + vx[1] * xcosr + vy[1] * ysinr;
+              v[2] = vp[2] + vx[2] * xcosr + vy[2] * ysinr;
+
+              i = *(MapLocusEStart(map, v));
+              if(i && map->EList) {
+                int j = map->EList[i++];
+                while(j >= 0) {
+                  SurfaceJobAtomInfo *j_atom_info = atom_info + j;
+                  if((!present) || present[j])
+                    if((j != a) && (j != jj)) {
+                      int skip_flag = false;
+                      if(a_atom_info->vdw == j_atom_info->vdw) {        /* handle singularities */
+                        float *v1 = coord + 3 * j;
+                        if((v0[0] == v1[0]) && (v0[1] == v1[1]) && (v0[2] == v1[2]))
+                          skip_flag = true;
                       }
-		      ok &= !G->Interrupt;
+                      if(jj_atom_info->vdw == j_atom_info->vdw) {       /* handle singularities */
+                        float *v1 = coord + 3 * j;
+                        if((v2[0] == v1[0]) && (v2[1] == v1[1]) && (v2[2] == v1[2]))
+                          skip_flag = true;
+                      }
+                      if(!skip_flag)
+                        if(within3f(coord + 3 * j, v, j_atom_info->vdw + probe_radius)) {
+                          flag = false;
+                          break;
+                        }
                     }
-                  }
-                  v0 += 3;
-                  n0 += 3;
-		  ok &= !G->Interrupt;
+                  j = map->EList[i++];
                 }
               }
-              FreeP(dot);
+              if(flag) {
+                float vt0[3], vt2[3];
+                float *n = chunk->vn + 3 * chunk->n;
+                subtract3f(v0, v, vt0);
+                subtract3f(v2, v, vt2);
+                normalize3f(vt0);
+                normalize3f(vt2);
+                add3f(vt0, vt2, n);
+                invert3f(n);
+                normalize3f(n);
+                chunk->n++;
+              }
             }
           }
-          MapFree(solv_map);
-          MapFree(map);
-        }
-      } else {
-        float *v0 = sol_dot->dot;
-        float *n0 = sol_dot->dotNormal;
-        int a;
-        circumscribe = 0;
-        if(sol_dot->nDot) {
-          for(a = 0; a < sol_dot->nDot; a++) {
-            *(v++) = *(v0++);
-            *(vn++) = *(n0++);
-            *(v++) = *(v0++);
-            *(vn++) = *(n0++);
-            *(v++) = *(v0++);
-            *(vn++) = *(n0++);
-            I->N++;
-          }
         }
-      }
+      jj = map2->EList[ii++];
     }
-    SolventDotFree(sol_dot);
-    sol_dot = NULL;
-    ok &= !G->Interrupt;
-    if(ok) {
-      int refine, ref_count = 1;
-
-      if((surface_type == 0) && (circumscribe)) {
-        ref_count = 2;          /* these constants need more tuning... */
-      }
+  }
+}
 
-      for(refine = 0; ok && refine < ref_count; refine++) {
+static void SolventDotTask(void *data, int t)
+{
+  SolventDotJob *job = (SolventDotJob *) data;
+  SurfaceDotChunk *chunk = job->chunk + t;
+  int a, a_start, a_stop;
+
+  SurfaceJobRange(job->n_coord, job->n_task, t, &a_start, &a_stop);
+  for(a = a_start; chunk->ok && a < a_stop; a++) {
+    if(!t)                      /* main thread */
+      OrthoBusyFast(job->G, (a - a_start) * job->n_task, job->n_coord * 5);
+    if((!job->present) || job->present[a]) {
+      if(job->map2)
+        SolventDotAtomScribe(job, a, chunk);
+      else
+        SolventDotAtomDots(job, a, chunk);
+    }
+    if(job->G->Interrupt)
+      chunk->ok = false;
+  }
+}
+
+/*
+ * Runs one pass of solvent dot generation over all atoms and appends the
+ * dots to the VLAs *v (and *vn, if given) holding *n dots
+ */
+static int SolventDotRun(SolventDotJob * job, float **v, float **vn, int *n, int n_max)
+{
+  PyMOLGlobals *G = job->G;
+  int ok = true;
+  int n_thread = SurfaceJobGetNThread(G, job->n_coord);
+
+  job->n_task = SurfaceJobGetNTask(job->n_coord, n_thread);
+  job->chunk = SurfaceDotChunkNew(job->n_task, vn != NULL);
+  CHECKOK(ok, job->chunk);
+  if(ok) {
+    ThreadPoolRun(G, n_thread, job->n_task, SolventDotTask, job);
+    ok = SurfaceDotChunkMerge(job->chunk, job->n_task, v, vn, n, n_max);
+  }
+  SurfaceDotChunkFree(job->chunk, job->n_task);
+  job->chunk = NULL;
+  return ok;
+}
+
+/*
+ * Trims the probe spheres placed on the solvent dots down to the points
+ * which lie on the interior of the solvent surface and cover present
+ * atoms
+ */
+typedef struct {
+  PyMOLGlobals *G;
+  SolventDot *sol_dot;
+  MapType *map, *solv_map;
+  SphereRec *sp;
+  Vector3f *dot;                /* sphere dots scaled by the probe radius */
+  float *coord;
+  SurfaceJobAtomInfo *atom_info;
+  int *present;
+  float probe_rad_less, probe_rad_more;
+  int surface_type;
+  int n_task;
+  SurfaceDotChunk *chunk;       /* per task */
+} SurfaceTrimJob;
+
+static void SurfaceTrimDot(SurfaceTrimJob * job, int a, SurfaceDotChunk * chunk)
+{
+  SolventDot *sol_dot = job->sol_dot;
+  MapType *map = job->map, *solv_map = job->solv_map;
+  SphereRec *sp = job->sp;
+  float *v0 = sol_dot->dot + 3 * a;
+  float dist2 = job->probe_rad_less * job->probe_rad_less;
+  int b;
+
+  if(!SurfaceDotChunkCheck(chunk, sp->nDot))
+    return;
+
+  for(b = 0; b < sp->nDot; b++) {
+    float *dot_b = job->dot[b];
+    float *v = chunk->v + 3 * chunk->n;
+    int flag = true;
+    int ii;
+    v[0] = v0[0] + dot_b[0];
+    v[1] = v0[1] + dot_b[1];
+    v[2] = v0[2] + dot_b[2];
+    ii = *(MapLocusEStart(solv_map, v));
+    if(ii && solv_map->EList) {
+      float *i_dot = sol_dot->dot;
+      float dist = job->probe_rad_less;
+      int *elist_ii = solv_map->EList + ii;
+      float v_0 = v[0];
+      int jj_next, jj = *(elist_ii++);
+      float v_1 = v[1];
+      float *v1 = i_dot + 3 * jj;
+      float v_2 = v[2];
+      while(jj >= 0) {
+        /* huge bottleneck -- optimized for superscaler processors */
+        float dx = v1[0], dy, dz;
+        jj_next = *(elist_ii++);
+        dx -= v_0;
+        if(jj != a) {
+          dx = (dx < 0.0F) ? -dx : dx;
+          dy = v1[1] - v_1;
+          if(!(dx > dist)) {
+            dy = (dy < 0.0F) ? -dy : dy;
+            dz = v1[2] - v_2;
+            if(!(dy > dist)) {
+              dx = dx * dx;
+              dz = (dz < 0.0F) ? -dz : dz;
+              dy = dy * dy;
+              if(!(dz > dist)) {
+                dx = dx + dy;
+                dz = dz * dz;
+                if(!(dx > dist2))
+                  if((dx + dz) <= dist2) {
+                    flag = false;
+                    break;
+                  }
+              }
+            }
+          }
+        }
+        v1 = i_dot + 3 * jj_next;
+        jj = jj_next;
+      }
+    }
+
+    /* at this point, we have points on the interior of the solvent surface,
+       so now we need to further trim that surface to cover atoms that are present */
+
+    if(flag) {
+      int i = *(MapLocusEStart(map, v));
+      if(i && map->EList) {
+        int j = map->EList[i++];
+        while(j >= 0) {
+          SurfaceJobAtomInfo *atom_info = job->atom_info + j;
+          if((!job->present) || job->present[j]) {
+            if(within3f(job->coord + 3 * j, v, atom_info->vdw + job->probe_rad_more)) {
+              flag = false;
+              break;
+            }
+          }
+          j = map->EList[i++];
+        }
+      }
+      if(!flag) {               /* compute the normals */
+        float *vn = chunk->vn + 3 * chunk->n;
+        vn[0] = -sp->dot[b][0];
+        vn[1] = -sp->dot[b][1];
+        vn[2] = -sp->dot[b][2];
+        chunk->n++;
+      }
+    }
+  }
+}
+
+static void SurfaceTrimTask(void *data, int t)
+{
+  SurfaceTrimJob *job = (SurfaceTrimJob *) data;
+  SurfaceDotChunk *chunk = job->chunk + t;
+  int n_dot = job->sol_dot->nDot;
+  int a, a_start, a_stop;
+
+  SurfaceJobRange(n_dot, job->n_task, t, &a_start, &a_stop);
+  for(a = a_start; chunk->ok && a < a_stop; a++) {
+    if(job->sol_dot->dotCode[a] || (job->surface_type < 6)) {   /* surface type 6 is completely scribed */
+      if(!t)                    /* main thread */
+        OrthoBusyFast(job->G, (a - a_start) * job->n_task + n_dot * 2, n_dot * 5);     /* 2/5 to 3/5 */
+      SurfaceTrimDot(job, a, chunk);
+    }
+    if(job->G->Interrupt)
+      chunk->ok = false;
+  }
+}
+
+/*
+ * Inserts new vertices where neighboring points diverge strongly or are
+ * too far apart
+ */
+typedef struct {
+  PyMOLGlobals *G;
+  MapType *map;
+  float *V, *VN;
+  int N;
+  float map_cutoff, neighborhood, dot_cutoff, insert_cutoff;
+  int n_task;
+  SurfaceDotChunk *chunk;       /* per task */
+} SurfaceRefineJob;
+
+static void SurfaceRefineTask(void *data, int t)
+{
+  SurfaceRefineJob *job = (SurfaceRefineJob *) data;
+  SurfaceDotChunk *chunk = job->chunk + t;
+  MapType *map = job->map;
+  int a, a_start, a_stop;
+
+  SurfaceJobRange(job->N, job->n_task, t, &a_start, &a_stop);
+  for(a = a_start; chunk->ok && a < a_stop; a++) {
+    float *v = job->V + 3 * a;
+    float *vn = job->VN + 3 * a;
+    int i = *(MapLocusEStart(map, v));
+    if(i && map->EList) {
+      int j = map->EList[i++];
+      while(j >= 0) {
+        if(j > a) {
+          float *v0 = job->V + 3 * j;
+          if(within3f(v0, v, job->map_cutoff)) {
+            int add_new = false;
+            float *n0 = job->VN + 3 * j;
+            float *v1, *n1;
+            if(!SurfaceDotChunkCheck(chunk, 1))
+              break;
+            v1 = chunk->v + 3 * chunk->n;
+            n1 = chunk->vn + 3 * chunk->n;
+            average3f(v, v0, v1);
+            if((dot_product3f(n0, vn) < job->dot_cutoff)
+               && (within3f(v0, v, job->neighborhood)))
+              add_new = true;
+            else {
+              /* if points are too far apart, insert a new one */
+              int ii = *(MapLocusEStart(map, v1));
+              if(ii) {
+                int found = false;
+                int jj = map->EList[ii++];
+                while(jj >= 0) {
+                  if(jj != j) {
+                    float *vv0 = job->V + 3 * jj;
+                    if(within3f(vv0, v1, job->insert_cutoff)) {
+                      found = true;
+                      break;
+                    }
+                  }
+                  jj = map->EList[ii++];
+                }
+                if(!found)
+                  add_new = true;
+              }
+            }
+            if(add_new) {
+              /* highly divergent */
+              average3f(vn, n0, n1);
+              normalize3f(n1);
+              chunk->n++;
+            }
+          }
+        }
+        j = map->EList[i++];
+      }
+    }
+    if(job->G->Interrupt)
+      chunk->ok = false;
+  }
+}
+
+/*
+ * surface_type 7: distance field surface
+ *
+ * Rather than placing and triangulating dots, the atoms are rasterized
+ * into a grid of signed distances g(x) = min(|x - c| - vdw) which is then
+ * contoured with Tetsurf.  Every grid point y with g(y) >= probe is the
+ * center of an empty ball of radius g(y), and the union of these balls is
+ * the region swept by the probe, so the solvent excluded surface is the
+ * zero level of
+ *
+ *   D(x) = min over y of (|x - y|^2 - g(y)^2)
+ *
+ * which is computed with the separable lower envelope transform of
+ * Felzenszwalb & Huttenlocher, one pass per grid axis.  Solvent accessible
+ * surfaces simply contour probe - g.  Both fields are positive inside, so
+ * the Tetsurf triangles (level 0) face outward.
+ *
+ * The grid is anchored at the origin and cut into patches of
+ * cSurfacePatchSize cells.  g is capped slightly above the probe radius, so
+ * a ball never reaches further than the cap, and each patch computes its
+ * field with a halo of that many points.  D is clamped to the smallest
+ * value a ball from beyond the halo could contribute, which makes every
+ * patch agree on the points it shares with its neighbors.
+ *
+ * Patches are contoured and welded one at a time and kept with the rep
+ * (CSurfacePatches).  When the surface is rebuilt after a few atoms have
+ * moved, only the patches within reach of their old and new positions are
+ * recomputed, the others are reused as they are, and all of them are
+ * stitched together along the patch faces.
+ */
+
+#define cSurfaceFieldFar 1.0e30F
+#define cSurfacePatchSize 48    /* cells per patch edge (one Tetsurf block) */
+
+/* welded mesh of one patch */
+typedef struct {
+  int N, NS;
+  float *V, *VN;
+  int *S;                       /* strips over V, as in RepSurface */
+} SurfacePatch;
+
+struct _CSurfacePatches {
+  /* what the patches were computed from */
+  int n_coord;
+  float *coord;
+  float *vdw;                   /* negative for atoms which are not present */
+  int solvent;
+  float probe, spacing;
+  /* patch lattice, x varies slowest */
+  int lo[3], dim[3];
+  SurfacePatch *patch;
+};
+
+static void SurfacePatchesFree(CSurfacePatches * I)
+{
+  if(I) {
+    if(I->patch) {
+      int a, n = I->dim[0] * I->dim[1] * I->dim[2];
+      for(a = 0; a < n; a++) {
+        VLAFreeP(I->patch[a].V);
+        VLAFreeP(I->patch[a].VN);
+        VLAFreeP(I->patch[a].S);
+      }
+      FreeP(I->patch);
+    }
+    FreeP(I->coord);
+    FreeP(I->vdw);
+    FreeP(I);
+  }
+}
+
+/* a / b rounded down (b > 0) */
+static int SurfaceFloorDiv(int a, int b)
+{
+  return (a >= 0) ? (a / b) : -((b - 1 - a) / b);
+}
+
+/*
+ * Patches (unclipped lattice coordinates) whose fields an atom at v0
+ * contributes to
+ */
+static void SurfacePatchReach(const float *v0, float vdw, float cap, float h, int halo,
+                              int *lo, int *hi)
+{
+  float reach = vdw + cap + h;
+  int c;
+  for(c = 0; c < 3; c++) {
+    int i0 = (int) ceil((v0[c] - reach) / h);
+    int i1 = (int) floor((v0[c] + reach) / h);
+    lo[c] = -SurfaceFloorDiv(cSurfacePatchSize + halo - i0, cSurfacePatchSize);
+    hi[c] = SurfaceFloorDiv(i1 + halo, cSurfacePatchSize);
+  }
+}
+
+/* field of one patch, halo included */
+typedef struct {
+  int off[3];                   /* grid index of the first point */
+  int dim;                      /* points per edge */
+  float spacing;
+  float *data;                  /* last index varies fastest */
+} SurfaceFieldGrid;
+
+typedef struct {
+  PyMOLGlobals *G;
+  float *coord;
+  float *vdw;
+  int solvent;                  /* contour probe - g instead of D */
+  float probe;
+  float cap;                    /* g is only needed up to this value */
+  float spacing;
+  int halo;
+  CSurfacePatches *patches;
+  int *start, *atom;            /* atoms reaching each patch */
+  int *todo;                    /* patches of the current batch */
+  SurfaceFieldGrid *grid;       /* one per batch entry */
+  float *line, *z;              /* envelope scratch, per batch entry */
+  int *v;
+} SurfacePatchJob;
+
+/*
+ * Lower envelope of the parabolas (q - y)^2 + f(y) along one grid line;
+ * samples at cSurfaceFieldFar are absent
+ */
+static void SurfaceFieldEnvelope(float *f, int n, int stride, float *line, int *v, float *z)
+{
+  int q, j, k = -1;
+  float s = 0.0F;
+  for(q = 0; q < n; q++)
+    line[q] = f[(size_t) q * stride];
+  for(q = 0; q < n; q++) {
+    if(line[q] >= cSurfaceFieldFar)
+      continue;
+    while(k >= 0) {
+      int p = v[k];
+      s = (float) (((line[q] + (double) q * q) - (line[p] + (double) p * p))
+                   / (2.0 * (q - p)));
+      if(s > z[k])
+        break;
+      k--;
+    }
+    k++;
+    v[k] = q;
+    z[k] = k ? s : -cSurfaceFieldFar;
+  }
+  if(k < 0)                     /* nothing on this line */
+    return;
+  z[k + 1] = cSurfaceFieldFar;
+  j = 0;
+  for(q = 0; q < n; q++) {
+    float d;
+    while(z[j + 1] < q)
+      j++;
+    d = (float) (q - v[j]);
+    f[(size_t) q * stride] = d * d + line[v[j]];
+  }
+}
+
+/* computes the field of batch entry t */
+static void SurfacePatchFieldTask(void *data, int t)
+{
+  SurfacePatchJob *job = (SurfacePatchJob *) data;
+  CSurfacePatches *patches = job->patches;
+  SurfaceFieldGrid *grid = job->grid + t;
+  int p = job->todo[t];
+  int n = grid->dim;
+  size_t plane = (size_t) n * n;
+  float h = job->spacing;
+  float probe = job->probe;
+  float *f = grid->data;
+  float *f_stop = f + plane * n;
+  int a, i, j, k, c;
+
+  grid->off[0] = patches->lo[0] + p / (patches->dim[1] * patches->dim[2]);
+  grid->off[1] = patches->lo[1] + (p / patches->dim[2]) % patches->dim[1];
+  grid->off[2] = patches->lo[2] + p % patches->dim[2];
+  for(c = 0; c < 3; c++)
+    grid->off[c] = grid->off[c] * cSurfacePatchSize - job->halo;
+
+  while(f < f_stop)
+    *(f++) = job->cap;
+  for(a = job->start[p]; a < job->start[p + 1]; a++) {
+    float *v0 = job->coord + 3 * job->atom[a];
+    float vdw = job->vdw[job->atom[a]];
+    float reach = vdw + job->cap + h;
+    int lo[3], hi[3];
+    /* same bounds as SurfacePatchReach */
+    for(c = 0; c < 3; c++) {
+      lo[c] = (int) ceil((v0[c] - reach) / h) - grid->off[c];
+      hi[c] = (int) floor((v0[c] + reach) / h) - grid->off[c];
+      if(lo[c] < 0)
+        lo[c] = 0;
+      if(hi[c] > n - 1)
+        hi[c] = n - 1;
+    }
+    for(i = lo[0]; i <= hi[0]; i++) {
+      float dx = (float) (grid->off[0] + i) * h - v0[0];
+      for(j = lo[1]; j <= hi[1]; j++) {
+        float dy = (float) (grid->off[1] + j) * h - v0[1];
+        float dxy2 = dx * dx + dy * dy;
+        f = grid->data + i * plane + (size_t) j * n;
+        for(k = lo[2]; k <= hi[2]; k++) {
+          float dz = (float) (grid->off[2] + k) * h - v0[2];
+          float lim = f[k] + vdw;
+          float dist2 = dxy2 + dz * dz;
+          if((lim > 0.0F) && (dist2 < lim * lim))
+            f[k] = (float) sqrt1f(dist2) - vdw;
+        }
+      }
+    }
+  }
+
+  f = grid->data;
+  if(job->solvent) {
+    while(f < f_stop) {
+      *f = probe - *f;
+      f++;
+    }
+  } else {
+    float *line = job->line + (size_t) t *(n + 1);
+    float *z = job->z + (size_t) t *(n + 1);
+    int *v = job->v + (size_t) t *(n + 1);
+    float d = (float) (job->halo + 1);
+    float clamp = d * d - (job->cap / h) * (job->cap / h);
+    int l;
+
+    /* empty ball radii (in grid units) become the envelope samples */
+    while(f < f_stop) {
+      if(*f >= probe) {
+        float r = *f / h;
+        *f = -r * r;
+      } else {
+        *f = cSurfaceFieldFar;
+      }
+      f++;
+    }
+    for(l = 0; l < (int) plane; l++)
+      SurfaceFieldEnvelope(grid->data + l, n, (int) plane, line, v, z);
+    for(l = 0; l < (int) plane; l++)
+      SurfaceFieldEnvelope(grid->data + (l / n) * plane + (l % n), n, n, line, v, z);
+    for(l = 0; l < (int) plane; l++)
+      SurfaceFieldEnvelope(grid->data + (size_t) l * n, n, 1, line, v, z);
+    /* whatever lies beyond the halo differs between patches */
+    for(f = grid->data; f < f_stop; f++)
+      if(*f > clamp)
+        *f = clamp;
+  }
+}
+
+/* trilinear interpolation of the field at v */
+static float SurfaceFieldSample(SurfaceFieldGrid * grid, const float *v)
+{
+  int n = grid->dim;
+  int c, idx[3];
+  float fr[3], f00, f01, f10, f11;
+  const float *p;
+  size_t plane = (size_t) n * n;
+  for(c = 0; c < 3; c++) {
+    float u = v[c] / grid->spacing - grid->off[c];
+    idx[c] = (int) floor(u);
+    if(idx[c] < 0)
+      idx[c] = 0;
+    else if(idx[c] > n - 2)
+      idx[c] = n - 2;
+    fr[c] = u - idx[c];
+  }
+  p = grid->data + idx[0] * plane + (size_t) idx[1] * n + idx[2];
+  f00 = p[0] + fr[2] * (p[1] - p[0]);
+  f01 = p[n] + fr[2] * (p[n + 1] - p[n]);
+  f10 = p[plane] + fr[2] * (p[plane + 1] - p[plane]);
+  f11 = p[plane + n] + fr[2] * (p[plane + n + 1] - p[plane + n]);
+  f00 += fr[1] * (f01 - f00);
+  f10 += fr[1] * (f11 - f10);
+  return f00 + fr[0] * (f10 - f00);
+}
+
+/* outward normal from the field gradient (the field grows inward) */
+static void SurfaceFieldNormal(SurfaceFieldGrid * grid, const float *v, float *vn)
+{
+  float delta = grid->spacing * 0.5F;
+  float p[3];
+  int c;
+  for(c = 0; c < 3; c++) {
+    float f0, f1;
+    copy3f(v, p);
+    p[c] = v[c] + delta;
+    f0 = SurfaceFieldSample(grid, p);
+    p[c] = v[c] - delta;
+    f1 = SurfaceFieldSample(grid, p);
+    vn[c] = f1 - f0;
+  }
+  normalize3f(vn);
+}
+
+/* orders points (stride floats apart) by position, then by index */
+struct SurfaceFieldPointLess {
+  const float *vert;
+  int stride;
+  bool operator() (int a, int b) const {
+    const float *p = vert + stride * a;
+    const float *q = vert + stride * b;
+    if(p[0] != q[0])
+      return p[0] < q[0];
+    if(p[1] != q[1])
+      return p[1] < q[1];
+    if(p[2] != q[2])
+      return p[2] < q[2];
+    return a < b;
+  }
+};
+
+/*
+ * Welds the Tetsurf strips of a patch (which repeat the points shared
+ * between strips) into indexed vertices and strips
+ */
+static int SurfacePatchWeld(PyMOLGlobals * G, SurfacePatch * patch, int *num, float *vert)
+{
+  int ok = true;
+  int n_pt = 0;
+  int a, b, c, n, n_strip;
+  int *order = NULL, *vid = NULL;
+  SurfaceFieldPointLess less;
+
+  for(n_strip = 0; num[n_strip]; n_strip++)
+    n_pt += num[n_strip] / 2;
+  if(!n_pt)
+    return ok;
+
+  order = Alloc(int, n_pt);
+  CHECKOK(ok, order);
+  if(ok)
+    vid = Alloc(int, n_pt);
+  CHECKOK(ok, vid);
+  if(ok) {
+    less.vert = vert + 3;
+    less.stride = 6;
+    for(a = 0; a < n_pt; a++)
+      order[a] = a;
+    std::sort(order, order + n_pt, less);
+    /* every point refers to the first occurrence of its position */
+    for(a = 0; a < n_pt; a = b) {
+      float *p = vert + 6 * order[a] + 3;
+      for(b = a; b < n_pt; b++) {
+        float *q = vert + 6 * order[b] + 3;
+        if((p[0] != q[0]) || (p[1] != q[1]) || (p[2] != q[2]))
+          break;
+        vid[order[b]] = order[a];
+      }
+    }
+    /* then number the distinct points in strip order */
+    n = 0;
+    for(a = 0; a < n_pt; a++) {
+      if(vid[a] == a)
+        vid[a] = n++;
+      else
+        vid[a] = vid[vid[a]];
+    }
+    patch->N = n;
+    patch->V = VLAlloc(float, 3 * n);
+    CHECKOK(ok, patch->V);
+    if(ok)
+      patch->VN = VLACalloc(float, 3 * n);
+    CHECKOK(ok, patch->VN);
+    if(ok)
+      patch->S = VLAlloc(int, n_pt + n_strip + 1);
+    CHECKOK(ok, patch->S);
+  }
+  if(ok) {
+    int *s = vid;
+    for(a = 0; a < n_pt; a++) {
+      float *vn = patch->VN + 3 * vid[a];
+      copy3f(vert + 6 * a + 3, patch->V + 3 * vid[a]);
+      add3f(vert + 6 * a, vn, vn);
+    }
+    for(a = 0; a < patch->N; a++)
+      normalize3f(patch->VN + 3 * a);
+    for(c = 0; num[c]; c++) {
+      n = num[c] / 2;
+      if(n >= 3) {
+        patch->S[patch->NS++] = n - 2;
+        for(a = 0; a < n; a++)
+          patch->S[patch->NS++] = s[a];
+      }
+      s += n;
+    }
+    patch->S[patch->NS] = 0;
+    VLASize(patch->S, int, patch->NS + 1);
+  }
+  FreeP(order);
+  FreeP(vid);
+  return ok;
+}
+
+/*
+ * Contours the interior of batch entry t (normals taken from the field)
+ * into its patch
+ */
+static int SurfacePatchContour(SurfacePatchJob * job, int t, SurfacePatch * patch)
+{
+  PyMOLGlobals *G = job->G;
+  SurfaceFieldGrid *grid = job->grid + t;
+  int ok = true;
+  int dims[3];
+  Isofield *field;
+  int *s_num = NULL;
+  float *s_vert = NULL;
+
+  dims[0] = dims[1] = dims[2] = cSurfacePatchSize + 1;
+  field = IsosurfFieldAlloc(G, dims);
+  CHECKOK(ok, field);
+  if(ok)
+    s_num = VLAlloc(int, 1000);
+  CHECKOK(ok, s_num);
+  if(ok)
+    s_vert = VLAlloc(float, 6000);
+  CHECKOK(ok, s_vert);
+  if(ok) {
+    int n = grid->dim;
+    int halo = job->halo;
+    float h = job->spacing;
+    int i, j, k, c, n_pt = 0;
+
+    for(i = 0; i < dims[0]; i++) {
+      for(j = 0; j < dims[1]; j++) {
+        float *d = grid->data + ((size_t) (i + halo) * n + j + halo) * n + halo;
+        for(k = 0; k < dims[2]; k++) {
+          float *pt = F4Ptr(field->points, i, j, k, 0);
+          /* same expression for points shared by two patches */
+          pt[0] = (float) (grid->off[0] + halo + i) * h;
+          pt[1] = (float) (grid->off[1] + halo + j) * h;
+          pt[2] = (float) (grid->off[2] + halo + k) * h;
+          F3(field->data, i, j, k) = *(d++);
+        }
+      }
+    }
+    TetsurfVolume(G, field, 0.0F, &s_num, &s_vert, NULL, 2, NULL, NULL, 0.0F, 1, NULL);
+
+    for(c = 0; s_num[c]; c++)
+      n_pt += s_num[c];
+    for(c = 0; c < n_pt; c += 2)
+      SurfaceFieldNormal(grid, s_vert + 3 * c + 3, s_vert + 3 * c);
+    ok = SurfacePatchWeld(G, patch, s_num, s_vert);
+  }
+  VLAFreeP(s_num);
+  VLAFreeP(s_vert);
+  if(field)
+    IsosurfFieldFree(G, field);
+  return ok;
+}
+
+/* true if v lies on a face of the patch lattice */
+static int SurfacePatchOnFace(const float *v, float h)
+{
+  int c;
+  for(c = 0; c < 3; c++) {
+    int k = (int) floor(v[c] / (h * cSurfacePatchSize) + 0.5F);
+    if(v[c] == (float) (k * cSurfacePatchSize) * h)
+      return true;
+  }
+  return false;
+}
+
+/*
+ * Stitches the patch meshes into the vertices, triangles and strips of the
+ * surface; only the points on patch faces can be shared between patches
+ */
+static int SurfacePatchesMesh(PyMOLGlobals * G, SurfaceJob * I, CSurfacePatches * patches)
+{
+  int ok = true;
+  int n_patch = patches->dim[0] * patches->dim[1] * patches->dim[2];
+  int n_vert = 0, n_s = 0, n_face = 0;
+  int a, b, p, n;
+  int *vid = NULL, *face = NULL;
+  SurfaceFieldPointLess less;
+
+  for(p = 0; p < n_patch; p++) {
+    n_vert += patches->patch[p].N;
+    n_s += patches->patch[p].NS;
+  }
+  if(!n_vert)
+    return ok;
+
+  I->V = VLAlloc(float, 3 * n_vert);
+  CHECKOK(ok, I->V);
+  if(ok)
+    I->VN = VLAlloc(float, 3 * n_vert);
+  CHECKOK(ok, I->VN);
+  if(ok)
+    vid = Alloc(int, n_vert);
+  CHECKOK(ok, vid);
+  if(ok)
+    face = Alloc(int, n_vert);
+  CHECKOK(ok, face);
+  if(ok) {
+    float *v = I->V, *vn = I->VN;
+    for(p = 0; p < n_patch; p++) {
+      SurfacePatch *patch = patches->patch + p;
+      if(patch->N) {
+        memcpy(v, patch->V, sizeof(float) * 3 * patch->N);
+        memcpy(vn, patch->VN, sizeof(float) * 3 * patch->N);
+        v += 3 * patch->N;
+        vn += 3 * patch->N;
+      }
+    }
+    for(a = 0; a < n_vert; a++) {
+      vid[a] = a;
+      if(SurfacePatchOnFace(I->V + 3 * a, patches->spacing))
+        face[n_face++] = a;
+    }
+    /* points shared between patches refer to their first occurrence */
+    less.vert = I->V;
+    less.stride = 3;
+    std::sort(face, face + n_face, less);
+    for(a = 0; a < n_face; a = b) {
+      float *p0 = I->V + 3 * face[a];
+      for(b = a + 1; b < n_face; b++) {
+        float *q = I->V + 3 * face[b];
+        if((p0[0] != q[0]) || (p0[1] != q[1]) || (p0[2] != q[2]))
+          break;
+        vid[face[b]] = face[a];
+      }
+    }
+    /* compact in place, summing the normals of shared points */
+    n = 0;
+    for(a = 0; a < n_vert; a++) {
+      if(vid[a] == a) {
+        if(n != a) {
+          copy3f(I->V + 3 * a, I->V + 3 * n);
+          copy3f(I->VN + 3 * a, I->VN + 3 * n);
+        }
+        vid[a] = n++;
+      } else {
+        vid[a] = vid[vid[a]];
+        add3f(I->VN + 3 * a, I->VN + 3 * vid[a], I->VN + 3 * vid[a]);
+      }
+    }
+    for(a = 0; a < n_face; a++)
+      normalize3f(I->VN + 3 * vid[face[a]]);
+    I->N = n;
+    VLASize(I->V, float, 3 * n);
+    VLASize(I->VN, float, 3 * n);
+
+    I->T = VLAlloc(int, 3 * n_s);
+    CHECKOK(ok, I->T);
+    if(ok)
+      I->S = VLAlloc(int, n_s + 1);
+    CHECKOK(ok, I->S);
+  }
+  if(ok) {
+    int *t = I->T, *s = I->S;
+    int base = 0;
+    for(p = 0; p < n_patch; p++) {
+      SurfacePatch *patch = patches->patch + p;
+      int *ps = patch->S;
+      if(!patch->N)
+        continue;
+      while(*ps) {
+        int *sv = s + 1;
+        n = *ps + 2;
+        *(s++) = *(ps++);
+        for(a = 0; a < n; a++)
+          *(s++) = vid[base + *(ps++)];
+        for(a = 0; a < n - 2; a++) {
+          int i0 = sv[a + (a & 1)], i1 = sv[a + 1 - (a & 1)], i2 = sv[a + 2];
+          if((i0 != i1) && (i1 != i2) && (i2 != i0)) {
+            t[0] = i0;
+            t[1] = i1;
+            t[2] = i2;
+            t += 3;
+            I->NT++;
+          }
+        }
+      }
+      base += patch->N;
+    }
+    *s = 0;
+    VLASize(I->T, int, 3 * I->NT);
+  }
+  FreeP(vid);
+  FreeP(face);
+  return ok;
+}
+
+/* marks the patches within reach of an atom */
+static void SurfacePatchMark(CSurfacePatches * I, char *dirty, const float *v0,
+                             float vdw, float cap, int halo)
+{
+  int lo[3], hi[3], i, j, k, c;
+  SurfacePatchReach(v0, vdw, cap, I->spacing, halo, lo, hi);
+  for(c = 0; c < 3; c++) {
+    lo[c] -= I->lo[c];
+    hi[c] -= I->lo[c];
+    if(lo[c] < 0)
+      lo[c] = 0;
+    if(hi[c] > I->dim[c] - 1)
+      hi[c] = I->dim[c] - 1;
+  }
+  for(i = lo[0]; i <= hi[0]; i++)
+    for(j = lo[1]; j <= hi[1]; j++)
+      for(k = lo[2]; k <= hi[2]; k++)
+        dirty[(i * I->dim[1] + j) * I->dim[2] + k] = true;
+}
+
+static int SurfaceJobRunField(PyMOLGlobals * G, SurfaceJob * I)
+{
+  int ok = true;
+  CSurfacePatches *old = I->patches, *cache;
+  SurfacePatchJob job;
+  int n_coord = VLAGetSize(I->atomInfo);
+  int n_thread = SurfaceJobGetNThread(G, I->nPresent);
+  int n_patch = 0, n_todo = 0, n_batch, n_reused = 0;
+  char *dirty = NULL;
+  int *todo = NULL;
+  double phase_time[2] = { 0.0, 0.0 };
+  double start_time;
+  float mn[3], mx[3];
+  int a, c, p, pass, found = false;
+
+  start_time = UtilGetSeconds(G);
+  UtilZeroMem(&job, sizeof(SurfacePatchJob));
+  job.G = G;
+  job.solvent = I->surfaceSolvent;
+  job.probe = I->probeRadius;
+  job.spacing = I->pointSep;
+  job.cap = job.probe + 2 * job.spacing;
+  job.halo = 1 + (job.solvent ? 0 : (int) ceil(job.cap / job.spacing));
+
+  I->patches = NULL;
+  cache = Calloc(CSurfacePatches, 1);
+  CHECKOK(ok, cache);
+  if(ok) {
+    cache->n_coord = n_coord;
+    cache->solvent = job.solvent;
+    cache->probe = job.probe;
+    cache->spacing = job.spacing;
+    cache->coord = Alloc(float, 3 * n_coord + 1);
+    CHECKOK(ok, cache->coord);
+    if(ok)
+      cache->vdw = Alloc(float, n_coord + 1);
+    CHECKOK(ok, cache->vdw);
+  }
+  if(ok) {
+    memcpy(cache->coord, I->coord, sizeof(float) * 3 * n_coord);
+    for(a = 0; a < n_coord; a++) {
+      if((!I->presentVla) || I->presentVla[a]) {
+        float *v0 = I->coord + 3 * a;
+        cache->vdw[a] = I->atomInfo[a].vdw;
+        if(!found) {
+          copy3f(v0, mn);
+          copy3f(v0, mx);
+          found = true;
+        }
+        for(c = 0; c < 3; c++) {
+          if(mn[c] > v0[c])
+            mn[c] = v0[c];
+          if(mx[c] < v0[c])
+            mx[c] = v0[c];
+        }
+      } else {
+        cache->vdw[a] = -1.0F;
+      }
+    }
+    job.coord = cache->coord;
+    job.vdw = cache->vdw;
+    job.patches = cache;
+  }
+
+  if(ok && found) {
+    /* the lattice covers present atoms plus everything a probe can touch */
+    float margin = I->maxVdw + job.cap + 2 * job.spacing;
+    for(c = 0; c < 3; c++) {
+      int i0 = (int) floor((mn[c] - margin) / job.spacing);
+      int i1 = (int) ceil((mx[c] + margin) / job.spacing);
+      cache->lo[c] = SurfaceFloorDiv(i0, cSurfacePatchSize);
+      cache->dim[c] = SurfaceFloorDiv(i1, cSurfacePatchSize) - cache->lo[c] + 1;
+    }
+    n_patch = cache->dim[0] * cache->dim[1] * cache->dim[2];
+    cache->patch = Calloc(SurfacePatch, n_patch);
+    CHECKOK(ok, cache->patch);
+    if(ok)
+      dirty = Calloc(char, n_patch);
+    CHECKOK(ok, dirty);
+  }
+
+  if(ok && found) {
+    if(old && (old->n_coord == n_coord) && (old->solvent == job.solvent)
+       && (old->probe == job.probe) && (old->spacing == job.spacing)) {
+      /* only the patches which moved atoms reach (before or after) change */
+      for(a = 0; a < n_coord; a++) {
+        float *v0 = old->coord + 3 * a, *v1 = cache->coord + 3 * a;
+        if((old->vdw[a] != cache->vdw[a]) || (v0[0] != v1[0])
+           || (v0[1] != v1[1]) || (v0[2] != v1[2])) {
+          if(old->vdw[a] >= 0.0F)
+            SurfacePatchMark(cache, dirty, v0, old->vdw[a], job.cap, job.halo);
+          if(cache->vdw[a] >= 0.0F)
+            SurfacePatchMark(cache, dirty, v1, cache->vdw[a], job.cap, job.halo);
+        }
+      }
+      for(p = 0; p < n_patch; p++) {
+        if(!dirty[p]) {
+          int b[3], q = 0;
+          b[0] = p / (cache->dim[1] * cache->dim[2]);
+          b[1] = (p / cache->dim[2]) % cache->dim[1];
+          b[2] = p % cache->dim[2];
+          for(c = 0; c < 3; c++) {
+            b[c] += cache->lo[c] - old->lo[c];
+            if((b[c] < 0) || (b[c] >= old->dim[c]))
+              break;
+            q = q * old->dim[c] + b[c];
+          }
+          if(c < 3) {
+            dirty[p] = true;
+          } else {
+            cache->patch[p] = old->patch[q];
+            UtilZeroMem(old->patch + q, sizeof(SurfacePatch));
+            n_reused++;
+          }
+        }
+      }
+    } else {
+      memset(dirty, true, n_patch);
+    }
+  }
+  SurfacePatchesFree(old);
+
+  if(ok && found) {
+    /* atoms reaching each of the patches to recompute */
+    job.start = Calloc(int, n_patch + 2);
+    CHECKOK(ok, job.start);
+    for(pass = 0; ok && (pass < 2); pass++) {
+      for(a = 0; a < n_coord; a++) {
+        if(cache->vdw[a] >= 0.0F) {
+          int lo[3], hi[3], i, j, k;
+          SurfacePatchReach(cache->coord + 3 * a, cache->vdw[a], job.cap,
+                            job.spacing, job.halo, lo, hi);
+          for(c = 0; c < 3; c++) {
+            lo[c] -= cache->lo[c];
+            hi[c] -= cache->lo[c];
+            if(lo[c] < 0)
+              lo[c] = 0;
+            if(hi[c] > cache->dim[c] - 1)
+              hi[c] = cache->dim[c] - 1;
+          }
+          for(i = lo[0]; i <= hi[0]; i++)
+            for(j = lo[1]; j <= hi[1]; j++)
+              for(k = lo[2]; k <= hi[2]; k++) {
+                p = (i * cache->dim[1] + j) * cache->dim[2] + k;
+                if(dirty[p]) {
+                  if(pass)
+                    job.atom[job.start[p + 1]++] = a;
+                  else
+                    job.start[p + 2]++;
+                }
+              }
+        }
+      }
+      if(!pass) {
+        for(p = 0; p < n_patch; p++)
+          job.start[p + 2] += job.start[p + 1];
+        job.atom = Alloc(int, job.start[n_patch + 1] + 1);
+        CHECKOK(ok, job.atom);
+      }
+    }
+    /* patches nothing reaches stay empty */
+    if(ok)
+      todo = Alloc(int, n_patch);
+    CHECKOK(ok, todo);
+    for(p = 0; ok && (p < n_patch); p++)
+      if(dirty[p] && (job.start[p + 1] > job.start[p]))
+        todo[n_todo++] = p;
+  }
+
+  n_batch = SurfaceJobGetNTask(n_todo, n_thread);
+  if(ok && n_todo) {
+    int dim = cSurfacePatchSize + 1 + 2 * job.halo;
+    job.grid = Calloc(SurfaceFieldGrid, n_batch);
+    CHECKOK(ok, job.grid);
+    for(a = 0; ok && (a < n_batch); a++) {
+      job.grid[a].dim = dim;
+      job.grid[a].spacing = job.spacing;
+      job.grid[a].data = Alloc(float, (size_t) dim * dim * dim);
+      CHECKOK(ok, job.grid[a].data);
+    }
+    if(ok) {
+      job.line = Alloc(float, (size_t) n_batch * (dim + 1));
+      job.z = Alloc(float, (size_t) n_batch * (dim + 1));
+      job.v = Alloc(int, (size_t) n_batch * (dim + 1));
+      CHECKOK(ok, job.line);
+      CHECKOK(ok, job.z);
+      CHECKOK(ok, job.v);
+    }
+    if(!ok) {
+      PRINTFB(G, FB_RepSurface, FB_Errors)
+        "Error-RepSurface: insufficient memory to calculate surface at this quality.\n"
+        ENDFB(G);
+    }
+  }
+
+  for(a = 0; ok && (a < n_todo); a += n_batch) {
+    int n = (n_todo - a < n_batch) ? (n_todo - a) : n_batch;
+    double batch_time = UtilGetSeconds(G);
+    int t;
+
+    job.todo = todo + a;
+    ThreadPoolRun(G, n_thread, n, SurfacePatchFieldTask, &job);
+    phase_time[0] += UtilGetSeconds(G) - batch_time;
+    ok &= !G->Interrupt;
+
+    batch_time = UtilGetSeconds(G);
+    for(t = 0; ok && (t < n); t++)
+      ok = SurfacePatchContour(&job, t, cache->patch + job.todo[t]);
+    phase_time[1] += UtilGetSeconds(G) - batch_time;
+    ok &= !G->Interrupt;
+  }
+  if(job.grid) {
+    for(a = 0; a < n_batch; a++)
+      FreeP(job.grid[a].data);
+    FreeP(job.grid);
+  }
+  FreeP(job.line);
+  FreeP(job.z);
+  FreeP(job.v);
+  FreeP(job.start);
+  FreeP(job.atom);
+  FreeP(todo);
+  FreeP(dirty);
+
+  if(ok)
+    ok = SurfacePatchesMesh(G, I, cache);
+  if(ok) {
+    I->patches = cache;
+  } else {
+    SurfacePatchesFree(cache);
+    SurfaceJobPurgeResult(G, I);
+  }
+
+  PRINTFB(G, FB_RepSurface, FB_Blather)
+    " RepSurface: %i surface points.\n", I->N ENDFB(G);
+  PRINTFB(G, FB_RepSurface, FB_Blather)
+    " RepSurface: %i triangles.\n", I->NT ENDFB(G);
+  PRINTFB(G, FB_RepSurface, FB_Blather)
+    " RepSurface: %d of %d patches reused, %d recomputed.\n",
+    n_reused, n_patch, n_todo ENDFB(G);
+  PRINTFB(G, FB_RepSurface, FB_Blather)
+    " RepSurface: field %.3f, contour %.3f, mesh %.3f sec (%d threads).\n",
+    phase_time[0], phase_time[1],
+    UtilGetSeconds(G) - start_time - phase_time[0] - phase_time[1], n_thread ENDFB(G);
+  return ok;
+}
+
+static int SurfaceJobRun(PyMOLGlobals * G, SurfaceJob * I)
+{
+  int ok = true;
+  int MaxN;
+  int n_index = VLAGetSize(I->atomInfo);
+  int n_present = I->nPresent;
+  SphereRec *sp = G->Sphere->Sphere[I->sphereIndex];
+  SphereRec *ssp = G->Sphere->Sphere[I->solventSphereIndex];
+
+  SurfaceJobPurgeResult(G, I);
+
+  if(I->surfaceType == 7)       /* distance field surface */
+    return SurfaceJobRunField(G, I);
+
+  {
+    /* compute limiting storage requirements */
+    int tmp = n_present;
+    if(tmp < 1)
+      tmp = 1;
+    if(sp->nDot < ssp->nDot)
+      MaxN = tmp * ssp->nDot;
+    else
+      MaxN = tmp * sp->nDot;
+  }
+
+  I->V = VLAlloc(float, (MaxN + 1) * 3);
+  CHECKOK(ok, I->V);
+  if (ok)
+    I->VN = VLAlloc(float, (MaxN + 1) * 3);
+  CHECKOK(ok, I->VN);
+
+  ok &= !G->Interrupt;
+
+  if(!(I->V && I->VN) || (!ok)) {       /* bail out point -- try to reduce crashes */
+    PRINTFB(G, FB_RepSurface, FB_Errors)
+      "Error-RepSurface: insufficient memory to calculate surface at this quality.\n"
+      ENDFB(G);
+    VLAFreeP(I->V);
+    I->V = NULL;
+    VLAFreeP(I->VN);
+    I->VN = NULL;
+    ok = false;
+  } else {
+    SolventDot *sol_dot = NULL;
+    float *v = I->V;
+    float *vn = I->VN;
+    MapType *carve_map = NULL;
+    float probe_radius = I->probeRadius;
+    int circumscribe = I->circumscribe;
+    int surface_type = I->surfaceType;
+    float point_sep = I->pointSep;
+    float *I_coord = I->coord;
+    int *present_vla = I->presentVla;
+    SurfaceJobAtomInfo *I_atom_info = I->atomInfo;
+    double phase_time[5];
+
+    I->N = 0;
+    phase_time[0] = UtilGetSeconds(G);
+
+    sol_dot = SolventDotNew(G, I->coord, I->atomInfo, probe_radius,
+                            ssp, present_vla,
+                            circumscribe, I->surfaceMode, I->surfaceSolvent,
+                            I->cavityCull, I->allVisibleFlag, I->maxVdw,
+                            I->cavityMode, I->cavityRadius, I->cavityCutoff);
+    CHECKOK(ok, sol_dot);
+    phase_time[1] = UtilGetSeconds(G);
+    ok &= !G->Interrupt;
+    if(ok && sol_dot) {
+      if(!I->surfaceSolvent) {
+
+        float solv_tole = point_sep * 0.04F;
+        float probe_rad_more;
+        float probe_rad_less;
+
+        if(probe_radius < (2.5F * point_sep)) { /* minimum probe radius allowed */
+          probe_radius = 2.5F * point_sep;
+        }
+
+        probe_rad_more = probe_radius * (1.0F + solv_tole);
+
+        switch (surface_type) {
+        case 0:                /* solid */
+        case 3:
+        case 4:
+        case 5:
+        case 6:
+          probe_rad_less = probe_radius;
+          break;
+        default:
+          probe_rad_less = probe_radius * (1.0F - solv_tole);
+          break;
+        }
+
+        if(surface_type >= 5) { /* effectively double-weights atom points */
+          if(sol_dot->nDot) {
+            int a;
+            float *v0 = sol_dot->dot;
+            float *n0 = sol_dot->dotNormal;
+            for(a = 0; a < sol_dot->nDot; a++) {
+              scale3f(n0, -probe_radius, v);
+              add3f(v0, v, v);
+              copy3f(n0, vn);
+              v += 3;
+              vn += 3;
+              n0 += 3;
+              v0 += 3;
+              I->N++;
+            }
+          }
+        }
+	ok &= !G->Interrupt;
+        if(ok) {
+          MapType *map, *solv_map = NULL;
+          map = MapNewFlagged(G, I->maxVdw + probe_rad_more,
+                              I->coord, VLAGetSize(I->coord) / 3, NULL, NULL);
+	  CHECKOK(ok, map);
+	  if (ok)
+	    solv_map = MapNew(G, probe_rad_less, sol_dot->dot, sol_dot->nDot, NULL);
+	  CHECKOK(ok, solv_map);
+          if(ok) {
+            ok &= MapSetupExpress(solv_map);
+	    if (ok)
+	      ok &= MapSetupExpress(map);
+	    ok &= !G->Interrupt;
+	    ok &= map->EList && solv_map->EList;
+            if(sol_dot->nDot && ok) {
+              SurfaceTrimJob job;
+              int n_thread = SurfaceJobGetNThread(G, sol_dot->nDot);
+              Vector3f *dot = Alloc(Vector3f, sp->nDot);
+	      CHECKOK(ok, dot);
+              if (ok){
+                int b;
+                for(b = 0; b < sp->nDot; b++) {
+                  scale3f(sp->dot[b], probe_radius, dot[b]);
+                }
+              }
+              job.G = G;
+              job.sol_dot = sol_dot;
+              job.map = map;
+              job.solv_map = solv_map;
+              job.sp = sp;
+              job.dot = dot;
+              job.coord = I_coord;
+              job.atom_info = I_atom_info;
+              job.present = present_vla;
+              job.probe_rad_less = probe_rad_less;
+              job.probe_rad_more = probe_rad_more;
+              job.surface_type = surface_type;
+              job.n_task = SurfaceJobGetNTask(sol_dot->nDot, n_thread);
+              job.chunk = NULL;
+              if (ok) {
+                job.chunk = SurfaceDotChunkNew(job.n_task, true);
+                CHECKOK(ok, job.chunk);
+              }
+              if (ok) {
+                ThreadPoolRun(G, n_thread, job.n_task, SurfaceTrimTask, &job);
+                ok = SurfaceDotChunkMerge(job.chunk, job.n_task, &I->V, &I->VN, &I->N, -1);
+              }
+              SurfaceDotChunkFree(job.chunk, job.n_task);
+              FreeP(dot);
+            }
+          }
+          MapFree(solv_map);
+          MapFree(map);
+        }
+      } else {
+        float *v0 = sol_dot->dot;
+        float *n0 = sol_dot->dotNormal;
+        int a;
+        circumscribe = 0;
+        if(sol_dot->nDot) {
+          for(a = 0; a < sol_dot->nDot; a++) {
+            *(v++) = *(v0++);
+            *(vn++) = *(n0++);
+            *(v++) = *(v0++);
+            *(vn++) = *(n0++);
+            *(v++) = *(v0++);
+            *(vn++) = *(n0++);
+            I->N++;
+          }
+        }
+      }
+    }
+    SolventDotFree(sol_dot);
+    sol_dot = NULL;
+    phase_time[2] = UtilGetSeconds(G);
+    ok &= !G->Interrupt;
+    if(ok) {
+      int refine, ref_count = 1;
+
+      if((surface_type == 0) && (circumscribe)) {
+        ref_count = 2;          /* these constants need more tuning... */
+      }
+
+      for(refine = 0; ok && refine < ref_count; refine++) {
 
         /* add new vertices in regions where curvature is very high
            or where there are gaps with no points */
 
         if(I->N && (surface_type == 0) && (circumscribe)) {
-          int n_new = 0;
-
           float neighborhood = 2.6 * point_sep; /* these constants need more tuning... */
           float dot_cutoff = 0.666;
           float insert_cutoff = 1.1 * point_sep;
 
           float map_cutoff = neighborhood;
-          float *new_dot = VLAlloc(float, 1000);
 
           if(map_cutoff < (2.9 * point_sep)) {  /* these constants need more tuning... */
             map_cutoff = 2.9 * point_sep;
           }
 
           {
-            MapType *map = NULL;
-            int a;
-            map = MapNew(G, map_cutoff, I->V, I->N, NULL);
+            MapType *map = MapNew(G, map_cutoff, I->V, I->N, NULL);
 	    CHECKOK(ok, map);
 	    if (ok)
 	      ok &= MapSetupExpress(map);
-            v = I->V;
-            vn = I->VN;
-            for(a = 0; ok && a < I->N; a++) {
-              int i = *(MapLocusEStart(map, v));
-              if(i && map->EList) {
-                int j = map->EList[i++];
-                while(ok && j >= 0) {
-                  if(j > a) {
-                    float *v0 = I->V + 3 * j;
-                    if(within3f(v0, v, map_cutoff)) {
-                      int add_new = false;
-                      float *n0 = I->VN + 3 * j;
-                      VLACheck(new_dot, float, n_new * 6 + 5);
-		      CHECKOK(ok, new_dot);
-                      if (ok){
-                        float *v1 = new_dot + n_new * 6;
-                        average3f(v, v0, v1);
-                        if((dot_product3f(n0, vn) < dot_cutoff)
-                           && (within3f(v0, v, neighborhood)))
-                          add_new = true;
-                        else {
-                          /* if points are too far apart, insert a new one */
-                          int ii = *(MapLocusEStart(map, v1));
-                          if(ii) {
-                            int found = false;
-                            int jj = map->EList[ii++];
-                            while(jj >= 0) {
-                              if(jj != j) {
-                                float *vv0 = I->V + 3 * jj;
-                                if(within3f(vv0, v1, insert_cutoff)) {
-                                  found = true;
-                                  break;
-                                }
-                              }
-                              jj = map->EList[ii++];
-                            }
-                            if(!found)
-                              add_new = true;
-                          }
-                        }
-                        if(add_new) {
-                          /* highly divergent */
-                          float *n1 = v1 + 3;
-                          n_new++;
-                          average3f(vn, n0, n1);
-                          normalize3f(n1);
-                        }
-                      }
-                    }
-                  }
-                  j = map->EList[i++];
-		  ok &= !G->Interrupt;
-                }
+            if(ok) {
+              SurfaceRefineJob job;
+              int n_thread = SurfaceJobGetNThread(G, I->N);
+              job.G = G;
+              job.map = map;
+              job.V = I->V;
+              job.VN = I->VN;
+              job.N = I->N;
+              job.map_cutoff = map_cutoff;
+              job.neighborhood = neighborhood;
+              job.dot_cutoff = dot_cutoff;
+              job.insert_cutoff = insert_cutoff;
+              job.n_task = SurfaceJobGetNTask(I->N, n_thread);
+              job.chunk = SurfaceDotChunkNew(job.n_task, true);
+              CHECKOK(ok, job.chunk);
+              if(ok) {
+                ThreadPoolRun(G, n_thread, job.n_task, SurfaceRefineTask, &job);
+                ok = SurfaceDotChunkMerge(job.chunk, job.n_task, &I->V, &I->VN, &I->N, -1);
               }
-              v += 3;
-              vn += 3;
-	      ok &= !G->Interrupt;
+              SurfaceDotChunkFree(job.chunk, job.n_task);
             }
             MapFree(map);
           }
-          if(ok && n_new) {
-            float *n1 = new_dot + 3;
-            float *v1 = new_dot;
-            VLASize(I->V, float, 3 * (I->N + n_new));
-	    CHECKOK(ok, I->V);
-	    if (ok)
-	      VLASize(I->VN, float, 3 * (I->N + n_new));
-	    CHECKOK(ok, I->VN);
-	    if (ok){
-	      v = I->V + 3 * I->N;
-	      vn = I->VN + 3 * I->N;
-	      I->N += n_new;
-	    }
-            while(ok && n_new--) {
-              copy3f(v1, v);
-              copy3f(n1, vn);
-              v += 3;
-              vn += 3;
-              v1 += 6;
-              n1 += 6;
-            }
-          }
-          VLAFreeP(new_dot);
         }
 
         if(ok && I->N && (surface_type == 0) && (circumscribe)) {
@@ -3735,28 +5123,12 @@ static int SurfaceJobRun(PyMOLGlobals * G, SurfaceJob * I)
           MapType *map =
             MapNewFlagged(G, I->maxVdw + probe_radius, I_coord, n_index, NULL,
                           present_vla);
-          int a;
 	  CHECKOK(ok, map);
           if (ok)
 	    ok &= MapSetupExpress(map);
-          v = I->V;
-          for(a = 0; ok && a < I->N; a++) {
-            int i = *(MapLocusEStart(map, v));
-            if(i && map->EList) {
-              int j = map->EList[i++];
-              while(j >= 0) {
-                SurfaceJobAtomInfo *atom_info = I_atom_info + j;
-                if((!present_vla) || present_vla[j]) {
-                  if(within3f(I_coord + 3 * j, v, atom_info->vdw + cutoff)) {
-                    dot_flag[a] = true;
-                  }
-                }
-                j = map->EList[i++];
-              }
-            }
-            v += 3;
-	    ok &= !G->Interrupt;
-          }
+          if (ok)
+            ok &= SurfaceFlagPoints(G, map, I_coord, I_atom_info, present_vla, cutoff,
+                                    I->V, I->N, dot_flag);
 
           MapFree(map);
           map = NULL;
@@ -4042,6 +5414,8 @@ static int SurfaceJobRun(PyMOLGlobals * G, SurfaceJob * I)
       CHECKOK(ok, I->VN);
     }
 
+    phase_time[3] = UtilGetSeconds(G);
+
     PRINTFB(G, FB_RepSurface, FB_Blather)
       " RepSurface: %i surface points.\n", I->N ENDFB(G);
 
@@ -4069,19 +5443,54 @@ static int SurfaceJobRun(PyMOLGlobals * G, SurfaceJob * I)
     }
     if(carve_map)
       MapFree(carve_map);
+
+    phase_time[4] = UtilGetSeconds(G);
+    PRINTFB(G, FB_RepSurface, FB_Blather)
+      " RepSurface: dots %.3f, trim %.3f, cleanup %.3f, triangles %.3f sec (%d threads).\n",
+      phase_time[1] - phase_time[0], phase_time[2] - phase_time[1],
+      phase_time[3] - phase_time[2], phase_time[4] - phase_time[3],
+      SurfaceJobGetNThread(G, n_present) ENDFB(G);
   }
   return ok;
 }
 
+/*
+ * Rebuilds the surface, handing the patches of the distance field surface
+ * over to the new rep so that only the parts which changed are recomputed
+ */
+static Rep *RepSurfaceRebuild(RepSurface * I, CoordSet * cs, int state, int rep)
+{
+  Rep *tmp;
+  CSurfacePatches *patches = I->Patches;
+  I->Patches = NULL;
+  tmp = RepSurfaceNewFromPatches(cs, state, patches);
+  if(tmp) {
+    tmp->fNew = I->R.fNew;
+    RepSurfaceFree(I);
+  } else {                      /* nothing returned -- visibility is zero... */
+    cs->Active[rep] = false;    /* keep the old object around, but inactive */
+    tmp = &I->R;
+  }
+  return (tmp);
+}
+
 Rep *RepSurfaceNew(CoordSet * cs, int state)
+{
+  return RepSurfaceNewFromPatches(cs, state, NULL);
+}
+
+static Rep *RepSurfaceNewFromPatches(CoordSet * cs, int state, CSurfacePatches * patches)
 {
   int ok = true;
   PyMOLGlobals *G = cs->State.G;
   ObjectMolecule *obj = cs->Obj;
   OOCalloc(G, RepSurface);
   CHECKOK(ok, I);
-  if (!ok)
+  if (!ok) {
+    SurfacePatchesFree(patches);
     return NULL;
+  }
+  I->Patches = patches;         /* freed with the rep unless used */
   I->pickingCGO = I->shaderCGO = 0;
   I->vertexIndices = 0;
   I->sum = 0;
@@ -4115,6 +5524,7 @@ Rep *RepSurfaceNew(CoordSet * cs, int state)
       }
     }
     if(!visFlag) {
+      SurfacePatchesFree(I->Patches);
       OOFreeP(I);
       return (NULL);            /* skip if no thing visible */
     }
@@ -4248,6 +5658,7 @@ Rep *RepSurfaceNew(CoordSet * cs, int state)
       I->R.fSameVis = (int (*)(struct Rep *, struct CoordSet *)) RepSurfaceSameVis;
       I->R.fSameColor = (int (*)(struct Rep *, struct CoordSet *)) RepSurfaceSameColor;
       I->R.fInvalidate = (void (*)(struct Rep *, struct CoordSet *, int)) RepSurfaceInvalidate;
+      I->R.fRebuild = (struct Rep *(*)(struct Rep *, struct CoordSet *, int, int)) RepSurfaceRebuild;
       I->R.obj = (CObject *) (cs->Obj);
       I->R.cs = cs;
       I->allVisibleFlag = true;
@@ -4498,6 +5909,12 @@ Rep *RepSurfaceNew(CoordSet * cs, int state)
 	      
 	      surf_job->surfaceMode = surface_mode;
 	      surf_job->surfaceSolvent = surface_solvent;
+	      if(surface_type == 7) {
+		surf_job->patches = I->Patches;
+	      } else {
+		SurfacePatchesFree(I->Patches);
+	      }
+	      I->Patches = NULL;
 	      
 	      surf_job->cavityCull = SettingGet_i(G, cs->Setting,
 						  obj->Obj.Setting, cSetting_cavity_cull);
@@ -4578,6 +5995,8 @@ Rep *RepSurfaceNew(CoordSet * cs, int state)
 	    surf_job->T = NULL;
 	    I->S = surf_job->S;
 	    surf_job->S = NULL;
+	    I->Patches = surf_job->patches;
+	    surf_job->patches = NULL;
 	  }
 	  
           SurfaceJobPurgeResult(G, surf_job);
@@ -4618,13 +6037,9 @@ static SolventDot *SolventDotNew(PyMOLGlobals * G,
                                  float cavity_cutoff)
 {
   int ok = true;
-  int b;
-  float vdw;
   float probe_radius_plus;
-  int maxDot = 0;
   int stopDot;
   int n_coord = VLAGetSize(atom_info);
-  Vector3f *sp_dot = sp->dot;
   OOCalloc(G, SolventDot);
   CHECKOK(ok, I);
   /*  printf("%p %p %p %f %p %p %p %d %d %d %d %d %f\n",
@@ -4655,260 +6070,52 @@ static SolventDot *SolventDotNew(PyMOLGlobals * G,
 
   I->nDot = 0;
   if (ok) {
-    int dotCnt = 0;
     MapType *map = MapNewFlagged(G, max_vdw + probe_radius, coord, n_coord, NULL, present);
     CHECKOK(ok, map);
     ok &= !G->Interrupt;
     if(map && ok) {
-      float *v = I->dot;
-      float *n = I->dotNormal;
-      int *dc = I->dotCode;
-      int maxCnt = 0;
+      SolventDotJob job;
+      job.G = G;
+      job.coord = coord;
+      job.atom_info = atom_info;
+      job.present = present;
+      job.map = map;
+      job.map2 = NULL;
+      job.sp = sp;
+      job.radius = probe_radius;
+      job.circumscribe = circumscribe;
+      job.n_coord = n_coord;
 
       ok &= MapSetupExpress(map);
-      if (ok) {
-        int a;
-        int skip_flag;
-
-        SurfaceJobAtomInfo *a_atom_info = atom_info;
-        for(a = 0; ok && a < n_coord; a++) {
-          OrthoBusyFast(G, a, n_coord * 5);
-          if((!present) || (present[a])) {
-            int i;
-            float *v0 = coord + 3 * a;
-            vdw = a_atom_info->vdw + probe_radius;
-
-            skip_flag = false;
-
-            i = *(MapLocusEStart(map, v0));
-            if(i && map->EList) {
-              int j = map->EList[i++];
-              while(ok && j >= 0) {
-                SurfaceJobAtomInfo *j_atom_info = atom_info + j;
-                if(j > a)       /* only check if this is atom trails */
-                  if((!present) || present[j]) {
-                    if(j_atom_info->vdw == a_atom_info->vdw) {        /* handle singularities */
-                      float *v1 = coord + 3 * j;
-                      if((v0[0] == v1[0]) && (v0[1] == v1[1]) && (v0[2] == v1[2]))
-                        skip_flag = true;
-                    }
-                  }
-                j = map->EList[i++];
-		ok &= !G->Interrupt;
-              }
-            }
-            if(ok && !skip_flag) {
-              for(b = 0; ok && b < sp->nDot; b++) {
-                float *sp_dot_b = (float*)(sp_dot + b);
-                int i;
-                int flag = true;
-                v[0] = v0[0] + vdw * (n[0] = sp_dot_b[0]);
-                v[1] = v0[1] + vdw * (n[1] = sp_dot_b[1]);
-                v[2] = v0[2] + vdw * (n[2] = sp_dot_b[2]);
-                i = *(MapLocusEStart(map, v));
-                if(i) {
-                  int j = map->EList[i++];
-                  while(ok && j >= 0) {
-                    SurfaceJobAtomInfo *j_atom_info = atom_info + j;
-                    if((!present) || present[j]) {
-                      if(j != a) {
-                        skip_flag = false;
-                        if(j_atom_info->vdw == a_atom_info->vdw) {      /* handle singularities */
-                          float *v1 = coord + 3 * j;
-                          if((v0[0] == v1[0]) && (v0[1] == v1[1]) && (v0[2] == v1[2]))
-                            skip_flag = true;
-                        }
-                        if(!skip_flag)
-                          if(within3f(coord + 3 * j, v, j_atom_info->vdw + probe_radius)) {
-                            flag = false;
-                            break;
-                          }
-                      }
-                    }
-                    j = map->EList[i++];
-		    ok &= !G->Interrupt;
-                  }
-                }
-                if(ok && flag && (dotCnt < stopDot)) {
-                  dotCnt++;
-                  v += 3;
-                  n += 3;
-                  dc++;
-                  I->nDot++;
-                }
-              }
-            }
-            if(dotCnt > maxCnt) {
-              maxCnt = dotCnt;
-              maxDot = I->nDot - 1;
-            }
-          }
-          a_atom_info++;
-        }
-      }
+      if (ok)
+        ok = SolventDotRun(&job, &I->dot, &I->dotNormal, &I->nDot, stopDot);
 
       /* for each pair of proximal atoms, circumscribe a circle for their intersection */
 
-      /*    CGOReset(G->DebugCGO); */
-
-      if (ok) {
-        MapType *map2 = NULL;
-        if(circumscribe && (!surface_solvent)){
-          map2 = MapNewFlagged(G, 2 * (max_vdw + probe_radius), coord, n_coord, NULL, present);
-	  CHECKOK(ok, map2);
-	}
-	ok &= !G->Interrupt;
-        if(ok && map2) {
-          /*        CGOBegin(G->DebugCGO,GL_LINES); */
-          int a;
-          int skip_flag;
-
-          SurfaceJobAtomInfo *a_atom_info = atom_info;
+      if (ok && circumscribe && (!surface_solvent)) {
+        int n_atom_dot = I->nDot;
+        MapType *map2 = MapNewFlagged(G, 2 * (max_vdw + probe_radius), coord, n_coord, NULL, present);
+        CHECKOK(ok, map2);
+        ok &= !G->Interrupt;
+        if(ok)
           ok &= MapSetupExpress(map2);
-          for(a = 0; ok && a < n_coord; a++) {
-            if((!present) || present[a]) {
-              int i;
-              float vdw2;
-              float *v0 = coord + 3 * a;
-              vdw = a_atom_info->vdw + probe_radius;
-              vdw2 = vdw * vdw;
-
-              skip_flag = false;
-
-              i = *(MapLocusEStart(map2, v0));
-              if(i) {
-                int j = map2->EList[i++];
-                while(ok && j >= 0) {
-                  SurfaceJobAtomInfo *j_atom_info = atom_info + j;
-                  if(j > a)     /* only check if this is atom trails */
-                    if((!present) || present[j]) {
-                      if(j_atom_info->vdw == a_atom_info->vdw) {      /* handle singularities */
-                        float *v2 = coord + 3 * j;
-                        if((v0[0] == v2[0]) && (v0[1] == v2[1]) && (v0[2] == v2[2]))
-                          skip_flag = true;
-                      }
-                    }
-                  j = map2->EList[i++];
-		  ok &= !G->Interrupt;
-                }
-              }
-
-              if(ok && !skip_flag) {
-                int ii = *(MapLocusEStart(map2, v0));
-                if(ii) {
-                  int jj = map2->EList[ii++];
-                  while(jj >= 0) {
-                    SurfaceJobAtomInfo *jj_atom_info = atom_info + jj;
-                    float dist;
-                    if(jj > a)  /* only check if this is atom trails */
-                      if((!present) || present[jj]) {
-                        float vdw3 = jj_atom_info->vdw + probe_radius;
-
-                        float *v2 = coord + 3 * jj;
-                        dist = (float) diff3f(v0, v2);
-                        if((dist > R_SMALL4) && (dist < (vdw + vdw3))) {
-                          float vz[3], vx[3], vy[3], vp[3];
-                          float tri_a = vdw, tri_b = vdw3, tri_c = dist;
-                          float tri_s = (tri_a + tri_b + tri_c) * 0.5F;
-                          float area = (float) sqrt1f(tri_s * (tri_s - tri_a) *
-                                                      (tri_s - tri_b) * (tri_s - tri_c));
-                          float radius = (2 * area) / dist;
-                          float adj = (float) sqrt1f(vdw2 - radius * radius);
-
-                          subtract3f(v2, v0, vz);
-                          get_system1f3f(vz, vx, vy);
-
-                          copy3f(vz, vp);
-                          scale3f(vp, adj, vp);
-                          add3f(v0, vp, vp);
-
-                          for(b = 0; ok && b <= circumscribe; b++) {
-                            float xcos = (float) cos((b * 2 * cPI) / circumscribe);
-                            float ysin = (float) sin((b * 2 * cPI) / circumscribe);
-                            float xcosr = xcos * radius;
-                            float ysinr = ysin * radius;
-                            int flag = true;
-                            v[0] = vp[0] + vx[0] * xcosr + vy[0] * ysinr;
-                            v[1] = vp[1] + vx[1] * xcosr + vy[1] * ysinr;
-                            v[2] = vp[2] + vx[2] * xcosr + vy[2] * ysinr;
-
-                            i = *(MapLocusEStart(map, v));
-                            if(i && map->EList) {
-                              int j = map->EList[i++];
-                              while(ok && j >= 0) {
-                                SurfaceJobAtomInfo *j_atom_info = atom_info + j;
-                                if((!present) || present[j])
-                                  if((j != a) && (j != jj)) {
-                                    skip_flag = false;
-                                    if(a_atom_info->vdw == j_atom_info->vdw) {  /* handle singularities */
-                                      float *v1 = coord + 3 * j;
-                                      if((v0[0] == v1[0]) &&
-                                         (v0[1] == v1[1]) && (v0[2] == v1[2]))
-                                        skip_flag = true;
-                                    }
-                                    if(jj_atom_info->vdw == j_atom_info->vdw) { /* handle singularities */
-                                      float *v1 = coord + 3 * j;
-                                      if((v2[0] == v1[0]) &&
-                                         (v2[1] == v1[1]) && (v2[2] == v1[2]))
-                                        skip_flag = true;
-                                    }
-                                    if(!skip_flag)
-                                      if(within3f
-                                         (coord + 3 * j, v,
-                                          j_atom_info->vdw + probe_radius)) {
-                                        flag = false;
-                                        break;
-                                      }
-                                  }
-                                j = map->EList[i++];
-				ok &= !G->Interrupt;
-                              }
-                            }
-                            if(ok && flag && (dotCnt < stopDot)) {
-                              float vt0[3], vt2[3];
-                              subtract3f(v0, v, vt0);
-                              subtract3f(v2, v, vt2);
-                              normalize3f(vt0);
-                              normalize3f(vt2);
-                              add3f(vt0, vt2, n);
-                              invert3f(n);
-                              normalize3f(n);
-                              /*
-                                 n[0] = vx[0] * xcos + vy[0] * ysin;
-                                 n[1] = vx[1] * xcos + vy[1] * ysin;
-                                 n[2] = vx[2] * xcos + vy[2] * ysin;
-                               */
-
-                              *dc = 1;  /* mark as exempt */
-
-                              dotCnt++;
-                              v += 3;
-                              n += 3;
-                              dc++;
-                              I->nDot++;
-                            }
-                          }
-                        }
-                      }
-                    jj = map2->EList[ii++];
-                  }
-                }
-              }
-            }
-            a_atom_info++;
-	    ok &= !G->Interrupt;
-          }
+        if(ok) {
+          job.map2 = map2;
+          ok = SolventDotRun(&job, &I->dot, &I->dotNormal, &I->nDot, stopDot);
+        }
+        if(ok) {
+          int a;
+          for(a = n_atom_dot; a < I->nDot; a++)
+            I->dotCode[a] = 1;  /* mark as exempt */
         }
         MapFree(map2);
       }
     }
     MapFree(map);
-    /*    CGOEnd(G->DebugCGO); */
   }
 
   if(ok && cavity_mode) {
     int nCavityDot = 0;
-    int dotCnt = 0;
     float *cavityDot = VLAlloc(float, (stopDot + 1) * 3);
     CHECKOK(ok, cavityDot);
     if(cavity_radius<0.0F) {
@@ -4923,78 +6130,20 @@ static SolventDot *SolventDotNew(PyMOLGlobals * G,
       if(G->Interrupt)
         ok = false;
       if(ok && map) {
-        float *v = cavityDot;
+        SolventDotJob job;
+        job.G = G;
+        job.coord = coord;
+        job.atom_info = atom_info;
+        job.present = present;
+        job.map = map;
+        job.map2 = NULL;
+        job.sp = sp;
+        job.radius = cavity_radius;
+        job.circumscribe = 0;
+        job.n_coord = n_coord;
         ok &= MapSetupExpress(map);
-        if (ok) {
-          int a;
-          int skip_flag;
-          SurfaceJobAtomInfo *a_atom_info = atom_info;
-          for(a = 0; a < n_coord; a++) {
-            if((!present) || (present[a])) {
-              int i;
-              float *v0 = coord + 3 * a;
-              vdw = a_atom_info->vdw + cavity_radius;
-              skip_flag = false;
-              i = *(MapLocusEStart(map, v0));
-              if(i && map->EList) {
-                int j = map->EList[i++];
-                while(j >= 0) {
-                  SurfaceJobAtomInfo *j_atom_info = atom_info + j;
-                  if(j > a)       /* only check if this is atom trails */
-                    if((!present) || present[j]) {
-                      if(j_atom_info->vdw == a_atom_info->vdw) {        /* handle singularities */
-                        float *v1 = coord + 3 * j;
-                        if((v0[0] == v1[0]) && (v0[1] == v1[1]) && (v0[2] == v1[2]))
-                          skip_flag = true;
-                      }
-                    }
-                  j = map->EList[i++];
-                }
-              }
-              if(!skip_flag) {
-                for(b = 0; b < sp->nDot; b++) {
-                  float *sp_dot_b = (float*)(sp_dot + b);
-                  int i;
-                  int flag = true;
-                  v[0] = v0[0] + vdw * (sp_dot_b[0]);
-                  v[1] = v0[1] + vdw * (sp_dot_b[1]);
-                  v[2] = v0[2] + vdw * (sp_dot_b[2]);
-                  i = *(MapLocusEStart(map, v));
-                  if(i) {
-                    int j = map->EList[i++];
-                    while(j >= 0) {
-                      SurfaceJobAtomInfo *j_atom_info = atom_info + j;
-                      if((!present) || present[j]) {
-                        if(j != a) {
-                          skip_flag = false;
-                          if(j_atom_info->vdw == a_atom_info->vdw) {
-                            /* handle singularities */
-                            float *v1 = coord + 3 * j;
-                            if((v0[0] == v1[0]) && (v0[1] == v1[1]) && (v0[2] == v1[2]))
-                              skip_flag = true;
-                          }
-                          if(!skip_flag) {
-                            if(within3f(coord + 3 * j, v, j_atom_info->vdw + cavity_radius)) {
-                              flag = false;
-                              break;
-                            }
-                          }
-                        }
-                      }
-                      j = map->EList[i++];
-                    }
-                  }
-                  if(flag && (dotCnt < stopDot)) {
-                    v += 3;
-                    nCavityDot++;
-                    dotCnt++;
-                  }
-                }
-              }
-            }
-            a_atom_info++;
-          }
-        }
+        if (ok)
+          ok = SolventDotRun(&job, &cavityDot, NULL, &nCavityDot, stopDot);
       }
       MapFree(map);
     }
@@ -5005,30 +6154,9 @@ static SolventDot *SolventDotNew(PyMOLGlobals * G,
         MapType *map = MapNew(G, cavity_cutoff, cavityDot, nCavityDot, NULL);
         if(map) {
           MapSetupExpress(map);
-          {
-            int *p = dot_flag;
-            float *v = I->dot;
-            int a;
-            for(a = 0; a < I->nDot; a++) {
-              int i = *(MapLocusEStart(map, v));
-              if(i && map->EList) {
-                int j = map->EList[i++];
-                while(j >= 0) {
-                  if(within3f(cavityDot + (3 * j), v, cavity_cutoff)) {
-                    *p = true;
-                    break;
-                  }
-                  j = map->EList[i++];
-                }
-              }
-              v += 3;
-              p++;
-              if(G->Interrupt) {
-                ok = false;
-                break;
-              }
-            }
-          }
+          if(!SurfaceFlagPoints(G, map, cavityDot, NULL, NULL, cavity_cutoff,
+                                I->dot, I->nDot, dot_flag))
+            ok = false;
         }
         MapFree(map);
       }
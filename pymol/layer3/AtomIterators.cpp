@@ -9,6 +9,7 @@
 #include "AtomIterators.h"
 #include "Selector.h"
 #include "SelectorDef.h"
+#include "FrameStore.h"
 
 /*========================================================================*/
 bool CoordSetAtomIterator::next() {
@@ -133,9 +134,17 @@ bool SeleCoordIterator::next() {
       prev_obj = obj;
     }
 
-    if(state >= obj->NCSet || !(cs = obj->CSet[state]))
+    if(state >= obj->NCSet)
       continue;
 
+    if(!(cs = obj->CSet[state])) {
+      if(!obj->Frames)
+        continue;
+      FrameStoreLoad(obj, state);       // stored trajectory frame
+      if(!(cs = obj->CSet[state]))
+        continue;
+    }
+
     atm = I->Table[a].atom;
     idx = cs->atmToIdx(atm);
 
@@ -3588,7 +3588,7 @@ int ExecutiveLoad(PyMOLGlobals * G,
 {
   int ok = true;
   const char * fname = content;
-  char * buffer = NULL;
+  CFileView view = { NULL, 0, false };
   long size = (long) content_length;
   OrthoLineType buf = "";
   char plugin[16] = "";
@@ -3631,10 +3631,24 @@ int ExecutiveLoad(PyMOLGlobals * G,
   case cLoadTypeXYZStr:
     fname = NULL;
     break;
+  case cLoadTypeCIF:
+    // the CIF reader maps the file itself (its data may stay in memory)
+    content = NULL;
+    {
+      FILE *fp = pymol_fopen(fname, "rb");
+      if(!fp) {
+        PRINTFB(G, FB_Executive, FB_Errors)
+          "ExecutiveLoad-Error: Unable to open file '%s'.\n", fname ENDFB(G);
+        return false;
+      }
+      fclose(fp);
+    }
+    PRINTFB(G, FB_Executive, FB_Blather)
+      " ExecutiveLoad: Loading from %s.\n", fname ENDFB(G);
+    break;
   case cLoadTypePQR:
   case cLoadTypePDBQT:
   case cLoadTypePDB:
-  case cLoadTypeCIF:
   case cLoadTypeMMTF:
   case cLoadTypeMAE:
   case cLoadTypeXPLORMap:
@@ -3645,14 +3659,15 @@ int ExecutiveLoad(PyMOLGlobals * G,
   case cLoadTypeMOL2:
   case cLoadTypeSDF2:
   case cLoadTypeXYZ:
-    buffer = FileGetContents(fname, &size);
-    content = buffer;
-
-    if(!buffer) {
+    // read-only and NUL terminated, parsed in place without a heap copy
+    if(!FileViewOpenText(&view, fname)) {
       PRINTFB(G, FB_Executive, FB_Errors)
         "ExecutiveLoad-Error: Unable to open file '%s'.\n", fname ENDFB(G);
       return false;
     } else {
+      content = view.data;
+      size = view.size;
+
       PRINTFB(G, FB_Executive, FB_Blather)
         " ExecutiveLoad: Loading from %s.\n", fname ENDFB(G);
     }
@@ -3745,7 +3760,7 @@ int ExecutiveLoad(PyMOLGlobals * G,
   case cLoadTypeCIF:
   case cLoadTypeCIFStr:
     obj = (CObject *) ObjectMoleculeReadCifStr(G, (ObjectMolecule *) origObj,
-        content, state, discrete, quiet, multiplex, zoom);
+        content, state, discrete, quiet, multiplex, zoom, fname);
     break;
   case cLoadTypeMMTF:
   case cLoadTypeMMTFStr:
@@ -3909,7 +3924,7 @@ int ExecutiveLoad(PyMOLGlobals * G,
       sprintf(buf, " CmdLoad: loaded as \"%s\".\n", obj->Name);
   }
 
-  mfree(buffer);
+  FileViewClose(&view);
 
   if(!quiet && buf[0]) {
     PRINTFB(G, FB_Executive, FB_Actions)
@@ -4592,22 +4607,34 @@ int ExecutiveSetVisFromPyDict(PyMOLGlobals * G, PyObject * dict)
 
 /*
  * returns a pointer to the data in a volume or map object
+ *
+ * shared: the caller hands the data out for writing (e.g. as a NumPy view),
+ * so the field stops using its min/max pyramid which could go stale
  */
-CField * ExecutiveGetVolumeField(PyMOLGlobals * G, const char * objName, int state) {
+CField * ExecutiveGetVolumeField(PyMOLGlobals * G, const char * objName, int state,
+    int shared) {
   ObjectMapState *oms;
   CObject *obj;
+  Isofield *field = NULL;
 
   obj = ExecutiveFindObjectByName(G, objName);
   ok_assert(1, obj);
 
   switch (obj->type) {
   case cObjectVolume:
-    return ObjectVolumeGetField((ObjectVolume *) obj);
+    field = ObjectVolumeGetIsofield((ObjectVolume *) obj);
+    break;
   case cObjectMap:
     oms = ObjectMapGetState((ObjectMap *) obj, state);
-    ok_assert(1, oms && oms->Field);
-    return oms->Field->data;
+    ok_assert(1, oms);
+    field = oms->Field;
+    break;
   }
+  ok_assert(1, field && field->data);
+
+  if(shared)
+    IsofieldSetShared(field);
+  return field->data;
 
 ok_except1:
   return NULL;
@@ -6942,6 +6969,7 @@ int ExecutiveMapSet(PyMOLGlobals * G, const char *name, int operator_, const cha
         /* copy after calculation so that operand can include target */
 
         memcpy(ms->Field->data->data, l_value, n_pnt * sizeof(float));
+        IsofieldInvalidate(ms->Field);
 
         FreeP(present);
         FreeP(l_value);
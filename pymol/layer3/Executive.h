@@ -482,7 +482,8 @@ int ExecutiveReinitialize(PyMOLGlobals * G, int what, const char *pattern);
 const char *ExecutiveFindBestNameMatch(PyMOLGlobals * G, const char *name);
 int ExecutiveSetVisFromPyDict(PyMOLGlobals * G, PyObject * dict);
 PyObject *ExecutiveGetVisAsPyDict(PyMOLGlobals * G);
-CField   *ExecutiveGetVolumeField(PyMOLGlobals * G, const char * objName, int state);
+CField   *ExecutiveGetVolumeField(PyMOLGlobals * G, const char * objName, int state,
+    int shared = false);
 int       ExecutiveSetVolumeRamp(PyMOLGlobals * G, const char * objName, float *ramp_list, int list_size);
 PyObject *ExecutiveGetVolumeRamp(PyMOLGlobals * G, const char * objName);
 
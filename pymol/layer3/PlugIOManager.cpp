@@ -21,6 +21,7 @@ Z* -------------------------------------------------------------------
 #include "PlugIOManager.h"
 #include "Selector.h"
 #include "CoordSet.h"
+#include "FrameStore.h"
 #include "Feedback.h"
 #include "Scene.h"
 #include "Executive.h"
@@ -148,6 +149,152 @@ static molfile_plugin_t * find_plugin(CPlugIOManager * I, const char * plugin_ty
   return NULL;
 }
 
+/*
+ * Streamed trajectory reader (setting frame_stream). Molfile plugins only
+ * read forward, so the index maps streamed frames to frame numbers in the
+ * file, and reading backwards reopens the file and skips forward (which
+ * formats like DCD and DTR do by seeking).
+ */
+typedef struct {
+  molfile_plugin_t *plugin;
+  char *fname;
+  void *handle;
+  int natoms;
+  int next;                     /* file frame the handle is positioned at */
+  int *index;                   /* VLA: file frame of each streamed frame */
+} PlugIOStream;
+
+static int PlugIOStreamRead(void *data, int frame, float *coord, float *box)
+{
+  PlugIOStream *I = (PlugIOStream *) data;
+  molfile_timestep_t timestep;
+  int target = I->index[frame];
+  int natoms;
+
+  if(I->handle && (target < I->next)) {
+    I->plugin->close_file_read(I->handle);
+    I->handle = NULL;
+  }
+  if(!I->handle) {
+    I->handle = I->plugin->open_file_read(I->fname, I->plugin->name, &natoms);
+    I->next = 0;
+    if(!I->handle)
+      return false;
+  }
+  for(; I->next < target; I->next++)
+    if(I->plugin->read_next_timestep(I->handle, I->natoms, NULL))
+      break;
+
+  memset(&timestep, 0, sizeof(timestep));
+  timestep.coords = coord;
+  if((I->next != target) ||
+     I->plugin->read_next_timestep(I->handle, I->natoms, &timestep)) {
+    I->plugin->close_file_read(I->handle);
+    I->handle = NULL;
+    return false;
+  }
+  I->next++;
+
+  if(timestep.A > 0.0F) {
+    box[0] = timestep.A;
+    box[1] = timestep.B;
+    box[2] = timestep.C;
+    box[3] = timestep.alpha;
+    box[4] = timestep.beta;
+    box[5] = timestep.gamma;
+  }
+  return true;
+}
+
+static void PlugIOStreamFree(void *data)
+{
+  PlugIOStream *I = (PlugIOStream *) data;
+  if(I->handle)
+    I->plugin->close_file_read(I->handle);
+  FreeP(I->fname);
+  VLAFreeP(I->index);
+  FreeP(I);
+}
+
+static void *PlugIOStreamCopy(void *data)
+{
+  PlugIOStream *src = (PlugIOStream *) data;
+  PlugIOStream *I = Calloc(PlugIOStream, 1);
+  if(I) {
+    I->plugin = src->plugin;
+    I->natoms = src->natoms;
+    I->fname = mstrdup(src->fname);
+    I->index = VLAlloc(int, VLAGetSize(src->index));
+    if(!I->fname || !I->index) {
+      PlugIOStreamFree(I);
+      return NULL;
+    }
+    memcpy(I->index, src->index, sizeof(int) * VLAGetSize(src->index));
+  }
+  return I;
+}
+
+/*
+ * Indexes the frames of a trajectory (skipping over them, with the same
+ * start/interval/stop/max selection as PlugIOManagerLoadTraj) and streams
+ * them into obj from state `frame` on. Returns the number of frames.
+ */
+static int PlugIOStreamTraj(PyMOLGlobals * G, ObjectMolecule * obj,
+                            molfile_plugin_t * plugin, const char *fname,
+                            int natoms, int frame, int interval, int start,
+                            int stop, int max)
+{
+  PlugIOStream *I = Calloc(PlugIOStream, 1);
+  FrameStoreSource source;
+  void *handle;
+  int cnt = 0, icnt, n = 0;
+
+  if(!I)
+    return 0;
+  I->plugin = plugin;
+  I->natoms = natoms;
+  I->fname = mstrdup(fname);
+  I->index = VLAlloc(int, 1000);
+  handle = plugin->open_file_read(fname, plugin->name, &natoms);
+  if(!I->fname || !I->index || !handle) {
+    if(handle)
+      plugin->close_file_read(handle);
+    PlugIOStreamFree(I);
+    return 0;
+  }
+
+  if(interval < 1)
+    interval = 1;
+  icnt = interval;
+  while(!plugin->read_next_timestep(handle, I->natoms, NULL)) {
+    cnt++;
+    if(cnt >= start) {
+      if(--icnt > 0)
+        continue;
+      icnt = interval;
+      VLACheck(I->index, int, n);
+      I->index[n++] = cnt - 1;
+      if((stop > 0 && cnt >= stop) || (max > 0 && n >= max))
+        break;
+    }
+  }
+  plugin->close_file_read(handle);
+  VLASize(I->index, int, n);
+
+  source.data = I;
+  source.read = PlugIOStreamRead;
+  source.copy = PlugIOStreamCopy;
+  source.free = PlugIOStreamFree;
+  if(!n || !FrameStoreStream(obj, frame, n, I->natoms, &source)) {
+    PlugIOStreamFree(I);
+    return 0;
+  }
+  PRINTFB(G, FB_ObjectMolecule, FB_Details)
+    " ObjectMolecule: streaming %d sets into states %d-%d...\n", n, frame + 1, frame + n
+    ENDFB(G);
+  return n;
+}
+
 int PlugIOManagerLoadTraj(PyMOLGlobals * G, ObjectMolecule * obj,
                           const char *fname, int frame,
                           int interval, int average, int start,
@@ -181,6 +328,10 @@ int PlugIOManagerLoadTraj(PyMOLGlobals * G, ObjectMolecule * obj,
       int icnt = interval;
       int n_avg = 0;
       int ncnt = 0;
+      int stored = false;
+      int first_stored = -1;
+      int streaming = (average < 2) &&
+        SettingGet_b(G, obj->Obj.Setting, NULL, cSetting_frame_stream);
       CoordSet *cs = obj->NCSet > 0 ? obj->CSet[0] : obj->CSTmpl ? obj->CSTmpl : NULL;
 
       timestep.coords = NULL;
@@ -217,7 +368,27 @@ int PlugIOManagerLoadTraj(PyMOLGlobals * G, ObjectMolecule * obj,
 
       timestep.coords = (float *) cs->Coord;
 
-      {
+      /* frame_store: keep the frames compact, cs stays the read buffer */
+      if(!obj->Frames) {
+        int format = SettingGet_i(G, obj->Obj.Setting, NULL, cSetting_frame_store);
+        if(format || streaming)
+          obj->Frames = FrameStoreNew(obj, cs, format);
+      }
+
+      /* frame_stream: index the frames now, read them when needed */
+      if(streaming && obj->Frames) {
+        if(frame < 0)
+          frame = obj->NCSet;
+        if(!obj->NCSet)
+          zoom_flag = true;
+        if(PlugIOStreamTraj(G, obj, plugin, fname, natoms, frame, interval,
+                            start, stop, max))
+          first_stored = frame;
+        else
+          streaming = false;
+      }
+
+      if(!streaming) {
 	  /* read_next_timestep fills in &timestep for each iteration; we need
 	   * to copy that out to a new CoordSet, each time. */
           while(!plugin->read_next_timestep(file_handle, natoms, &timestep)) {
@@ -254,6 +425,11 @@ int PlugIOManagerLoadTraj(PyMOLGlobals * G, ObjectMolecule * obj,
                   if(frame < 0) frame = obj->NCSet;
                   if(!obj->NCSet) zoom_flag = true;
 
+                  stored = obj->Frames && FrameStoreAdd(obj, frame, cs);
+                  if(stored) {
+                    if(first_stored < 0)
+                      first_stored = frame;
+                  } else {
 		  /* make sure we have room for 'frame' CoordSet*'s in obj->CSet */
 		  /* TODO: TEST this function */
                   VLACheck(obj->CSet, CoordSet*, frame); /* was CoordSet* */
@@ -264,6 +440,7 @@ int PlugIOManagerLoadTraj(PyMOLGlobals * G, ObjectMolecule * obj,
                     obj->CSet[frame]->fFree();
 		  /* set this state's coordset to cs */
                   obj->CSet[frame] = cs;
+                  }
                   ncnt++;
                   if(average < 2) {
                     PRINTFB(G, FB_ObjectMolecule, FB_Details)
@@ -278,14 +455,17 @@ int PlugIOManagerLoadTraj(PyMOLGlobals * G, ObjectMolecule * obj,
                   }
 
                   if((stop > 0 && cnt >= stop) || (max > 0 && ncnt >= max)) {
-                    cs = NULL;
+                    if(!stored)
+                      cs = NULL;
                     break;
                   }
 
                   frame++;
+                  if(!stored) {
 		  /* make a new cs */
                   cs = CoordSetCopy(cs);        /* otherwise, we need a place to put the next set */
                   timestep.coords = (float *) cs->Coord;
+                  }
                   n_avg = 0;
                 }
               }
@@ -298,6 +478,8 @@ int PlugIOManagerLoadTraj(PyMOLGlobals * G, ObjectMolecule * obj,
         plugin->close_file_read(file_handle);
         if(cs)
           cs->fFree();
+        if(first_stored >= 0)
+          FrameStoreLoad(obj, first_stored);
         SceneChanged(G);
         SceneCountFrames(G);
         if(zoom_flag)
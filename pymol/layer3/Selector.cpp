@@ -34,6 +34,7 @@ Z* -------------------------------------------------------------------
 #include"Selector.h"
 #include"Executive.h"
 #include"ObjectMolecule.h"
+#include"FrameStore.h"
 #include"CoordSet.h"
 #include"DistSet.h"
 #include"Word.h"
@@ -125,12 +126,28 @@ static const char *backbone_names[] = {
   ""
 };
 
+/*
+ * Operands on the evaluation stack are packed bit vectors over the atom
+ * table (bits).  Members normally carry tag 1; when any member of an
+ * ordered selection carries another tag, the full per-atom array is kept
+ * as well (tag).  The selection handlers work on per-atom int arrays
+ * (sele) which only exist while a handler runs, see SelectorEvalExpand
+ * and SelectorEvalPack.  Plain and/or/not are evaluated on the bits.
+ */
+typedef ov_uint64 SeleWord;
+
+#define cSeleWordBits 64
+#define SeleWordCount(n) (((n) + cSeleWordBits - 1) / cSeleWordBits)
+#define SeleBit(bits, a) ((int) (((bits)[(a) / cSeleWordBits] >> ((a) % cSeleWordBits)) & 1))
+
 typedef struct {
   int level, imp_op_level;
   int type;                     /* 0 = value 1 = operation 2 = pre-operation */
   unsigned int code;
   SelectorWordType text;
   int *sele;
+  SeleWord *bits;
+  int *tag;
 } EvalElem;
 
 typedef struct {
@@ -7019,6 +7036,13 @@ int SelectorCreateObjectMolecule(PyMOLGlobals * G, int sele, const char *name,
 
   for(StateIterator iter(G, NULL, source, nCSet); iter.next();) {
     d = iter.state;
+    for(a = cNDummyModels; a < I->NModel; a++) {
+      obj = I->Obj[a];
+      if(obj && obj->Frames) {  /* stored trajectory frames, one at a time */
+        FrameStoreTrim(obj, d, d + 1);
+        FrameStoreLoad(obj, d);
+      }
+    }
     {
       cs2 = CoordSetNew(G);
       c = 0;
@@ -8038,7 +8062,12 @@ int SelectorUpdateTableImpl(PyMOLGlobals * G, CSelector *I, int req_state, int d
         state = -1;
         break;
       }
-    } else {
+    }
+
+    if(state >= 0 && state < obj->NCSet && obj->Frames)
+      FrameStoreLoad(obj, state);       /* stored trajectory frame */
+
+    if(req_state >= 0) {
       if(state >= obj->NCSet)
         skip_flag = true;
       else if(!obj->CSet[state])
@@ -8171,6 +8200,242 @@ static int *SelectorSelect(PyMOLGlobals * G, const char *sele, int state, int do
 }
 
 
+/*========================================================================*/
+/*
+ * Neighbor search for the proximity operators (around, expand, gap,
+ * within, beyond, near_to) against the coordinates of one state.
+ *
+ * With valid table offsets, every coordinate set is searched through its
+ * own neighbor map (CoordSet::Coord2Idx), which stays on the coordinate
+ * set until the coordinates change (cRepInvCoord), so repeated proximity
+ * selections against an unmoved state no longer rebuild a map over the
+ * whole table. Maps of multi-state objects queried across all states are
+ * built per call only, to keep trajectories from doubling their memory.
+ * Without valid offsets, one flagged map over the table is built per call.
+ */
+
+typedef struct {
+  ObjectMolecule *obj;
+  CoordSet *cs;
+  MapType *map;                 /* NULL: scan cs->Coord */
+  int owned;                    /* map is not cached on cs */
+  float min[3], max[3];
+} SeleNbrSet;
+
+typedef struct {
+  int atom;                     /* table offset */
+  const float *v;
+} SeleNbrHit;
+
+typedef struct {
+  PyMOLGlobals *G;
+  float cutoff;
+  MapType *map;                 /* table map, I->Vertex */
+  SeleNbrSet *set;              /* VLA */
+  int n_set;
+  SeleNbrHit *hit;              /* VLA, filled by SelectorNbrFind */
+} SeleNbr;
+
+static void SelectorNbrReset(SeleNbr * nbr)
+{
+  int a;
+  for(a = 0; a < nbr->n_set; a++) {
+    if(nbr->set[a].owned)
+      MapFree(nbr->set[a].map);
+  }
+  nbr->n_set = 0;
+  MapFree(nbr->map);
+  nbr->map = NULL;
+}
+
+static void SelectorNbrFree(SeleNbr * nbr)
+{
+  SelectorNbrReset(nbr);
+  VLAFreeP(nbr->set);
+  VLAFreeP(nbr->hit);
+}
+
+static int SelectorNbrInit(PyMOLGlobals * G, SeleNbr * nbr)
+{
+  int ok = true;
+  nbr->G = G;
+  nbr->cutoff = 0.0F;
+  nbr->map = NULL;
+  nbr->n_set = 0;
+  nbr->set = VLAlloc(SeleNbrSet, 10);
+  CHECKOK(ok, nbr->set);
+  nbr->hit = VLAlloc(SeleNbrHit, 100);
+  CHECKOK(ok, nbr->hit);
+  if(!ok)
+    SelectorNbrFree(nbr);
+  return ok;
+}
+
+
+/*
+ * Prepares the search against state `state`; `cache` allows keeping the
+ * maps of multi-state objects. Returns the number of atoms with
+ * coordinates in that state (nothing to search for if zero).
+ */
+static int SelectorNbrSetup(SeleNbr * nbr, int state, float cutoff, int cache)
+{
+  PyMOLGlobals *G = nbr->G;
+  CSelector *I = G->Selector;
+  ObjectMolecule *obj;
+  CoordSet *cs;
+  MapType *map;
+  ov_size a;
+  int b, at;
+  int n1 = 0;
+
+  SelectorNbrReset(nbr);
+  nbr->cutoff = cutoff;
+  for(a = cNDummyModels; a < I->NModel; a++)
+    if((obj = I->Obj[a]) && obj->Frames)
+      FrameStoreLoad(obj, state);       /* stored trajectory frames */
+  if(I->SeleBaseOffsetsValid) {
+    for(a = cNDummyModels; a < I->NModel; a++) {
+      obj = I->Obj[a];
+      if(!obj || (state >= obj->NCSet) || !(cs = obj->CSet[state]) || !cs->NIndex)
+        continue;
+      VLACheck(nbr->set, SeleNbrSet, nbr->n_set);
+      {
+        SeleNbrSet *set = nbr->set + nbr->n_set++;
+        set->obj = obj;
+        set->cs = cs;
+        set->owned = false;
+        map = NULL;
+        if(cache || (obj->NCSet == 1)) {
+          CoordSetUpdateCoord2IdxMap(cs, cutoff);
+          if((map = cs->Coord2Idx) && !map->CellStart && !MapSetupCells(map, cs->Coord)) {
+            MapFree(map);
+            cs->Coord2Idx = map = NULL;
+          }
+        } else if(cs->NIndex > 10) {
+          map = MapNew(G, cutoff, cs->Coord, cs->NIndex, NULL);
+          if(map && !MapSetupCells(map, cs->Coord)) {
+            MapFree(map);
+            map = NULL;
+          }
+          set->owned = (map != NULL);
+        }
+        set->map = map;
+        if(map) {
+          copy3f(map->Min, set->min);
+          copy3f(map->Max, set->max);
+        } else {
+          const float *v = cs->Coord;
+          copy3f(v, set->min);
+          copy3f(v, set->max);
+          for(b = 1; b < cs->NIndex; b++) {
+            v += 3;
+            if(set->min[0] > v[0]) set->min[0] = v[0];
+            if(set->max[0] < v[0]) set->max[0] = v[0];
+            if(set->min[1] > v[1]) set->min[1] = v[1];
+            if(set->max[1] < v[1]) set->max[1] = v[1];
+            if(set->min[2] > v[2]) set->min[2] = v[2];
+            if(set->max[2] < v[2]) set->max[2] = v[2];
+          }
+        }
+        n1 += cs->NIndex;
+      }
+    }
+  } else {
+    for(a = 0; a < I->NAtom; a++) {
+      I->Flag1[a] = false;
+      at = I->Table[a].atom;
+      obj = I->Obj[I->Table[a].model];
+      if(state < obj->NCSet)
+        cs = obj->CSet[state];
+      else
+        cs = NULL;
+      if(cs) {
+        if(CoordSetGetAtomVertex(cs, at, I->Vertex + 3 * a)) {
+          I->Flag1[a] = true;
+          n1++;
+        }
+      }
+    }
+    if(n1) {
+      map = MapNewFlagged(G, -cutoff, I->Vertex, I->NAtom, NULL, I->Flag1);
+      if(map && !MapSetupCells(map, I->Vertex)) {
+        MapFree(map);
+        map = NULL;
+      }
+      if(!(nbr->map = map))
+        n1 = 0;
+    }
+  }
+  return n1;
+}
+
+
+/*
+ * Collects the atoms within the cutoff of `v` into nbr->hit (with their
+ * coordinates in the state searched) and returns their number.
+ */
+static int SelectorNbrFind(SeleNbr * nbr, const float *v)
+{
+  float cutoff = nbr->cutoff;
+  MapType *map;
+  int a, i, d, e, h, k, l, x, x_stop;
+  int n = 0;
+
+  if((map = nbr->map)) {
+    MapLocus(map, v, &h, &k, &l);
+    for(d = h - 1; d <= h + 1; d++) {
+      for(e = k - 1; e <= k + 1; e++) {
+        MapCellRun(map, d, e, l, x, x_stop);
+        for(; x < x_stop; x++) {
+          if(within3f(map->CellVert + 3 * x, v, cutoff)) {
+            VLACheck(nbr->hit, SeleNbrHit, n);
+            nbr->hit[n].atom = map->CellList[x];
+            nbr->hit[n].v = map->CellVert + 3 * x;
+            n++;
+          }
+        }
+      }
+    }
+  }
+  for(a = 0; a < nbr->n_set; a++) {
+    SeleNbrSet *set = nbr->set + a;
+    const int *idx_to_atm = set->cs->IdxToAtm;
+    int base = set->obj->SeleBase;
+    if((v[0] < set->min[0] - cutoff) || (v[0] > set->max[0] + cutoff) ||
+       (v[1] < set->min[1] - cutoff) || (v[1] > set->max[1] + cutoff) ||
+       (v[2] < set->min[2] - cutoff) || (v[2] > set->max[2] + cutoff))
+      continue;
+    if((map = set->map)) {
+      MapLocus(map, v, &h, &k, &l);
+      for(d = h - 1; d <= h + 1; d++) {
+        for(e = k - 1; e <= k + 1; e++) {
+          MapCellRun(map, d, e, l, x, x_stop);
+          for(; x < x_stop; x++) {
+            if(within3f(map->CellVert + 3 * x, v, cutoff)) {
+              VLACheck(nbr->hit, SeleNbrHit, n);
+              nbr->hit[n].atom = base + idx_to_atm[map->CellList[x]];
+              nbr->hit[n].v = map->CellVert + 3 * x;
+              n++;
+            }
+          }
+        }
+      }
+    } else {
+      const float *coord = set->cs->Coord;
+      for(i = 0; i < set->cs->NIndex; i++) {
+        if(within3f(coord + 3 * i, v, cutoff)) {
+          VLACheck(nbr->hit, SeleNbrHit, n);
+          nbr->hit[n].atom = base + idx_to_atm[i];
+          nbr->hit[n].v = coord + 3 * i;
+          n++;
+        }
+      }
+    }
+  }
+  return n;
+}
+
+
 /*========================================================================*/
 static int SelectorModulate1(PyMOLGlobals * G, EvalElem * base, int state)
 {
@@ -8183,8 +8448,8 @@ static int SelectorModulate1(PyMOLGlobals * G, EvalElem * base, int state)
   CoordSet *cs;
   int ok = true;
   int nCSet;
-  MapType *map;
-  int i, j, h, k, l;
+  SeleNbr nbr;
+  int i, j;
   int n1, at, idx;
   ObjectMolecule *obj;
 
@@ -8207,69 +8472,43 @@ static int SelectorModulate1(PyMOLGlobals * G, EvalElem * base, int state)
   case SELE_EXP_:
     if(!sscanf(base[2].text, "%f", &dist))
       ok = ErrMessage(G, "Selector", "Invalid distance.");
+    if(ok)
+      ok = SelectorNbrInit(G, &nbr);
     if(ok) {
       for(d = 0; d < I->NCSet; d++) {
         if((state < 0) || (d == state)) {
-          n1 = 0;
-          for(a = 0; a < I->NAtom; a++) {
-            I->Flag1[a] = false;
-            at = I->Table[a].atom;
-            obj = I->Obj[I->Table[a].model];
-            if(d < obj->NCSet)
-              cs = obj->CSet[d];
-            else
-              cs = NULL;
-            if(cs) {
-              if(CoordSetGetAtomVertex(cs, at, I->Vertex + 3 * a)) {
-                I->Flag1[a] = true;
-                n1++;
-              }
-            }
-          }
-          if(n1) {
-            map = MapNewFlagged(G, -dist, I->Vertex, I->NAtom, NULL, I->Flag1);
-            if(map) {
-              ok &= MapSetupExpress(map);
-              nCSet = SelectorGetArrayNCSet(G, base[1].sele, false);
-              for(e = 0; ok && e < nCSet; e++) {
-                if((state < 0) || (e == state)) {
-                  for(a = 0; ok && a < I->NAtom; a++) {
-                    if(base[1].sele[a]) {
-                      at = I->Table[a].atom;
-                      obj = I->Obj[I->Table[a].model];
-                      if(e < obj->NCSet)
-                        cs = obj->CSet[e];
-                      else
-                        cs = NULL;
-                      if(cs) {
-                        idx = cs->atmToIdx(at);
-                        if(idx >= 0) {
-                          v2 = cs->Coord + (3 * idx);
-                          MapLocus(map, v2, &h, &k, &l);
-                          i = *(MapEStart(map, h, k, l));
-                          if(i) {
-                            j = map->EList[i++];
-                            while(j >= 0) {
-                              if((!base[0].sele[j]) && ((base[1].code == SELE_EXP_)
-                                                        || (!base[1].sele[j]))) {   
-                                /*exclude current selection */
-                                if(within3f(I->Vertex + 3 * j, v2, dist))
-                                  base[0].sele[j] = true;
-                              }
-                              j = map->EList[i++];
-                            }
-                          }
+          if(SelectorNbrSetup(&nbr, d, dist, state >= 0)) {
+            nCSet = SelectorGetArrayNCSet(G, base[1].sele, false);
+            for(e = 0; ok && e < nCSet; e++) {
+              if((state < 0) || (e == state)) {
+                for(a = 0; ok && a < I->NAtom; a++) {
+                  if(base[1].sele[a]) {
+                    at = I->Table[a].atom;
+                    obj = I->Obj[I->Table[a].model];
+                    if(e < obj->NCSet)
+                      cs = obj->CSet[e];
+                    else
+                      cs = NULL;
+                    if(cs) {
+                      idx = cs->atmToIdx(at);
+                      if(idx >= 0) {
+                        v2 = cs->Coord + (3 * idx);
+                        n1 = SelectorNbrFind(&nbr, v2);
+                        for(i = 0; i < n1; i++) {
+                          j = nbr.hit[i].atom;
+                          if((base[1].code == SELE_EXP_) || (!base[1].sele[j]))
+                            base[0].sele[j] = true;     /*exclude current selection */
                         }
                       }
                     }
                   }
                 }
               }
-              MapFree(map);
             }
           }
         }
       }
+      SelectorNbrFree(&nbr);
     }
     break;
 
@@ -8312,6 +8551,8 @@ static int SelectorModulate1(PyMOLGlobals * G, EvalElem * base, int state)
   case SELE_GAP_:
     if(!sscanf(base[2].text, "%f", &dist))
       ok = ErrMessage(G, "Selector", "Invalid distance.");
+    if(ok)
+      ok = SelectorNbrInit(G, &nbr);
     if(ok) {
       for(a = 0; a < I->NAtom; a++) {
         obj = I->Obj[I->Table[a].model];
@@ -8322,62 +8563,35 @@ static int SelectorModulate1(PyMOLGlobals * G, EvalElem * base, int state)
       }
       for(d = 0; d < I->NCSet; d++) {
         if((state < 0) || (d == state)) {
-          n1 = 0;
-          for(a = 0; a < I->NAtom; a++) {
-            obj = I->Obj[I->Table[a].model];
-            I->Flag1[a] = false;
-            at = I->Table[a].atom;
-            if(d < obj->NCSet)
-              cs = obj->CSet[d];
-            else
-              cs = NULL;
-            if(cs) {
-              if(CoordSetGetAtomVertex(cs, at, I->Vertex + 3 * a)) {
-                I->Flag1[a] = true;
-                n1++;
-              }
-            }
-          }
-          if(n1) {
-            map =
-              MapNewFlagged(G, -(dist + 2 * MAX_VDW), I->Vertex, I->NAtom, NULL,
-                            I->Flag1);
-            if(map) {
-
-              ok &= MapSetupExpress(map);
-              nCSet = SelectorGetArrayNCSet(G, base[1].sele, false);
-              for(e = 0; ok && e < nCSet; e++) {
-                if((state < 0) || (e == state)) {
-                  for(a = 0; a < I->NAtom; a++) {
-                    if(base[1].sele[a]) {
-                      at = I->Table[a].atom;
-                      obj = I->Obj[I->Table[a].model];
-                      if(e < obj->NCSet)
-                        cs = obj->CSet[e];
-                      else
-                        cs = NULL;
-                      if(cs) {
-                        idx = cs->atmToIdx(at);
-
-                        if(idx >= 0) {
-                          v2 = cs->Coord + (3 * idx);
-                          MapLocus(map, v2, &h, &k, &l);
-                          i = *(MapEStart(map, h, k, l));
-                          if(i) {
-                            j = map->EList[i++];
-                            while(j >= 0) {
-                              if((base[0].sele[j]) && (!base[1].sele[j])) {     /*exclude current selection */
-                                if(within3f(I->Vertex + 3 * j, v2, dist +       /* eliminate atoms w/o gap */
-                                            I->Table[a].f1 + I->Table[j].f1)) {
-                                  base[0].sele[j] = false;
-                                  c--;
-                                }
-                              } else if(base[1].sele[j]) {
-                                base[0].sele[j] = false;
-                                c--;
-                              }
-                              j = map->EList[i++];
+          if(SelectorNbrSetup(&nbr, d, dist + 2 * MAX_VDW, state >= 0)) {
+            nCSet = SelectorGetArrayNCSet(G, base[1].sele, false);
+            for(e = 0; ok && e < nCSet; e++) {
+              if((state < 0) || (e == state)) {
+                for(a = 0; a < I->NAtom; a++) {
+                  if(base[1].sele[a]) {
+                    at = I->Table[a].atom;
+                    obj = I->Obj[I->Table[a].model];
+                    if(e < obj->NCSet)
+                      cs = obj->CSet[e];
+                    else
+                      cs = NULL;
+                    if(cs) {
+                      idx = cs->atmToIdx(at);
+
+                      if(idx >= 0) {
+                        v2 = cs->Coord + (3 * idx);
+                        n1 = SelectorNbrFind(&nbr, v2);
+                        for(i = 0; i < n1; i++) {
+                          j = nbr.hit[i].atom;
+                          if((base[0].sele[j]) && (!base[1].sele[j])) {     /*exclude current selection */
+                            if(within3f(nbr.hit[i].v, v2, dist +    /* eliminate atoms w/o gap */
+                                        I->Table[a].f1 + I->Table[j].f1)) {
+                              base[0].sele[j] = false;
+                              c--;
                             }
+                          } else if(base[1].sele[j]) {
+                            base[0].sele[j] = false;
+                            c--;
                           }
                         }
                       }
@@ -8385,11 +8599,11 @@ static int SelectorModulate1(PyMOLGlobals * G, EvalElem * base, int state)
                   }
                 }
               }
-              MapFree(map);
             }
           }
         }
       }
+      SelectorNbrFree(&nbr);
     }
     break;
   }
@@ -10452,8 +10666,8 @@ int SelectorOperator22(PyMOLGlobals * G, EvalElem * base, int state)
   CoordSet *cs;
   int ok = true;
   int nCSet;
-  MapType *map;
-  int i, j, h, k, l;
+  SeleNbr nbr;
+  int i, j;
   int n1, at, idx;
   int code = base[1].code;
 
@@ -10482,69 +10696,45 @@ int SelectorOperator22(PyMOLGlobals * G, EvalElem * base, int state)
         base[0].sele[a] = false;
       }
 
-      for(d = 0; d < I->NCSet; d++) {
+      if(ok)
+        ok = SelectorNbrInit(G, &nbr);
+      for(d = 0; ok && d < I->NCSet; d++) {
         if((state < 0) || (d == state)) {
-          n1 = 0;
-          for(a = 0; a < I->NAtom; a++) {
-            I->Flag1[a] = false;
-            at = I->Table[a].atom;
-            obj = I->Obj[I->Table[a].model];
-            if(d < obj->NCSet)
-              cs = obj->CSet[d];
-            else
-              cs = NULL;
-            if(cs) {
-              if(CoordSetGetAtomVertex(cs, at, I->Vertex + 3 * a)) {
-                I->Flag1[a] = true;
-                n1++;
-              }
-            }
-          }
-          if(n1) {
-            map = MapNewFlagged(G, -dist, I->Vertex, I->NAtom, NULL, I->Flag1);
-            if(map) {
-              ok &= MapSetupExpress(map);
-              nCSet = SelectorGetArrayNCSet(G, base[4].sele, false);
-              for(e = 0; ok && e < nCSet; e++) {
-                if((state < 0) || (e == state)) {
-                  for(a = 0; a < I->NAtom; a++) {
-                    if(base[4].sele[a]) {
-                      at = I->Table[a].atom;
-                      obj = I->Obj[I->Table[a].model];
-                      if(e < obj->NCSet)
-                        cs = obj->CSet[e];
-                      else
-                        cs = NULL;
-                      if(cs) {
-                        idx = cs->atmToIdx(at);
-                        if(idx >= 0) {
-                          v2 = cs->Coord + (3 * idx);
-                          MapLocus(map, v2, &h, &k, &l);
-                          i = *(MapEStart(map, h, k, l));
-                          if(i) {
-                            j = map->EList[i++];
-
-                            while(j >= 0) {
-                              if(!base[0].sele[j])
-                                if(I->Flag2[j])
-                                  if(within3f(I->Vertex + 3 * j, v2, dist)) {
-                                    if((code != SELE_NTO_) || (!base[4].sele[j]))
-                                      base[0].sele[j] = true;
-                                  }
-                              j = map->EList[i++];
-                            }
-                          }
+          if(SelectorNbrSetup(&nbr, d, dist, state >= 0)) {
+            nCSet = SelectorGetArrayNCSet(G, base[4].sele, false);
+            for(e = 0; ok && e < nCSet; e++) {
+              if((state < 0) || (e == state)) {
+                for(a = 0; a < I->NAtom; a++) {
+                  if(base[4].sele[a]) {
+                    at = I->Table[a].atom;
+                    obj = I->Obj[I->Table[a].model];
+                    if(e < obj->NCSet)
+                      cs = obj->CSet[e];
+                    else
+                      cs = NULL;
+                    if(cs) {
+                      idx = cs->atmToIdx(at);
+                      if(idx >= 0) {
+                        v2 = cs->Coord + (3 * idx);
+                        n1 = SelectorNbrFind(&nbr, v2);
+                        for(i = 0; i < n1; i++) {
+                          j = nbr.hit[i].atom;
+                          if(!base[0].sele[j])
+                            if(I->Flag2[j])
+                              if((code != SELE_NTO_) || (!base[4].sele[j]))
+                                base[0].sele[j] = true;
                         }
                       }
                     }
                   }
                 }
               }
-              MapFree(map);
             }
           }
         }
       }
+      if(ok)
+        SelectorNbrFree(&nbr);
       if(code == SELE_BEY_) {
         for(a = 0; a < I->NAtom; a++) {
           if(I->Flag2[a])
@@ -10633,6 +10823,157 @@ static void remove_quotes(char *st)
   e->type = (e->code & 0xF); \
 }
 
+/*========================================================================*/
+static int SeleWordBitCount(SeleWord w)
+{
+#ifdef __GNUC__
+  return __builtin_popcountll(w);
+#else
+  int c = 0;
+  while(w) {
+    w &= w - 1;
+    c++;
+  }
+  return c;
+#endif
+}
+
+static int SelectorEvalCount(PyMOLGlobals * G, EvalElem * e)
+{
+  int a, c = 0;
+  int n_word = SeleWordCount(G->Selector->NAtom);
+  for(a = 0; a < n_word; a++)
+    c += SeleWordBitCount(e->bits[a]);
+  return c;
+}
+
+/* replaces the bits of an operand with the int array handlers work on */
+static int SelectorEvalExpand(PyMOLGlobals * G, EvalElem * e)
+{
+  int n_atom = G->Selector->NAtom;
+  int a;
+  if(e->tag) {
+    e->sele = e->tag;
+    e->tag = NULL;
+  } else {
+    e->sele = Alloc(int, n_atom + 1);
+    if(!e->sele)
+      return false;
+    for(a = 0; a < n_atom; a++)
+      e->sele[a] = SeleBit(e->bits, a);
+  }
+  FreeP(e->bits);
+  return true;
+}
+
+/*
+ * Packs the int array left by a handler into bits.  The array itself is
+ * only kept when it carries tags other than 1.
+ */
+static int SelectorEvalPack(PyMOLGlobals * G, EvalElem * e, int ok)
+{
+  int n_atom = G->Selector->NAtom;
+  int a, tagged = false;
+  e->bits = NULL;
+  e->tag = NULL;
+  if(ok) {
+    e->bits = Calloc(SeleWord, SeleWordCount(n_atom) + 1);
+    ok = (e->bits != NULL);
+  }
+  if(ok) {
+    for(a = 0; a < n_atom; a++) {
+      int value = e->sele[a];
+      if(value) {
+        e->bits[a / cSeleWordBits] |= ((SeleWord) 1) << (a % cSeleWordBits);
+        if(value != 1)
+          tagged = true;
+      }
+    }
+    if(tagged) {
+      e->tag = e->sele;
+      e->sele = NULL;
+    }
+  }
+  FreeP(e->sele);
+  return ok;
+}
+
+static void SelectorEvalPurge(EvalElem * e)
+{
+  FreeP(e->sele);
+  FreeP(e->bits);
+  FreeP(e->tag);
+}
+
+static int SelectorEvalLogic1(PyMOLGlobals * G, EvalElem * base, int state)
+{
+  int ok;
+  if((base[0].code == SELE_NOT1) && !base[1].tag) {
+    int n_atom = G->Selector->NAtom;
+    int a, n_word = SeleWordCount(n_atom);
+    SeleWord *bits = base[1].bits;
+    for(a = 0; a < n_word; a++)
+      bits[a] = ~bits[a];
+    if(n_atom % cSeleWordBits)
+      bits[n_word - 1] &= (((SeleWord) 1) << (n_atom % cSeleWordBits)) - 1;
+    base[0].type = STYP_LIST;
+    base[0].sele = NULL;
+    base[0].tag = NULL;
+    base[0].bits = bits;
+    base[1].bits = NULL;
+    PRINTFD(G, FB_Selector)
+      " SelectorLogic1: %d atoms selected.\n", SelectorEvalCount(G, base) ENDFD;
+    return true;
+  }
+  base[0].sele = NULL;
+  ok = SelectorEvalExpand(G, base + 1);
+  if(ok)
+    ok = SelectorLogic1(G, base, state);
+  return SelectorEvalPack(G, base, ok);
+}
+
+static int SelectorEvalLogic2(PyMOLGlobals * G, EvalElem * base)
+{
+  int ok;
+  if(!(base[0].tag || base[2].tag)) {
+    SeleWord *bits0 = base[0].bits, *bits2 = base[2].bits;
+    int a, n_word = SeleWordCount(G->Selector->NAtom);
+    int done = true;
+    /* with all tags 1, the higher tag rule reduces to plain logic */
+    switch (base[1].code) {
+    case SELE_OR_2:
+    case SELE_IOR2:
+      for(a = 0; a < n_word; a++)
+        bits0[a] |= bits2[a];
+      break;
+    case SELE_AND2:
+      for(a = 0; a < n_word; a++)
+        bits0[a] &= bits2[a];
+      break;
+    case SELE_ANT2:
+      for(a = 0; a < n_word; a++)
+        bits0[a] &= ~bits2[a];
+      break;
+    default:
+      done = false;
+      break;
+    }
+    if(done) {
+      FreeP(base[2].bits);
+      PRINTFD(G, FB_Selector)
+        " SelectorLogic2: %d atoms selected.\n", SelectorEvalCount(G, base) ENDFD;
+      return true;
+    }
+  }
+  ok = SelectorEvalExpand(G, base);
+  if(ok)
+    ok = SelectorEvalExpand(G, base + 2);
+  if(ok)
+    ok = SelectorLogic2(G, base);
+  FreeP(base[2].sele);
+  return SelectorEvalPack(G, base, ok);
+}
+
 /*========================================================================*/
 int *SelectorEvaluate(PyMOLGlobals * G, SelectorWordType * word, int state, int quiet)
 {
@@ -10852,7 +11193,7 @@ int *SelectorEvaluate(PyMOLGlobals * G, SelectorWordType * word, int state, int
       PRINTFD(G, FB_Selector)
         " Selector initial stack %d-%p lv: %x co: %d type: %x sele %p\n",
         a, (void *) (Stack + a), Stack[a].level, Stack[a].code,
-        Stack[a].type, (void *) Stack[a].sele ENDFD;
+        Stack[a].type, (void *) Stack[a].bits ENDFD;
 
       if(Stack[a].level > maxLevel)
         maxLevel = Stack[a].level;
@@ -10874,7 +11215,7 @@ int *SelectorEvaluate(PyMOLGlobals * G, SelectorWordType * word, int state, int
             " Selector: lvl: %d de:%d-%p slv:%d co: %x typ %x sele %p td: %d\n",
             level, depth, (void *) (Stack + depth), Stack[depth].level,
             Stack[depth].code,
-            Stack[depth].type, (void *) Stack[depth].sele, totDepth ENDFD;
+            Stack[depth].type, (void *) Stack[depth].bits, totDepth ENDFD;
 
           opFlag = false;
 
@@ -10885,7 +11226,9 @@ int *SelectorEvaluate(PyMOLGlobals * G, SelectorWordType * word, int state, int
             if(depth > 0)
               if((!opFlag) && (Stack[depth].type == STYP_SEL0)) {
                 opFlag = true;
+                Stack[depth].sele = NULL;
                 ok = SelectorSelect0(G, &Stack[depth]);
+                ok = SelectorEvalPack(G, &Stack[depth], ok);
               }
           if(ok)
             if(depth > 1)
@@ -10894,7 +11237,9 @@ int *SelectorEvaluate(PyMOLGlobals * G, SelectorWordType * word, int state, int
                    && (Stack[depth].type == STYP_VALU)) {
                   /* 1 argument selection operator */
                   opFlag = true;
+                  Stack[depth - 1].sele = NULL;
                   ok = SelectorSelect1(G, &Stack[depth - 1], quiet);
+                  ok = SelectorEvalPack(G, &Stack[depth - 1], ok);
                   for(a = depth + 1; a <= totDepth; a++)
                     Stack[a - 1] = Stack[a];
                   totDepth--;
@@ -10902,7 +11247,7 @@ int *SelectorEvaluate(PyMOLGlobals * G, SelectorWordType * word, int state, int
                           && (Stack[depth].type == STYP_LIST)) {
                   /* 1 argument logical operator */
                   opFlag = true;
-                  ok = SelectorLogic1(G, &Stack[depth - 1], state);
+                  ok = SelectorEvalLogic1(G, &Stack[depth - 1], state);
                   for(a = depth + 1; a <= totDepth; a++)
                     Stack[a - 1] = Stack[a];
                   totDepth--;
@@ -10921,6 +11266,8 @@ int *SelectorEvaluate(PyMOLGlobals * G, SelectorWordType * word, int state, int
                   Stack[depth].code = SELE_IOR2;
                   Stack[depth].level = Stack[depth].imp_op_level;
                   Stack[depth].sele = NULL;
+                  Stack[depth].bits = NULL;
+                  Stack[depth].tag = NULL;
                   Stack[depth].text[0] = 0;
                   if(level < Stack[depth].level)
                     level = Stack[depth].level;
@@ -10936,7 +11283,7 @@ int *SelectorEvaluate(PyMOLGlobals * G, SelectorWordType * word, int state, int
                    && (Stack[depth].type == STYP_LIST)
                    && (Stack[depth - 2].type == STYP_LIST)) {
                   /* 2 argument logical operator */
-                  ok = SelectorLogic2(G, &Stack[depth - 2]);
+                  ok = SelectorEvalLogic2(G, &Stack[depth - 2]);
                   opFlag = true;
                   for(a = depth + 1; a <= totDepth; a++)
                     Stack[a - 2] = Stack[a];
@@ -10945,7 +11292,10 @@ int *SelectorEvaluate(PyMOLGlobals * G, SelectorWordType * word, int state, int
                           && (Stack[depth].type == STYP_PVAL)
                           && (Stack[depth - 2].type == STYP_LIST)) {
                   /* 2 argument logical operator */
-                  ok = SelectorModulate1(G, &Stack[depth - 2], state);
+                  ok = SelectorEvalExpand(G, &Stack[depth - 2]);
+                  if(ok)
+                    ok = SelectorModulate1(G, &Stack[depth - 2], state);
+                  ok = SelectorEvalPack(G, &Stack[depth - 2], ok);
                   opFlag = true;
                   for(a = depth + 1; a <= totDepth; a++)
                     Stack[a - 2] = Stack[a];
@@ -10961,7 +11311,9 @@ int *SelectorEvaluate(PyMOLGlobals * G, SelectorWordType * word, int state, int
                    && (Stack[depth - 1].type == STYP_VALU)
                    && (Stack[depth].type == STYP_VALU)) {
                   /* 2 argument value operator */
+                  Stack[depth - 2].sele = NULL;
                   ok = SelectorSelect2(G, &Stack[depth - 2], state);
+                  ok = SelectorEvalPack(G, &Stack[depth - 2], ok);
                   opFlag = true;
                   for(a = depth + 1; a <= totDepth; a++)
                     Stack[a - 2] = Stack[a];
@@ -10979,7 +11331,9 @@ int *SelectorEvaluate(PyMOLGlobals * G, SelectorWordType * word, int state, int
                    && (Stack[depth - 1].type == STYP_VALU)
                    && (Stack[depth - 2].type == STYP_VALU)) {
                   /* 2 argument logical operator */
-                  ok = SelectorSelect3(G, &Stack[depth-3], state);
+                  Stack[depth - 3].sele = NULL;
+                  ok = SelectorSelect3(G, &Stack[depth - 3], state);
+                  ok = SelectorEvalPack(G, &Stack[depth - 3], ok);
                   opFlag = true;
                   for(a = depth + 1; a <= totDepth; a++)
                     Stack[a - 3] = Stack[a];
@@ -10999,7 +11353,13 @@ int *SelectorEvaluate(PyMOLGlobals * G, SelectorWordType * word, int state, int
                    && (Stack[depth].type == STYP_LIST)
                    && (Stack[depth - 4].type == STYP_LIST)) {
 
-                  ok = SelectorOperator22(G, &Stack[depth - 4], state);
+                  ok = SelectorEvalExpand(G, &Stack[depth - 4]);
+                  if(ok)
+                    ok = SelectorEvalExpand(G, &Stack[depth]);
+                  if(ok)
+                    ok = SelectorOperator22(G, &Stack[depth - 4], state);
+                  FreeP(Stack[depth].sele);
+                  ok = SelectorEvalPack(G, &Stack[depth - 4], ok);
                   opFlag = true;
                   for(a = depth + 1; a <= totDepth; a++)
                     Stack[a - 4] = Stack[a];
@@ -11028,15 +11388,17 @@ int *SelectorEvaluate(PyMOLGlobals * G, SelectorWordType * word, int state, int
 	ok = ErrMessage(G, "Selector", "Malformed selection.");
     } else if(Stack[depth].type != STYP_LIST)
 	ok = ErrMessage(G, "Selector", "Invalid selection.");
-    else
+    else if((ok = SelectorEvalExpand(G, &Stack[totDepth]))) {
       result = Stack[totDepth].sele;    /* return the selection list */
+      Stack[totDepth].sele = NULL;
+    }
   }
   if(!ok) {
     for(a = 1; a <= depth; a++) {
       PRINTFD(G, FB_Selector)
-        " Selector: releasing %d %x %p\n", a, Stack[a].type, (void *) Stack[a].sele ENDFD;
+        " Selector: releasing %d %x %p\n", a, Stack[a].type, (void *) Stack[a].bits ENDFD;
       if(Stack[a].type == STYP_LIST)
-        FreeP(Stack[a].sele);
+        SelectorEvalPurge(Stack + a);
     }
     depth = 0;
     {
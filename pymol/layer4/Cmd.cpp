@@ -75,6 +75,7 @@ Z* -------------------------------------------------------------------
 #include"Editor.h"
 #include"Wizard.h"
 #include"SculptCache.h"
+#include"MemoryCache.h"
 #include"TestPyMOL.h"
 #include"Color.h"
 #include"Seq.h"
@@ -759,7 +760,7 @@ static PyObject * CmdGetVolumeField(PyObject * self, PyObject * args)
     API_HANDLE_ERROR;
   }
   if(ok && (ok = APIEnterBlockedNotModal(G))) {
-    CField * field = ExecutiveGetVolumeField(G, objName, state);
+    CField * field = ExecutiveGetVolumeField(G, objName, state, !copy);
     if (field) {
       result = FieldAsNumPyArray(field, copy);
     }
@@ -1885,6 +1886,40 @@ static PyObject *CmdGetRenderer(PyObject * self, PyObject * args)
   return Py_BuildValue("(sss)", vendor, renderer, version);
 }
 
+static PyObject *CmdGetMemoryCacheStats(PyObject * self, PyObject * args)
+{
+  PyMOLGlobals *G = NULL;
+  PyObject *result = NULL;
+  int reset = 0;
+  int ok = false;
+  ok = PyArg_ParseTuple(args, "Oi", &self, &reset);
+  if(ok) {
+    API_SETUP_PYMOL_GLOBALS;
+    ok = (G != NULL);
+  } else {
+    API_HANDLE_ERROR;
+  }
+  if(ok && (ok = APIEnterNotModal(G))) {
+    MemoryCacheStats stats;
+    int a;
+    MemoryCacheGetStats(G, &stats, reset);
+    APIExit(G);
+
+    /* (pooled bytes, limit bytes, [(slot, hits, misses), ...]) */
+    result = PyList_New(0);
+    for(a = 0; a < cMemoryCache_max_block; a++) {
+      if(stats.Hit[a] || stats.Miss[a]) {
+        PyObject *item = Py_BuildValue("(iII)", a, stats.Hit[a], stats.Miss[a]);
+        PyList_Append(result, item);
+        Py_DECREF(item);
+      }
+    }
+    result = Py_BuildValue("(KKN)", (unsigned long long) stats.Pooled,
+                           (unsigned long long) stats.Limit, result);
+  }
+  return APIAutoNone(result);
+}
+
 #include <PyMOLBuildInfo.h>
 
 static PyObject *CmdGetVersion(PyObject * self, PyObject * args)
@@ -8413,6 +8448,7 @@ static PyMethodDef Cmd_methods[] = {
   {"get_idtf", CmdGetIdtf, METH_VARARGS},
   {"get_legal_name", CmdGetLegalName, METH_VARARGS},
   {"get_matrix", CmdGetMatrix, METH_VARARGS},
+  {"get_memory_cache_stats", CmdGetMemoryCacheStats, METH_VARARGS},
   {"get_min_max", CmdGetMinMax, METH_VARARGS},
   {"get_mtl_obj", CmdGetMtlObj, METH_VARARGS},
   {"get_model", CmdGetModel, METH_VARARGS},
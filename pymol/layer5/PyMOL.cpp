@@ -28,6 +28,7 @@
 
 #include "MemoryDebug.h"
 #include "MemoryCache.h"
+#include "ThreadPool.h"
 #include "Err.h"
 #include "Util.h"
 #include "Selector.h"
@@ -115,6 +116,28 @@ extern CPyMOLOptions *MacPyMOLOption;
 #endif
 #define IDLE_AND_READY 3
 
+#ifndef _PYMOL_NO_CXX11
+#include <mutex>
+#endif
+
+/* progressive ray tracing preview; has its own lock since the ray call
+   which publishes it holds the API lock */
+typedef struct _CPyMOLPreview {
+#ifndef _PYMOL_NO_CXX11
+  std::mutex Mutex;
+#endif
+  unsigned int *Data;
+  int Width, Height;
+  int Ready;
+} CPyMOLPreview;
+
+#ifndef _PYMOL_NO_CXX11
+#define PYMOL_PREVIEW_LOCK(P) std::lock_guard<std::mutex> preview_lock_((P)->Mutex)
+#else
+/* without native threads the host can't poll while a ray call runs */
+#define PYMOL_PREVIEW_LOCK(P)
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -134,6 +157,7 @@ typedef struct _CPyMOL {
   int ClickedIndex, ClickedButton, ClickedModifiers, ClickedX, ClickedY, ClickedHavePos, ClickedPosState;
   float ClickedPos[3];
   int ImageRequestedFlag, ImageReadyFlag;
+  CPyMOLPreview *Preview;
   int DraggedFlag;
   int Reshape[PYMOL_RESHAPE_SIZE];
   int Progress[PYMOL_PROGRESS_SIZE];
@@ -1957,6 +1981,65 @@ int PyMOL_GetProgressChanged(CPyMOL * I, int reset)
   return result;
 }
 
+void PyMOL_SetRayPreview(CPyMOL * I, const unsigned int *image, int width, int height)
+{                               /* API lock intentionally omitted */
+  CPyMOLPreview *P = I ? I->Preview : NULL;
+  if(!P)
+    return;
+  PYMOL_PREVIEW_LOCK(P);
+  if(!image) {
+    FreeP(P->Data);
+    P->Width = P->Height = 0;
+    P->Ready = false;
+    return;
+  }
+  if(!P->Data || (P->Width != width) || (P->Height != height)) {
+    FreeP(P->Data);
+    P->Data = Alloc(unsigned int, width * height);
+    if(!P->Data) {
+      P->Width = P->Height = 0;
+      P->Ready = false;
+      return;
+    }
+    P->Width = width;
+    P->Height = height;
+  }
+  memcpy(P->Data, image, sizeof(unsigned int) * width * height);
+  P->Ready = true;
+}
+
+int PyMOL_GetRayPreviewInfo(CPyMOL * I, int *width, int *height)
+{                               /* API lock intentionally omitted */
+  CPyMOLPreview *P = I->Preview;
+  int result = false;
+  *width = *height = 0;
+  if(P) {
+    PYMOL_PREVIEW_LOCK(P);
+    *width = P->Width;
+    *height = P->Height;
+    result = P->Ready;
+  }
+  return result;
+}
+
+int PyMOL_GetRayPreview(CPyMOL * I, int width, int height, int row_bytes, void *buffer)
+{                               /* API lock intentionally omitted */
+  CPyMOLPreview *P = I->Preview;
+  int ok = false;
+  if(P && buffer && (row_bytes >= 4 * width)) {
+    PYMOL_PREVIEW_LOCK(P);
+    if(P->Data && (P->Width == width) && (P->Height == height)) {
+      int y;
+      for(y = 0; y < height; y++)
+        memcpy(((char *) buffer) + (size_t) row_bytes * y, P->Data + width * y,
+               4 * width);
+      P->Ready = false;
+      ok = true;
+    }
+  }
+  return get_status_ok(ok);
+}
+
 static CPyMOL *_PyMOL_New(void)
 {
   CPyMOL *result = NULL;
@@ -1965,6 +2048,8 @@ static CPyMOL *_PyMOL_New(void)
 
   if((result = Calloc(CPyMOL, 1))) {    /* all values initialized to zero */
 
+    result->Preview = new CPyMOLPreview();
+
     if((result->G = Calloc(PyMOLGlobals, 1))) {
 
       result->G->PyMOL = result;        /* store the instance pointer */
@@ -2048,6 +2133,7 @@ void PyMOL_Start(CPyMOL * I)
 #include "lex_constants.h"
 
   MemoryCacheInit(G);
+  ThreadPoolInit(G);
   FeedbackInit(G, G->Option->quiet);
   WordInit(G);
   UtilInit(G);
@@ -2149,6 +2235,8 @@ void PyMOL_Stop(CPyMOL * I)
 {
   PyMOLGlobals *G = I->G;
   G->Terminating = true;
+  ThreadPoolFree(G);
+  RayCacheFree(G);
   TetsurfFree(G);
   IsosurfFree(G);
   WizardFree(G);
@@ -2203,6 +2291,10 @@ void PyMOL_Free(CPyMOL * I)
     SingletonPyMOLGlobals = NULL;
 #endif
 
+  if(I->Preview) {
+    FreeP(I->Preview->Data);
+    delete I->Preview;
+  }
   FreeP(I->G);
   FreeP(I);
   return;
@@ -326,6 +326,15 @@ void PyMOL_SetProgress(CPyMOL * I, int offset, int current, int range);
 int PyMOL_GetProgress(CPyMOL * I, int *progress, int reset);
 int PyMOL_GetProgressChanged(CPyMOL * I, int reset);
 
+/* progressive ray tracing: the latest preview of the image being traced.
+   These don't take the API lock, so hosts may poll them while a ray call
+   is running. The info call returns true if a preview has been published
+   since the last fetch; the data are RGBA rows, bottom row first, gamma
+   applied. Passing NULL to the setter drops the preview. */
+void PyMOL_SetRayPreview(CPyMOL * I, const unsigned int *image, int width, int height);
+int PyMOL_GetRayPreviewInfo(CPyMOL * I, int *width, int *height);
+int PyMOL_GetRayPreview(CPyMOL * I, int width, int height, int row_bytes, void *buffer);
+
 int PyMOL_GetInterrupt(CPyMOL * I, int reset);
 void PyMOL_SetInterrupt(CPyMOL * I, int value);
 
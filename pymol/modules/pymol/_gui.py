@@ -630,6 +630,7 @@ class PyMOLDesktopGUI(object):
                     ('radio', 'Dot', 'surface_type', 1),
                     ('radio', 'Wireframe', 'surface_type', 2),
                     ('radio', 'Solid', 'surface_type', 0),
+                    ('radio', 'Solid (Distance Field)', 'surface_type', 7),
                     ('separator',),
                     ('radio', 'Cavities and Pockets Only', 'surface_cavity_mode', 1),
                     ('radio', 'Cavities and Pockets (Culled)', 'surface_cavity_mode', 2),
@@ -12,6 +12,25 @@ def get_progress(reset=0,_self=cmd):
         _self.unlock_status(_self)
     return r
 
+def get_memory_cache_stats(reset=0,_self=cmd):
+    '''
+DESCRIPTION
+
+    "get_memory_cache_stats" returns the state of the ray tracing and
+    map buffer pool (see settings "cache_memory" and "cache_memory_max")
+    as a dictionary: "pooled" and "limit" in MB, and "slots", which maps
+    each cache slot id to a (hits, misses) tuple.
+
+    With reset=1, the hit and miss counters are cleared afterwards.
+    '''
+    with _self.lockcm:
+        r = _cmd.get_memory_cache_stats(_self._COb,int(reset))
+    return {
+        'pooled': r[0] / 1048576.0,
+        'limit': r[1] / 1048576.0,
+        'slots': dict((slot, (hits, misses)) for (slot, hits, misses) in r[2]),
+    }
+
 def check_redundant_open(file,_self=cmd):
     found = 0
     for a in _self._pymol.invocation.options.deferred:
@@ -0,0 +1,44 @@
+#
+# ray tracing benchmark: voxel map versus bounding volume hierarchy
+# (ray_bvh) on large cartoon + surface scenes
+#
+
+import time
+from pymol import cmd
+
+cmd.set("auto_zoom","off")
+cmd.set("surface_quality",1)
+
+def build(copies):
+   cmd.delete("all")
+   for a in range(copies):
+      name = "prot%02d"%a
+      cmd.load("dat/1tii.pdb",name)
+      cmd.translate([(a%3)*70.0,(a//3)*70.0,0.0],object=name)
+   cmd.hide()
+   cmd.show("cartoon")
+   cmd.show("surface","chain A")
+   cmd.set("transparency",0.3)
+   # tiny label quads next to big surface triangles
+   cmd.label("name CA and resi 1-40","resn")
+   cmd.orient()
+
+def bench(width,height,ortho,shadows):
+   cmd.set("orthoscopic",ortho)
+   cmd.set("ray_shadow",shadows)
+   result = []
+   for bvh in (0,1):
+      cmd.set("ray_bvh",bvh)
+      cmd.ray(width,height) # warm up: builds surfaces & caches
+      start = time.time()
+      cmd.ray(width,height)
+      result.append(time.time()-start)
+   print("%dx%d ortho=%d shadows=%d: map %6.2f sec, bvh %6.2f sec (%4.2fx)"%(
+      width,height,ortho,shadows,result[0],result[1],result[0]/max(result[1],1e-6)))
+
+for copies in (1,3,6):
+   build(copies)
+   print("copies: %d, atoms: %d"%(copies,cmd.count_atoms()))
+   for ortho in (1,0):
+      for shadows in (0,1):
+         bench(1024,768,ortho,shadows)
@@ -0,0 +1,40 @@
+#
+# ray tracing benchmark: rebuilding versus refitting the bounding volume
+# hierarchy (ray_bvh_reuse) when only the camera moves between frames
+#
+
+import time
+from pymol import cmd
+
+cmd.set("auto_zoom","off")
+cmd.set("surface_quality",1)
+cmd.set("ray_bvh",1)
+
+def build(copies):
+   cmd.delete("all")
+   for a in range(copies):
+      name = "prot%02d"%a
+      cmd.load("dat/1tii.pdb",name)
+      cmd.translate([(a%3)*70.0,(a//3)*70.0,0.0],object=name)
+   cmd.hide()
+   cmd.show("cartoon")
+   cmd.show("surface","chain A")
+   cmd.orient()
+
+def bench(width,height,frames):
+   result = []
+   for reuse in (0,1):
+      cmd.set("ray_bvh_reuse",reuse)
+      cmd.ray(width,height) # warm up: builds surfaces & caches
+      start = time.time()
+      for a in range(frames):
+         cmd.turn("y",360.0/frames)
+         cmd.ray(width,height)
+      result.append((time.time()-start)/frames)
+   print("%dx%d: rebuild %6.2f sec/frame, reuse %6.2f sec/frame (%4.2fx)"%(
+      width,height,result[0],result[1],result[0]/max(result[1],1e-6)))
+
+for copies in (1,3,6):
+   build(copies)
+   print("copies: %d, atoms: %d"%(copies,cmd.count_atoms()))
+   bench(640,480,12)
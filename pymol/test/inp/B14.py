@@ -0,0 +1,56 @@
+#
+# neighbor counting benchmark: "around" / "expand" selections and
+# distance based bonding on random point clouds, which stream the
+# cell-sorted (CSR) map layout
+#
+
+import time
+import random
+from pymol import cmd
+from chempy import models, Atom
+
+cmd.set("auto_zoom","off")
+cmd.feedback("disable","all","warnings")
+
+CHUNK = 100000
+
+connect_time = [0.0]
+
+def build(n_point):
+   cmd.delete("all")
+   connect_time[0] = 0.0
+   random.seed(1)
+   # ~ atom density of a protein
+   edge = 2.2 * (n_point ** (1.0/3.0))
+   names = []
+   for start in range(0,n_point,CHUNK):
+      model = models.Indexed()
+      for a in range(start,min(n_point,start+CHUNK)):
+         at = Atom.Atom()
+         at.name = "C"
+         at.symbol = "C"
+         at.resi = str(a%10000)
+         at.id = a + 1
+         at.q = random.random()
+         at.coord = [random.random()*edge for c in range(3)]
+         model.add_atom(at)
+      name = "chunk%04d"%(start//CHUNK)
+      start_time = time.time()
+      cmd.load_model(model,name) # distance based bonding
+      connect_time[0] += time.time() - start_time
+      names.append(name)
+   cmd.create("pts"," ".join(names))
+   cmd.delete("chunk*")
+   cmd.select("probe","pts and q<0.1")
+
+def bench(label,fn):
+   start = time.time()
+   result = fn()
+   print("  %-20s %8.3f sec (%s)"%(label,time.time()-start,result))
+
+for n_point in (100000,1000000,10000000):
+   build(n_point)
+   print("points: %d"%cmd.count_atoms("pts"))
+   bench("around 3.0",lambda: cmd.count_atoms("probe around 3.0"))
+   bench("expand 3.0",lambda: cmd.count_atoms("probe expand 3.0"))
+   print("  %-20s %8.3f sec"%("load + connect",connect_time[0]))
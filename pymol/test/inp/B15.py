@@ -0,0 +1,39 @@
+#
+# molecular surface benchmark: the dot based surface types (0-6) versus
+# the distance field surface (surface_type 7) on ~10k, 100k and 1M atoms;
+# triangle counts are reported by the RepSurface blather lines
+#
+
+import time
+from pymol import cmd
+
+cmd.set("auto_zoom","off")
+cmd.set("surface_quality",0)
+cmd.feedback("enable","repsurface","blather")
+
+def build(copies):
+   cmd.delete("all")
+   names = []
+   for a in range(copies):
+      name = "prot%03d"%a
+      cmd.load("dat/1tii.pdb",name)
+      cmd.translate([(a%8)*70.0,((a//8)%8)*70.0,(a//64)*70.0],object=name)
+      names.append(name)
+   cmd.create("big"," ".join(names))
+   cmd.delete("prot*")
+   cmd.hide()
+
+def bench(surface_type):
+   cmd.hide("surface")
+   cmd.rebuild()
+   cmd.set("surface_type",surface_type,"big")
+   start = time.time()
+   cmd.show("surface","big")
+   cmd.refresh() # builds the surface
+   print("  surface_type %d: %8.2f sec"%(surface_type,time.time()-start))
+
+for copies in (2,18,176):
+   build(copies)
+   print("atoms: %d"%cmd.count_atoms("big"))
+   for surface_type in (0,1,2,3,4,5,6,7):
+      bench(surface_type)
@@ -0,0 +1,62 @@
+#
+# selection benchmark: evaluation time of typical selection expressions
+# on ~10k, 100k and 1M atoms (compare the output of two builds)
+#
+
+import time
+from pymol import cmd
+
+cmd.set("auto_zoom","off")
+
+expressions = [
+   "all",
+   "none",
+   "polymer",
+   "not polymer",
+   "name CA",
+   "name CA+CB+N+C+O",
+   "resn ALA+GLY+SER",
+   "resi 10-120",
+   "chain A and resi 10-120 and not name CA",
+   "(chain A or chain B) and not hydrogens",
+   "elem C and not (resn ALA or resn GLY) and b > 20",
+   "backbone and not (chain A or resi 50-60)",
+   "sidechain or hetatm or solvent",
+   "ss H+S and name CA",
+   "polymer and not (name C+O+N+CA) and q > 0.5",
+   "byres (resn TRP and name NE1)",
+   "sele_ca and not sele_bb",
+   "sele_ca or sele_bb or sele_het",
+   "sele_het around 5",
+   "sele_het expand 3",
+   "sele_het gap 1",
+   "polymer within 4 of sele_het",
+   "name CA beyond 8 of sele_het",
+   "byres (polymer near_to 6 of sele_het)",
+]
+
+def build(copies):
+   cmd.delete("all")
+   names = []
+   for a in range(copies):
+      name = "prot%03d"%a
+      cmd.load("dat/1tii.pdb",name)
+      cmd.translate([(a%8)*70.0,((a//8)%8)*70.0,(a//64)*70.0],object=name)
+      names.append(name)
+   cmd.create("big"," ".join(names))
+   cmd.delete("prot*")
+   cmd.select("sele_ca","name CA")
+   cmd.select("sele_bb","backbone")
+   cmd.select("sele_het","hetatm")
+
+def bench(expression,repeat):
+   start = time.time()
+   for a in range(repeat):
+      count = cmd.count_atoms(expression)
+   print("  %8.4f sec %8d atoms: %s"%((time.time()-start)/repeat,count,expression))
+
+for copies in (2,18,176):
+   build(copies)
+   print("atoms: %d"%cmd.count_atoms("big"))
+   for expression in expressions:
+      bench(expression,max(1,40//copies))
@@ -0,0 +1,43 @@
+#
+# mmCIF loading benchmark: the serial tokenizer (max_threads=1) versus
+# the chunked parallel tokenizer on ~10k, 100k and 1M atoms
+#
+
+import os
+import time
+import tempfile
+from pymol import cmd
+
+cmd.set("auto_zoom","off")
+
+def build(copies,filename):
+   cmd.delete("all")
+   names = []
+   for a in range(copies):
+      name = "prot%03d"%a
+      cmd.load("dat/1tii.pdb",name)
+      cmd.translate([(a%8)*70.0,((a//8)%8)*70.0,(a//64)*70.0],object=name)
+      names.append(name)
+   cmd.create("big"," ".join(names))
+   cmd.delete("prot*")
+   cmd.save(filename,"big")
+   cmd.delete("all")
+
+def bench(filename,max_threads,repeat):
+   cmd.set("max_threads",max_threads)
+   start = time.time()
+   for a in range(repeat):
+      cmd.load(filename,"cif")
+      count = cmd.count_atoms("cif")
+      cmd.delete("cif")
+   print("  max_threads %2d: %8.3f sec %8d atoms"%(max_threads,(time.time()-start)/repeat,count))
+
+max_threads = cmd.get_setting_int("max_threads")
+filename = os.path.join(tempfile.gettempdir(),"B17_big.cif")
+for copies in (2,18,176):
+   build(copies,filename)
+   print("file size: %d bytes"%os.path.getsize(filename))
+   for threads in sorted(set((1,max_threads))):
+      bench(filename,threads,max(1,20//copies))
+os.remove(filename)
+cmd.set("max_threads",max_threads)
@@ -0,0 +1,58 @@
+#
+# PDB loading benchmark: serial record decoding (max_threads=1) versus
+# the parallel decoding on ~10k, 100k and 1M atoms, single model and
+# multi-model files (the loaded atoms must be identical)
+#
+
+import os
+import time
+import tempfile
+from pymol import cmd
+
+cmd.set("auto_zoom","off")
+
+def build(copies,states,filename):
+   cmd.delete("all")
+   names = []
+   for a in range(copies):
+      name = "prot%03d"%a
+      cmd.load("dat/1tii.pdb",name)
+      cmd.translate([(a%8)*70.0,((a//8)%8)*70.0,(a//64)*70.0],object=name)
+      names.append(name)
+   cmd.create("big"," ".join(names))
+   for a in range(1,states):
+      cmd.create("big","big",1,a+1)
+   cmd.delete("prot*")
+   cmd.save(filename,"big",0)
+   cmd.delete("all")
+
+def fingerprint(name):
+   data = []
+   cmd.iterate_state(-1,name,"data.append((ID,name,resn,resi,chain,segi,alt,elem,q,b,formal_charge,ss,x,y,z))",space={"data":data})
+   return hash(tuple(data))
+
+def bench(filename,max_threads,repeat):
+   cmd.set("max_threads",max_threads)
+   start = time.time()
+   for a in range(repeat):
+      cmd.load(filename,"pdb")
+      count = cmd.count_atoms("pdb")
+      states = cmd.count_states("pdb")
+      if a < repeat - 1:
+         cmd.delete("pdb")
+   print("  max_threads %2d: %8.3f sec %8d atoms %3d states"%(max_threads,(time.time()-start)/repeat,count,states))
+   result = fingerprint("pdb")
+   cmd.delete("pdb")
+   return result
+
+max_threads = cmd.get_setting_int("max_threads")
+filename = os.path.join(tempfile.gettempdir(),"B18_big.pdb")
+for copies,states in ((2,1),(18,1),(176,1),(2,20)):
+   build(copies,states,filename)
+   print("file size: %d bytes"%os.path.getsize(filename))
+   results = set()
+   for threads in sorted(set((1,max_threads))):
+      results.add(bench(filename,threads,max(1,20//(copies*states))))
+   print("  identical: %s"%(len(results) == 1))
+os.remove(filename)
+cmd.set("max_threads",max_threads)